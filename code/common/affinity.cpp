@@ -0,0 +1,209 @@
+#include "affinity.h"
+#include "log.h"
+
+#include <algorithm>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <strings.h>
+
+namespace myriel {
+static Logger::ptr g_logger = LOG_ROOT();
+
+const char *ToString(NumaPolicy policy) {
+	switch(policy) {
+		case NumaPolicy::NONE:
+			return "none";
+		case NumaPolicy::SPREAD:
+			return "spread";
+		case NumaPolicy::PACK:
+			return "pack";
+	}
+	return "unknown";
+}
+
+bool NumaPolicyFromString(const std::string &str, NumaPolicy &policy) {
+	if(str.empty() || strcasecmp(str.c_str(), "none") == 0) {
+		policy = NumaPolicy::NONE;
+	} else if(strcasecmp(str.c_str(), "spread") == 0) {
+		policy = NumaPolicy::SPREAD;
+	} else if(strcasecmp(str.c_str(), "pack") == 0) {
+		policy = NumaPolicy::PACK;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool CpuTopology::ParseCpuList(const std::string &str, std::vector<int> &cpus) {
+	cpus.clear();
+	size_t pos = 0;
+	while(pos < str.size()) {
+		size_t comma = str.find(',', pos);
+		if(comma == std::string::npos) {
+			comma = str.size();
+		}
+		std::string item = str.substr(pos, comma - pos);
+		pos = comma + 1;
+		item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+		if(item.empty()) {
+			continue;
+		}
+
+		char *end = nullptr;
+		long first = strtol(item.c_str(), &end, 10);
+		if(end == item.c_str()) {
+			return false;
+		}
+		long last = first;
+		if(*end == '-') {
+			const char *begin = end + 1;
+			last = strtol(begin, &end, 10);
+			if(end == begin) {
+				return false;
+			}
+		}
+		if(*end != '\0') {
+			return false;
+		}
+		if(first < 0 || last < first || last >= CPU_SETSIZE) {
+			return false;
+		}
+		for(int cpu = first; cpu <= last; ++cpu) {
+			cpus.push_back(cpu);
+		}
+	}
+	std::sort(cpus.begin(), cpus.end());
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+	return true;
+}
+
+CpuTopology::CpuTopology() {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if(CPU_ISSET(cpu, &set)) {
+				m_cpus.push_back(cpu);
+			}
+		}
+	}
+	if(m_cpus.empty()) {
+		m_cpus.push_back(0);
+	}
+	m_cpuNode.assign(m_cpus.back() + 1, -1);
+
+	// 节点编号可能不连续，按online列表读取
+	std::vector<int> nodes;
+	std::ifstream online("/sys/devices/system/node/online");
+	std::string line;
+	if(online && std::getline(online, line)) {
+		ParseCpuList(line, nodes);
+	}
+	for(int node : nodes) {
+		std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::vector<int> cpus;
+		if(!ifs || !std::getline(ifs, line) || !ParseCpuList(line, cpus)) {
+			continue;
+		}
+		std::vector<int> usable;
+		for(int cpu : cpus) {
+			if(std::binary_search(m_cpus.begin(), m_cpus.end(), cpu)) {
+				usable.push_back(cpu);
+				m_cpuNode[cpu] = (int)m_nodeCpus.size();
+			}
+		}
+		if(!usable.empty()) {
+			m_nodeCpus.push_back(std::move(usable));
+		}
+	}
+
+	// 没有NUMA信息，或者有的CPU不属于任何节点，都归到一个节点上
+	std::vector<int> orphans;
+	for(int cpu : m_cpus) {
+		if(m_cpuNode[cpu] < 0) {
+			m_cpuNode[cpu] = (int)m_nodeCpus.size();
+			orphans.push_back(cpu);
+		}
+	}
+	if(!orphans.empty()) {
+		m_nodeCpus.push_back(std::move(orphans));
+	}
+}
+
+const CpuTopology &CpuTopology::Get() {
+	static CpuTopology s_topology;
+	return s_topology;
+}
+
+int CpuTopology::getNodeOfCpu(int cpu) const {
+	if(cpu < 0 || (size_t)cpu >= m_cpuNode.size()) {
+		return -1;
+	}
+	return m_cpuNode[cpu];
+}
+
+std::vector<int> CpuTopology::placeThread(const std::vector<int> &allowed, NumaPolicy policy, size_t index) const {
+	const std::vector<int> &cpus = allowed.empty() ? m_cpus : allowed;
+	if(policy == NumaPolicy::NONE || cpus.empty()) {
+		return cpus;
+	}
+
+	// 按节点分组，节点内保持CPU编号顺序
+	std::vector<std::vector<int>> groups;
+	for(const auto &node : m_nodeCpus) {
+		std::vector<int> group;
+		for(int cpu : node) {
+			if(std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+				group.push_back(cpu);
+			}
+		}
+		if(!group.empty()) {
+			groups.push_back(std::move(group));
+		}
+	}
+	std::vector<int> order;
+	if(policy == NumaPolicy::PACK) {
+		for(const auto &group : groups) {
+			order.insert(order.end(), group.begin(), group.end());
+		}
+	} else {
+		size_t longest = 0;
+		for(const auto &group : groups) {
+			longest = std::max(longest, group.size());
+		}
+		for(size_t i = 0; i < longest; ++i) {
+			for(const auto &group : groups) {
+				if(i < group.size()) {
+					order.push_back(group[i]);
+				}
+			}
+		}
+	}
+	for(int cpu : cpus) {
+		// allowed中不在任何节点上的CPU
+		if(getNodeOfCpu(cpu) < 0) {
+			order.push_back(cpu);
+		}
+	}
+	return {order[index % order.size()]};
+}
+
+bool SetThreadAffinity(const std::vector<int> &cpus) {
+	if(cpus.empty()) {
+		return true;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int cpu : cpus) {
+		CPU_SET(cpu, &set);
+	}
+	int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if(rt) {
+		LOG_ERROR(g_logger) << "pthread_setaffinity_np error=" << rt;
+		return false;
+	}
+	return true;
+}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace myriel {
+
+/**
+ * @brief 调度线程在NUMA节点间的放置策略
+ */
+enum class NumaPolicy {
+	NONE,		// 不区分节点，线程可以在允许的CPU集合内任意迁移
+	SPREAD,		// 线程轮流分配到各个节点，每个线程绑定一个CPU
+	PACK		// 先占满一个节点的CPU再使用下一个节点，每个线程绑定一个CPU
+};
+
+const char *ToString(NumaPolicy policy);
+
+/**
+ * @brief 解析放置策略，大小写不敏感
+ *
+ * @return 无法识别时返回false
+ */
+bool NumaPolicyFromString(const std::string &str, NumaPolicy &policy);
+
+/**
+ * @brief CPU与NUMA节点的拓扑，从/sys/devices/system/node读取
+ * @details 没有NUMA信息时视为一个节点，包含进程允许使用的所有CPU
+ */
+class CpuTopology {
+public:
+	/**
+	 * @brief 进程启动后第一次调用时读取，之后不再变化
+	 */
+	static const CpuTopology &Get();
+
+	/**
+	 * @brief 解析"0-3,8,10-11"形式的CPU列表
+	 *
+	 * @return 格式错误时返回false
+	 */
+	static bool ParseCpuList(const std::string &str, std::vector<int> &cpus);
+
+	size_t getNodeCount() const { return m_nodeCpus.size(); }
+
+	/**
+	 * @brief CPU所在的节点，未知时返回-1
+	 */
+	int getNodeOfCpu(int cpu) const;
+
+	/**
+	 * @brief 进程允许使用的所有CPU
+	 */
+	const std::vector<int> &getCpus() const { return m_cpus; }
+
+	/**
+	 * @brief 计算第index个线程绑定的CPU集合
+	 *
+	 * @param allowed 允许使用的CPU，为空时使用进程允许的所有CPU
+	 * @return NONE策略返回整个允许集合，SPREAD/PACK返回单个CPU
+	 */
+	std::vector<int> placeThread(const std::vector<int> &allowed, NumaPolicy policy, size_t index) const;
+
+private:
+	CpuTopology();
+
+private:
+	std::vector<int> m_cpus;						// 允许使用的CPU
+	std::vector<std::vector<int>> m_nodeCpus;		// 每个节点上允许使用的CPU
+	std::vector<int> m_cpuNode;						// CPU所在的节点
+};
+
+/**
+ * @brief 把当前线程绑定到cpus
+ *
+ * @return 失败时返回false，cpus为空时不做任何事并返回true
+ */
+bool SetThreadAffinity(const std::vector<int> &cpus);
+}
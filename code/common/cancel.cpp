@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <condition_variable>
+#include <thread>
+
+#include "cancel.h"
+#include "fiber.h"
+#include "utils.h"
+
+namespace myriel {
+
+const char *ToString(WaitStatus status) {
+	switch(status) {
+	case WaitStatus::OK:
+		return "ok";
+	case WaitStatus::CANCELLED:
+		return "cancelled";
+	case WaitStatus::TIMEOUT:
+		return "timeout";
+	}
+	return "unknown";
+}
+
+/**
+ * @brief 截止时间线程，按时间顺序在到期时取消令牌
+ */
+class DeadlineWatcher {
+public:
+	/**
+	 * @attention 有意不析构：令牌可能在静态对象析构阶段才销毁，线程随进程退出
+	 */
+	static DeadlineWatcher &Get() {
+		static DeadlineWatcher *s_watcher = new DeadlineWatcher;
+		return *s_watcher;
+	}
+
+	void add(const CancelToken::ptr &token) {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		auto it = m_deadlines.emplace(token->m_deadline, std::make_pair(std::weak_ptr<CancelToken>(token), token.get()));
+		token->m_watchIt = it;
+		token->m_watched = true;
+		if(!m_started) {
+			m_started = true;
+			std::thread(&DeadlineWatcher::run, this).detach();
+		}
+		if(it == m_deadlines.begin()) {
+			m_cond.notify_one();
+		}
+	}
+
+	void remove(CancelToken *token) {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(token->m_watched) {
+			m_deadlines.erase(token->m_watchIt);
+			token->m_watched = false;
+		}
+	}
+
+private:
+	void run() {
+		std::vector<CancelToken::ptr> expired;
+		std::unique_lock<std::mutex> locker(m_mutex);
+		while(true) {
+			if(m_deadlines.empty()) {
+				m_cond.wait(locker);
+				continue;
+			}
+			uint64_t now = GetElapsedMS();
+			auto it = m_deadlines.begin();
+			if(it->first > now) {
+				m_cond.wait_for(locker, std::chrono::milliseconds(it->first - now));
+				continue;
+			}
+			while(it != m_deadlines.end() && it->first <= now) {
+				if(CancelToken::ptr token = it->second.first.lock()) {
+					expired.push_back(std::move(token));
+				}
+				// 令牌已开始析构时，析构函数中的remove会等这把锁，持锁期间令牌仍然有效；
+				// 撤销标记，remove不会再删除这个已删除的节点
+				it->second.second->m_watched = false;
+				it = m_deadlines.erase(it);
+			}
+			// 取消会调度协程，不能持锁；令牌的析构也需要这把锁
+			locker.unlock();
+			for(auto &token : expired) {
+				token->cancel(WaitStatus::TIMEOUT);
+			}
+			expired.clear();
+			locker.lock();
+		}
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	CancelToken::WatchMap m_deadlines;			// 截止时间 -> 令牌
+	bool m_started = false;
+};
+
+CancelToken::ptr CancelToken::Create(uint64_t timeout_ms) {
+	ptr token(new CancelToken);
+	if(timeout_ms) {
+		token->m_deadline = GetElapsedMS() + timeout_ms;
+		token->watchDeadline(token);
+	}
+	return token;
+}
+
+CancelToken::~CancelToken() {
+	if(m_deadline) {
+		DeadlineWatcher::Get().remove(this);
+	}
+}
+
+void CancelToken::watchDeadline(const ptr &self) {
+	DeadlineWatcher::Get().add(self);
+}
+
+CancelToken::ptr CancelToken::child(uint64_t timeout_ms) {
+	ptr token(new CancelToken);
+	token->m_deadline = m_deadline;
+	bool watch = false;
+	if(timeout_ms) {
+		uint64_t deadline = GetElapsedMS() + timeout_ms;
+		// 不早于父令牌的截止时间由父令牌的取消传递过来即可
+		if(!m_deadline || deadline < m_deadline) {
+			token->m_deadline = deadline;
+			watch = true;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		WaitStatus status = m_status.load(std::memory_order_relaxed);
+		if(status != WaitStatus::OK) {
+			token->m_status.store(status, std::memory_order_relaxed);
+			return token;
+		}
+		if(m_children.size() >= m_pruneAt) {
+			m_children.erase(std::remove_if(m_children.begin(), m_children.end(),
+				[](const std::weak_ptr<CancelToken> &child) { return child.expired(); }),
+				m_children.end());
+			m_pruneAt = std::max<size_t>(8, m_children.size() * 2);
+		}
+		m_children.push_back(token);
+	}
+	if(watch) {
+		token->watchDeadline(token);
+	}
+	return token;
+}
+
+bool CancelToken::cancel(WaitStatus status) {
+	std::vector<std::pair<uint64_t, Callback>> callbacks;
+	std::vector<std::weak_ptr<CancelToken>> children;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(m_status.load(std::memory_order_relaxed) != WaitStatus::OK) {
+			return false;
+		}
+		m_status.store(status, std::memory_order_release);
+		callbacks.swap(m_callbacks);
+		children.swap(m_children);
+	}
+	for(auto &i : callbacks) {
+		i.second(status);
+	}
+	for(auto &i : children) {
+		if(ptr child = i.lock()) {
+			child->cancel(status);
+		}
+	}
+	return true;
+}
+
+uint64_t CancelToken::addCallback(Callback cb) {
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if(m_status.load(std::memory_order_relaxed) != WaitStatus::OK) {
+		return 0;
+	}
+	uint64_t id = ++m_nextId;
+	m_callbacks.emplace_back(id, std::move(cb));
+	return id;
+}
+
+void CancelToken::removeCallback(uint64_t id) {
+	std::lock_guard<std::mutex> locker(m_mutex);
+	for(auto it = m_callbacks.begin(); it != m_callbacks.end(); ++it) {
+		if(it->first == id) {
+			m_callbacks.erase(it);
+			return;
+		}
+	}
+}
+
+CancelScope::CancelScope(uint64_t timeout_ms)
+	: m_fiber(Fiber::GetThis()) {
+	m_prev = m_fiber->getCancelToken();
+	m_token = m_prev ? m_prev->child(timeout_ms) : CancelToken::Create(timeout_ms);
+	m_fiber->setCancelToken(m_token);
+}
+
+CancelScope::~CancelScope() {
+	m_fiber->setCancelToken(m_prev);
+}
+}
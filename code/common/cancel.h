@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace myriel {
+class Fiber;
+
+/**
+ * @brief 可取消的等待的结果
+ */
+enum class WaitStatus {
+	OK,				// 正常完成
+	CANCELLED,		// 取消令牌被取消
+	TIMEOUT			// 取消令牌的截止时间已到
+};
+
+const char *ToString(WaitStatus status);
+
+/**
+ * @brief 等待被取消时由无法返回状态的接口(如FiberFuture::get)抛出
+ */
+class CancelledError : public std::runtime_error {
+public:
+	explicit CancelledError(WaitStatus status)
+		: std::runtime_error(ToString(status)), m_status(status) {}
+
+	WaitStatus status() const { return m_status; }
+
+private:
+	WaitStatus m_status;
+};
+
+/**
+ * @brief 取消令牌，可带截止时间
+ * @details 令牌挂在协程上，协程在FiberWaiter上挂起时向令牌登记回调，令牌被取消或
+ * 			截止时间到达时立即唤醒协程，等待点返回取消状态。取消会传递给所有子令牌：
+ * 			带令牌的协程中创建的协程获得子令牌，调度的回调任务直接沿用该令牌。
+ * 			截止时间由一个后台线程统一检查，只有比父令牌更早的截止时间才需要登记。
+ */
+class CancelToken {
+public:
+	using ptr = std::shared_ptr<CancelToken>;
+	using Callback = std::function<void(WaitStatus)>;
+
+	/**
+	 * @brief 创建根令牌
+	 *
+	 * @param timeout_ms 从现在起的超时时间，0表示没有截止时间
+	 */
+	static ptr Create(uint64_t timeout_ms = 0);
+
+	~CancelToken();
+
+	CancelToken(const CancelToken &) = delete;
+	CancelToken &operator=(const CancelToken &) = delete;
+
+	/**
+	 * @brief 创建子令牌，父令牌取消时子令牌随之取消，反之不影响父令牌
+	 *
+	 * @param timeout_ms 子令牌的超时时间，实际截止时间不晚于父令牌，0表示沿用父令牌
+	 */
+	ptr child(uint64_t timeout_ms = 0);
+
+	/**
+	 * @brief 取消令牌及其所有子令牌，唤醒正在等待的协程
+	 *
+	 * @return 是否由本次调用取消，已经取消过时返回false
+	 */
+	bool cancel(WaitStatus status = WaitStatus::CANCELLED);
+
+	bool isCancelled() const { return m_status.load(std::memory_order_acquire) != WaitStatus::OK; }
+
+	/**
+	 * @brief 取消状态，未取消时为OK
+	 */
+	WaitStatus status() const { return m_status.load(std::memory_order_acquire); }
+
+	/**
+	 * @brief 截止时间，GetElapsedMS的时间基准，0表示没有截止时间
+	 */
+	uint64_t deadline() const { return m_deadline; }
+
+	/**
+	 * @brief 登记取消回调，回调在取消方的上下文中执行，应当很短且不能挂起
+	 *
+	 * @return 回调id，令牌已经取消时不登记并返回0
+	 */
+	uint64_t addCallback(Callback cb);
+
+	/**
+	 * @brief 注销回调，回调可能已经或正在执行
+	 */
+	void removeCallback(uint64_t id);
+
+private:
+	CancelToken() = default;
+
+	/**
+	 * @brief 向截止时间线程登记
+	 */
+	void watchDeadline(const ptr &self);
+
+private:
+	friend class DeadlineWatcher;
+
+	std::atomic<WaitStatus> m_status{WaitStatus::OK};	// 取消状态
+	uint64_t m_deadline = 0;							// 截止时间
+
+	std::mutex m_mutex;									// 保护以下成员
+	uint64_t m_nextId = 0;								// 下一个回调id
+	std::vector<std::pair<uint64_t, Callback>> m_callbacks;
+	std::vector<std::weak_ptr<CancelToken>> m_children;	// 子令牌，登记时顺便清理已销毁的
+	size_t m_pruneAt = 8;								// 子令牌数量达到该值时清理
+
+	// 截止时间 -> 令牌；裸指针用于令牌正在析构、weak_ptr已失效时撤销登记标记
+	using WatchMap = std::multimap<uint64_t, std::pair<std::weak_ptr<CancelToken>, CancelToken *>>;
+
+	// 以下由截止时间线程的锁保护
+	bool m_watched = false;								// 是否已在截止时间线程登记
+	WatchMap::iterator m_watchIt;
+};
+
+/**
+ * @brief 在当前协程上开启一个取消作用域
+ * @details 以当前协程的令牌(没有时新建根令牌)为父令牌创建子令牌并挂到当前协程上，
+ * 			析构时恢复原来的令牌。用于给一次请求设置时间预算：
+ * @code
+ * myriel::CancelScope scope(100);
+ * if(!channel.recv(value)) { ... scope.status() ... }
+ * @endcode
+ * @attention 只能在同一个协程中构造和析构，作用域按栈的顺序嵌套
+ */
+class CancelScope {
+public:
+	/**
+	 * @param timeout_ms 超时时间，0表示不设截止时间，只能显式取消
+	 */
+	explicit CancelScope(uint64_t timeout_ms = 0);
+	~CancelScope();
+
+	CancelScope(const CancelScope &) = delete;
+	CancelScope &operator=(const CancelScope &) = delete;
+
+	const CancelToken::ptr &token() const { return m_token; }
+
+	bool cancel() { return m_token->cancel(); }
+
+	WaitStatus status() const { return m_token->status(); }
+
+private:
+	std::shared_ptr<Fiber> m_fiber;	// 作用域所在的协程
+	CancelToken::ptr m_token;		// 作用域的令牌
+	CancelToken::ptr m_prev;		// 进入作用域前协程的令牌
+};
+}
@@ -0,0 +1,75 @@
+#include "channel.h"
+
+namespace myriel {
+
+/**
+ * @brief 线程局部的xorshift随机数，只用于打散select分支的尝试顺序
+ */
+static uint32_t NextRandom() {
+	static thread_local uint32_t t_state = 0x9E3779B9u ^ (uint32_t)(uintptr_t)&t_state;
+	t_state ^= t_state << 13;
+	t_state ^= t_state >> 17;
+	t_state ^= t_state << 5;
+	return t_state;
+}
+
+int Select::tryOnce() {
+	size_t n = m_cases.size();
+	size_t start = NextRandom() % n;
+	for(size_t i = 0; i < n; ++i) {
+		size_t idx = (start + i) % n;
+		if(m_cases[idx]->tryComplete()) {
+			return (int)idx;
+		}
+	}
+	return -1;
+}
+
+int Select::tryWait() {
+	ASSERT(!m_cases.empty());
+	return tryOnce();
+}
+
+size_t Select::wait() {
+	ASSERT(!m_cases.empty());
+	bool woken = false;
+	while(true) {
+		int idx = tryOnce();
+		if(idx >= 0) {
+			if(woken) {
+				// 本次可能是被其它通道唤醒的，把这次唤醒让给那些通道上的下一个等待者
+				for(size_t i = 0; i < m_cases.size(); ++i) {
+					if((int)i != idx) {
+						m_cases[i]->passOn();
+					}
+				}
+			}
+			return idx;
+		}
+
+		FiberWaiter::ptr waiter = FiberWaiter::Create("select");
+		size_t parked = 0;
+		while(parked < m_cases.size() && m_cases[parked]->park(waiter)) {
+			++parked;
+		}
+		bool all_parked = parked == m_cases.size();
+		WaitStatus status = WaitStatus::OK;
+		if(all_parked) {
+			status = waiter->wait();
+		}
+		for(size_t i = 0; i < parked; ++i) {
+			m_cases[i]->unpark(waiter);
+		}
+		woken = all_parked;
+		if(!all_parked && !waiter->cancel()) {
+			// 有通道已经就绪，但前面挂上的通道抢先唤醒了等待者
+			status = waiter->wait();
+			woken = true;
+		}
+		// 取消抢先唤醒时通道的唤醒已经转给了下一个等待者
+		if(status != WaitStatus::OK) {
+			return kCancelled;
+		}
+	}
+}
+}
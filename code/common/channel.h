@@ -0,0 +1,580 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "fiber_sync.h"
+
+namespace myriel {
+
+namespace detail {
+template<class T> class SelectRecvCase;
+template<class T> class SelectSendCase;
+}
+
+/**
+ * @brief 协程间通信的通道，多生产者多消费者
+ * @details 缓冲区满时send挂起当前协程，为空时recv挂起当前协程，不阻塞调度线程；
+ * 			在非调度器协程中调用时阻塞当前线程。close之后send失败，recv取完剩余
+ * 			数据后失败。内部锁只保护缓冲区与等待队列，持锁期间不会切换协程。
+ *
+ * @tparam T 元素类型
+ */
+template<class T>
+class Channel {
+public:
+	using ptr = std::shared_ptr<Channel>;
+
+	/**
+	 * @brief 无界通道的容量
+	 */
+	static constexpr size_t kUnbounded = SIZE_MAX;
+
+	/**
+	 * @brief 构造函数
+	 *
+	 * @param capacity 缓冲区容量，默认无界，不支持0容量的同步通道
+	 */
+	explicit Channel(size_t capacity = kUnbounded) : m_capacity(capacity) {
+		ASSERT(capacity > 0);
+	}
+
+	Channel(const Channel &) = delete;
+	Channel &operator=(const Channel &) = delete;
+
+	/**
+	 * @brief 发送，缓冲区满时挂起
+	 *
+	 * @return 通道已关闭或当前协程被取消时返回false，可用Fiber::IsCancelled区分
+	 */
+	bool send(const T &value) { return sendImpl(value); }
+	bool send(T &&value) { return sendImpl(std::move(value)); }
+
+	/**
+	 * @brief 接收，缓冲区空时挂起
+	 *
+	 * @return 通道已关闭且缓冲区为空，或当前协程被取消时返回false
+	 */
+	bool recv(T &value) {
+		while(true) {
+			FiberWaiter::ptr waiter;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				if(tryRecvLocked(value)) {
+					return true;
+				}
+				if(m_closed) {
+					return false;
+				}
+				waiter = FiberWaiter::Create("channel_recv");
+				m_receivers.push(waiter);
+			}
+			if(waiter->wait() != WaitStatus::OK) {
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_receivers.remove(waiter);
+				return false;
+			}
+		}
+	}
+
+	/**
+	 * @brief 尝试发送，不挂起
+	 *
+	 * @return 缓冲区满或通道已关闭时返回false，value保持不变
+	 */
+	bool trySend(const T &value) {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return !m_closed && trySendLocked(value);
+	}
+	bool trySend(T &&value) {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return !m_closed && trySendLocked(std::move(value));
+	}
+
+	/**
+	 * @brief 尝试接收，不挂起
+	 */
+	bool tryRecv(T &value) {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return tryRecvLocked(value);
+	}
+
+	/**
+	 * @brief 关闭通道，唤醒所有等待者
+	 */
+	void close() {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_closed = true;
+		m_senders.notifyAll();
+		m_receivers.notifyAll();
+	}
+
+	bool isClosed() const {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_closed;
+	}
+
+	size_t size() const {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_buffer.size();
+	}
+
+	size_t capacity() const { return m_capacity; }
+
+private:
+	template<class U> friend class detail::SelectRecvCase;
+	template<class U> friend class detail::SelectSendCase;
+
+	template<class U>
+	bool sendImpl(U &&value) {
+		while(true) {
+			FiberWaiter::ptr waiter;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				if(m_closed) {
+					return false;
+				}
+				if(trySendLocked(std::forward<U>(value))) {
+					return true;
+				}
+				waiter = FiberWaiter::Create("channel_send");
+				m_senders.push(waiter);
+			}
+			if(waiter->wait() != WaitStatus::OK) {
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_senders.remove(waiter);
+				return false;
+			}
+		}
+	}
+
+	template<class U>
+	bool trySendLocked(U &&value) {
+		if(m_buffer.size() >= m_capacity) {
+			return false;
+		}
+		m_buffer.push_back(std::forward<U>(value));
+		m_receivers.notifyOne();
+		return true;
+	}
+
+	bool tryRecvLocked(T &value) {
+		if(m_buffer.empty()) {
+			return false;
+		}
+		value = std::move(m_buffer.front());
+		m_buffer.pop_front();
+		m_senders.notifyOne();
+		return true;
+	}
+
+private:
+	mutable std::mutex m_mutex;		// 保护以下状态
+	std::deque<T> m_buffer;			// 缓冲区
+	size_t m_capacity;				// 缓冲区容量
+	bool m_closed = false;			// 是否已关闭
+	WaitQueue m_senders;			// 等待缓冲区非满的发送者
+	WaitQueue m_receivers;			// 等待缓冲区非空的接收者
+};
+
+namespace detail {
+
+/**
+ * @brief select的一个分支
+ */
+class SelectCase {
+public:
+	virtual ~SelectCase() {}
+
+	/**
+	 * @brief 尝试完成操作，通道已关闭也视为完成
+	 */
+	virtual bool tryComplete() = 0;
+
+	/**
+	 * @brief 把等待者挂到通道上
+	 *
+	 * @return 通道此刻已经可以完成操作时不挂起，返回false
+	 */
+	virtual bool park(const FiberWaiter::ptr &waiter) = 0;
+
+	/**
+	 * @brief 从通道上摘下等待者
+	 */
+	virtual void unpark(const FiberWaiter::ptr &waiter) = 0;
+
+	/**
+	 * @brief select被该通道唤醒却完成了其它分支时，把唤醒转交给通道上的下一个等待者
+	 */
+	virtual void passOn() = 0;
+};
+
+template<class T>
+class SelectRecvCase : public SelectCase {
+public:
+	SelectRecvCase(Channel<T> &channel, T &value, bool *ok)
+		: m_channel(channel), m_value(value), m_ok(ok) {}
+
+	bool tryComplete() override {
+		std::lock_guard<std::mutex> locker(m_channel.m_mutex);
+		if(m_channel.tryRecvLocked(m_value)) {
+			setOk(true);
+			return true;
+		}
+		if(m_channel.m_closed) {
+			setOk(false);
+			return true;
+		}
+		return false;
+	}
+
+	bool park(const FiberWaiter::ptr &waiter) override {
+		std::lock_guard<std::mutex> locker(m_channel.m_mutex);
+		if(!m_channel.m_buffer.empty() || m_channel.m_closed) {
+			return false;
+		}
+		m_channel.m_receivers.push(waiter);
+		return true;
+	}
+
+	void unpark(const FiberWaiter::ptr &waiter) override {
+		std::lock_guard<std::mutex> locker(m_channel.m_mutex);
+		m_channel.m_receivers.remove(waiter);
+	}
+
+	void passOn() override {
+		std::lock_guard<std::mutex> locker(m_channel.m_mutex);
+		if(!m_channel.m_buffer.empty()) {
+			m_channel.m_receivers.notifyOne();
+		}
+	}
+
+private:
+	void setOk(bool ok) {
+		if(m_ok) {
+			*m_ok = ok;
+		}
+	}
+
+private:
+	Channel<T> &m_channel;
+	T &m_value;
+	bool *m_ok;
+};
+
+template<class T>
+class SelectSendCase : public SelectCase {
+public:
+	SelectSendCase(Channel<T> &channel, T value, bool *ok)
+		: m_channel(channel), m_value(std::move(value)), m_ok(ok) {}
+
+	bool tryComplete() override {
+		std::lock_guard<std::mutex> locker(m_channel.m_mutex);
+		if(m_channel.m_closed) {
+			setOk(false);
+			return true;
+		}
+		if(m_channel.trySendLocked(std::move(m_value))) {
+			setOk(true);
+			return true;
+		}
+		return false;
+	}
+
+	bool park(const FiberWaiter::ptr &waiter) override {
+		std::lock_guard<std::mutex> locker(m_channel.m_mutex);
+		if(m_channel.m_buffer.size() < m_channel.m_capacity || m_channel.m_closed) {
+			return false;
+		}
+		m_channel.m_senders.push(waiter);
+		return true;
+	}
+
+	void unpark(const FiberWaiter::ptr &waiter) override {
+		std::lock_guard<std::mutex> locker(m_channel.m_mutex);
+		m_channel.m_senders.remove(waiter);
+	}
+
+	void passOn() override {
+		std::lock_guard<std::mutex> locker(m_channel.m_mutex);
+		if(m_channel.m_buffer.size() < m_channel.m_capacity) {
+			m_channel.m_senders.notifyOne();
+		}
+	}
+
+private:
+	void setOk(bool ok) {
+		if(m_ok) {
+			*m_ok = ok;
+		}
+	}
+
+private:
+	Channel<T> &m_channel;
+	T m_value;
+	bool *m_ok;
+};
+}
+
+/**
+ * @brief 在多个通道操作中等待任意一个完成，类似Go的select
+ * @details 所有分支共用一个等待者挂到各个通道上，任意一个通道就绪即被唤醒，
+ * 			然后重新尝试所有分支；每轮从随机分支开始尝试，避免总是偏向前面的分支。
+ * 			已关闭的通道上的分支视为立即完成，通过ok返回false。
+ *
+ * @code
+ * Select sel;
+ * sel.recv(requests, req, &ok);
+ * sel.recv(quit, dummy);
+ * switch(sel.wait()) { ... }
+ * @endcode
+ */
+class Select {
+public:
+	/**
+	 * @brief 添加接收分支
+	 *
+	 * @param value 接收结果
+	 * @param ok 接收成功为true，通道已关闭为false
+	 * @return 分支下标
+	 */
+	template<class T>
+	size_t recv(Channel<T> &channel, T &value, bool *ok = nullptr) {
+		m_cases.emplace_back(new detail::SelectRecvCase<T>(channel, value, ok));
+		return m_cases.size() - 1;
+	}
+
+	/**
+	 * @brief 添加发送分支
+	 *
+	 * @param ok 发送成功为true，通道已关闭为false
+	 * @return 分支下标
+	 */
+	template<class T>
+	size_t send(Channel<T> &channel, T value, bool *ok = nullptr) {
+		m_cases.emplace_back(new detail::SelectSendCase<T>(channel, std::move(value), ok));
+		return m_cases.size() - 1;
+	}
+
+	/**
+	 * @brief 当前协程被取消时wait的返回值
+	 */
+	static constexpr size_t kCancelled = SIZE_MAX;
+
+	/**
+	 * @brief 挂起直到某个分支完成
+	 *
+	 * @return 完成的分支下标，当前协程被取消时返回kCancelled，此时没有分支完成
+	 */
+	size_t wait();
+
+	/**
+	 * @brief 尝试完成某个分支，不挂起
+	 *
+	 * @return 完成的分支下标，没有分支可以完成时返回-1
+	 */
+	int tryWait();
+
+private:
+	/**
+	 * @brief 从随机位置开始尝试所有分支
+	 */
+	int tryOnce();
+
+private:
+	std::vector<std::unique_ptr<detail::SelectCase>> m_cases;
+};
+
+/**
+ * @brief 单生产者单消费者的有界通道
+ * @details 基于环形缓冲区，发送与接收只涉及各自的下标与一次内存屏障，不加锁。
+ * 			一端需要挂起时把等待者发布到对端可见的位置，再重新检查一次缓冲区，
+ * 			与对端"先更新下标、再检查等待者"的顺序配合，不会丢失唤醒。
+ * 			发布的是等待者引用的副本，由取走它的一方释放，被取消的一端可以先行返回。
+ * @attention 同一时刻只能有一个协程发送、一个协程接收，不支持select
+ *
+ * @tparam T 元素类型
+ */
+template<class T>
+class SpscChannel {
+public:
+	using ptr = std::shared_ptr<SpscChannel>;
+
+	/**
+	 * @brief 构造函数
+	 *
+	 * @param capacity 缓冲区容量，向上取整为2的幂
+	 */
+	explicit SpscChannel(size_t capacity) {
+		ASSERT(capacity > 0);
+		size_t cap = 1;
+		while(cap < capacity) {
+			cap <<= 1;
+		}
+		m_mask = cap - 1;
+		m_slots = static_cast<Slot *>(::operator new(sizeof(Slot) * cap));
+	}
+
+	~SpscChannel() {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		for(size_t i = m_head.load(std::memory_order_relaxed); i != tail; ++i) {
+			m_slots[i & m_mask].get()->~T();
+		}
+		::operator delete(m_slots);
+		delete m_recvWaiter.load(std::memory_order_relaxed);
+		delete m_sendWaiter.load(std::memory_order_relaxed);
+	}
+
+	SpscChannel(const SpscChannel &) = delete;
+	SpscChannel &operator=(const SpscChannel &) = delete;
+
+	bool send(const T &value) { return sendImpl(value); }
+	bool send(T &&value) { return sendImpl(std::move(value)); }
+
+	bool recv(T &value) {
+		while(true) {
+			if(tryRecv(value)) {
+				return true;
+			}
+			if(m_closed.load(std::memory_order_acquire)) {
+				// 关闭前发送的数据仍然需要取完
+				return tryRecv(value);
+			}
+			FiberWaiter::ptr waiter = FiberWaiter::Create("channel_recv");
+			m_recvWaiter.store(new FiberWaiter::ptr(waiter), std::memory_order_seq_cst);
+			if(m_tail.load(std::memory_order_seq_cst) != m_head.load(std::memory_order_relaxed)
+					|| m_closed.load(std::memory_order_seq_cst)) {
+				if(Retract(m_recvWaiter)) {
+					continue;
+				}
+				// 发送方已经取走等待者，必然会唤醒
+			}
+			if(waiter->wait() != WaitStatus::OK) {
+				// 发送方若已取走等待者，它的唤醒会失败，不影响数据
+				Retract(m_recvWaiter);
+				return false;
+			}
+		}
+	}
+
+	bool trySend(const T &value) { return trySendImpl(value); }
+	bool trySend(T &&value) { return trySendImpl(std::move(value)); }
+
+	bool tryRecv(T &value) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if(head == m_tailCache) {
+			m_tailCache = m_tail.load(std::memory_order_acquire);
+			if(head == m_tailCache) {
+				return false;
+			}
+		}
+		T *slot = m_slots[head & m_mask].get();
+		value = std::move(*slot);
+		slot->~T();
+		m_head.store(head + 1, std::memory_order_release);
+		Wake(m_sendWaiter);
+		return true;
+	}
+
+	void close() {
+		m_closed.store(true, std::memory_order_seq_cst);
+		Wake(m_sendWaiter);
+		Wake(m_recvWaiter);
+	}
+
+	bool isClosed() const { return m_closed.load(std::memory_order_acquire); }
+
+	size_t capacity() const { return m_mask + 1; }
+
+private:
+	struct Slot {
+		alignas(T) unsigned char storage[sizeof(T)];
+		T *get() { return reinterpret_cast<T *>(storage); }
+	};
+
+	template<class U>
+	bool trySendImpl(U &&value) {
+		if(m_closed.load(std::memory_order_relaxed)) {
+			return false;
+		}
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if(tail - m_headCache > m_mask) {
+			m_headCache = m_head.load(std::memory_order_acquire);
+			if(tail - m_headCache > m_mask) {
+				return false;
+			}
+		}
+		new (m_slots[tail & m_mask].storage) T(std::forward<U>(value));
+		m_tail.store(tail + 1, std::memory_order_release);
+		Wake(m_recvWaiter);
+		return true;
+	}
+
+	template<class U>
+	bool sendImpl(U &&value) {
+		while(true) {
+			if(m_closed.load(std::memory_order_acquire)) {
+				return false;
+			}
+			if(trySendImpl(std::forward<U>(value))) {
+				return true;
+			}
+			FiberWaiter::ptr waiter = FiberWaiter::Create("channel_send");
+			m_sendWaiter.store(new FiberWaiter::ptr(waiter), std::memory_order_seq_cst);
+			if(m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_seq_cst) <= m_mask
+					|| m_closed.load(std::memory_order_seq_cst)) {
+				if(Retract(m_sendWaiter)) {
+					continue;
+				}
+			}
+			if(waiter->wait() != WaitStatus::OK) {
+				Retract(m_sendWaiter);
+				return false;
+			}
+		}
+	}
+
+	/**
+	 * @brief 更新下标之后唤醒对端，与对端发布等待者之后的重新检查构成握手
+	 */
+	static void Wake(std::atomic<FiberWaiter::ptr *> &slot) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(slot.load(std::memory_order_relaxed)) {
+			if(FiberWaiter::ptr *waiter = slot.exchange(nullptr, std::memory_order_acq_rel)) {
+				(*waiter)->fire();
+				delete waiter;
+			}
+		}
+	}
+
+	/**
+	 * @brief 撤回自己发布的等待者
+	 *
+	 * @return 对端尚未取走时返回true
+	 */
+	static bool Retract(std::atomic<FiberWaiter::ptr *> &slot) {
+		FiberWaiter::ptr *waiter = slot.exchange(nullptr, std::memory_order_acq_rel);
+		delete waiter;
+		return waiter != nullptr;
+	}
+
+private:
+	Slot *m_slots = nullptr;
+	size_t m_mask = 0;
+
+	alignas(64) std::atomic<size_t> m_head{0};			// 消费者下标
+	size_t m_tailCache = 0;								// 消费者缓存的生产者下标
+	std::atomic<FiberWaiter::ptr *> m_recvWaiter{nullptr};	// 挂起的消费者
+
+	alignas(64) std::atomic<size_t> m_tail{0};			// 生产者下标
+	size_t m_headCache = 0;								// 生产者缓存的消费者下标
+	std::atomic<FiberWaiter::ptr *> m_sendWaiter{nullptr};	// 挂起的生产者
+
+	alignas(64) std::atomic<bool> m_closed{false};
+};
+}
@@ -0,0 +1,122 @@
+#include <cstdint>
+
+#include "context.h"
+#include "macro.h"
+
+namespace myriel {
+
+#ifdef MYRIEL_FIBER_ASM_CONTEXT
+
+#if !defined(__x86_64__)
+#error "MYRIEL_FIBER_ASM_CONTEXT only supports x86-64"
+#endif
+
+/**
+ * 切出时栈上的布局(低地址 -> 高地址):
+ * 	[mxcsr|x87 cw] r15 r14 r13 r12 rbx rbp 返回地址
+ * 新建上下文时r12保存入口函数，返回地址指向myriel_context_trampoline
+ */
+asm(R"(
+	.pushsection .text
+	.globl	myriel_swap_context
+	.hidden	myriel_swap_context
+	.type	myriel_swap_context, @function
+	.p2align 4
+myriel_swap_context:
+	pushq	%rbp
+	pushq	%rbx
+	pushq	%r12
+	pushq	%r13
+	pushq	%r14
+	pushq	%r15
+	subq	$8, %rsp
+	stmxcsr	(%rsp)
+	fnstcw	4(%rsp)
+	movq	%rsp, (%rdi)
+	movq	%rsi, %rsp
+	ldmxcsr	(%rsp)
+	fldcw	4(%rsp)
+	addq	$8, %rsp
+	popq	%r15
+	popq	%r14
+	popq	%r13
+	popq	%r12
+	popq	%rbx
+	popq	%rbp
+	ret
+	.size	myriel_swap_context, .-myriel_swap_context
+
+	.globl	myriel_context_trampoline
+	.hidden	myriel_context_trampoline
+	.type	myriel_context_trampoline, @function
+	.p2align 4
+myriel_context_trampoline:
+	callq	*%r12
+	ud2
+	.size	myriel_context_trampoline, .-myriel_context_trampoline
+	.popsection
+)");
+
+extern "C" void myriel_context_trampoline() __attribute__((visibility("hidden")));
+
+void Context::init() {
+	// 当前上下文的寄存器在第一次Swap切出时保存
+	m_sp = nullptr;
+}
+
+void Context::make(void *stack, size_t size, Entry entry) {
+	uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~static_cast<uintptr_t>(15);
+	// 预留16字节，保证跳板函数call之前栈指针16字节对齐
+	uint64_t *sp = reinterpret_cast<uint64_t *>(top - 80);
+	sp[0] = 0x1F80 | (static_cast<uint64_t>(0x037F) << 32);	// mxcsr与x87控制字默认值
+	sp[1] = 0;													// r15
+	sp[2] = 0;													// r14
+	sp[3] = 0;													// r13
+	sp[4] = reinterpret_cast<uint64_t>(entry);					// r12
+	sp[5] = 0;													// rbx
+	sp[6] = 0;													// rbp
+	sp[7] = reinterpret_cast<uint64_t>(&myriel_context_trampoline);
+	m_sp = sp;
+}
+
+void *Context::getStackPointer() const {
+	return m_sp;
+}
+
+#else
+
+void Context::init() {
+	if(getcontext(&m_ctx)) {
+		ASSERT2(false, "system error: getcontext failed!");
+	}
+}
+
+void Context::make(void *stack, size_t size, Entry entry) {
+	if(getcontext(&m_ctx)) {
+		ASSERT2(false, "system error: getcontext failed!");
+	}
+	m_ctx.uc_link = nullptr;
+	m_ctx.uc_stack.ss_sp = stack;
+	m_ctx.uc_stack.ss_size = size;
+
+	makecontext(&m_ctx, entry, 0);
+}
+
+void Context::Swap(Context *from, Context *to) {
+	if(swapcontext(&from->m_ctx, &to->m_ctx)) {
+		ASSERT2(false, "system error: swapcontext failed!");
+	}
+}
+
+void *Context::getStackPointer() const {
+#if defined(__x86_64__)
+	return reinterpret_cast<void *>(m_ctx.uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+	return reinterpret_cast<void *>(m_ctx.uc_mcontext.sp);
+#else
+	return nullptr;
+#endif
+}
+
+#endif
+}
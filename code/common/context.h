@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef MYRIEL_FIBER_ASM_CONTEXT
+extern "C" void myriel_swap_context(void **from_sp, void *to_sp)
+	__attribute__((visibility("hidden")));
+#else
+#include <ucontext.h>
+#endif
+
+namespace myriel {
+
+/**
+ * @brief 协程上下文
+ * @details 定义MYRIEL_FIBER_ASM_CONTEXT时使用手写汇编切换(仅x86-64)，
+ * 			只保存callee-saved寄存器与栈指针，不产生rt_sigprocmask系统调用；
+ * 			否则退化为ucontext实现，保证可移植性
+ */
+class Context {
+public:
+	/**
+	 * @brief 上下文入口函数类型
+	 */
+	using Entry = void (*)();
+
+	/**
+	 * @brief 初始化为当前线程正在运行的上下文，用于线程主协程
+	 */
+	void init();
+
+	/**
+	 * @brief 在指定栈上创建新的上下文，切入后从entry开始执行
+	 *
+	 * @param stack 栈底(低地址)
+	 * @param size 栈大小
+	 * @param entry 入口函数，不允许返回
+	 */
+	void make(void *stack, size_t size, Entry entry);
+
+	/**
+	 * @brief 保存当前上下文到from，并切换到to
+	 *
+	 * @param from 保存当前上下文
+	 * @param to 目标上下文
+	 */
+	static void Swap(Context *from, Context *to);
+
+	/**
+	 * @brief 获取上下文切出时的栈指针
+	 */
+	void *getStackPointer() const;
+
+private:
+#ifdef MYRIEL_FIBER_ASM_CONTEXT
+	void *m_sp = nullptr;		// 切出时的栈指针，寄存器保存在栈上
+#else
+	ucontext_t m_ctx;			// ucontext上下文
+#endif
+};
+
+#ifdef MYRIEL_FIBER_ASM_CONTEXT
+inline void Context::Swap(Context *from, Context *to) {
+	myriel_swap_context(&from->m_sp, to->m_sp);
+}
+#endif
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+
+#include "singleton.hpp"
+
+namespace myriel {
+
+/**
+ * @brief hook使用的fd状态
+ * @details 记录fd是否为socket、用户是否设置了非阻塞以及读写超时。socket在hook层
+ * 			一律设为非阻塞，用户没有设置非阻塞时，hook把EAGAIN转换为挂起协程等待IO事件。
+ */
+class FdCtx : public std::enable_shared_from_this<FdCtx> {
+public:
+	using ptr = std::shared_ptr<FdCtx>;
+
+	explicit FdCtx(int fd);
+
+	bool isInit() const { return m_isInit; }
+	bool isSocket() const { return m_isSocket; }
+	bool isClose() const { return m_isClosed; }
+
+	/**
+	 * @brief 用户通过fcntl/ioctl设置的非阻塞标志
+	 */
+	void setUserNonblock(bool v) { m_userNonblock = v; }
+	bool getUserNonblock() const { return m_userNonblock; }
+
+	/**
+	 * @brief hook层实际设置的非阻塞标志
+	 */
+	void setSysNonblock(bool v) { m_sysNonblock = v; }
+	bool getSysNonblock() const { return m_sysNonblock; }
+
+	/**
+	 * @brief 设置超时时间
+	 *
+	 * @param type SO_RCVTIMEO或SO_SNDTIMEO
+	 * @param v 毫秒，~0ull表示不超时
+	 */
+	void setTimeout(int type, uint64_t v);
+	uint64_t getTimeout(int type) const;
+
+private:
+	bool init();
+
+private:
+	bool m_isInit: 1;
+	bool m_isSocket: 1;
+	bool m_sysNonblock: 1;
+	bool m_userNonblock: 1;
+	bool m_isClosed: 1;
+	int m_fd;
+	uint64_t m_recvTimeout = ~0ull;		// 读超时(毫秒)
+	uint64_t m_sendTimeout = ~0ull;		// 写超时(毫秒)
+};
+
+/**
+ * @brief fd状态管理器，按fd下标保存
+ */
+class FdManager {
+public:
+	FdManager();
+
+	/**
+	 * @brief 获取fd的状态
+	 *
+	 * @param auto_create 不存在时是否创建
+	 * @return 不存在且不创建时返回nullptr
+	 */
+	FdCtx::ptr get(int fd, bool auto_create = false);
+
+	/**
+	 * @brief 删除fd的状态，close时调用
+	 */
+	void del(int fd);
+
+private:
+	std::shared_mutex m_mutex;
+	std::vector<FdCtx::ptr> m_datas;
+};
+
+using FdMgr = Singleton<FdManager>;
+}
@@ -1,9 +1,19 @@
+#include <algorithm>
 #include <cassert>
+#include <mutex>
+#include <vector>
+#include <signal.h>
+#include <sys/mman.h>
 
 #include "scheduler.h"
 #include "fiber.h"
 #include "log.h"
 #include "utils.h"
+#include "stack_allocator.h"
+#include "config.h"
+#include "fiber_local.h"
+#include "stack_profile.h"
+#include "fiber_trace.h"
 
 namespace myriel {
 
@@ -17,66 +27,270 @@ static thread_local Fiber *t_fiber = nullptr;
 // 线程局部变量，当前线程的主协程
 static thread_local Fiber::ptr t_thread_fiber = nullptr;
 
-static uint32_t g_fiber_stack_size = 128 * 1024;
+static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
+	Config::Lookup("fiber.stack_size", (uint32_t)(128 * 1024), "fiber stack size");
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+	Config::Lookup("fiber.shared_stack.count", (uint32_t)4, "shared stacks per thread");
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+	Config::Lookup("fiber.shared_stack.size", (uint32_t)(1024 * 1024), "size of each shared stack");
+
+static ConfigVar<bool>::ptr g_fiber_stack_overflow_handler =
+	Config::Lookup("fiber.stack_overflow_handler", true, "report fiber stack overflow in SIGSEGV handler");
+
+// 配置项的缓存，避免创建协程时加锁读取配置
+static std::atomic<uint32_t> s_fiber_stack_size{128 * 1024};
+
+struct FiberIniter {
+	FiberIniter() {
+		s_fiber_stack_size = g_fiber_stack_size->getValue();
+		g_fiber_stack_size->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+			s_fiber_stack_size = new_value;
+		});
+	}
+};
+
+static FiberIniter s_fiber_initer;
 
 static Logger::ptr g_logger = LOG_ROOT();
 
-class MallocStackAllocator {
-public:
-	/**
-	 * @brief 静态函数，申请内存空间
-	 * 
-	 * @param size 申请空间大小
-	 */
-	static void *Alloc(size_t size) {
-		return malloc(size);
+/*************************** 共享栈 ***************************/
+
+/**
+ * @brief 线程内的共享栈，同一时刻只有occupant的栈内容真正位于其上
+ * @details 线程的共享栈集合与每个绑定的协程各持有一个引用，最后一个引用释放时归还栈。
+ * 			协程可能在所属线程退出后才析构，此时栈仍然有效
+ */
+struct SharedStack {
+	void *stack = nullptr;
+	size_t size = 0;
+	size_t guard = 0;
+	std::atomic<Fiber *> occupant{nullptr};
+	std::atomic<uint32_t> bound{0};			// 绑定在该栈上的协程数，协程析构时减少
+	std::atomic<uint32_t> refs{1};			// 引用数，初始为集合持有的一个
+
+	void ref() {
+		refs.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	/**
-	 * @brief 回收内存空间
-	 * 
-	 * @param vp 回收内存空间指针
-	 * @param size 回收内存空间大小
-	 */
-	static void Dealloc(void* vp, size_t size) {
-		return free(vp);
+	void unref() {
+		if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			MmapStackAllocator().dealloc(stack, size);
+			delete this;
+		}
+	}
+};
+
+/**
+ * @brief 线程的共享栈集合，线程退出时释放自己的引用
+ */
+struct SharedStackSet {
+	MmapStackAllocator allocator;
+	std::vector<SharedStack *> stacks;
+	size_t next = 0;
+
+	SharedStack *get() {
+		if(stacks.empty()) {
+			size_t count = std::max<uint32_t>(g_fiber_shared_stack_count->getValue(), 1);
+			size_t size = g_fiber_shared_stack_size->getValue();
+			for(size_t i = 0; i < count; ++i) {
+				SharedStack *ss = new SharedStack;
+				ss->size = size;
+				ss->stack = allocator.alloc(size);
+				ss->guard = allocator.guardSize();
+				stacks.push_back(ss);
+			}
+		}
+		return stacks[next++ % stacks.size()];
+	}
+
+	~SharedStackSet() {
+		for(auto i : stacks) {
+			i->unref();
+		}
+	}
+};
+
+static thread_local SharedStackSet t_shared_stacks;
+
+/*************************** 栈溢出检测 ***************************/
+
+static struct sigaction s_old_segv_action;
+
+/**
+ * @brief 异步信号安全的整数格式化
+ */
+static size_t FormatNumber(char *buf, uint64_t value, int base) {
+	char tmp[32];
+	size_t n = 0;
+	do {
+		tmp[n++] = "0123456789abcdef"[value % base];
+		value /= base;
+	} while(value);
+	for(size_t i = 0; i < n; ++i) {
+		buf[i] = tmp[n - 1 - i];
+	}
+	return n;
+}
+
+static void AppendString(char *buf, size_t &len, const char *str) {
+	size_t n = strlen(str);
+	memcpy(buf + len, str, n);
+	len += n;
+}
+
+/**
+ * @brief 交给安装本处理函数之前的处理方式
+ * @details 原处理函数直接调用，本处理函数保持安装；原处理方式为默认或忽略时恢复默认处理并
+ * 			重新发送信号，信号在返回后送达，进程以SIGSEGV终止(默认core dump)
+ */
+static void ChainSegv(int sig, siginfo_t *info, void *ucontext) {
+	if(s_old_segv_action.sa_flags & SA_SIGINFO) {
+		if(s_old_segv_action.sa_sigaction) {
+			s_old_segv_action.sa_sigaction(sig, info, ucontext);
+			return;
+		}
+	} else if(s_old_segv_action.sa_handler != SIG_DFL && s_old_segv_action.sa_handler != SIG_IGN) {
+		s_old_segv_action.sa_handler(sig);
+		return;
+	}
+	signal(SIGSEGV, SIG_DFL);
+	raise(SIGSEGV);
+}
+
+/**
+ * @brief SIGSEGV处理函数，运行在sigaltstack上
+ * @details 故障地址落在当前协程栈的保护页内时输出溢出的协程id后以SIGSEGV终止进程，
+ * 			栈已溢出，不能再交给原处理函数；其它故障交给原处理方式
+ */
+static void FiberSegvHandler(int sig, siginfo_t *info, void *ucontext) {
+	Fiber *cur = t_fiber;
+	if(!cur || !cur->isInStackGuard(info->si_addr)) {
+		ChainSegv(sig, info, ucontext);
+		return;
+	}
+	char buf[128];
+	size_t len = 0;
+	AppendString(buf, len, "fiber stack overflow: fiber_id=");
+	len += FormatNumber(buf + len, cur->getId(), 10);
+	AppendString(buf, len, " fault_addr=0x");
+	len += FormatNumber(buf + len, (uintptr_t)info->si_addr, 16);
+	AppendString(buf, len, "\n");
+	ssize_t rt = write(STDERR_FILENO, buf, len);
+	(void)rt;
+	signal(SIGSEGV, SIG_DFL);
+	raise(SIGSEGV);
+}
+
+/**
+ * @brief 线程的备用信号栈，协程栈溢出时信号处理函数不能再使用已溢出的栈
+ */
+struct SignalStack {
+	void *stack = nullptr;
+	size_t size = 64 * 1024;
+
+	SignalStack() {
+		stack = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(stack == MAP_FAILED) {
+			stack = nullptr;
+			return;
+		}
+		stack_t ss;
+		ss.ss_sp = stack;
+		ss.ss_size = size;
+		ss.ss_flags = 0;
+		sigaltstack(&ss, nullptr);
+	}
+
+	~SignalStack() {
+		if(stack) {
+			stack_t ss;
+			memset(&ss, 0, sizeof(ss));
+			ss.ss_flags = SS_DISABLE;
+			sigaltstack(&ss, nullptr);
+			munmap(stack, size);
+		}
 	}
 };
 
-using StackAllocator = MallocStackAllocator;
+/**
+ * @brief 为当前线程安装备用信号栈，首次调用时注册SIGSEGV处理函数
+ */
+static void InstallStackOverflowHandler() {
+	if(!g_fiber_stack_overflow_handler->getValue()) {
+		return;
+	}
+
+	static std::once_flag s_once;
+	std::call_once(s_once, []() {
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = &FiberSegvHandler;
+		sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGSEGV, &sa, &s_old_segv_action);
+	});
+
+	static thread_local SignalStack t_signal_stack;
+	(void)t_signal_stack;
+}
+
 
 Fiber::Fiber() {
 	SetThis(this);
 	m_state = EXEC;
 
-	if(getcontext(&m_ctx)) {
-		ASSERT2(false, "system error: getcontext failed!");
-	}
+	m_ctx.init();
 	++s_fiber_count;
+
+	InstallStackOverflowHandler();
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler) 
-: m_id(++s_fiber_id), m_cb(cb), m_scheduler(run_in_scheduler) {
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler, bool shared_stack) 
+: m_id(++s_fiber_id), m_cb(std::move(cb)), m_scheduler(run_in_scheduler) {
 	
 	++s_fiber_count;
-	m_stacksize = stacksize ? stacksize : g_fiber_stack_size;
-
-	m_stack = StackAllocator::Alloc(m_stacksize);
-	if(getcontext(&m_ctx)) {
-		ASSERT2(false, "system error: getcontext failed!");
+	if(t_fiber && t_fiber->m_cancelToken) {
+		m_cancelToken = t_fiber->m_cancelToken->child();
+	}
+	if(t_fiber) {
+		m_priority.store(t_fiber->getPriority(), std::memory_order_relaxed);
 	}
-	m_ctx.uc_link = nullptr;
-	m_ctx.uc_stack.ss_sp = m_stack;
-	m_ctx.uc_stack.ss_size = m_stacksize;
+	if(shared_stack) {
+		// 共享栈在首次切入时才绑定，协程可以在一个线程创建、在另一个线程运行
+		m_sharedMode = true;
+		m_sharedFresh = true;
+		return;
+	}
+	m_stacksize = stacksize ? stacksize : s_fiber_stack_size.load(std::memory_order_relaxed);
 
-	makecontext(&m_ctx, &Fiber::MainFunc, 0);
+	m_allocator = StackAllocator::GetDefault();
+	m_stack = m_allocator->alloc(m_stacksize);
+	if(StackProfiler::IsEnabled()) {
+		StackProfiler::Paint(m_stack, m_stacksize);
+		m_stackProfiled = true;
+	}
+	m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
 }
 
 Fiber::~Fiber() {
 	--s_fiber_count;
-	if(m_stack) {
+	if(!m_locals.empty()) {
+		FiberLocalBase::DestroySlots(m_locals);
+	}
+	if(m_sharedMode) {
+		assert(m_state == TERM || m_state == READY);
+		if(m_sharedStack) {
+			Fiber *self = this;
+			m_sharedStack->occupant.compare_exchange_strong(self, nullptr);
+			m_sharedStack->bound.fetch_sub(1, std::memory_order_relaxed);
+			m_sharedStack->unref();
+		}
+		free(m_saveBuffer);
+	} else if(m_stack) {
 		assert(m_state == TERM);
-		StackAllocator::Dealloc(m_stack, m_stacksize);
+		m_allocator->dealloc(m_stack, m_stacksize);
 	} else {
 		assert(!m_cb);
 		assert(m_state == EXEC);
@@ -88,34 +302,101 @@ Fiber::~Fiber() {
 }
 
 void Fiber::reset(std::function<void()> cb) {
-	assert(m_stack);
+	assert(m_stack || m_sharedMode);
 	assert(m_state == TERM);
 
-	m_cb = cb;
-	if(getcontext(&m_ctx)) {
-		ASSERT2(false, "system error: getcontext failed!");
+	m_cb = std::move(cb);
+	m_cancelToken = nullptr;
+	m_priority.store(Priority::NORMAL, std::memory_order_relaxed);
+	m_runNs.store(0, std::memory_order_relaxed);
+	if(m_sharedMode) {
+		m_sharedFresh = true;
+		m_saveSize = 0;
+	} else {
+		if(m_stackProfiled) {
+			// 测量之后协程仍在栈上运行到切出，重新测量一次得到实际弄脏的范围
+			size_t dirty = StackProfiler::Measure(m_stack, m_stacksize);
+			StackProfiler::Paint((char *)m_stack + m_stacksize - dirty, dirty);
+		}
+		m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
+	}
+	m_state = READY;
+}
+
+void Fiber::saveSharedStack() {
+	char *top = (char *)m_sharedStack->stack + m_sharedStack->size;
+	char *sp = (char *)m_ctx.getStackPointer();
+	if(!sp) {
+		sp = (char *)m_sharedStack->stack;
+	}
+	size_t size = top - sp;
+	// 保存区按实际大小分配，过大时收缩，避免长期挂起的协程占用多余内存
+	if(m_saveCapacity < size || m_saveCapacity > size * 2) {
+		free(m_saveBuffer);
+		m_saveBuffer = (char *)malloc(size);
+		m_saveCapacity = size;
 	}
+	memcpy(m_saveBuffer, sp, size);
+	m_saveSize = size;
+}
 
-	m_ctx.uc_link = nullptr;
-	m_ctx.uc_stack.ss_sp = m_stack;
-	m_ctx.uc_stack.ss_size = m_stacksize;
+void Fiber::acquireSharedStack() {
+	if(!m_sharedStack) {
+		m_sharedStack = t_shared_stacks.get();
+		m_sharedStack->bound.fetch_add(1, std::memory_order_relaxed);
+		m_sharedStack->ref();
+		m_boundThread = std::this_thread::get_id();
+	}
+	ASSERT2(m_boundThread == std::this_thread::get_id(),
+			"shared stack fiber resumed on another thread, fiber_id = " << m_id);
 
-	makecontext(&m_ctx, &Fiber::MainFunc, 0);
-	m_state = READY;
+	SharedStack *ss = m_sharedStack;
+	Fiber *occupant = ss->occupant.load(std::memory_order_relaxed);
+	if(occupant != this) {
+		if(occupant && occupant->m_state != TERM) {
+			ASSERT2(occupant->m_state != EXEC, "shared stack is in use, fiber_id = " << occupant->m_id);
+			occupant->saveSharedStack();
+		}
+		ss->occupant.store(this, std::memory_order_relaxed);
+		if(!m_sharedFresh) {
+			char *top = (char *)ss->stack + ss->size;
+			memcpy(top - m_saveSize, m_saveBuffer, m_saveSize);
+		}
+	}
+	if(m_sharedFresh) {
+		m_ctx.make(ss->stack, ss->size, &Fiber::MainFunc);
+		m_sharedFresh = false;
+	}
 }
 
 void Fiber::resume() {
 	assert(m_state != TERM && m_state != EXEC);
+	if(m_sharedMode) {
+		acquireSharedStack();
+	}
 	SetThis(this);
-	m_state = EXEC;
+	m_state.store(EXEC, std::memory_order_relaxed);
+	bool traced = m_traced && FiberTrace::IsEnabled();
+	if(MYRIEL_UNLIKELY(traced)) {
+		FiberTrace::SwitchIn(m_id);
+	}
 	if(m_scheduler) {
-		if (swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
-			ASSERT2(false, "system error: swapcontext failed!");
-		}
+		Context::Swap(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx);
 	} else {
-		if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx)) {
-			ASSERT2(false, "system error: swapcontext failed!");
+		Context::Swap(&(t_thread_fiber->m_ctx), &m_ctx);
+	}
+	if(MYRIEL_UNLIKELY(traced)) {
+		if(m_state.load(std::memory_order_relaxed) == TERM) {
+			FiberTrace::SetSwitchReason("term");
 		}
+		FiberTrace::SwitchOut(m_id);
+	}
+	/**
+	 * 协程的上下文已经完整保存，此时才允许其它线程再次切入该协程。
+	 * 若在yield中切出之前置为READY，被唤醒的协程可能在保存完成前就被其它线程resume
+	 */
+	if(m_state.load(std::memory_order_relaxed) == EXEC) {
+		m_state.store(READY, std::memory_order_release);
 	}
 }
 
@@ -123,19 +404,25 @@ void Fiber::yield() {
 	assert(m_state == EXEC || m_state == TERM);
 	SetThis(t_thread_fiber.get());
 
-	if(m_state != TERM) {
-		m_state = READY;
-	}
-
 	if(m_scheduler) {
-		if(swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
-			ASSERT2(false, "system error: swapcontext failed!");
-		}
+		Context::Swap(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx));
 	} else {
-		if(swapcontext(&m_ctx, &(t_thread_fiber->m_ctx))) {
-			ASSERT2(false, "system error: swapcontext failed!");
-		}
+		Context::Swap(&m_ctx, &(t_thread_fiber->m_ctx));
+	}
+}
+
+bool Fiber::isInStackGuard(const void *addr) const {
+	if(m_sharedStack) {
+		const char *p = (const char *)addr;
+		const char *stack = (const char *)m_sharedStack->stack;
+		return p < stack && p >= stack - m_sharedStack->guard;
+	}
+	if(!m_stack) {
+		return false;
 	}
+	size_t guard = m_allocator->guardSize();
+	const char *p = (const char *)addr;
+	return p < (const char *)m_stack && p >= (const char *)m_stack - guard;
 }
 
 void Fiber::SetThis(Fiber *f) {
@@ -159,7 +446,14 @@ void Fiber::MainFunc() {
 	assert(cur);
 	try {
 		cur->m_cb();
+		if(cur->m_stackProfiled) {
+			StackProfiler::Record(cur->m_cb, StackProfiler::Measure(cur->m_stack, cur->m_stacksize),
+								  cur->m_stacksize);
+		}
 		cur->m_cb = nullptr;
+		if(!cur->m_locals.empty()) {
+			FiberLocalBase::DestroySlots(cur->m_locals);
+		}
 		cur->m_state = TERM;
 	} catch (std::exception& ex) {
 		LOG_ERROR(g_logger) << "Fiber Except: " << ex.what()
@@ -191,4 +485,33 @@ uint64_t Fiber::GetFiberId() {
 uint64_t Fiber::GetTotalFibers() {
 	return s_fiber_count;
 }
-}
\ No newline at end of file
+
+size_t Fiber::GetBoundFibers() {
+	size_t count = 0;
+	for(SharedStack *ss : t_shared_stacks.stacks) {
+		count += ss->bound.load(std::memory_order_relaxed);
+	}
+	return count;
+}
+
+std::vector<void *> *Fiber::GetLocalSlots() {
+	// 线程主协程的槽位随线程存在，即线程局部存储
+	Fiber *cur = t_fiber;
+	return cur ? &cur->m_locals : nullptr;
+}
+
+CancelToken::ptr Fiber::GetCancelToken() {
+	Fiber *cur = t_fiber;
+	return cur ? cur->m_cancelToken : nullptr;
+}
+
+Priority Fiber::GetPriority() {
+	Fiber *cur = t_fiber;
+	return cur ? cur->getPriority() : Priority::NORMAL;
+}
+
+bool Fiber::IsCancelled() {
+	Fiber *cur = t_fiber;
+	return cur && cur->m_cancelToken && cur->m_cancelToken->isCancelled();
+}
+}
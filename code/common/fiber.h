@@ -1,15 +1,29 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <thread>
 #include <functional>
+#include <vector>
 
-#include <ucontext.h>
-
+#include "context.h"
 #include "macro.h"
+#include "cancel.h"
 
 namespace myriel {
 class Scheduler;
+class StackAllocator;
+struct SharedStack;
+
+/**
+ * @brief 调度优先级，数值越小越优先
+ */
+enum class Priority : uint8_t {
+	HIGH	= 0,		// 延迟敏感的任务，如请求处理
+	NORMAL	= 1,		// 默认
+	LOW		= 2,		// 后台批处理任务
+	INHERIT	= 0xff		// 协程沿用自己的优先级，回调沿用调度方协程的优先级
+};
 
 class Fiber : public std::enable_shared_from_this<Fiber> {
 public:
@@ -34,12 +48,19 @@ private:
 public:
 	/**
 	 * @brief 有参构造函数，创建协程并绑定协程函数
+	 * @details 共享栈模式下协程运行在所在线程的若干个共享栈之一上，切出时只把栈上
+	 * 			实际使用的部分拷贝到按需分配的保存区，切入时再拷贝回来。协程首次运行后
+	 * 			即绑定到该线程，调度器会把它固定调度到该线程上。
+	 * @attention 共享栈协程切出后，其栈上的对象可能被其它协程覆盖，
+	 * 			  不能把栈上对象的地址交给其它协程在此期间访问
 	 * 
 	 * @param cb 协程函数
-	 * @param stacksize 协程栈大小
+	 * @param stacksize 协程栈大小，共享栈模式下忽略
 	 * @param run_in_scheduler 是否由调度器调度
+	 * @param shared_stack 是否使用共享栈
 	 */
-	Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+	Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true,
+		  bool shared_stack = false);
 	
 	/**
 	 * @brief 析构函数，对调度协程和普通协程进行不同的析构处理
@@ -77,7 +98,68 @@ public:
 	 * 
 	 * @return State 
 	 */
-	State getState() const { return m_state; }
+	State getState() const { return m_state.load(std::memory_order_acquire); }
+
+	/**
+	 * @brief 是否由调度器调度，即切出时回到调度协程
+	 */
+	bool isRunInScheduler() const { return m_scheduler; }
+
+	/**
+	 * @brief 判断地址是否落在协程栈底之下的保护页内，用于栈溢出检测
+	 * 
+	 * @param addr 访问出错的地址
+	 */
+	bool isInStackGuard(const void *addr) const;
+
+	/**
+	 * @brief 是否使用共享栈
+	 */
+	bool isSharedStack() const { return m_sharedMode; }
+
+	/**
+	 * @brief 共享栈协程绑定的线程，未绑定或非共享栈协程返回空id
+	 */
+	std::thread::id getBoundThread() const { return m_boundThread; }
+
+	/**
+	 * @brief 共享栈协程切出时保存的栈大小
+	 */
+	size_t getSavedStackSize() const { return m_saveSize; }
+
+	/**
+	 * @brief 协程在调度器中累计运行的时间(纳秒)
+	 * @details 由调度器在每次切出后累加，开启scheduler.run_time_stats后才记录；reset时清零
+	 */
+	uint64_t getRunTime() const { return m_runNs.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief 累加运行时间，由切入该协程的调度线程在切出后调用
+	 */
+	void addRunTime(uint64_t ns) {
+		// 同一时刻只有一个线程运行该协程，不需要原子的读改写
+		m_runNs.store(m_runNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief 设置是否记录该协程的切换事件，调度器的idle协程等会关闭
+	 */
+	void setTraced(bool traced) { m_traced = traced; }
+
+	/**
+	 * @brief 设置协程的取消令牌，等待点据此提前返回
+	 * @attention 只能在协程运行之前或由协程自己设置；其它线程应通过令牌取消协程
+	 */
+	void setCancelToken(CancelToken::ptr token) { m_cancelToken = std::move(token); }
+
+	const CancelToken::ptr &getCancelToken() const { return m_cancelToken; }
+
+	/**
+	 * @brief 设置调度优先级，之后协程每次被唤醒都按该优先级入队
+	 */
+	void setPriority(Priority priority) { m_priority.store(priority, std::memory_order_relaxed); }
+
+	Priority getPriority() const { return m_priority.load(std::memory_order_relaxed); }
 
 public:
 	/**
@@ -108,16 +190,72 @@ public:
 
 	static uint64_t GetTotalFibers();
 
+	/**
+	 * @brief 绑定在当前线程共享栈上、尚未析构的协程数
+	 * @details 这些协程只能回到当前线程运行，线程退出前需要等它们析构
+	 */
+	static size_t GetBoundFibers();
+
+	/**
+	 * @brief 获取当前协程的局部存储槽位数组，供FiberLocal使用
+	 * @details 没有协程运行时返回线程主协程的槽位，即退化为线程局部存储
+	 * 
+	 * @return 当前线程尚未初始化协程时返回nullptr
+	 */
+	static std::vector<void *> *GetLocalSlots();
+
+	/**
+	 * @brief 获取当前协程的取消令牌，没有时返回nullptr
+	 */
+	static CancelToken::ptr GetCancelToken();
+
+	/**
+	 * @brief 当前协程是否已被取消，供计算密集的循环主动检查
+	 */
+	static bool IsCancelled();
+
+	/**
+	 * @brief 获取当前协程的调度优先级，不在协程中时为NORMAL
+	 */
+	static Priority GetPriority();
+
 private:
 	uint64_t m_id = 0;			// 协程id
 	uint32_t m_stacksize = 0;	// 协程运行栈大小
-	State m_state = READY;		// 协程状态
+	std::atomic<State> m_state{READY};	// 协程状态，切出完成后才由切换方置为READY
 
-	ucontext_t m_ctx;			// 协程上下文
+	Context m_ctx;				// 协程上下文
 	void *m_stack = nullptr;	// 协程运行栈指针
+	StackAllocator *m_allocator = nullptr;	// 申请协程栈的分配器
+	bool m_stackProfiled = false;			// 栈是否已填充哨兵值，用于峰值用量分析
 
 	std::function<void()> m_cb;	// 协程运行函数
 
-	bool m_scheduler;
+	bool m_scheduler = false;	// 是否由调度器调度，线程主协程为false
+	bool m_traced = true;		// 开启协程追踪时是否记录该协程
+
+	bool m_sharedMode = false;				// 是否使用共享栈
+	bool m_sharedFresh = false;				// 共享栈上的上下文是否需要重新创建
+	SharedStack *m_sharedStack = nullptr;	// 绑定的共享栈
+	char *m_saveBuffer = nullptr;			// 切出时栈内容的保存区
+	size_t m_saveSize = 0;					// 保存区中的有效字节数
+	size_t m_saveCapacity = 0;				// 保存区容量
+	std::thread::id m_boundThread;			// 共享栈所属线程
+
+	std::vector<void *> m_locals;			// 协程局部存储槽位
+	CancelToken::ptr m_cancelToken;			// 取消令牌，在带令牌的协程中创建时继承其子令牌
+	std::atomic<Priority> m_priority{Priority::NORMAL};	// 调度优先级，创建时继承当前协程的优先级
+	std::atomic<uint64_t> m_runNs{0};		// 累计运行时间，其它线程可能同时读取
+
+private:
+	/**
+	 * @brief 切入前占用共享栈：保存原占用者的栈，恢复或创建本协程的栈
+	 */
+	void acquireSharedStack();
+
+	/**
+	 * @brief 把共享栈上的活跃部分拷贝到保存区
+	 */
+	void saveSharedStack();
 };
 }
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "fiber_future.h"
+
+namespace myriel {
+namespace detail {
+
+WaitStatus FutureStateBase::wait() {
+	if(isReady()) {
+		return WaitStatus::OK;
+	}
+	FiberWaiter::ptr waiter;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(isReady()) {
+			return WaitStatus::OK;
+		}
+		waiter = FiberWaiter::Create("future");
+		m_waiters.push(waiter);
+	}
+	WaitStatus status = waiter->wait();
+	if(status != WaitStatus::OK) {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_waiters.remove(waiter);
+	}
+	return status;
+}
+
+void FutureStateBase::onReady(Callback cb) {
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(!isReady()) {
+			m_callbacks.push_back(std::move(cb));
+			return;
+		}
+	}
+	cb();
+}
+
+void FutureStateBase::setException(std::exception_ptr ex) {
+	std::vector<Callback> callbacks;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		ASSERT2(!isReady(), "promise already satisfied");
+		m_exception = ex;
+		callbacks = markReadyLocked();
+	}
+	RunCallbacks(callbacks);
+}
+
+std::vector<FutureStateBase::Callback> FutureStateBase::markReadyLocked() {
+	m_ready.store(true, std::memory_order_release);
+	m_waiters.notifyAll();
+	return std::move(m_callbacks);
+}
+
+void FutureStateBase::RunCallbacks(std::vector<Callback> &callbacks) {
+	for(auto &cb : callbacks) {
+		cb();
+	}
+}
+}
+}
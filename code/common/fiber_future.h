@@ -0,0 +1,250 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "fiber_sync.h"
+
+namespace myriel {
+
+namespace detail {
+
+/**
+ * @brief future的共享状态中与值类型无关的部分
+ */
+class FutureStateBase {
+public:
+	using Callback = std::function<void()>;
+
+	virtual ~FutureStateBase() {}
+
+	bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+
+	/**
+	 * @brief 挂起当前协程(或阻塞当前线程)直到就绪
+	 *
+	 * @return 就绪返回OK，当前协程被取消时返回取消状态
+	 */
+	WaitStatus wait();
+
+	/**
+	 * @brief 注册就绪回调，已就绪时立即在当前上下文执行
+	 * @attention 回调在设置结果的上下文中执行，应当很短且不能挂起
+	 */
+	void onReady(Callback cb);
+
+	void setException(std::exception_ptr ex);
+
+	/**
+	 * @brief 有异常时重新抛出
+	 */
+	void rethrowIfFailed() const {
+		if(m_exception) {
+			std::rethrow_exception(m_exception);
+		}
+	}
+
+protected:
+	/**
+	 * @brief 调用方持有m_mutex并已写入结果，置为就绪并取出回调
+	 */
+	std::vector<Callback> markReadyLocked();
+
+	/**
+	 * @brief 执行回调，不持锁
+	 */
+	static void RunCallbacks(std::vector<Callback> &callbacks);
+
+protected:
+	std::mutex m_mutex;						// 保护结果与等待者
+	std::atomic<bool> m_ready{false};		// 是否已就绪
+	std::exception_ptr m_exception;			// 异常结果
+	WaitQueue m_waiters;					// 等待就绪的协程
+	std::vector<Callback> m_callbacks;		// 就绪回调
+};
+
+template<class T>
+class FutureState : public FutureStateBase {
+public:
+	template<class U>
+	void setValue(U &&value) {
+		std::vector<Callback> callbacks;
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			ASSERT2(!isReady(), "promise already satisfied");
+			m_value.emplace(std::forward<U>(value));
+			callbacks = markReadyLocked();
+		}
+		RunCallbacks(callbacks);
+	}
+
+	T &value() { return *m_value; }
+
+private:
+	std::optional<T> m_value;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase {
+public:
+	void setValue() {
+		std::vector<Callback> callbacks;
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			ASSERT2(!isReady(), "promise already satisfied");
+			callbacks = markReadyLocked();
+		}
+		RunCallbacks(callbacks);
+	}
+};
+}
+
+/**
+ * @brief 协程future，持有异步结果的共享状态，可以拷贝
+ * @details 在调度器协程中get/wait会挂起当前协程而不阻塞调度线程，
+ * 			在其它上下文中阻塞当前线程
+ *
+ * @tparam T 结果类型，可以是void
+ */
+template<class T>
+class FiberFuture {
+public:
+	using State = detail::FutureState<T>;
+
+	FiberFuture() = default;
+	explicit FiberFuture(std::shared_ptr<State> state) : m_state(std::move(state)) {}
+
+	/**
+	 * @brief 是否关联了共享状态
+	 */
+	bool valid() const { return (bool)m_state; }
+
+	bool isReady() const { return m_state->isReady(); }
+
+	/**
+	 * @brief 等待就绪
+	 *
+	 * @return 就绪返回OK，当前协程被取消时返回取消状态
+	 */
+	WaitStatus wait() const { return m_state->wait(); }
+
+	/**
+	 * @brief 等待并获取结果，结果为异常时重新抛出
+	 * @attention 返回共享状态中值的引用，多个future副本看到的是同一个值；
+	 * 			  当前协程被取消时抛出CancelledError
+	 */
+	typename std::add_lvalue_reference<T>::type get() const {
+		WaitStatus status = m_state->wait();
+		if(status != WaitStatus::OK) {
+			throw CancelledError(status);
+		}
+		m_state->rethrowIfFailed();
+		if constexpr (!std::is_void<T>::value) {
+			return m_state->value();
+		}
+	}
+
+	/**
+	 * @brief 注册就绪回调，供组合器使用
+	 */
+	void onReady(std::function<void()> cb) const { m_state->onReady(std::move(cb)); }
+
+private:
+	std::shared_ptr<State> m_state;
+};
+
+/**
+ * @brief 协程promise，设置结果并唤醒等待的协程
+ *
+ * @tparam T 结果类型，可以是void
+ */
+template<class T>
+class FiberPromise {
+public:
+	using State = detail::FutureState<T>;
+
+	FiberPromise() : m_state(std::make_shared<State>()) {}
+
+	FiberFuture<T> getFuture() const { return FiberFuture<T>(m_state); }
+
+	template<class U = T>
+	typename std::enable_if<!std::is_void<U>::value>::type setValue(U value) {
+		m_state->setValue(std::move(value));
+	}
+
+	template<class U = T>
+	typename std::enable_if<std::is_void<U>::value>::type setValue() {
+		m_state->setValue();
+	}
+
+	void setException(std::exception_ptr ex) { m_state->setException(ex); }
+
+private:
+	std::shared_ptr<State> m_state;
+};
+
+/**
+ * @brief 调用f并把返回值或异常写入promise
+ */
+template<class T, class F>
+void FulfillPromise(FiberPromise<T> &promise, F &f) {
+	try {
+		if constexpr (std::is_void<T>::value) {
+			f();
+			promise.setValue();
+		} else {
+			promise.setValue(f());
+		}
+	} catch (...) {
+		promise.setException(std::current_exception());
+	}
+}
+
+/**
+ * @brief 所有future都就绪(包括异常)时就绪
+ * @details 每个future就绪时计数减一，最后一个就绪时唤醒等待者，等待方只被唤醒一次
+ */
+template<class T>
+FiberFuture<void> WhenAll(const std::vector<FiberFuture<T>> &futures) {
+	FiberPromise<void> promise;
+	FiberFuture<void> result = promise.getFuture();
+	if(futures.empty()) {
+		promise.setValue();
+		return result;
+	}
+	auto remaining = std::make_shared<std::atomic<size_t>>(futures.size());
+	for(auto &future : futures) {
+		future.onReady([remaining, promise]() mutable {
+			if(remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				promise.setValue();
+			}
+		});
+	}
+	return result;
+}
+
+/**
+ * @brief 任意一个future就绪时就绪，结果为最先就绪的下标
+ */
+template<class T>
+FiberFuture<size_t> WhenAny(const std::vector<FiberFuture<T>> &futures) {
+	ASSERT(!futures.empty());
+	FiberPromise<size_t> promise;
+	FiberFuture<size_t> result = promise.getFuture();
+	auto done = std::make_shared<std::atomic<bool>>(false);
+	for(size_t i = 0; i < futures.size(); ++i) {
+		futures[i].onReady([done, promise, i]() mutable {
+			if(!done->exchange(true, std::memory_order_acq_rel)) {
+				promise.setValue(i);
+			}
+		});
+	}
+	return result;
+}
+}
@@ -0,0 +1,101 @@
+#include <atomic>
+#include <mutex>
+
+#include "fiber_local.h"
+#include "macro.h"
+
+namespace myriel {
+
+// 以下均可平凡析构，静态的FiberLocal在程序退出时析构也能安全访问
+static std::mutex s_local_mutex;
+static std::atomic<size_t> s_local_count{0};						// 已分配过的下标个数
+static size_t s_local_free[FiberLocalBase::kMaxLocals];				// 已归还的下标
+static size_t s_local_free_count = 0;
+static uint32_t s_local_generations[FiberLocalBase::kMaxLocals];	// 下标当前的代数
+
+/**
+ * @brief 线程局部的槽位数组，没有协程运行时使用，线程退出时析构其中的值
+ */
+static thread_local bool t_local_slots_alive = false;
+
+struct ThreadLocalSlots {
+	std::vector<void *> slots;
+
+	ThreadLocalSlots() {
+		t_local_slots_alive = true;
+	}
+
+	~ThreadLocalSlots() {
+		FiberLocalBase::DestroySlots(slots);
+		t_local_slots_alive = false;
+	}
+};
+
+static thread_local ThreadLocalSlots t_local_slots;
+
+FiberLocalBase::FiberLocalBase() {
+	std::lock_guard<std::mutex> locker(s_local_mutex);
+	if(s_local_free_count) {
+		m_index = s_local_free[--s_local_free_count];
+	} else {
+		m_index = s_local_count.load(std::memory_order_relaxed);
+		ASSERT2(m_index < kMaxLocals, "too many FiberLocal, max = " << kMaxLocals);
+		s_local_count.store(m_index + 1, std::memory_order_release);
+	}
+	m_generation = s_local_generations[m_index];
+}
+
+FiberLocalBase::~FiberLocalBase() {
+	// 只析构当前协程上的值，其它协程上的旧值由代数识别，不会被复用下标的新变量误用；
+	// 静态的FiberLocal可能在线程局部的槽位数组析构之后才析构
+	std::vector<void *> *slots = Fiber::GetLocalSlots();
+	if(!slots && t_local_slots_alive) {
+		slots = &t_local_slots.slots;
+	}
+	if(slots && m_index < slots->size()) {
+		Value *vp = static_cast<Value *>((*slots)[m_index]);
+		if(vp && vp->generation == m_generation) {
+			(*slots)[m_index] = nullptr;
+			vp->destroy(vp);
+		}
+	}
+
+	std::lock_guard<std::mutex> locker(s_local_mutex);
+	++s_local_generations[m_index];
+	s_local_free[s_local_free_count++] = m_index;
+}
+
+void **FiberLocalBase::GetSlotSlow(size_t index) {
+	std::vector<void *> *slots = Fiber::GetLocalSlots();
+	if(!slots) {
+		slots = &t_local_slots.slots;
+	}
+	if(MYRIEL_UNLIKELY(slots->size() <= index)) {
+		slots->resize(s_local_count.load(std::memory_order_acquire), nullptr);
+	}
+	return &(*slots)[index];
+}
+
+void FiberLocalBase::DropStale(void **slot) {
+	Value *vp = static_cast<Value *>(*slot);
+	*slot = nullptr;
+	vp->destroy(vp);
+}
+
+void FiberLocalBase::DestroySlots(std::vector<void *> &slots) {
+	// 析构函数中可能再次访问协程局部变量，逐个取出后再析构，直到全部为空
+	bool found = true;
+	while(found) {
+		found = false;
+		for(size_t i = 0; i < slots.size(); ++i) {
+			Value *vp = static_cast<Value *>(slots[i]);
+			if(vp) {
+				found = true;
+				slots[i] = nullptr;
+				vp->destroy(vp);
+			}
+		}
+	}
+	slots.clear();
+}
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "fiber.h"
+
+namespace myriel {
+
+/**
+ * @brief 协程局部存储的槽位管理
+ * @details 每个FiberLocal对象注册时获得一个槽位下标，值保存在协程对象上的
+ * 			连续槽位数组中，按下标常数时间访问。没有协程运行时使用线程主协程上的
+ * 			槽位，线程尚未初始化协程时使用线程局部的槽位数组，即退化为线程局部存储。
+ * 			FiberLocal析构后下标归还复用，每次复用代数加一；值带有所属代数与析构函数，
+ * 			其它协程上残留的旧值在协程结束或被新变量访问到时按原类型析构。
+ */
+class FiberLocalBase {
+public:
+	/**
+	 * @brief 槽位中保存的值的头部
+	 */
+	struct Value {
+		void (*destroy)(Value *);		// 按实际类型析构
+		uint32_t generation;			// 所属变量注册时的代数
+	};
+
+	/**
+	 * @brief 同时存在的协程局部变量的最大个数
+	 */
+	static const size_t kMaxLocals = 1024;
+
+	/**
+	 * @brief 获取当前协程(或线程)上指定下标的槽位
+	 */
+	static void **GetSlot(size_t index) {
+		std::vector<void *> *slots = Fiber::GetLocalSlots();
+		if(MYRIEL_LIKELY(slots && index < slots->size())) {
+			return &(*slots)[index];
+		}
+		return GetSlotSlow(index);
+	}
+
+	/**
+	 * @brief 析构并清空槽位数组中的所有值，协程结束时调用
+	 */
+	static void DestroySlots(std::vector<void *> &slots);
+
+protected:
+	/**
+	 * @brief 构造函数，注册并获得槽位下标
+	 */
+	FiberLocalBase();
+
+	/**
+	 * @brief 析构函数，析构当前协程上的值并归还槽位下标
+	 */
+	~FiberLocalBase();
+
+	/**
+	 * @brief 取出槽位中属于本变量的值
+	 *
+	 * @return 没有值时返回nullptr；槽位中是下标复用前留下的旧值时将其析构并返回nullptr
+	 */
+	Value *find(void **slot) const {
+		Value *vp = static_cast<Value *>(*slot);
+		if(MYRIEL_LIKELY(!vp || vp->generation == m_generation)) {
+			return vp;
+		}
+		DropStale(slot);
+		return nullptr;
+	}
+
+private:
+	/**
+	 * @brief 槽位数组需要扩容或线程尚未初始化协程时的慢路径
+	 */
+	static void **GetSlotSlow(size_t index);
+
+	/**
+	 * @brief 析构槽位中的旧值并清空槽位
+	 */
+	static void DropStale(void **slot);
+
+protected:
+	size_t m_index;					// 槽位下标
+	uint32_t m_generation;			// 下标的代数
+};
+
+/**
+ * @brief 协程局部变量
+ * @details 值在协程内首次访问时构造，协程进入TERM状态时析构；
+ * 			协程被调度到其它线程后仍然访问到同一份值，这一点thread_local做不到
+ *
+ * @tparam T 值类型
+ */
+template<class T>
+class FiberLocal : public FiberLocalBase {
+public:
+	/**
+	 * @brief 构造函数，值使用T的默认构造函数初始化
+	 */
+	FiberLocal() = default;
+
+	/**
+	 * @brief 构造函数
+	 *
+	 * @param init 首次访问时用于生成初始值
+	 */
+	explicit FiberLocal(std::function<T()> init) : m_init(std::move(init)) {}
+
+	FiberLocal(const FiberLocal &) = delete;
+	FiberLocal &operator=(const FiberLocal &) = delete;
+
+	/**
+	 * @brief 获取当前协程的值，不存在时构造
+	 */
+	T &get() {
+		void **slot = GetSlot(m_index);
+		Value *vp = find(slot);
+		if(MYRIEL_UNLIKELY(!vp)) {
+			vp = m_init ? new Holder(m_generation, m_init()) : new Holder(m_generation);
+			*slot = vp;
+		}
+		return static_cast<Holder *>(vp)->value;
+	}
+
+	T *operator->() { return &get(); }
+
+	T &operator*() { return get(); }
+
+	/**
+	 * @brief 设置当前协程的值
+	 */
+	void set(T value) { get() = std::move(value); }
+
+	/**
+	 * @brief 当前协程是否已经构造了值
+	 */
+	bool has() const { return find(GetSlot(m_index)) != nullptr; }
+
+	/**
+	 * @brief 提前析构当前协程的值，下次访问时重新构造
+	 */
+	void reset() {
+		void **slot = GetSlot(m_index);
+		if(Value *vp = find(slot)) {
+			*slot = nullptr;
+			vp->destroy(vp);
+		}
+	}
+
+private:
+	struct Holder : public Value {
+		T value;
+
+		template<class... Args>
+		explicit Holder(uint32_t generation, Args &&...args)
+			: Value{&Destroy, generation}, value(std::forward<Args>(args)...) {}
+	};
+
+	static void Destroy(Value *vp) {
+		delete static_cast<Holder *>(vp);
+	}
+
+private:
+	std::function<T()> m_init;		// 初始值生成函数
+};
+}
@@ -0,0 +1,415 @@
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "fiber_trace.h"
+#include "macro.h"
+
+#include <thread>
+#include <vector>
+
+namespace myriel {
+
+// 单核机器上自旋只会白白消耗持锁者的时间片
+static const uint32_t s_spin_count = std::thread::hardware_concurrency() > 1 ? 128 : 0;
+
+/**
+ * @brief 挂起之前短暂自旋，临界区很短时省去一次挂起与调度
+ */
+template<class TryAcquire>
+static bool SpinAcquire(TryAcquire try_acquire) {
+	for(uint32_t i = 0; i < s_spin_count; ++i) {
+		if(try_acquire()) {
+			return true;
+		}
+		MYRIEL_CPU_RELAX();
+	}
+	return false;
+}
+
+FiberWaiter::ptr FiberWaiter::Create(const char *reason) {
+	ptr waiter(new FiberWaiter);
+	waiter->m_reason = reason;
+	if(InFiberContext()) {
+		waiter->m_fiber = Fiber::GetThis();
+		waiter->m_scheduler = Scheduler::GetThis();
+	}
+	return waiter;
+}
+
+bool FiberWaiter::InFiberContext() {
+	if(!Scheduler::GetThis()) {
+		return false;
+	}
+	Fiber::ptr cur = Fiber::GetThis();
+	return cur->isRunInScheduler() && cur.get() != Scheduler::GetMainFiber();
+}
+
+WaitStatus FiberWaiter::wait(bool cancellable) {
+	CancelToken::ptr token = cancellable ? Fiber::GetCancelToken() : nullptr;
+	uint64_t callback_id = 0;
+	if(token) {
+		FiberWaiter::ptr self = shared_from_this();
+		callback_id = token->addCallback([self](WaitStatus status) { self->fire(status); });
+		if(!callback_id) {
+			// 已经取消，抢在其它唤醒之前放弃时不必挂起
+			bool expected = false;
+			if(m_fired.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+				m_fiber = nullptr;
+				m_status = token->status();
+				return m_status;
+			}
+		}
+	}
+
+	if(m_scheduler) {
+		/**
+		 * fire可能在yield之前就把协程放回任务队列，此时协程仍处于EXEC状态，
+		 * 调度器要等它完整切出之后才会再次resume
+		 */
+		if(FiberTrace::IsEnabled()) {
+			FiberTrace::SetSwitchReason(m_reason);
+		}
+		Fiber::GetThis()->yield();
+		ASSERT(isFired());
+	} else {
+		std::unique_lock<std::mutex> locker(m_mutex);
+		m_cond.wait(locker, [this]() { return m_signaled; });
+	}
+	if(callback_id) {
+		token->removeCallback(callback_id);
+	}
+	return m_status;
+}
+
+bool FiberWaiter::fire(WaitStatus status) {
+	bool expected = false;
+	if(!m_fired.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+		return false;
+	}
+	m_status = status;
+	if(m_scheduler) {
+		// 交出协程的引用，避免等待者与协程互相持有
+		Fiber::ptr fiber = std::move(m_fiber);
+		m_scheduler->schedule(fiber);
+		return true;
+	}
+	// 持锁通知：等待者拿到锁返回后可能立即销毁本对象
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_signaled = true;
+	m_cond.notify_one();
+	return true;
+}
+
+FiberWaiter::ptr WaitQueue::pop() {
+	if(m_waiters.empty()) {
+		return nullptr;
+	}
+	FiberWaiter::ptr waiter = std::move(m_waiters.front());
+	m_waiters.pop_front();
+	return waiter;
+}
+
+bool WaitQueue::notifyOne() {
+	while(FiberWaiter::ptr waiter = pop()) {
+		if(waiter->fire()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void WaitQueue::notifyAll() {
+	while(FiberWaiter::ptr waiter = pop()) {
+		waiter->fire();
+	}
+}
+
+bool WaitQueue::remove(const FiberWaiter::ptr &waiter) {
+	for(auto it = m_waiters.begin(); it != m_waiters.end(); ++it) {
+		if(*it == waiter) {
+			m_waiters.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FiberMutex::try_lock() {
+	return !m_locked.load(std::memory_order_relaxed)
+		&& !m_locked.exchange(true, std::memory_order_acquire);
+}
+
+void FiberMutex::lock() {
+	if(try_lock() || SpinAcquire([this]() { return try_lock(); })) {
+		return;
+	}
+	lockSlow(false);
+}
+
+WaitStatus FiberMutex::lockCancellable() {
+	if(try_lock() || SpinAcquire([this]() { return try_lock(); })) {
+		return WaitStatus::OK;
+	}
+	return lockSlow(true);
+}
+
+WaitStatus FiberMutex::lockSlow(bool cancellable) {
+
+	bool requeue = false;
+	while(true) {
+		FiberWaiter::ptr waiter = FiberWaiter::Create("mutex");
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			/**
+			 * 先登记等待者再重试加锁，与unlock中先释放锁再检查等待者数量构成
+			 * Dekker式的握手(均为seq_cst)：两者至少有一方能看到对方，不会丢失唤醒
+			 */
+			m_waiters.fetch_add(1, std::memory_order_seq_cst);
+			if(!m_locked.exchange(true, std::memory_order_seq_cst)) {
+				m_waiters.fetch_sub(1, std::memory_order_relaxed);
+				return WaitStatus::OK;
+			}
+			if(requeue) {
+				m_queue.pushFront(waiter);
+			} else {
+				m_queue.push(waiter);
+			}
+		}
+		WaitStatus status = waiter->wait(cancellable);
+		if(status != WaitStatus::OK) {
+			std::lock_guard<std::mutex> locker(m_mutex);
+			// 不在队列中说明已被unlock取出，unlock唤醒失败后会改为唤醒下一个
+			if(m_queue.remove(waiter)) {
+				m_waiters.fetch_sub(1, std::memory_order_relaxed);
+			}
+			return status;
+		}
+		if(try_lock()) {
+			return WaitStatus::OK;
+		}
+		// 被插队，回到队首继续等待
+		requeue = true;
+	}
+}
+
+void FiberMutex::unlock() {
+	m_locked.store(false, std::memory_order_seq_cst);
+	if(m_waiters.load(std::memory_order_seq_cst) == 0) {
+		return;
+	}
+
+	while(true) {
+		FiberWaiter::ptr waiter;
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			waiter = m_queue.pop();
+			if(waiter) {
+				m_waiters.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+		// 等待者已被取消时唤醒下一个
+		if(!waiter || waiter->fire()) {
+			return;
+		}
+	}
+}
+
+bool FiberSemaphore::tryWait() {
+	uint32_t count = m_count.load(std::memory_order_relaxed);
+	while(count > 0) {
+		if(m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire,
+										 std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+WaitStatus FiberSemaphore::wait() {
+	if(tryWait() || SpinAcquire([this]() { return tryWait(); })) {
+		return WaitStatus::OK;
+	}
+
+	FiberWaiter::ptr waiter = FiberWaiter::Create("semaphore");
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(tryWait()) {
+			return WaitStatus::OK;
+		}
+		m_queue.push(waiter);
+	}
+	// notify把计数直接转交给等待者
+	WaitStatus status = waiter->wait();
+	if(status != WaitStatus::OK) {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_queue.remove(waiter);
+	}
+	return status;
+}
+
+void FiberSemaphore::notify() {
+	while(true) {
+		FiberWaiter::ptr waiter;
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			waiter = m_queue.pop();
+			if(!waiter) {
+				m_count.fetch_add(1, std::memory_order_release);
+				return;
+			}
+		}
+		// 已被取消的等待者不能接收计数
+		if(waiter->fire()) {
+			return;
+		}
+	}
+}
+
+WaitStatus FiberCondVar::wait(FiberMutex &mutex) {
+	FiberWaiter::ptr waiter = FiberWaiter::Create("condvar");
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_queue.push(waiter);
+	}
+	// 先入队再释放mutex，notify不会落在两者之间
+	mutex.unlock();
+	WaitStatus status = waiter->wait();
+	if(status != WaitStatus::OK) {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_queue.remove(waiter);
+	}
+	mutex.lock();
+	return status;
+}
+
+void FiberCondVar::notifyOne() {
+	while(true) {
+		FiberWaiter::ptr waiter;
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			waiter = m_queue.pop();
+		}
+		if(!waiter || waiter->fire()) {
+			return;
+		}
+	}
+}
+
+void FiberCondVar::notifyAll() {
+	WaitQueue queue;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		std::swap(queue, m_queue);
+	}
+	while(FiberWaiter::ptr waiter = queue.pop()) {
+		waiter->fire();
+	}
+}
+
+bool FiberRWMutex::tryRdlock() {
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if(m_writer || m_writeWaiters) {
+		return false;
+	}
+	++m_readers;
+	return true;
+}
+
+bool FiberRWMutex::tryWrlock() {
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if(m_writer || m_readers) {
+		return false;
+	}
+	m_writer = true;
+	return true;
+}
+
+void FiberRWMutex::rdlock() {
+	if(tryRdlock() || SpinAcquire([this]() { return tryRdlock(); })) {
+		return;
+	}
+
+	FiberWaiter::ptr waiter = FiberWaiter::Create("rwlock_read");
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(!m_writer && !m_writeWaiters) {
+			++m_readers;
+			return;
+		}
+		m_readQueue.push(waiter);
+	}
+	// unlock转交读锁后才会唤醒
+	waiter->wait(false);
+}
+
+void FiberRWMutex::wrlock() {
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(!m_writer && !m_readers) {
+			m_writer = true;
+			return;
+		}
+		// 自旋期间就阻止新的读者进入，让已有读者尽快退出
+		++m_writeWaiters;
+	}
+
+	auto try_acquire = [this]() {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(m_writer || m_readers) {
+			return false;
+		}
+		m_writer = true;
+		--m_writeWaiters;
+		return true;
+	};
+	if(SpinAcquire(try_acquire)) {
+		return;
+	}
+
+	bool requeue = false;
+	while(true) {
+		FiberWaiter::ptr waiter = FiberWaiter::Create("rwlock_write");
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if(!m_writer && !m_readers) {
+				m_writer = true;
+				--m_writeWaiters;
+				return;
+			}
+			if(requeue) {
+				m_writeQueue.pushFront(waiter);
+			} else {
+				m_writeQueue.push(waiter);
+			}
+		}
+		waiter->wait(false);
+		requeue = true;
+	}
+}
+
+void FiberRWMutex::unlock() {
+	std::vector<FiberWaiter::ptr> wakeups;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(m_writer) {
+			m_writer = false;
+			// 读者整批直接持有读锁，不会被后来的写者饿死
+			while(FiberWaiter::ptr waiter = m_readQueue.pop()) {
+				++m_readers;
+				wakeups.push_back(std::move(waiter));
+			}
+		} else {
+			ASSERT(m_readers > 0);
+			--m_readers;
+		}
+		// 写者只被唤醒而不直接持有写锁，持锁的协程在切回之前不会阻塞其它正在运行的协程
+		if(!m_writer && !m_readers) {
+			if(FiberWaiter::ptr waiter = m_writeQueue.pop()) {
+				wakeups.push_back(std::move(waiter));
+			}
+		}
+	}
+	for(auto &waiter : wakeups) {
+		waiter->fire();
+	}
+}
+}
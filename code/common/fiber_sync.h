@@ -0,0 +1,288 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "fiber.h"
+#include "cancel.h"
+
+namespace myriel {
+class Scheduler;
+
+/**
+ * @brief 一次性的等待者
+ * @details 在调度器协程中等待时记录协程与调度器，唤醒时通过Scheduler::schedule把协程
+ * 			放回任务队列，等待期间不占用调度线程；在线程主协程等非调度上下文中等待时
+ * 			退化为条件变量，阻塞当前线程。fire只有第一次调用生效。
+ * 			等待期间当前协程的取消令牌被取消时，由令牌代为fire，wait返回取消状态。
+ */
+class FiberWaiter : public std::enable_shared_from_this<FiberWaiter> {
+public:
+	using ptr = std::shared_ptr<FiberWaiter>;
+
+	/**
+	 * @brief 为当前执行上下文创建等待者
+	 *
+	 * @param reason 等待原因，开启协程追踪时记录为切出原因，必须是静态存储的字符串
+	 */
+	static ptr Create(const char *reason = "wait");
+
+	/**
+	 * @brief 当前是否运行在调度器调度的协程中，即可以挂起协程而不阻塞线程
+	 */
+	static bool InFiberContext();
+
+	/**
+	 * @brief 挂起当前协程(或阻塞当前线程)直到被fire
+	 * @attention 只能由创建等待者的上下文调用；被取消时等待者仍在调用方的等待队列中，
+	 * 			  需要调用方移除
+	 *
+	 * @param cancellable 是否响应当前协程的取消令牌
+	 * @return 被fire唤醒时为OK，否则为取消令牌的状态
+	 */
+	WaitStatus wait(bool cancellable = true);
+
+	/**
+	 * @brief 唤醒等待者
+	 *
+	 * @param status 唤醒原因，作为wait的返回值
+	 * @return 本次调用是否真正唤醒了等待者，已被唤醒过(包括已被取消)时返回false，
+	 * 		   调用方应当改为唤醒下一个等待者
+	 */
+	bool fire(WaitStatus status = WaitStatus::OK);
+
+	/**
+	 * @brief 放弃等待，之后的fire不再生效
+	 *
+	 * @return 放弃成功返回true；返回false说明已经被fire，调用方仍需调用wait消化这次唤醒，
+	 * 		   否则协程会在之后的某个切出点被意外调度
+	 */
+	bool cancel() {
+		bool expected = false;
+		return m_fired.compare_exchange_strong(expected, true, std::memory_order_acq_rel);
+	}
+
+	/**
+	 * @brief 是否已被唤醒
+	 */
+	bool isFired() const { return m_fired.load(std::memory_order_acquire); }
+
+private:
+	Fiber::ptr m_fiber;					// 等待的协程，线程模式下为空
+	Scheduler *m_scheduler = nullptr;	// 协程所属调度器
+	const char *m_reason = "wait";		// 等待原因
+	std::atomic<bool> m_fired{false};	// 是否已被唤醒
+	WaitStatus m_status = WaitStatus::OK;	// 唤醒原因，由fire成功的一方写入
+
+	std::mutex m_mutex;					// 线程模式下使用
+	std::condition_variable m_cond;
+	bool m_signaled = false;
+};
+
+/**
+ * @brief 等待者队列，调用方负责加锁
+ */
+class WaitQueue {
+public:
+	void push(FiberWaiter::ptr waiter) { m_waiters.push_back(std::move(waiter)); }
+	void pushFront(FiberWaiter::ptr waiter) { m_waiters.push_front(std::move(waiter)); }
+
+	/**
+	 * @brief 取出队首的等待者，队列为空时返回nullptr
+	 */
+	FiberWaiter::ptr pop();
+
+	/**
+	 * @brief 从队首开始唤醒，直到有一个等待者真正被唤醒
+	 * @details 同一个等待者可能挂在多个队列上(如select)，已被其它队列唤醒的直接丢弃
+	 *
+	 * @return 是否唤醒了等待者
+	 */
+	bool notifyOne();
+
+	/**
+	 * @brief 唤醒并清空所有等待者
+	 */
+	void notifyAll();
+
+	/**
+	 * @brief 移除指定的等待者，等待者放弃等待时调用
+	 *
+	 * @return 等待者是否仍在队列中
+	 */
+	bool remove(const FiberWaiter::ptr &waiter);
+
+	bool empty() const { return m_waiters.empty(); }
+	size_t size() const { return m_waiters.size(); }
+
+private:
+	std::deque<FiberWaiter::ptr> m_waiters;
+};
+
+/**
+ * @brief 协程互斥锁
+ * @details 无竞争时一次CAS加锁；竞争时先自旋一小段时间，仍拿不到锁再把当前协程
+ * 			挂到等待队列并让出调度线程，解锁时通过调度器重新调度一个等待者。
+ * 			被唤醒的协程需要重新竞争锁(允许插队)，竞争失败时排到队首。
+ * 			提供lock/unlock/try_lock，可直接配合std::lock_guard与std::unique_lock使用。
+ * 			lock不响应取消，需要响应取消时使用lockCancellable。
+ * @attention 不可重入
+ */
+class FiberMutex {
+public:
+	FiberMutex() = default;
+	FiberMutex(const FiberMutex &) = delete;
+	FiberMutex &operator=(const FiberMutex &) = delete;
+
+	void lock();
+	void unlock();
+	bool try_lock();
+
+	/**
+	 * @brief 加锁，当前协程被取消时放弃
+	 *
+	 * @return 加锁成功返回OK，否则未持有锁
+	 */
+	WaitStatus lockCancellable();
+
+private:
+	WaitStatus lockSlow(bool cancellable);
+
+private:
+	std::atomic<bool> m_locked{false};		// 是否已加锁
+	std::atomic<uint32_t> m_waiters{0};		// 等待队列长度，解锁时据此判断是否需要唤醒
+	std::mutex m_mutex;						// 保护等待队列
+	WaitQueue m_queue;						// 等待队列
+};
+
+/**
+ * @brief 协程信号量
+ * @details notify时若有等待者，直接把计数转交给队首的等待者，被唤醒者无需再次竞争
+ */
+class FiberSemaphore {
+public:
+	explicit FiberSemaphore(uint32_t count = 0) : m_count(count) {}
+	FiberSemaphore(const FiberSemaphore &) = delete;
+	FiberSemaphore &operator=(const FiberSemaphore &) = delete;
+
+	/**
+	 * @brief 获取一个计数，计数为0时挂起
+	 *
+	 * @return 获取成功返回OK，当前协程被取消时不获取计数，返回取消状态
+	 */
+	WaitStatus wait();
+
+	/**
+	 * @brief 尝试获取一个计数，不挂起
+	 */
+	bool tryWait();
+
+	/**
+	 * @brief 释放一个计数
+	 */
+	void notify();
+
+private:
+	std::atomic<uint32_t> m_count;		// 剩余计数，修改时持有m_mutex
+	std::mutex m_mutex;
+	WaitQueue m_queue;
+};
+
+/**
+ * @brief 协程条件变量，配合FiberMutex使用
+ */
+class FiberCondVar {
+public:
+	FiberCondVar() = default;
+	FiberCondVar(const FiberCondVar &) = delete;
+	FiberCondVar &operator=(const FiberCondVar &) = delete;
+
+	/**
+	 * @brief 释放mutex并挂起，被唤醒后重新加锁再返回
+	 * @attention 调用前必须持有mutex，可能出现虚假唤醒；被取消时同样重新加锁后返回
+	 *
+	 * @return 被唤醒返回OK，当前协程被取消时返回取消状态
+	 */
+	WaitStatus wait(FiberMutex &mutex);
+
+	/**
+	 * @brief 挂起直到pred成立
+	 *
+	 * @return pred成立返回OK，当前协程被取消且pred仍不成立时返回取消状态
+	 */
+	template<class Predicate>
+	WaitStatus wait(FiberMutex &mutex, Predicate pred) {
+		while(!pred()) {
+			WaitStatus status = wait(mutex);
+			if(status != WaitStatus::OK && !pred()) {
+				return status;
+			}
+		}
+		return WaitStatus::OK;
+	}
+
+	void notifyOne();
+	void notifyAll();
+
+private:
+	std::mutex m_mutex;
+	WaitQueue m_queue;
+};
+
+/**
+ * @brief 协程读写锁
+ * @details 有写者自旋或排队时新的读者需要等待，避免写者饿死；写者释放锁时把读锁
+ * 			整批转交给正在等待的读者，避免读者饿死。锁空闲时唤醒一个写者重新竞争，
+ * 			而不是把写锁转交给尚未运行的协程，避免其它协程跟着排队。
+ * 			与FiberMutex::lock一样不响应取消。
+ */
+class FiberRWMutex {
+public:
+	FiberRWMutex() = default;
+	FiberRWMutex(const FiberRWMutex &) = delete;
+	FiberRWMutex &operator=(const FiberRWMutex &) = delete;
+
+	void rdlock();
+	void wrlock();
+	bool tryRdlock();
+	bool tryWrlock();
+
+	/**
+	 * @brief 释放读锁或写锁
+	 */
+	void unlock();
+
+	/**
+	 * @brief 读锁守卫
+	 */
+	class ReadLock {
+	public:
+		explicit ReadLock(FiberRWMutex &mutex) : m_mutex(mutex) { m_mutex.rdlock(); }
+		~ReadLock() { m_mutex.unlock(); }
+	private:
+		FiberRWMutex &m_mutex;
+	};
+
+	/**
+	 * @brief 写锁守卫
+	 */
+	class WriteLock {
+	public:
+		explicit WriteLock(FiberRWMutex &mutex) : m_mutex(mutex) { m_mutex.wrlock(); }
+		~WriteLock() { m_mutex.unlock(); }
+	private:
+		FiberRWMutex &m_mutex;
+	};
+
+private:
+	std::mutex m_mutex;				// 保护以下状态
+	uint32_t m_readers = 0;			// 持有读锁的数量
+	bool m_writer = false;			// 是否有写者持有锁
+	uint32_t m_writeWaiters = 0;	// 自旋或排队中的写者数量，不为0时新的读者需要等待
+	WaitQueue m_readQueue;			// 等待的读者
+	WaitQueue m_writeQueue;			// 等待的写者
+};
+}
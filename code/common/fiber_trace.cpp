@@ -0,0 +1,240 @@
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "fiber_trace.h"
+#include "config.h"
+#include "utils.h"
+#include "macro.h"
+
+namespace myriel {
+
+static ConfigVar<bool>::ptr g_fiber_trace =
+	Config::Lookup("fiber.trace", false, "record fiber switch events for chrome trace export");
+
+static ConfigVar<uint32_t>::ptr g_fiber_trace_buffer_events =
+	Config::Lookup("fiber.trace.buffer_events", (uint32_t)65536, "trace events kept per thread");
+
+std::atomic<bool> FiberTrace::s_enabled{false};
+
+struct FiberTraceIniter {
+	FiberTraceIniter() {
+		FiberTrace::SetEnabled(g_fiber_trace->getValue());
+		g_fiber_trace->addListener([](const bool &old_value, const bool &new_value) {
+			FiberTrace::SetEnabled(new_value);
+		});
+	}
+};
+
+static FiberTraceIniter s_fiber_trace_initer;
+
+/**
+ * @brief 追踪事件
+ */
+struct TraceEvent {
+	uint64_t ts;			// 纳秒时间戳
+	uint64_t fiberId;		// 协程id
+	uint64_t queueNs;		// 切入前的排队时间，0表示未知
+	const char *reason;		// 切出原因
+	FiberTrace::Phase phase;
+};
+
+/**
+ * @brief 线程的事件缓冲区，线程退出后仍保留在全局列表中，以便事后导出
+ */
+struct TraceBuffer {
+	long tid = 0;
+	std::string threadName;
+	std::unique_ptr<TraceEvent[]> events;
+	size_t capacity = 0;
+	std::atomic<uint64_t> written{0};		// 累计写入的事件数，只有所属线程修改
+	std::atomic<uint64_t> cleared{0};		// Clear时的written，导出时跳过之前的事件
+};
+
+struct TraceRegistry {
+	std::mutex mutex;
+	std::vector<std::shared_ptr<TraceBuffer>> buffers;
+};
+
+static TraceRegistry &GetRegistry() {
+	static TraceRegistry s_registry;
+	return s_registry;
+}
+
+static thread_local TraceBuffer *t_buffer = nullptr;
+static thread_local std::string t_thread_name;
+static thread_local const char *t_switch_reason = nullptr;
+static thread_local uint64_t t_queue_ns = 0;
+
+static TraceBuffer *GetBuffer() {
+	if(MYRIEL_LIKELY(t_buffer != nullptr)) {
+		return t_buffer;
+	}
+	auto buffer = std::make_shared<TraceBuffer>();
+	buffer->tid = GetThreadID();
+	buffer->threadName = t_thread_name;
+	buffer->capacity = std::max<uint32_t>(g_fiber_trace_buffer_events->getValue(), 16);
+	buffer->events.reset(new TraceEvent[buffer->capacity]);
+	{
+		TraceRegistry &registry = GetRegistry();
+		std::lock_guard<std::mutex> locker(registry.mutex);
+		registry.buffers.push_back(buffer);
+	}
+	t_buffer = buffer.get();
+	return t_buffer;
+}
+
+static void Record(FiberTrace::Phase phase, uint64_t fiber_id, uint64_t queue_ns, const char *reason) {
+	TraceBuffer *buffer = GetBuffer();
+	uint64_t n = buffer->written.load(std::memory_order_relaxed);
+	TraceEvent &ev = buffer->events[n % buffer->capacity];
+	ev.ts = FiberTrace::NowNs();
+	ev.fiberId = fiber_id;
+	ev.queueNs = queue_ns;
+	ev.reason = reason;
+	ev.phase = phase;
+	buffer->written.store(n + 1, std::memory_order_release);
+}
+
+void FiberTrace::SetEnabled(bool enabled) {
+	s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void FiberTrace::SwitchIn(uint64_t fiber_id) {
+	uint64_t queue_ns = t_queue_ns;
+	t_queue_ns = 0;
+	t_switch_reason = nullptr;
+	Record(BEGIN, fiber_id, queue_ns, nullptr);
+}
+
+void FiberTrace::SwitchOut(uint64_t fiber_id) {
+	const char *reason = t_switch_reason ? t_switch_reason : "yield";
+	t_switch_reason = nullptr;
+	Record(END, fiber_id, 0, reason);
+}
+
+void FiberTrace::SetSwitchReason(const char *reason) {
+	t_switch_reason = reason;
+}
+
+void FiberTrace::SetQueueTime(uint64_t ns) {
+	t_queue_ns = ns;
+}
+
+void FiberTrace::SetThreadName(const std::string &name) {
+	t_thread_name = name;
+	if(t_buffer) {
+		std::lock_guard<std::mutex> locker(GetRegistry().mutex);
+		t_buffer->threadName = name;
+	}
+}
+
+uint64_t FiberTrace::NowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief 转义为JSON字符串，线程名由用户设置，可能含有引号等字符
+ */
+static std::string Quote(const std::string &s) {
+	std::string out = "\"";
+	for(char c : s) {
+		if(c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if((unsigned char)c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+std::string FiberTrace::DumpChromeJson() {
+	std::vector<std::shared_ptr<TraceBuffer>> buffers;
+	std::vector<std::string> names;
+	{
+		TraceRegistry &registry = GetRegistry();
+		std::lock_guard<std::mutex> locker(registry.mutex);
+		buffers = registry.buffers;
+		for(auto &i : buffers) {
+			names.push_back(i->threadName);
+		}
+	}
+
+	std::stringstream ss;
+	ss << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool first = true;
+	auto sep = [&ss, &first]() {
+		if(!first) {
+			ss << ",\n";
+		}
+		first = false;
+	};
+	long pid = getpid();
+	ss.setf(std::ios::fixed);
+	ss.precision(3);
+	for(size_t b = 0; b < buffers.size(); ++b) {
+		TraceBuffer *buffer = buffers[b].get();
+		sep();
+		ss << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+		   << ",\"args\":{\"name\":"
+		   << Quote((names[b].empty() ? "thread" : names[b]) + " " + std::to_string(buffer->tid)) << "}}";
+
+		uint64_t written = buffer->written.load(std::memory_order_acquire);
+		uint64_t begin = written > buffer->capacity ? written - buffer->capacity : 0;
+		begin = std::max(begin, buffer->cleared.load(std::memory_order_relaxed));
+		for(uint64_t i = begin; i < written; ++i) {
+			const TraceEvent &ev = buffer->events[i % buffer->capacity];
+			sep();
+			ss << "{\"ph\":\"" << (ev.phase == BEGIN ? "B" : "E") << "\",\"pid\":" << pid
+			   << ",\"tid\":" << buffer->tid << ",\"ts\":" << ev.ts / 1000.0;
+			if(ev.phase == BEGIN) {
+				ss << ",\"name\":\"" << (ev.fiberId ? "fiber " : "coroutine");
+				if(ev.fiberId) {
+					ss << ev.fiberId;
+				}
+				ss << "\",\"cat\":\"fiber\"";
+				if(ev.queueNs) {
+					ss << ",\"args\":{\"queue_us\":" << ev.queueNs / 1000.0 << "}";
+				}
+			} else {
+				ss << ",\"args\":{\"reason\":" << Quote(ev.reason) << "}";
+			}
+			ss << "}";
+		}
+	}
+	ss << "]}\n";
+	return ss.str();
+}
+
+bool FiberTrace::DumpToFile(const std::string &path) {
+	std::ofstream ofs(path);
+	if(!ofs) {
+		return false;
+	}
+	ofs << DumpChromeJson();
+	return (bool)ofs;
+}
+
+void FiberTrace::Clear() {
+	TraceRegistry &registry = GetRegistry();
+	std::lock_guard<std::mutex> locker(registry.mutex);
+	// 只记录清空位置，不修改written：所属线程可能正在写入，写回的written会覆盖清空
+	for(auto &i : registry.buffers) {
+		i->cleared.store(i->written.load(std::memory_order_acquire), std::memory_order_relaxed);
+	}
+}
+}
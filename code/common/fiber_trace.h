@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace myriel {
+
+/**
+ * @brief 协程执行追踪，导出为Chrome/Perfetto的JSON trace
+ * @details 每个线程写自己的环形缓冲区，只有该线程写入，不加锁；缓冲区写满后覆盖最旧的事件。
+ * 			协程切入记录为B事件，切出记录为E事件并带上切出原因，嵌套的resume自然形成调用层次；
+ * 			调度器取出任务时把排队时间附加到随后的切入事件上。
+ * 			关闭时每个埋点只多一次relaxed原子读与一次分支。
+ * @attention 导出时最好先关闭追踪，否则环形缓冲区回绕处的事件可能不完整
+ */
+class FiberTrace {
+public:
+	/**
+	 * @brief 事件类型
+	 */
+	enum Phase : uint8_t {
+		BEGIN,		// 切入协程
+		END			// 切出协程
+	};
+
+	/**
+	 * @brief 是否开启追踪，对应配置项fiber.trace
+	 */
+	static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+	static void SetEnabled(bool enabled);
+
+	/**
+	 * @brief 记录切入协程
+	 *
+	 * @param fiber_id 协程id，无栈协程为0
+	 */
+	static void SwitchIn(uint64_t fiber_id);
+
+	/**
+	 * @brief 记录切出协程，原因取自SetSwitchReason，未设置时为yield
+	 */
+	static void SwitchOut(uint64_t fiber_id);
+
+	/**
+	 * @brief 设置当前线程下一次切出的原因，如mutex、channel_recv
+	 * @attention 只接受字符串字面量等静态存储的字符串
+	 */
+	static void SetSwitchReason(const char *reason);
+
+	/**
+	 * @brief 设置当前线程下一次切入的协程在任务队列中等待的时间
+	 */
+	static void SetQueueTime(uint64_t ns);
+
+	/**
+	 * @brief 设置当前线程在trace中显示的名称
+	 */
+	static void SetThreadName(const std::string &name);
+
+	/**
+	 * @brief 单调时钟，纳秒
+	 */
+	static uint64_t NowNs();
+
+	/**
+	 * @brief 导出为Chrome trace JSON
+	 */
+	static std::string DumpChromeJson();
+
+	/**
+	 * @brief 导出到文件，可直接在chrome://tracing或ui.perfetto.dev中打开
+	 */
+	static bool DumpToFile(const std::string &path);
+
+	/**
+	 * @brief 清空所有线程的缓冲区
+	 * @details 不与写入方同步，追踪开启时也可以调用，之后导出只包含清空后写入的事件
+	 */
+	static void Clear();
+
+private:
+	static std::atomic<bool> s_enabled;
+};
+}
@@ -0,0 +1,510 @@
+#include "hook.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "utils.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#include <mutex>
+
+namespace myriel {
+static Logger::ptr g_logger = LOG_ROOT();
+
+static ConfigVar<int>::ptr g_tcp_connect_timeout =
+	Config::Lookup("tcp.connect.timeout", 5000, "tcp connect timeout(ms)");
+
+static thread_local bool t_hook_enable = false;
+
+#define HOOK_FUN(XX) \
+	XX(sleep) \
+	XX(usleep) \
+	XX(nanosleep) \
+	XX(socket) \
+	XX(connect) \
+	XX(accept) \
+	XX(read) \
+	XX(readv) \
+	XX(recv) \
+	XX(recvfrom) \
+	XX(recvmsg) \
+	XX(write) \
+	XX(writev) \
+	XX(send) \
+	XX(sendto) \
+	XX(sendmsg) \
+	XX(close) \
+	XX(fcntl) \
+	XX(ioctl) \
+	XX(getsockopt) \
+	XX(setsockopt)
+
+/**
+ * @brief 解析原始函数，可以重复调用
+ * @details 通常由s_hook_initer在静态初始化时调用；其它编译单元的全局构造可能更早地调用
+ * 			被hook的函数，此时由HOOK_LAZY_INIT在第一次调用时解析
+ */
+static void HookInit() {
+	static std::once_flag s_once;
+	std::call_once(s_once, []() {
+#define XX(name) name ## _f = (name ## _fun)dlsym(RTLD_NEXT, #name);
+		HOOK_FUN(XX);
+#undef XX
+	});
+}
+
+#define HOOK_LAZY_INIT(name) \
+	if(MYRIEL_UNLIKELY(name ## _f == nullptr)) { \
+		myriel::HookInit(); \
+	}
+
+static uint64_t s_connect_timeout = ~0ull;
+
+struct HookIniter {
+	HookIniter() {
+		HookInit();
+		s_connect_timeout = g_tcp_connect_timeout->getValue();
+		g_tcp_connect_timeout->addListener([](const int &old_value, const int &new_value) {
+			LOG_INFO(g_logger) << "tcp connect timeout changed from " << old_value << " to " << new_value;
+			s_connect_timeout = new_value;
+		});
+	}
+};
+
+static HookIniter s_hook_initer;
+
+bool is_hook_enable() {
+	return t_hook_enable;
+}
+
+void set_hook_enable(bool flag) {
+	t_hook_enable = flag;
+}
+
+/**
+ * @brief 当前上下文能否挂起协程代替阻塞：开启了hook且运行在IOManager调度的协程中
+ */
+static IOManager *HookedIOManager() {
+	if(!t_hook_enable) {
+		return nullptr;
+	}
+	IOManager *iom = IOManager::GetThis();
+	if(!iom || !FiberWaiter::InFiberContext()) {
+		return nullptr;
+	}
+	return iom;
+}
+
+/**
+ * @brief 挂起当前协程直到fd上的事件就绪、超时或被取消令牌取消
+ *
+ * @param timeout_ms 超时时间(毫秒)，~0ull表示不超时
+ * @param reason 挂起原因，必须是静态存储的字符串
+ * @return 事件就绪返回0；失败返回-1并设置errno，超时为ETIMEDOUT，被取消为ECANCELED
+ */
+static int WaitEvent(IOManager *iom, int fd, IOManager::Event event, uint64_t timeout_ms, const char *reason) {
+	FiberWaiter::ptr waiter = FiberWaiter::Create(reason);
+	Timer::ptr timer;
+	if(timeout_ms != ~0ull) {
+		timer = iom->addTimer(timeout_ms, [waiter]() {
+			waiter->fire(WaitStatus::TIMEOUT);
+		});
+	}
+	if(iom->addEvent(fd, event, [waiter]() { waiter->fire(); })) {
+		LOG_ERROR(g_logger) << reason << " addEvent(" << fd << ", " << event << ") error";
+		if(timer) {
+			timer->cancel();
+		}
+		return -1;
+	}
+
+	WaitStatus status = waiter->wait();
+	if(timer) {
+		timer->cancel();
+	}
+	if(status == WaitStatus::OK) {
+		return 0;
+	}
+	// 超时或被取消，事件可能已经触发，此时回调中的fire不再生效
+	iom->delEvent(fd, event);
+	errno = status == WaitStatus::CANCELLED ? ECANCELED : ETIMEDOUT;
+	return -1;
+}
+
+/**
+ * @brief 挂起当前协程ms毫秒
+ *
+ * @return 睡满返回OK，否则为取消令牌的状态
+ */
+static WaitStatus SleepFor(IOManager *iom, uint64_t ms) {
+	FiberWaiter::ptr waiter = FiberWaiter::Create("sleep");
+	Timer::ptr timer = iom->addTimer(ms, [waiter]() { waiter->fire(); });
+	WaitStatus status = waiter->wait();
+	if(status != WaitStatus::OK) {
+		timer->cancel();
+	}
+	return status;
+}
+
+/**
+ * @brief socket读写的通用流程：非阻塞地尝试，EAGAIN时等待对应的IO事件后重试
+ *
+ * @param hook_fun_name 函数名，作为协程挂起原因
+ * @param event 等待的事件
+ * @param timeout_so 使用的超时类型，SO_RCVTIMEO或SO_SNDTIMEO
+ */
+template<typename OriginFun, typename... Args>
+static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name,
+					 IOManager::Event event, int timeout_so, Args &&...args) {
+	if(!t_hook_enable) {
+		return fun(fd, std::forward<Args>(args)...);
+	}
+
+	FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+	if(!ctx) {
+		return fun(fd, std::forward<Args>(args)...);
+	}
+	if(ctx->isClose()) {
+		errno = EBADF;
+		return -1;
+	}
+	IOManager *iom = nullptr;
+	if(!ctx->isSocket() || ctx->getUserNonblock() || !(iom = HookedIOManager())) {
+		return fun(fd, std::forward<Args>(args)...);
+	}
+
+	uint64_t timeout = ctx->getTimeout(timeout_so);
+	while(true) {
+		ssize_t n = fun(fd, args...);
+		while(n == -1 && errno == EINTR) {
+			n = fun(fd, args...);
+		}
+		if(n != -1 || errno != EAGAIN) {
+			return n;
+		}
+		if(WaitEvent(iom, fd, event, timeout, hook_fun_name)) {
+			return -1;
+		}
+	}
+}
+}
+
+extern "C" {
+#define XX(name) name ## _fun name ## _f = nullptr;
+	HOOK_FUN(XX);
+#undef XX
+
+unsigned int sleep(unsigned int seconds) {
+	HOOK_LAZY_INIT(sleep);
+	myriel::IOManager *iom = myriel::HookedIOManager();
+	if(!iom) {
+		return sleep_f(seconds);
+	}
+	uint64_t start = myriel::GetElapsedMS();
+	if(myriel::SleepFor(iom, (uint64_t)seconds * 1000) == myriel::WaitStatus::OK) {
+		return 0;
+	}
+	// 被取消时与被信号打断一样返回剩余的秒数
+	uint64_t elapsed = (myriel::GetElapsedMS() - start) / 1000;
+	return elapsed < seconds ? seconds - elapsed : 0;
+}
+
+int usleep(useconds_t usec) {
+	HOOK_LAZY_INIT(usleep);
+	myriel::IOManager *iom = myriel::HookedIOManager();
+	if(!iom) {
+		return usleep_f(usec);
+	}
+	if(myriel::SleepFor(iom, usec / 1000) != myriel::WaitStatus::OK) {
+		errno = EINTR;
+		return -1;
+	}
+	return 0;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+	HOOK_LAZY_INIT(nanosleep);
+	myriel::IOManager *iom = myriel::HookedIOManager();
+	if(!iom) {
+		return nanosleep_f(req, rem);
+	}
+	if(req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000) {
+		errno = EINVAL;
+		return -1;
+	}
+	uint64_t ms = req->tv_sec * 1000 + req->tv_nsec / 1000000;
+	uint64_t start = myriel::GetElapsedMS();
+	if(myriel::SleepFor(iom, ms) != myriel::WaitStatus::OK) {
+		if(rem) {
+			uint64_t elapsed = myriel::GetElapsedMS() - start;
+			uint64_t left = elapsed < ms ? ms - elapsed : 0;
+			rem->tv_sec = left / 1000;
+			rem->tv_nsec = left % 1000 * 1000000;
+		}
+		errno = EINTR;
+		return -1;
+	}
+	return 0;
+}
+
+int socket(int domain, int type, int protocol) {
+	HOOK_LAZY_INIT(socket);
+	if(!myriel::t_hook_enable) {
+		return socket_f(domain, type, protocol);
+	}
+	int fd = socket_f(domain, type, protocol);
+	if(fd == -1) {
+		return fd;
+	}
+	// fd可能被未经hook的close关闭后复用，重新创建状态
+	myriel::FdMgr::GetInstance()->del(fd);
+	myriel::FdMgr::GetInstance()->get(fd, true);
+	return fd;
+}
+
+int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms) {
+	HOOK_LAZY_INIT(connect);
+	if(!myriel::t_hook_enable) {
+		return connect_f(fd, addr, addrlen);
+	}
+	myriel::FdCtx::ptr ctx = myriel::FdMgr::GetInstance()->get(fd);
+	if(!ctx) {
+		return connect_f(fd, addr, addrlen);
+	}
+	if(ctx->isClose()) {
+		errno = EBADF;
+		return -1;
+	}
+	myriel::IOManager *iom = nullptr;
+	if(!ctx->isSocket() || ctx->getUserNonblock() || !(iom = myriel::HookedIOManager())) {
+		return connect_f(fd, addr, addrlen);
+	}
+
+	int n = connect_f(fd, addr, addrlen);
+	if(n == 0) {
+		return 0;
+	} else if(n != -1 || errno != EINPROGRESS) {
+		return n;
+	}
+
+	if(myriel::WaitEvent(iom, fd, myriel::IOManager::WRITE, timeout_ms, "connect")) {
+		return -1;
+	}
+	int error = 0;
+	socklen_t len = sizeof(int);
+	if(-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+		return -1;
+	}
+	if(!error) {
+		return 0;
+	}
+	errno = error;
+	return -1;
+}
+
+int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+	HOOK_LAZY_INIT(connect);
+	return connect_with_timeout(sockfd, addr, addrlen, myriel::s_connect_timeout);
+}
+
+int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
+	HOOK_LAZY_INIT(accept);
+	int fd = myriel::do_io(s, accept_f, "accept", myriel::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+	if(fd >= 0 && myriel::t_hook_enable) {
+		myriel::FdMgr::GetInstance()->del(fd);
+		myriel::FdMgr::GetInstance()->get(fd, true);
+	}
+	return fd;
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+	HOOK_LAZY_INIT(read);
+	return myriel::do_io(fd, read_f, "read", myriel::IOManager::READ, SO_RCVTIMEO, buf, count);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+	HOOK_LAZY_INIT(readv);
+	return myriel::do_io(fd, readv_f, "readv", myriel::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+}
+
+ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+	HOOK_LAZY_INIT(recv);
+	return myriel::do_io(sockfd, recv_f, "recv", myriel::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+}
+
+ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
+	HOOK_LAZY_INIT(recvfrom);
+	return myriel::do_io(sockfd, recvfrom_f, "recvfrom", myriel::IOManager::READ, SO_RCVTIMEO,
+						 buf, len, flags, src_addr, addrlen);
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
+	HOOK_LAZY_INIT(recvmsg);
+	return myriel::do_io(sockfd, recvmsg_f, "recvmsg", myriel::IOManager::READ, SO_RCVTIMEO, msg, flags);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+	HOOK_LAZY_INIT(write);
+	return myriel::do_io(fd, write_f, "write", myriel::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+	HOOK_LAZY_INIT(writev);
+	return myriel::do_io(fd, writev_f, "writev", myriel::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+}
+
+ssize_t send(int s, const void *msg, size_t len, int flags) {
+	HOOK_LAZY_INIT(send);
+	return myriel::do_io(s, send_f, "send", myriel::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+}
+
+ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
+	HOOK_LAZY_INIT(sendto);
+	return myriel::do_io(s, sendto_f, "sendto", myriel::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+}
+
+ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
+	HOOK_LAZY_INIT(sendmsg);
+	return myriel::do_io(s, sendmsg_f, "sendmsg", myriel::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+}
+
+int close(int fd) {
+	HOOK_LAZY_INIT(close);
+	if(!myriel::t_hook_enable) {
+		return close_f(fd);
+	}
+	myriel::FdCtx::ptr ctx = myriel::FdMgr::GetInstance()->get(fd);
+	if(ctx) {
+		// 唤醒等待在这个fd上的协程，它们重试时会得到EBADF
+		myriel::IOManager *iom = myriel::IOManager::GetThis();
+		if(iom) {
+			iom->cancelAll(fd);
+		}
+		myriel::FdMgr::GetInstance()->del(fd);
+	}
+	return close_f(fd);
+}
+
+int fcntl(int fd, int cmd, ... /* arg */) {
+	HOOK_LAZY_INIT(fcntl);
+	va_list va;
+	va_start(va, cmd);
+	switch(cmd) {
+		case F_SETFL: {
+			int arg = va_arg(va, int);
+			va_end(va);
+			myriel::FdCtx::ptr ctx = myriel::FdMgr::GetInstance()->get(fd);
+			if(!ctx || ctx->isClose() || !ctx->isSocket()) {
+				return fcntl_f(fd, cmd, arg);
+			}
+			// 记录用户的意图，socket实际保持hook层设置的非阻塞状态
+			ctx->setUserNonblock(arg & O_NONBLOCK);
+			if(ctx->getSysNonblock()) {
+				arg |= O_NONBLOCK;
+			} else {
+				arg &= ~O_NONBLOCK;
+			}
+			return fcntl_f(fd, cmd, arg);
+		}
+		case F_GETFL: {
+			va_end(va);
+			int arg = fcntl_f(fd, cmd);
+			myriel::FdCtx::ptr ctx = myriel::FdMgr::GetInstance()->get(fd);
+			if(arg == -1 || !ctx || ctx->isClose() || !ctx->isSocket()) {
+				return arg;
+			}
+			if(ctx->getUserNonblock()) {
+				return arg | O_NONBLOCK;
+			} else {
+				return arg & ~O_NONBLOCK;
+			}
+		}
+		case F_DUPFD:
+		case F_DUPFD_CLOEXEC:
+		case F_SETFD:
+		case F_SETOWN:
+		case F_SETSIG:
+		case F_SETLEASE:
+		case F_NOTIFY:
+#ifdef F_SETPIPE_SZ
+		case F_SETPIPE_SZ:
+#endif
+		{
+			int arg = va_arg(va, int);
+			va_end(va);
+			return fcntl_f(fd, cmd, arg);
+		}
+		case F_GETFD:
+		case F_GETOWN:
+		case F_GETSIG:
+		case F_GETLEASE:
+#ifdef F_GETPIPE_SZ
+		case F_GETPIPE_SZ:
+#endif
+		{
+			va_end(va);
+			return fcntl_f(fd, cmd);
+		}
+		case F_SETLK:
+		case F_SETLKW:
+		case F_GETLK: {
+			struct flock *arg = va_arg(va, struct flock *);
+			va_end(va);
+			return fcntl_f(fd, cmd, arg);
+		}
+		default: {
+			// 其余命令的参数按指针传递
+			void *arg = va_arg(va, void *);
+			va_end(va);
+			return fcntl_f(fd, cmd, arg);
+		}
+	}
+}
+
+int ioctl(int d, unsigned long int request, ...) {
+	HOOK_LAZY_INIT(ioctl);
+	va_list va;
+	va_start(va, request);
+	void *arg = va_arg(va, void *);
+	va_end(va);
+
+	if(FIONBIO == request) {
+		bool user_nonblock = !!*(int *)arg;
+		myriel::FdCtx::ptr ctx = myriel::FdMgr::GetInstance()->get(d);
+		if(!ctx || ctx->isClose() || !ctx->isSocket()) {
+			return ioctl_f(d, request, arg);
+		}
+		// 只记录用户的意图，socket保持非阻塞
+		ctx->setUserNonblock(user_nonblock);
+		return 0;
+	}
+	return ioctl_f(d, request, arg);
+}
+
+int getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optlen) {
+	HOOK_LAZY_INIT(getsockopt);
+	return getsockopt_f(sockfd, level, optname, optval, optlen);
+}
+
+int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen) {
+	HOOK_LAZY_INIT(setsockopt);
+	if(!myriel::t_hook_enable) {
+		return setsockopt_f(sockfd, level, optname, optval, optlen);
+	}
+	if(level == SOL_SOCKET && (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO)) {
+		myriel::FdCtx::ptr ctx = myriel::FdMgr::GetInstance()->get(sockfd);
+		if(ctx && optlen >= sizeof(timeval)) {
+			const timeval *v = (const timeval *)optval;
+			uint64_t ms = v->tv_sec * 1000 + v->tv_usec / 1000;
+			// 与内核一致，0表示不超时
+			ctx->setTimeout(optname, ms ? ms : ~0ull);
+		}
+	}
+	return setsockopt_f(sockfd, level, optname, optval, optlen);
+}
+}
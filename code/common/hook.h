@@ -0,0 +1,107 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace myriel {
+
+/**
+ * @brief 当前线程是否开启了hook
+ */
+bool is_hook_enable();
+
+/**
+ * @brief 设置当前线程是否开启hook
+ * @details 开启后，在IOManager调度的协程中调用sleep系列函数会挂起协程并注册定时器，
+ * 			socket上的阻塞读写在EAGAIN时注册IO事件并挂起协程，而不是阻塞整个线程。
+ * 			挂起期间响应协程的取消令牌，被取消时返回-1，errno为ECANCELED或ETIMEDOUT。
+ * 			调度线程按配置项scheduler.hook开启，其余线程默认关闭。
+ */
+void set_hook_enable(bool flag);
+}
+
+extern "C" {
+
+// sleep
+typedef unsigned int (*sleep_fun)(unsigned int seconds);
+extern sleep_fun sleep_f;
+
+typedef int (*usleep_fun)(useconds_t usec);
+extern usleep_fun usleep_f;
+
+typedef int (*nanosleep_fun)(const struct timespec *req, struct timespec *rem);
+extern nanosleep_fun nanosleep_f;
+
+// socket
+typedef int (*socket_fun)(int domain, int type, int protocol);
+extern socket_fun socket_f;
+
+typedef int (*connect_fun)(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+extern connect_fun connect_f;
+
+typedef int (*accept_fun)(int s, struct sockaddr *addr, socklen_t *addrlen);
+extern accept_fun accept_f;
+
+// read
+typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
+extern read_fun read_f;
+
+typedef ssize_t (*readv_fun)(int fd, const struct iovec *iov, int iovcnt);
+extern readv_fun readv_f;
+
+typedef ssize_t (*recv_fun)(int sockfd, void *buf, size_t len, int flags);
+extern recv_fun recv_f;
+
+typedef ssize_t (*recvfrom_fun)(int sockfd, void *buf, size_t len, int flags,
+								struct sockaddr *src_addr, socklen_t *addrlen);
+extern recvfrom_fun recvfrom_f;
+
+typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr *msg, int flags);
+extern recvmsg_fun recvmsg_f;
+
+// write
+typedef ssize_t (*write_fun)(int fd, const void *buf, size_t count);
+extern write_fun write_f;
+
+typedef ssize_t (*writev_fun)(int fd, const struct iovec *iov, int iovcnt);
+extern writev_fun writev_f;
+
+typedef ssize_t (*send_fun)(int s, const void *msg, size_t len, int flags);
+extern send_fun send_f;
+
+typedef ssize_t (*sendto_fun)(int s, const void *msg, size_t len, int flags,
+							  const struct sockaddr *to, socklen_t tolen);
+extern sendto_fun sendto_f;
+
+typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
+extern sendmsg_fun sendmsg_f;
+
+// fd
+typedef int (*close_fun)(int fd);
+extern close_fun close_f;
+
+typedef int (*fcntl_fun)(int fd, int cmd, ... /* arg */);
+extern fcntl_fun fcntl_f;
+
+typedef int (*ioctl_fun)(int d, unsigned long int request, ...);
+extern ioctl_fun ioctl_f;
+
+typedef int (*getsockopt_fun)(int sockfd, int level, int optname, void *optval, socklen_t *optlen);
+extern getsockopt_fun getsockopt_f;
+
+typedef int (*setsockopt_fun)(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
+extern setsockopt_fun setsockopt_f;
+
+/**
+ * @brief 带超时的connect
+ *
+ * @param timeout_ms 超时时间(毫秒)，~0ull表示不超时
+ */
+extern int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms);
+}
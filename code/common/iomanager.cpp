@@ -0,0 +1,361 @@
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+#include <errno.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace myriel {
+static Logger::ptr g_logger = LOG_ROOT();
+
+// epoll_wait的最长等待时间，只是兜底，正常情况下由tickle唤醒
+static const int s_max_timeout_ms = 5000;
+// 每次epoll_wait最多取出的事件数
+static const int s_max_events = 256;
+
+IOManager::EventContext &IOManager::FdContext::getEventContext(Event event) {
+	switch(event) {
+		case READ:
+			return read;
+		case WRITE:
+			return write;
+		default:
+			ASSERT2(false, "getEventContext");
+	}
+	throw std::invalid_argument("getEventContext invalid event");
+}
+
+void IOManager::FdContext::triggerEvent(Event event) {
+	ASSERT(events & event);
+	events = (Event)(events & ~event);
+	EventContext &ctx = getEventContext(event);
+	if(ctx.cb) {
+		ctx.scheduler->schedule(&ctx.cb);
+	} else {
+		ctx.scheduler->schedule(&ctx.fiber);
+	}
+	ctx.reset();
+}
+
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
+	: Scheduler(threads, use_caller, name) {
+	m_epfd = epoll_create1(EPOLL_CLOEXEC);
+	ASSERT2(m_epfd >= 0, "epoll_create1 errno=" << errno);
+
+	m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ASSERT2(m_eventfd >= 0, "eventfd errno=" << errno);
+
+	// data.ptr为空表示eventfd，fd上下文的指针不会为空
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLET;
+	event.data.ptr = nullptr;
+	int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_eventfd, &event);
+	ASSERT2(rt == 0, "epoll_ctl eventfd errno=" << errno);
+
+	start();
+}
+
+IOManager::~IOManager() {
+	stop();
+	close(m_epfd);
+	close(m_eventfd);
+	for(auto &chunk : m_fdChunks) {
+		delete[] chunk.load(std::memory_order_relaxed);
+	}
+}
+
+IOManager::FdContext *IOManager::getFdContext(int fd, bool create) {
+	if(fd < 0) {
+		return nullptr;
+	}
+	size_t index = (size_t)fd >> kFdChunkBits;
+	if(index >= kFdMaxChunks) {
+		return nullptr;
+	}
+	FdContext *chunk = m_fdChunks[index].load(std::memory_order_acquire);
+	if(!chunk) {
+		if(!create) {
+			return nullptr;
+		}
+		std::lock_guard<std::mutex> locker(m_chunkMutex);
+		chunk = m_fdChunks[index].load(std::memory_order_relaxed);
+		if(!chunk) {
+			chunk = new FdContext[kFdChunkSize];
+			for(size_t i = 0; i < kFdChunkSize; ++i) {
+				chunk[i].fd = (int)((index << kFdChunkBits) + i);
+			}
+			m_fdChunks[index].store(chunk, std::memory_order_release);
+		}
+	}
+	return &chunk[fd & (kFdChunkSize - 1)];
+}
+
+int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
+	FdContext *ctx = getFdContext(fd, true);
+	if(!ctx) {
+		LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> locker(ctx->mutex);
+	if(MYRIEL_UNLIKELY(ctx->events & event)) {
+		LOG_ERROR(g_logger) << "addEvent fd=" << fd << " event=" << event
+			<< " already registered, events=" << ctx->events;
+		return -1;
+	}
+
+	int op = ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	epoll_event epevent;
+	memset(&epevent, 0, sizeof(epevent));
+	epevent.events = EPOLLET | ctx->events | event;
+	epevent.data.ptr = ctx;
+	int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+	if(rt && op == EPOLL_CTL_MOD && errno == ENOENT) {
+		// fd被关闭后复用，epoll中已经没有它了
+		op = EPOLL_CTL_ADD;
+		rt = epoll_ctl(m_epfd, op, fd, &epevent);
+	}
+	if(rt) {
+		LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd << ", "
+			<< epevent.events << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
+		return -1;
+	}
+
+	++m_pendingEventCount;
+	ctx->events = (Event)(ctx->events | event);
+	EventContext &event_ctx = ctx->getEventContext(event);
+	ASSERT(event_ctx.empty());
+
+	event_ctx.scheduler = Scheduler::GetThis() ? Scheduler::GetThis() : this;
+	if(cb) {
+		event_ctx.cb.swap(cb);
+	} else {
+		event_ctx.fiber = Fiber::GetThis();
+		ASSERT2(event_ctx.fiber->getState() == Fiber::EXEC,
+				"state=" << event_ctx.fiber->getState());
+	}
+	return 0;
+}
+
+bool IOManager::updateEpoll(FdContext *ctx, Event event) {
+	Event left = (Event)(ctx->events & ~event);
+	int op = left ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+	epoll_event epevent;
+	memset(&epevent, 0, sizeof(epevent));
+	epevent.events = EPOLLET | left;
+	epevent.data.ptr = ctx;
+	int rt = epoll_ctl(m_epfd, op, ctx->fd, &epevent);
+	if(rt) {
+		LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << ctx->fd << ", "
+			<< epevent.events << "):" << rt << " (" << errno << ") (" << strerror(errno) << ")";
+		return false;
+	}
+	return true;
+}
+
+bool IOManager::delEvent(int fd, Event event) {
+	FdContext *ctx = getFdContext(fd, false);
+	if(!ctx) {
+		return false;
+	}
+	std::lock_guard<std::mutex> locker(ctx->mutex);
+	if(MYRIEL_UNLIKELY(!(ctx->events & event))) {
+		return false;
+	}
+	if(!updateEpoll(ctx, event)) {
+		return false;
+	}
+
+	--m_pendingEventCount;
+	ctx->events = (Event)(ctx->events & ~event);
+	ctx->getEventContext(event).reset();
+	return true;
+}
+
+bool IOManager::cancelEvent(int fd, Event event) {
+	FdContext *ctx = getFdContext(fd, false);
+	if(!ctx) {
+		return false;
+	}
+	std::lock_guard<std::mutex> locker(ctx->mutex);
+	if(MYRIEL_UNLIKELY(!(ctx->events & event))) {
+		return false;
+	}
+	if(!updateEpoll(ctx, event)) {
+		return false;
+	}
+
+	ctx->triggerEvent(event);
+	--m_pendingEventCount;
+	return true;
+}
+
+bool IOManager::cancelAll(int fd) {
+	FdContext *ctx = getFdContext(fd, false);
+	if(!ctx) {
+		return false;
+	}
+	std::lock_guard<std::mutex> locker(ctx->mutex);
+	if(!ctx->events) {
+		return false;
+	}
+	if(!updateEpoll(ctx, ctx->events)) {
+		return false;
+	}
+
+	if(ctx->events & READ) {
+		ctx->triggerEvent(READ);
+		--m_pendingEventCount;
+	}
+	if(ctx->events & WRITE) {
+		ctx->triggerEvent(WRITE);
+		--m_pendingEventCount;
+	}
+	ASSERT(ctx->events == NONE);
+	return true;
+}
+
+IOManager *IOManager::GetThis() {
+	return dynamic_cast<IOManager *>(Scheduler::GetThis());
+}
+
+void IOManager::tickle() {
+	// 与prepareSleep中的登记配对，没有线程阻塞在epoll_wait时不必写eventfd
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(!hasSleeper()) {
+		return;
+	}
+	uint64_t one = 1;
+	ssize_t rt = write(m_eventfd, &one, sizeof(one));
+	ASSERT(rt == sizeof(one));
+}
+
+void IOManager::wakeThread(size_t index) {
+	// 调用方已经做过内存屏障并确认所属线程已登记休眠
+	uint64_t one = 1;
+	ssize_t rt = write(m_eventfd, &one, sizeof(one));
+	ASSERT(rt == sizeof(one));
+}
+
+bool IOManager::stopping() {
+	// 不经过getNextTimer，避免改动等待方已知的下一次处理时刻
+	return !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
+}
+
+bool IOManager::stopping(uint64_t &timeout) {
+	timeout = getNextTimer();
+	return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+}
+
+void IOManager::onTimerInsertedAtFront() {
+	tickle();
+}
+
+void IOManager::idle() {
+	std::unique_ptr<epoll_event[]> events(new epoll_event[s_max_events]);
+	std::vector<std::function<void()>> cbs;
+	// 上一次epoll_wait读过eventfd，这次唤醒可能是给别的线程的
+	bool woken = false;
+	while(true) {
+		if(tryRetire()) {
+			finishSleep();
+			return;
+		}
+		// 登记后回到调度循环再扫描一次任务队列，之后的tickle一定会写eventfd
+		if(!prepareSleep()) {
+			if(stopping()) {
+				break;
+			}
+			Fiber::GetThis()->yield();
+			continue;
+		}
+
+		if(passMailWake(woken)) {
+			// 叫醒的是别的线程信箱中的任务，把唤醒传给下一个线程；
+			// 每次唤醒只传一次，之后照常进入epoll_wait，不会反复空转
+			woken = false;
+			finishSleep();
+			tickle();
+			if(stopping()) {
+				break;
+			}
+			Fiber::GetThis()->yield();
+			continue;
+		}
+		woken = false;
+
+		// 登记之后再计算超时，之后插到最前面的定时器会tickle
+		uint64_t next_timeout = 0;
+		if(stopping(next_timeout)) {
+			break;
+		}
+		// 弹性线程最多等到可以退出的时刻
+		int timeout = (int)std::min<uint64_t>({next_timeout, getRetireTimeout(), (uint64_t)s_max_timeout_ms});
+		int rt = 0;
+		uint64_t park_begin = FiberTrace::NowNs();
+		do {
+			rt = epoll_wait(m_epfd, events.get(), s_max_events, timeout);
+		} while(rt < 0 && errno == EINTR);
+		recordPark(park_begin);
+		finishSleep();
+
+		listExpiredCb(cbs);
+		if(!cbs.empty()) {
+			schedule(cbs.begin(), cbs.end());
+			cbs.clear();
+		}
+
+		for(int i = 0; i < rt; ++i) {
+			epoll_event &event = events[i];
+			if(!event.data.ptr) {
+				// eventfd为边缘触发，读一次即清零
+				uint64_t value = 0;
+				while(read(m_eventfd, &value, sizeof(value)) > 0);
+				woken = true;
+				continue;
+			}
+
+			FdContext *ctx = (FdContext *)event.data.ptr;
+			std::lock_guard<std::mutex> locker(ctx->mutex);
+			// 出错或对端关闭时，已注册的读写事件都触发
+			if(event.events & (EPOLLERR | EPOLLHUP)) {
+				event.events |= (EPOLLIN | EPOLLOUT) & ctx->events;
+			}
+			int real_events = NONE;
+			if(event.events & EPOLLIN) {
+				real_events |= READ;
+			}
+			if(event.events & EPOLLOUT) {
+				real_events |= WRITE;
+			}
+			real_events &= ctx->events;
+			if(real_events == NONE) {
+				continue;
+			}
+
+			// 事件是一次性的，剩下的事件重新注册
+			if(!updateEpoll(ctx, (Event)real_events)) {
+				continue;
+			}
+			if(real_events & READ) {
+				ctx->triggerEvent(READ);
+				--m_pendingEventCount;
+			}
+			if(real_events & WRITE) {
+				ctx->triggerEvent(WRITE);
+				--m_pendingEventCount;
+			}
+		}
+
+		Fiber::GetThis()->yield();
+	}
+	finishSleep();
+	// 调度器可以结束了，依次叫醒阻塞在epoll_wait上的线程检查退出条件
+	tickle();
+}
+}
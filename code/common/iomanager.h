@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+#include "scheduler.h"
+#include "timer.h"
+
+namespace myriel {
+
+/**
+ * @brief 基于epoll的IO协程调度器
+ * @details 在Scheduler的基础上，空闲的调度线程阻塞在epoll_wait上，tickle通过eventfd
+ * 			唤醒；fd就绪时把注册的回调或协程放回调度器。事件均为边缘触发的一次性事件，
+ * 			触发或取消后需要重新注册。
+ * 			fd上下文按fd下标保存在分块的平铺数组中，查找只需两次下标运算，扩容时
+ * 			只追加新的块，已有上下文的地址不变，不需要加锁。
+ * 			同时是定时器管理器，epoll_wait最多等到下一个定时器需要处理的时刻。
+ */
+class IOManager : public Scheduler, public TimerManager {
+public:
+	using ptr = std::shared_ptr<IOManager>;
+
+	/**
+	 * @brief IO事件，与EPOLLIN/EPOLLOUT取值相同
+	 */
+	enum Event {
+		NONE	= 0x0,	// 无事件
+		READ	= 0x1,	// 读事件(EPOLLIN)
+		WRITE	= 0x4,	// 写事件(EPOLLOUT)
+	};
+
+	/**
+	 * @brief 创建IO调度器并启动
+	 *
+	 * @param threads 线程数
+	 * @param use_caller 是否将当前线程也作为调度线程
+	 * @param name 调度器名称
+	 */
+	IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+
+	~IOManager();
+
+	/**
+	 * @brief 注册事件
+	 * @attention 同一个fd上的同一种事件只能注册一次；cb为空时以当前协程作为回调，
+	 * 			  调用方随后需要yield让出
+	 *
+	 * @param fd 文件描述符
+	 * @param event 事件类型
+	 * @param cb 事件回调
+	 * @return 成功返回0，失败返回-1
+	 */
+	int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+
+	/**
+	 * @brief 删除事件，不触发回调
+	 *
+	 * @return 事件未注册时返回false
+	 */
+	bool delEvent(int fd, Event event);
+
+	/**
+	 * @brief 取消事件，存在时触发一次回调
+	 *
+	 * @return 事件未注册时返回false
+	 */
+	bool cancelEvent(int fd, Event event);
+
+	/**
+	 * @brief 取消fd上的所有事件，触发所有回调
+	 */
+	bool cancelAll(int fd);
+
+	/**
+	 * @brief 获取当前线程的IO调度器
+	 *
+	 * @return 当前调度器不是IOManager时返回nullptr
+	 */
+	static IOManager *GetThis();
+
+	/**
+	 * @brief 已注册且尚未触发的事件数
+	 */
+	size_t getPendingEventCount() const { return m_pendingEventCount; }
+
+protected:
+	void tickle() override;
+
+	/**
+	 * @brief 所有线程阻塞在同一个epoll上，无法只叫醒指定的线程
+	 * @details 写一次eventfd叫醒任意一个线程；醒来的不是所属线程时，它不再进入epoll_wait
+	 * 			并继续写eventfd，直到所属线程醒来，最多经过线程数次唤醒
+	 */
+	void wakeThread(size_t index) override;
+	bool stopping() override;
+	void idle() override;
+	void onTimerInsertedAtFront() override;
+
+	/**
+	 * @brief 判断是否可以停止，同时获取距离下一个定时器的时间
+	 * @details 还有定时器或未触发的事件时不能停止
+	 *
+	 * @param timeout 距离下一次需要处理定时器的毫秒数，没有定时器时为~0ull
+	 */
+	bool stopping(uint64_t &timeout);
+
+private:
+	/**
+	 * @brief 事件回调，协程/函数二选一
+	 */
+	struct EventContext {
+		Scheduler *scheduler = nullptr;		// 执行回调的调度器
+		Fiber::ptr fiber;					// 事件协程
+		std::function<void()> cb;			// 事件回调函数
+
+		bool empty() const { return !scheduler && !fiber && !cb; }
+		void reset() {
+			scheduler = nullptr;
+			fiber.reset();
+			cb = nullptr;
+		}
+	};
+
+	/**
+	 * @brief fd上下文
+	 */
+	struct FdContext {
+		EventContext &getEventContext(Event event);
+
+		/**
+		 * @brief 触发事件，把回调放回调度器并从已注册事件中移除，调用方持有mutex
+		 */
+		void triggerEvent(Event event);
+
+		EventContext read;				// 读事件回调
+		EventContext write;				// 写事件回调
+		int fd = 0;						// 文件描述符
+		Event events = NONE;			// 已注册的事件
+		std::mutex mutex;
+	};
+
+	/**
+	 * @brief 获取fd的上下文
+	 *
+	 * @param create 不存在时是否分配所在的块
+	 * @return fd越界或不存在时返回nullptr
+	 */
+	FdContext *getFdContext(int fd, bool create);
+
+	/**
+	 * @brief 从epoll中移除已注册事件中的event，调用方持有ctx->mutex
+	 */
+	bool updateEpoll(FdContext *ctx, Event event);
+
+private:
+	static constexpr size_t kFdChunkBits = 12;							// 每块4096个fd
+	static constexpr size_t kFdChunkSize = (size_t)1 << kFdChunkBits;
+	static constexpr size_t kFdMaxChunks = 1024;						// 最多支持4M个fd
+
+	int m_epfd = -1;											// epoll文件描述符
+	int m_eventfd = -1;											// tickle使用的eventfd
+	std::atomic<size_t> m_pendingEventCount{0};					// 等待触发的事件数
+	std::atomic<FdContext *> m_fdChunks[kFdMaxChunks] = {};		// fd上下文分块
+	std::mutex m_chunkMutex;									// 分配新块时加锁
+};
+}
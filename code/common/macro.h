@@ -15,6 +15,15 @@
 #define MYRIEL_UNLIKELY(x) (x)
 #endif
 
+/// 自旋等待时提示CPU降低功耗并让出流水线给同核的超线程
+#if defined(__x86_64__) || defined(__i386__)
+#define MYRIEL_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define MYRIEL_CPU_RELAX() asm volatile("yield" ::: "memory")
+#else
+#define MYRIEL_CPU_RELAX() ((void)0)
+#endif
+
 /// 断言宏封装
 #define ASSERT(x)                                                                \
     if (MYRIEL_UNLIKELY(!(x))) {                                                        \
@@ -0,0 +1,74 @@
+#include "parallel.h"
+
+namespace myriel {
+namespace detail {
+
+// 自动选取最小块大小时，每个线程最多分到的块数
+static const size_t s_auto_chunks_per_thread = 64;
+
+ForkJoin::ForkJoin(size_t total, size_t grain, size_t parts, Chunk chunk)
+	: m_total(total), m_grain(grain), m_parts(parts), m_chunk(std::move(chunk)),
+	  m_waiter(FiberWaiter::Create("fork_join")) {
+}
+
+void ForkJoin::Plan(size_t total, size_t &grain, size_t &parts) {
+	Scheduler *scheduler = Scheduler::GetThis();
+	size_t threads = scheduler ? scheduler->getThreadCount() : 1;
+	if(grain == 0) {
+		grain = std::max<size_t>(1, total / (threads * s_auto_chunks_per_thread));
+	}
+	parts = std::min(threads, (total + grain - 1) / grain);
+}
+
+bool ForkJoin::work() {
+	bool last = false;
+	size_t begin = 0;
+	size_t end = 0;
+	while(grab(begin, end)) {
+		try {
+			m_chunk(begin, end);
+		} catch(...) {
+			return fail(std::current_exception(), end - begin);
+		}
+		last = finish(end - begin);
+	}
+	return last;
+}
+
+bool ForkJoin::grab(size_t &begin, size_t &end) {
+	size_t next = m_next.load(std::memory_order_relaxed);
+	while(next < m_total) {
+		size_t rest = m_total - next;
+		size_t chunk = std::min(rest, std::max(m_grain, rest / (2 * m_parts)));
+		if(m_next.compare_exchange_weak(next, next + chunk, std::memory_order_relaxed)) {
+			begin = next;
+			end = next + chunk;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ForkJoin::fail(std::exception_ptr error, size_t n) {
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(!m_error) {
+			m_error = error;
+		}
+	}
+	// 还没分出去的部分不再执行，算作完成
+	size_t next = m_next.exchange(m_total, std::memory_order_relaxed);
+	return finish(n + (m_total - next));
+}
+
+void ForkJoin::join(bool last) {
+	if(!last) {
+		m_waiter->wait(false);
+	}
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if(m_error) {
+		std::rethrow_exception(m_error);
+	}
+}
+}
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "scheduler.h"
+#include "fiber_sync.h"
+
+namespace myriel {
+namespace detail {
+
+/**
+ * @brief 一次fork-join的共享状态
+ * @details 区间[0, total)按块分给调用方与若干个辅助任务。每次取块的大小为剩余量除以两倍
+ * 			参与者数，且不小于grain：开始时块大、取块次数少，接近结束时块小、各参与者差不多
+ * 			同时完成。辅助任务开始运行时区间可能已经分完，此时什么也不做直接返回，
+ * 			因此共享状态由调用方与各辅助任务共同持有。块函数也保存在共享状态中，
+ * 			辅助任务不引用调用方栈上的对象：调用方可能是共享栈协程，挂起后栈会被覆盖。
+ */
+class ForkJoin {
+public:
+	using ptr = std::shared_ptr<ForkJoin>;
+	using Chunk = std::function<void(size_t, size_t)>;
+
+	/**
+	 * @brief 在调用方的上下文中创建，join时挂起调用方
+	 *
+	 * @param total 区间长度
+	 * @param grain 最小块大小
+	 * @param parts 参与者数，包括调用方
+	 * @param chunk 以块的[begin, end)调用
+	 */
+	ForkJoin(size_t total, size_t grain, size_t parts, Chunk chunk);
+
+	/**
+	 * @brief 调度器线程数对应的参与者数与最小块大小
+	 * @details grain为0时按区间长度与线程数自动选取
+	 */
+	static void Plan(size_t total, size_t &grain, size_t &parts);
+
+	/**
+	 * @brief 不断取块执行，直到区间分完
+	 * @details 块抛出异常时记录第一个异常，剩下未分出的部分不再执行
+	 *
+	 * @return 本次调用是否完成了最后一块
+	 */
+	bool work();
+
+	/**
+	 * @brief 辅助任务执行，完成最后一块时唤醒调用方
+	 */
+	void help() {
+		if(work()) {
+			m_waiter->fire();
+		}
+	}
+
+	/**
+	 * @brief 调用方等待其它参与者执行完已取走的块，有块抛出异常时重新抛出
+	 * @details 等待时挂起调用方协程而不阻塞调度线程，不响应取消：返回前辅助任务可能
+	 * 			还在执行块，访问块函数引用的对象
+	 *
+	 * @param last 调用方自己是否完成了最后一块
+	 */
+	void join(bool last);
+
+private:
+	bool grab(size_t &begin, size_t &end);
+
+	/**
+	 * @brief 记录完成的长度
+	 *
+	 * @return 是否全部完成
+	 */
+	bool finish(size_t n) {
+		return m_done.fetch_add(n, std::memory_order_acq_rel) + n == m_total;
+	}
+
+	bool fail(std::exception_ptr error, size_t n);
+
+private:
+	size_t m_total;							// 区间长度
+	size_t m_grain;							// 最小块大小
+	size_t m_parts;							// 参与者数
+	std::atomic<size_t> m_next{0};			// 下一块的起点
+	std::atomic<size_t> m_done{0};			// 已完成(或因异常放弃)的长度
+	Chunk m_chunk;							// 块函数
+	FiberWaiter::ptr m_waiter;				// 调用方
+	std::mutex m_mutex;
+	std::exception_ptr m_error;				// 第一个异常，m_mutex保护
+};
+
+/**
+ * @brief 把[0, total)分块交给当前调度器的各线程执行，调用方也参与执行
+ * @details 不在调度器中或只有一个调度线程时直接在调用方执行
+ */
+inline void ForkJoinRun(size_t total, size_t grain, ForkJoin::Chunk chunk) {
+	size_t parts = 0;
+	ForkJoin::Plan(total, grain, parts);
+	if(parts <= 1) {
+		if(total > 0) {
+			chunk(0, total);
+		}
+		return;
+	}
+	ForkJoin::ptr job = std::make_shared<ForkJoin>(total, grain, parts, std::move(chunk));
+	Scheduler *scheduler = Scheduler::GetThis();
+	for(size_t i = 1; i < parts; ++i) {
+		// 辅助任务取不到块时不会调用块函数，调用方返回后才开始运行也是安全的
+		scheduler->schedule([job]() { job->help(); });
+	}
+	job->join(job->work());
+}
+}
+
+/**
+ * @brief 在当前调度器的各线程上并行执行fn(b, e)，[b, e)为[begin, end)中的一块
+ * @details 调用方协程参与执行，之后等待其它线程上的块完成时挂起而不阻塞调度线程。
+ * 			块的大小随剩余量递减，不小于grain；grain为0时按区间长度与线程数自动选取。
+ * 			fn抛出异常时未开始的块不再执行，等已开始的块结束后在调用方重新抛出第一个异常。
+ * 			不在调度器中调用时在当前线程串行执行。
+ * @attention 在共享栈协程中调用时，fn不能引用调用方栈上的对象，调用方挂起期间栈会被覆盖
+ *
+ * @param begin 区间起点
+ * @param end 区间终点，不包含
+ * @param fn 以块的起止调用，可能在多个线程上同时调用
+ * @param grain 最小块大小
+ */
+template<class Index, class F>
+void ParallelFor(Index begin, Index end, F fn, size_t grain = 0) {
+	static_assert(std::is_integral<Index>::value, "ParallelFor needs an integral index");
+	if(end <= begin) {
+		return;
+	}
+	detail::ForkJoinRun((size_t)(end - begin), grain, [begin, fn = std::move(fn)](size_t b, size_t e) mutable {
+		fn((Index)(begin + b), (Index)(begin + e));
+	});
+}
+
+/**
+ * @brief 并行归约：各块的结果map(b, e)用reduce合并到identity上
+ * @details 分块与调度同ParallelFor。块的结果按完成顺序合并，reduce需要满足结合律与交换律
+ *
+ * @param identity 初值，也是空区间的结果
+ * @param map 以块的起止调用，返回该块的结果
+ * @param reduce 合并两个结果
+ */
+template<class Index, class T, class Map, class Reduce>
+T ParallelReduce(Index begin, Index end, T identity, Map map, Reduce reduce, size_t grain = 0) {
+	static_assert(std::is_integral<Index>::value, "ParallelReduce needs an integral index");
+	if(end <= begin) {
+		return identity;
+	}
+	// 归约结果放在堆上，辅助任务不引用调用方栈上的对象
+	struct State {
+		explicit State(T init) : result(std::move(init)) {}
+		T result;
+		std::mutex mutex;
+	};
+	std::shared_ptr<State> state = std::make_shared<State>(std::move(identity));
+	detail::ForkJoinRun((size_t)(end - begin), grain,
+		[begin, state, map = std::move(map), reduce = std::move(reduce)](size_t b, size_t e) mutable {
+			T part = map((Index)(begin + b), (Index)(begin + e));
+			std::lock_guard<std::mutex> locker(state->mutex);
+			state->result = reduce(std::move(state->result), std::move(part));
+		});
+	return std::move(state->result);
+}
+
+/**
+ * @brief 并行排序，不稳定
+ * @details 先把区间分成若干段并行排序，再逐轮并行地两两归并。
+ * 			元素数不超过grain时直接std::sort，grain为0时取默认值
+ *
+ * @param first 随机访问迭代器
+ * @param last 随机访问迭代器
+ * @param comp 比较函数
+ */
+template<class RandomIt, class Compare>
+void ParallelSort(RandomIt first, RandomIt last, Compare comp, size_t grain = 0) {
+	// 每段至少这么多元素，归并的开销才能被并行排序省下的时间抵消
+	static const size_t s_sort_grain = 4096;
+	size_t n = last - first;
+	if(grain == 0) {
+		grain = s_sort_grain;
+	}
+	size_t parts = 0;
+	size_t block_grain = grain;
+	detail::ForkJoin::Plan(n, block_grain, parts);
+	if(n <= grain || parts <= 1) {
+		std::sort(first, last, comp);
+		return;
+	}
+	// 每个线程两段，先排完的线程可以接着排别的段
+	size_t blocks = std::min(parts * 2, (n + grain - 1) / grain);
+	std::vector<size_t> bounds(blocks + 1);
+	for(size_t i = 0; i <= blocks; ++i) {
+		bounds[i] = n * i / blocks;
+	}
+	// 块函数按值捕获，调用方可能是共享栈协程
+	ParallelFor((size_t)0, blocks, [first, comp, bounds](size_t b, size_t e) {
+		for(size_t i = b; i < e; ++i) {
+			std::sort(first + bounds[i], first + bounds[i + 1], comp);
+		}
+	}, 1);
+	// 每轮把相邻两段归并为一段
+	for(size_t width = 1; width < blocks; width *= 2) {
+		size_t pairs = (blocks + 2 * width - 1) / (2 * width);
+		ParallelFor((size_t)0, pairs, [first, comp, bounds, width, blocks](size_t b, size_t e) {
+			for(size_t i = b; i < e; ++i) {
+				size_t lo = i * 2 * width;
+				size_t mid = std::min(lo + width, blocks);
+				size_t hi = std::min(lo + 2 * width, blocks);
+				if(mid < hi) {
+					std::inplace_merge(first + bounds[lo], first + bounds[mid], first + bounds[hi], comp);
+				}
+			}
+		}, 1);
+	}
+}
+
+template<class RandomIt>
+void ParallelSort(RandomIt first, RandomIt last) {
+	ParallelSort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+}
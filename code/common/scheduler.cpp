@@ -1,20 +1,259 @@
 #include "scheduler.h"
 #include "log.h"
 #include "utils.h"
+#include "macro.h"
+#include "config.h"
+#include "work_stealing_queue.h"
+#include "hook.h"
+#include "affinity.h"
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <sstream>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace myriel {
 static Logger::ptr g_logger = LOG_ROOT();
 
+static ConfigVar<bool>::ptr g_scheduler_work_stealing =
+	Config::Lookup("scheduler.work_stealing", false, "use per-thread work stealing queues");
+
+static ConfigVar<bool>::ptr g_scheduler_mailbox =
+	Config::Lookup("scheduler.mailbox", true, "put tasks pinned to a thread into that thread's own mailbox");
+
+static ConfigVar<bool>::ptr g_scheduler_hook =
+	Config::Lookup("scheduler.hook", false, "hook blocking syscalls in scheduler threads");
+
+static ConfigVar<std::string>::ptr g_scheduler_cpu_affinity =
+	Config::Lookup("scheduler.cpu_affinity", std::string(""), "cpu list scheduler threads are pinned to, e.g. 0-3,8");
+
+static ConfigVar<std::string>::ptr g_scheduler_priority_policy =
+	Config::Lookup("scheduler.priority_policy", std::string("weighted"), "dispatch across priority levels: weighted/strict");
+
+static ConfigVar<std::vector<uint32_t>>::ptr g_scheduler_priority_weights =
+	Config::Lookup("scheduler.priority_weights", std::vector<uint32_t>{16, 4, 1}, "weights of high/normal/low in weighted dispatch");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_priority_starvation_limit =
+	Config::Lookup("scheduler.priority_starvation_limit", (uint32_t)64,
+				   "in strict dispatch, times a lower level may be passed over before it runs once");
+
+static ConfigVar<bool>::ptr g_scheduler_queue_wait_stats =
+	Config::Lookup("scheduler.queue_wait_stats", false, "record per priority queue wait time");
+
+static ConfigVar<bool>::ptr g_scheduler_run_time_stats =
+	Config::Lookup("scheduler.run_time_stats", false, "record how long each task runs before switching out");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_elastic_max_threads =
+	Config::Lookup("scheduler.elastic.max_threads", (uint32_t)0,
+				   "upper bound of scheduler threads when growing with load, 0 keeps the pool fixed");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_elastic_grow_latency_us =
+	Config::Lookup("scheduler.elastic.grow_latency_us", (uint32_t)2000,
+				   "queue wait that, once sustained, adds a spare scheduler thread");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_elastic_retire_idle_ms =
+	Config::Lookup("scheduler.elastic.retire_idle_ms", (uint32_t)10000,
+				   "idle time after which a spare scheduler thread exits");
+
+static ConfigVar<std::string>::ptr g_scheduler_numa_policy =
+	Config::Lookup("scheduler.numa_policy", std::string("none"), "placement of scheduler threads across numa nodes: none/spread/pack");
+
+/**
+ * @brief 工作窃取模式下每个调度线程的任务队列
+ */
+class SchedulerWorker {
+public:
+	explicit SchedulerWorker(Scheduler *owner, size_t index)
+		: owner(owner), rand(0x9E3779B9u * (uint32_t)(index + 1)) {}
+
+	~SchedulerWorker() {
+		while(Scheduler::SchedulerTask *item = queue.take()) {
+			delete item;
+		}
+	}
+
+	/**
+	 * @brief xorshift随机数，用于选择窃取的起点
+	 */
+	uint32_t nextRandom() {
+		rand ^= rand << 13;
+		rand ^= rand >> 17;
+		rand ^= rand << 5;
+		return rand;
+	}
+
+	Scheduler *owner;									// 所属调度器
+	WorkStealingQueue<Scheduler::SchedulerTask> queue;	// 任务队列
+	uint32_t rand;										// 随机数状态
+};
+
+/**
+ * @brief 调度线程的信箱，存放指定在该线程运行的任务
+ */
+class alignas(64) SchedulerMailbox {
+public:
+	explicit SchedulerMailbox(size_t index)
+		: index(index) {}
+
+	size_t index;									// 所属调度线程的下标
+	std::atomic<std::thread::id> owner;				// 所属调度线程，线程启动时写入，弹性线程的槽位复用时改写
+	std::mutex mutex;
+	std::list<Scheduler::SchedulerTask> tasks;		// 指定在该线程运行的任务
+	bool closed = false;							// 所属的弹性线程已退出，mutex保护
+	std::atomic<size_t> size{0};					// 任务数，据此免锁判空
+	std::atomic<bool> parked{false};				// 所属线程是否已登记休眠
+	std::atomic<bool> notified{false};				// 休眠后已为信箱中的任务发出过唤醒，所属线程醒来时清除
+};
+
+/**
+ * @brief 调度线程的运行指标，只由所属线程写入
+ */
+class alignas(64) SchedulerThreadMetrics {
+public:
+	std::atomic<uint64_t> executed{0};
+	std::atomic<uint64_t> stolen{0};
+	std::atomic<uint64_t> parks{0};
+	std::atomic<uint64_t> parkNs{0};
+	std::atomic<uint64_t> idleNs{0};
+	std::atomic<uint64_t> runNs{0};
+	std::atomic<uint64_t> runMaxNs{0};
+	std::atomic<uint64_t> runBuckets[Scheduler::QueueWaitStats::kBuckets] = {};
+};
+
+/**
+ * @brief 单写者计数器加n，不需要原子的读改写，读取方仍能看到完整的值
+ */
+static inline void Bump(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 时间所在的直方图桶，桶i为[2^i, 2^(i+1))纳秒
+ */
+static inline int HistogramBucket(uint64_t ns) {
+	int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+	return std::min(bucket, Scheduler::QueueWaitStats::kBuckets - 1);
+}
+
+// 全局队列中的任务每次最多搬多少个到本线程的队列
+static const size_t s_list_batch = 32;
+// 每执行多少个本地任务检查一次全局队列，避免其中的任务饿死
+static const uint32_t s_list_check_interval = 61;
+
+// 空转重扫队列的轮数上下限
+static const uint32_t s_idle_spin_min = 2;
+static const uint32_t s_idle_spin_max = 64;
+
+/**
+ * @brief 调度线程的空闲状态
+ */
+struct IdleState {
+	uint32_t spins = 0;							// 本次空闲已空转的轮数
+	uint32_t spinLimit = s_idle_spin_max;		// 休眠前最多空转的轮数，空转等到任务时加倍，否则减半
+	bool registered = false;					// 是否已登记休眠
+	uint32_t seq = 0;							// 登记时的唤醒序号
+	uint64_t idleSinceNs = 0;					// 上次执行完任务后进入idle的时刻，拿到任务时清零
+};
+
+// 监视线程的采样间隔上下限
+static const uint64_t s_monitor_interval_min_ns = 1000 * 1000;
+static const uint64_t s_monitor_interval_max_ns = 100 * 1000 * 1000;
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+
+/**
+ * @brief 值仍为expected时休眠，直到被掩码有交集的FutexWake唤醒
+ *
+ * @param bitset 等待方的掩码，定向唤醒时只叫醒掩码相交的线程
+ * @param deadline_ns CLOCK_MONOTONIC下的绝对超时时刻，0表示不超时
+ */
+static void FutexWait(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t bitset, uint64_t deadline_ns = 0) {
+	struct timespec deadline;
+	deadline.tv_sec = deadline_ns / 1000000000;
+	deadline.tv_nsec = deadline_ns % 1000000000;
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT_BITSET_PRIVATE, expected,
+			deadline_ns ? &deadline : nullptr, nullptr, bitset);
+}
+
+static void FutexWake(std::atomic<uint32_t> *addr, int count, uint32_t bitset = FUTEX_BITSET_MATCH_ANY) {
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE_BITSET_PRIVATE, count, nullptr, nullptr, bitset);
+}
+
+/**
+ * @brief 调度线程在futex上等待时的掩码，超过32个线程时循环复用
+ */
+static inline uint32_t ThreadBit(size_t index) {
+	return 1u << (index % 32);
+}
+
 // 当前线程的调度器，同一个调度器下的所有线程指向同一个调度器实例
 static thread_local Scheduler *t_scheduler = nullptr;
 // 当前线程的调度协程，每个线程都独有一份，包括caller线程
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+// 工作窃取模式下当前调度线程的队列
+static thread_local SchedulerWorker *t_worker = nullptr;
+// 当前调度线程的信箱
+static thread_local SchedulerMailbox *t_mailbox = nullptr;
+// 当前调度线程的运行指标
+static thread_local SchedulerThreadMetrics *t_metrics = nullptr;
+// 当前调度线程的空闲状态
+static thread_local IdleState t_idle;
+// 当前线程是否为弹性线程
+static thread_local bool t_spare = false;
+
+/**
+ * @brief 调度线程在各优先级之间分配的状态
+ */
+struct DispatchState {
+	int64_t current[Scheduler::kPriorityLevels] = {};	// 加权轮询的当前权重
+	uint32_t passed[Scheduler::kPriorityLevels] = {};	// 严格优先级下有任务却被跳过的次数
+};
+static thread_local DispatchState t_dispatch;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const::std::string &name) : m_name(name) {
 	assert(threads > 0);
 	m_useCaller = use_caller;
+	m_workStealing = g_scheduler_work_stealing->getValue();
+	m_useMailbox = g_scheduler_mailbox->getValue();
+	m_hookEnable = g_scheduler_hook->getValue();
+	if(!CpuTopology::ParseCpuList(g_scheduler_cpu_affinity->getValue(), m_cpus)) {
+		LOG_ERROR(g_logger) << "invalid scheduler.cpu_affinity=" << g_scheduler_cpu_affinity->getValue();
+		m_cpus.clear();
+	}
+	if(!NumaPolicyFromString(g_scheduler_numa_policy->getValue(), m_numaPolicy)) {
+		LOG_ERROR(g_logger) << "invalid scheduler.numa_policy=" << g_scheduler_numa_policy->getValue();
+		m_numaPolicy = NumaPolicy::NONE;
+	}
+	const std::string &priority_policy = g_scheduler_priority_policy->getValue();
+	if(priority_policy == "strict") {
+		m_strictPriority = true;
+	} else if(priority_policy != "weighted") {
+		LOG_ERROR(g_logger) << "invalid scheduler.priority_policy=" << priority_policy;
+	}
+	const std::vector<uint32_t> &weights = g_scheduler_priority_weights->getValue();
+	if(weights.size() == kPriorityLevels && std::count(weights.begin(), weights.end(), 0u) == 0) {
+		std::copy(weights.begin(), weights.end(), m_priorityWeights);
+	} else {
+		LOG_ERROR(g_logger) << "invalid scheduler.priority_weights, need " << kPriorityLevels << " positive weights";
+	}
+	m_starvationLimit = std::max<uint32_t>(g_scheduler_priority_starvation_limit->getValue(), 1);
+	m_queueWaitStats = g_scheduler_queue_wait_stats->getValue();
+	m_runTimeStats = g_scheduler_run_time_stats->getValue();
+	size_t max_threads = g_scheduler_elastic_max_threads->getValue();
+	if(max_threads > threads) {
+		m_elastic = true;
+		m_maxSpares = max_threads - threads;
+		m_growLatencyNs = (uint64_t)g_scheduler_elastic_grow_latency_us->getValue() * 1000;
+		m_retireIdleNs = (uint64_t)g_scheduler_elastic_retire_idle_ms->getValue() * 1000 * 1000;
+		if(!m_useMailbox) {
+			// 弹性线程退出前要确认没有指定给它的任务，这些任务需要在它自己的信箱里
+			LOG_WRAN(g_logger) << "scheduler.elastic needs scheduler.mailbox, enabling it for " << name;
+			m_useMailbox = true;
+		}
+	}
 
 	if (use_caller) {
 		// 创建协程
@@ -61,14 +300,61 @@ void Scheduler::start() {
 	if(!m_stopping) {
 		return;
 	}
+	m_stopping = false;
 
 	assert(m_threads.empty());
 
+	// 下标依次为各调度线程、caller线程、弹性线程的槽位
+	m_spareBase = m_threadCount + (m_rootFiber ? 1 : 0);
+	size_t slots = m_spareBase + m_maxSpares;
+	if(m_workStealing) {
+		// 调度线程的队列由各线程绑定CPU后自己分配，落在本地节点上；
+		// caller线程在stop中才进入run，弹性线程随时启停，它们的队列在这里建好
+		m_workers.clear();
+		m_workers.resize(slots);
+		for(size_t i = m_threadCount; i < slots; ++i) {
+			m_workers[i].reset(new SchedulerWorker(this, i));
+		}
+	}
+	m_threadMetrics.clear();
+	for(size_t i = 0; i < slots; ++i) {
+		m_threadMetrics.emplace_back(new SchedulerThreadMetrics());
+	}
+	m_mailboxes.clear();
+	if(m_useMailbox) {
+		// 调度线程启动时写入自己的线程ID，caller线程的在这里写入；弹性线程启动前信箱是关闭的
+		for(size_t i = 0; i < slots; ++i) {
+			m_mailboxes.emplace_back(new SchedulerMailbox(i));
+			m_mailboxes.back()->closed = i >= m_spareBase;
+		}
+		if(m_rootFiber) {
+			m_mailboxes[m_threadCount]->owner = m_rootThread;
+		}
+	}
+	m_nextWorker = 0;
+	m_readyThreads = 0;
+	m_spareCount = 0;
+	m_maxWaitNs = 0;
+
 	m_threads.resize(m_threadCount);
 	for (size_t i = 0; i < m_threadCount; ++i) {
 		m_threads[i] = std::move(std::thread(std::bind(&Scheduler::run, this)));
 		m_threadIds.push_back(m_threads[i].get_id());
 	}
+	while(m_readyThreads < m_threadCount) {
+		std::this_thread::yield();
+	}
+
+	if(m_elastic) {
+		m_spareThreads.clear();
+		m_spareThreads.resize(m_maxSpares);
+		m_spareExited.reset(new std::atomic<bool>[m_maxSpares]);
+		for(size_t i = 0; i < m_maxSpares; ++i) {
+			m_spareExited[i] = false;
+		}
+		m_monitorStop = false;
+		m_monitor = std::thread(std::bind(&Scheduler::monitor, this));
+	}
 }
 
 void Scheduler::stop() {
@@ -79,6 +365,16 @@ void Scheduler::stop() {
 	}
 	m_stopping = true;
 
+	if(m_monitor.joinable()) {
+		// 先停监视线程，之后不会再启动弹性线程
+		{
+			std::lock_guard<std::mutex> locker(m_monitorMutex);
+			m_monitorStop = true;
+		}
+		m_monitorCond.notify_one();
+		m_monitor.join();
+	}
+
 	if(m_useCaller) {
 		assert(GetThis() == this);
 	} else {
@@ -89,11 +385,6 @@ void Scheduler::stop() {
 		tickle();
 	}
 
-	if(m_rootFiber) {
-		// SERVER_LOG_DEBUG(g_logger) << "scheduler::m_rootFiber";
-		tickle();
-	}
-
 	if(m_rootFiber) {
 		// LOG_DEBUG(g_logger) << "m_rootFiber resume";
 		m_rootFiber->resume();
@@ -109,6 +400,11 @@ void Scheduler::stop() {
     for(auto& i : thrs) {
         i.join();
     }
+	for(auto &i : m_spareThreads) {
+		if(i.joinable()) {
+			i.join();
+		}
+	}
 }
 
 void Scheduler::setThis() {
@@ -123,79 +419,180 @@ void Scheduler::setThis() {
  * 		2. 无任务执行，执行idle
  */
 void Scheduler::run() {
+	// 启动时创建的线程依次编号，caller线程排在它们之后
+	runThread(std::this_thread::get_id() == m_rootThread ? m_threadCount : m_nextWorker++, false);
+}
+
+void Scheduler::runThread(size_t index, bool spare) {
 	// SERVER_LOG_DEBUG(g_logger) << m_name << " Scheduler::run()";
 	// server::Fiber::EnableFiber();
-	// set_hook_enable(true);
+	// caller线程在stop中进入调度，退出后恢复原来的设置
+	bool hook_enable = is_hook_enable();
+	set_hook_enable(m_hookEnable);
 	setThis();
 	if(std::this_thread::get_id() != m_rootThread) {
 		t_scheduler_fiber = Fiber::GetThis().get();
 	}
 
+	FiberTrace::SetThreadName(m_name);
+	SchedulerWorker *worker = nullptr;
+	t_spare = spare;
+	if(spare) {
+		if(!m_cpus.empty() || m_numaPolicy != NumaPolicy::NONE) {
+			SetThreadAffinity(CpuTopology::Get().placeThread(m_cpus, m_numaPolicy, index));
+		}
+		// 信箱写入新的主人后再打开，之前按线程ID找到它的任务改为不指定线程
+		SchedulerMailbox *mailbox = m_mailboxes[index].get();
+		{
+			std::lock_guard<std::mutex> locker(mailbox->mutex);
+			mailbox->owner = std::this_thread::get_id();
+			mailbox->closed = false;
+		}
+		// 线程ID复用了已退出的弹性线程，指定给它的任务从此进入本线程的信箱
+		std::lock_guard<std::mutex> locker(m_retiredMutex);
+		std::replace(m_retiredThreads.begin(), m_retiredThreads.end(),
+					 std::this_thread::get_id(), std::thread::id());
+	} else if(std::this_thread::get_id() != m_rootThread) {
+		// 先绑定CPU，之后本线程分配的内存按首次访问落在所在节点上
+		if(!m_cpus.empty() || m_numaPolicy != NumaPolicy::NONE) {
+			SetThreadAffinity(CpuTopology::Get().placeThread(m_cpus, m_numaPolicy, index));
+		}
+		if(m_workStealing) {
+			m_workers[index].reset(new SchedulerWorker(this, index));
+		}
+		if(m_useMailbox) {
+			m_mailboxes[index]->owner = std::this_thread::get_id();
+		}
+		// 所有线程的队列都建好之后才能互相窃取，信箱都有了主人之后才能按线程ID查找
+		++m_readyThreads;
+		while(m_readyThreads < m_threadCount) {
+			std::this_thread::yield();
+		}
+	}
+	if(m_workStealing) {
+		ASSERT(index < m_workers.size());
+		worker = m_workers[index].get();
+		t_worker = worker;
+	}
+	SchedulerMailbox *mailbox = nullptr;
+	if(m_useMailbox) {
+		ASSERT(index < m_mailboxes.size());
+		mailbox = m_mailboxes[index].get();
+		t_mailbox = mailbox;
+	}
+	SchedulerThreadMetrics *metrics = m_threadMetrics[index].get();
+	t_metrics = metrics;
+	uint32_t tick = 0;
+	uint32_t mail_tick = 0;
+	t_idle = IdleState();
+	t_dispatch = DispatchState();
+
 	Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
+	// idle协程空转时会产生大量无意义的切换事件
+	idle_fiber->setTraced(false);
 	Fiber::ptr cb_fiber;
 
 	SchedulerTask task;
 	while(true) {
 		task.reset();
 		bool tickle_me = false;		// 是否tickle其它线程进行任务调度
-		{
-			// LOG_INFO(g_logger) << "begin while";
-			std::lock_guard<std::mutex> locker(m_mutex);
-			auto it = m_tasks.begin();
-			// 遍历所有调度任务
-			while(it != m_tasks.end()) {
-				// 任务指定了线程，且不在当前线程
-				if(it->thread != std::thread::id() && it->thread != std::this_thread::get_id()) {
-					// 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其它线程进行调度
-					// 然后跳过这个任务，继续下一个
-					// LOG_INFO(g_logger) << "tickle other thread";
-					++it;
-					tickle_me = true;
-					continue;
-				}
-
-				// 任务未指定线程或者指定了当前线程
-				assert(it->fiber || it->cb);
-				if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-					// LOG_INFO(g_logger) << "current or no thread m_task size: " << m_tasks.size();
-					++it;
-					continue;
+		bool busy = false;			// 信箱中有还在其它线程上切出的协程
+		bool found = false;
+		int level = (int)Priority::NORMAL;
+		// 指定了线程的任务大多是被唤醒的协程，先于其它任务执行；
+		// 每隔一段时间放到最后，避免信箱源源不断时其它队列饿死
+		bool mail_first = mailbox && ++mail_tick % s_list_check_interval != 0;
+		if(mail_first) {
+			found = takeMailbox(mailbox, task, busy);
+		}
+		if(!found && hasPriorityTasks()) {
+			level = pickLevel();
+			if(level != (int)Priority::NORMAL) {
+				found = takeFromList(level, task, tickle_me);
+			}
+		}
+		if(!found) {
+			if(worker && ++tick % s_list_check_interval != 0) {
+				found = takeLocal(worker, task);
+			}
+			if(!found) {
+				found = takeFromList((int)Priority::NORMAL, task, tickle_me);
+			}
+			if(!found && worker) {
+				found = takeLocal(worker, task) || stealTask(worker, task);
+			}
+		}
+		if(!found && hasPriorityTasks()) {
+			// 选中的优先级没有可运行的任务，依次看其它优先级
+			for(int i : {(int)Priority::HIGH, (int)Priority::LOW}) {
+				if(i != level && takeFromList(i, task, tickle_me)) {
+					found = true;
+					break;
 				}
-
-				// 取出该任务
-				task = *it;
-				m_tasks.erase(it++);
-				// LOG_DEBUG(g_logger) << "m_task.size() after erase: " << m_tasks.size();
-				// 增加活跃线程数
-				++m_activeThreadCount;
-				break;
 			}
-			tickle_me |= (it != m_tasks.end());
-			// LOG_DEBUG(g_logger) << "m_task.empty(): " << m_tasks.empty();
+		}
+		if(!found && mailbox && !mail_first) {
+			found = takeMailbox(mailbox, task, busy);
+		}
+
+		if(found) {
+			leaveIdle();
+		} else if(busy) {
+			// 协程切出后不会再有人唤醒本线程，撤销休眠登记，继续空转等它切出
+			finishSleep();
 		}
 
 		// 通知其他线程，有任务了
-		if(tickle_me) {
+		// 准备休眠的线程重扫时看到的只会是其它线程的任务，此时再tickle会把自己也叫醒，
+		// 这些任务在入队时已经tickle过，被叫醒而无法执行的线程会在登记休眠前继续传递
+		if(tickle_me && !t_idle.registered) {
 			tickle();
 		}
 
+		if(MYRIEL_UNLIKELY(task.enqueueNs != 0)) {
+			recordQueueWait(task);
+		}
+		uint64_t run_begin = found && MYRIEL_UNLIKELY(m_runTimeStats) ? FiberTrace::NowNs() : 0;
+
 		// 该任务协程存在且协程状态不为结束和异常
 		if(task.fiber) {			
 			// 保存调度协程上下文，并切换到当前协程ft的上下文
 			task.fiber->resume();
 			--m_activeThreadCount;
+			recordRun(metrics, run_begin, task.fiber.get());
+			task.reset();
+		} else if(task.handle) {
+			// 无栈协程没有自己的栈，直接在调度协程上恢复，挂起时返回这里
+			std::coroutine_handle<> handle = task.handle;
 			task.reset();
+			bool traced = FiberTrace::IsEnabled();
+			if(MYRIEL_UNLIKELY(traced)) {
+				FiberTrace::SwitchIn(0);
+			}
+			handle.resume();
+			if(MYRIEL_UNLIKELY(traced)) {
+				FiberTrace::SwitchOut(0);
+			}
+			--m_activeThreadCount;
+			recordRun(metrics, run_begin, nullptr);
 		} else if(task.cb) {
-			// 若为任务函数，则初始化任务协程
+			// 若为任务函数，则初始化任务协程；上一个回调已经执行完的协程直接复用，
+			// 省去每个回调一次的协程对象与栈的申请释放
 			if(cb_fiber) {
-				cb_fiber->reset(task.cb);
+				cb_fiber->reset(std::move(task.cb));
 			} else {
-				cb_fiber.reset(new Fiber(task.cb));
+				cb_fiber.reset(new Fiber(std::move(task.cb)));
 			}
+			cb_fiber->setCancelToken(std::move(task.cancel));
+			cb_fiber->setPriority(task.priority);
 			task.reset();
 			cb_fiber->resume();
 			--m_activeThreadCount;
-			cb_fiber.reset();
+			recordRun(metrics, run_begin, cb_fiber.get());
+			// 回调让出时协程已经交给了唤醒方，抛出异常时没有结束，这两种情况都不能复用
+			if(cb_fiber->getState() != Fiber::TERM || cb_fiber.use_count() != 1) {
+				cb_fiber.reset();
+			}
 		} else {
 			// 若都不是，即没有任务，则运行idle协程
 			if(idle_fiber->getState() == Fiber::TERM) {
@@ -204,30 +601,717 @@ void Scheduler::run() {
 			}
 
 			++m_idleThreadCount;
+			uint64_t idle_begin = FiberTrace::NowNs();
+			if(t_idle.idleSinceNs == 0) {
+				t_idle.idleSinceNs = idle_begin;
+			}
 			// LOG_DEBUG(g_logger) << "Scheduler::idle_fiber resume";
 			idle_fiber->resume();		// 这里直接析构，程序结束了
 			// LOG_DEBUG(g_logger) << "Scheduler::idle_fiber resume after";
+			Bump(metrics->idleNs, FiberTrace::NowNs() - idle_begin);
 			--m_idleThreadCount;
 		}
 	}
+	if(spare) {
+		if(worker) {
+			// 退出前本线程队列中剩下的任务交还全局队列
+			size_t moved = 0;
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				while(SchedulerTask *item = worker->queue.take()) {
+					scheduleNoLock(*item);
+					m_localTasks.fetch_sub(1, std::memory_order_relaxed);
+					delete item;
+					++moved;
+				}
+			}
+			for(size_t i = 0; i < moved && i < m_threadCount + 1; ++i) {
+				tickle();
+			}
+		}
+		--m_spareCount;
+		m_spareExited[index - m_spareBase].store(true, std::memory_order_release);
+	}
+	t_worker = nullptr;
+	t_mailbox = nullptr;
+	t_metrics = nullptr;
+	t_spare = false;
+	set_hook_enable(hook_enable);
 	// LOG_DEBUG(g_logger) << "Scheduler::run() exit";
 }
 
+bool Scheduler::takeFromList(int level, SchedulerTask &task, bool &tickle_me) {
+	// 入队后一定会tickle，这里漏看的任务会在休眠前的重扫中看到
+	if(m_listSize[level].load(std::memory_order_relaxed) == 0) {
+		return false;
+	}
+	SchedulerWorker *worker = m_workStealing && level == (int)Priority::NORMAL ? t_worker : nullptr;
+	bool found = false;
+	// LOG_INFO(g_logger) << "begin while";
+	std::lock_guard<std::mutex> locker(m_mutex);
+	std::list<SchedulerTask> &tasks = m_tasks[level];
+	// 顺便搬到本线程队列的任务数，留一部分给其它线程
+	size_t batch = worker ? std::min(s_list_batch, tasks.size() / m_workers.size()) : 0;
+	auto it = tasks.begin();
+	// 遍历所有调度任务
+	while(it != tasks.end()) {
+		// 任务指定了线程，且不在当前线程
+		if(it->thread != std::thread::id() && it->thread != std::this_thread::get_id()) {
+			// 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其它线程进行调度
+			// 然后跳过这个任务，继续下一个
+			// LOG_INFO(g_logger) << "tickle other thread";
+			++it;
+			tickle_me = true;
+			continue;
+		}
+
+		// 任务未指定线程或者指定了当前线程
+		assert(it->fiber || it->cb || it->handle);
+		if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+			// LOG_INFO(g_logger) << "current or no thread m_task size: " << tasks.size();
+			++it;
+			continue;
+		}
+
+		if(found) {
+			// 只搬未指定线程的任务，它们可能被其它线程窃取
+			if(it->thread == std::thread::id()) {
+				m_localTasks.fetch_add(1, std::memory_order_relaxed);
+				worker->queue.push(new SchedulerTask(std::move(*it)));
+				tasks.erase(it++);
+				m_listSize[level].fetch_sub(1, std::memory_order_relaxed);
+				--batch;
+			} else {
+				++it;
+			}
+			if(batch == 0) {
+				break;
+			}
+			continue;
+		}
+
+		// 取出该任务
+		task = std::move(*it);
+		tasks.erase(it++);
+		m_listSize[level].fetch_sub(1, std::memory_order_relaxed);
+		// LOG_DEBUG(g_logger) << "m_task.size() after erase: " << tasks.size();
+		// 增加活跃线程数
+		++m_activeThreadCount;
+		found = true;
+		if(batch == 0) {
+			break;
+		}
+	}
+	tickle_me |= (it != tasks.end());
+	// LOG_DEBUG(g_logger) << "m_task.empty(): " << m_tasks.empty();
+	return found;
+}
+
+SchedulerMailbox *Scheduler::findMailbox(std::thread::id thread) const {
+	for(auto &mailbox : m_mailboxes) {
+		if(mailbox->owner == thread) {
+			return mailbox.get();
+		}
+	}
+	return nullptr;
+}
+
+bool Scheduler::pushMailbox(SchedulerTask &task) {
+	SchedulerMailbox *mailbox = findMailbox(task.thread);
+	if(!mailbox) {
+		if(MYRIEL_UNLIKELY(m_elastic) && isRetiredThread(task.thread)) {
+			// 弹性线程已经退出，信箱的槽位被新线程复用，任务可以在任意线程运行
+			task.thread = std::thread::id();
+		}
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> locker(mailbox->mutex);
+		if(mailbox->closed) {
+			// 弹性线程退出前已确认没有协程绑定在它的共享栈上，任务可以在任意线程运行
+			task.thread = std::thread::id();
+			return false;
+		}
+		// 先计数再入箱，stopping不会漏看箱中的任务
+		m_mailboxTasks.fetch_add(1, std::memory_order_relaxed);
+		mailbox->tasks.push_back(std::move(task));
+		mailbox->size.fetch_add(1, std::memory_order_relaxed);
+	}
+	// 与prepareSleep中的登记配对：要么这里看到所属线程已登记休眠，要么它登记后的重扫看到新任务
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	// 所属线程醒来前只唤醒一次，之后的任务由它醒来后一并取走
+	if(mailbox->parked.load(std::memory_order_relaxed)
+		&& !mailbox->notified.exchange(true, std::memory_order_relaxed)) {
+		wakeThread(mailbox->index);
+	}
+	return true;
+}
+
+bool Scheduler::passMailWake(bool consumed) {
+	for(auto &mailbox : m_mailboxes) {
+		if(mailbox.get() != t_mailbox && mailbox->parked.load(std::memory_order_relaxed)
+			&& mailbox->size.load(std::memory_order_relaxed) != 0) {
+			if(!mailbox->notified.exchange(true, std::memory_order_relaxed) || consumed) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool Scheduler::takeMailbox(SchedulerMailbox *mailbox, SchedulerTask &task, bool &busy) {
+	// 入箱后一定会检查所属线程是否休眠，这里漏看的任务会在休眠前的重扫中看到
+	if(mailbox->size.load(std::memory_order_relaxed) == 0) {
+		return false;
+	}
+	std::lock_guard<std::mutex> locker(mailbox->mutex);
+	for(auto it = mailbox->tasks.begin(); it != mailbox->tasks.end(); ++it) {
+		if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+			// 协程在其它线程上把自己指定到本线程，还没有完全切出
+			busy = true;
+			continue;
+		}
+		task = std::move(*it);
+		mailbox->tasks.erase(it);
+		mailbox->size.fetch_sub(1, std::memory_order_relaxed);
+		// 先增加活跃数再减少信箱中的任务数，stopping不会看到两者同时为0
+		++m_activeThreadCount;
+		m_mailboxTasks.fetch_sub(1, std::memory_order_seq_cst);
+		return true;
+	}
+	return false;
+}
+
+bool Scheduler::pushLocal(SchedulerTask &task) {
+	SchedulerWorker *worker = t_worker;
+	if(!worker || worker->owner != this || task.thread != std::thread::id()
+		|| task.priority != Priority::NORMAL) {
+		return false;
+	}
+	m_localTasks.fetch_add(1, std::memory_order_relaxed);
+	worker->queue.push(new SchedulerTask(std::move(task)));
+	// 唤醒一个线程来窃取
+	tickle();
+	return true;
+}
+
+bool Scheduler::acceptTask(SchedulerTask *item, SchedulerTask &task) {
+	if(item->fiber && item->fiber->getState() == Fiber::EXEC) {
+		// 协程刚被唤醒，还没有在原线程上完全切出，放回全局队列稍后再试
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			scheduleNoLock(*item);
+		}
+		m_localTasks.fetch_sub(1, std::memory_order_relaxed);
+		delete item;
+		return false;
+	}
+	// 先增加活跃数再减少队列中的任务数，stopping不会看到两者同时为0
+	++m_activeThreadCount;
+	m_localTasks.fetch_sub(1, std::memory_order_seq_cst);
+	task = std::move(*item);
+	delete item;
+	return true;
+}
+
+bool Scheduler::takeLocal(SchedulerWorker *worker, SchedulerTask &task) {
+	while(SchedulerTask *item = worker->queue.take()) {
+		if(acceptTask(item, task)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Scheduler::stealTask(SchedulerWorker *worker, SchedulerTask &task) {
+	size_t n = m_workers.size();
+	if(n <= 1 || m_localTasks.load(std::memory_order_relaxed) == 0) {
+		return false;
+	}
+	size_t start = worker->nextRandom() % n;
+	for(size_t i = 0; i < n; ++i) {
+		SchedulerWorker *victim = m_workers[(start + i) % n].get();
+		if(victim == worker) {
+			continue;
+		}
+		while(SchedulerTask *item = victim->queue.take()) {
+			if(acceptTask(item, task)) {
+				Bump(t_metrics->stolen);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
 void Scheduler::tickle()
 {
 	// LOG_INFO(g_logger) << "tickle";
+	unpark(1);
+}
+
+void Scheduler::unpark(int count) {
+	// 与prepareSleep中的登记构成Dekker式配对：要么这里看到休眠者，要么休眠者登记后的重扫看到新任务
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(!hasSleeper()) {
+		return;
+	}
+	// 推进序号，让已登记但还没进入futex的线程放弃休眠
+	m_parkSeq.fetch_add(1, std::memory_order_seq_cst);
+	FutexWake(&m_parkSeq, count);
+}
+
+void Scheduler::wakeThread(size_t index) {
+	// 推进序号，所属线程已登记但还没进入futex时放弃休眠；已经休眠时只有掩码相交的线程被唤醒
+	m_parkSeq.fetch_add(1, std::memory_order_seq_cst);
+	FutexWake(&m_parkSeq, INT_MAX, ThreadBit(index));
+}
+
+bool Scheduler::prepareSleep() {
+	if(t_idle.registered) {
+		return true;
+	}
+	if(t_mailbox) {
+		t_mailbox->notified.store(false, std::memory_order_relaxed);
+		t_mailbox->parked.store(true, std::memory_order_relaxed);
+	}
+	m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	t_idle.seq = m_parkSeq.load(std::memory_order_relaxed);
+	t_idle.registered = true;
+	return false;
+}
+
+void Scheduler::finishSleep() {
+	if(t_idle.registered) {
+		t_idle.registered = false;
+		m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+		if(t_mailbox) {
+			t_mailbox->parked.store(false, std::memory_order_relaxed);
+			t_mailbox->notified.store(false, std::memory_order_relaxed);
+		}
+	}
+	t_idle.spins = 0;
+}
+
+void Scheduler::leaveIdle() {
+	t_idle.idleSinceNs = 0;
+	if(t_idle.registered) {
+		t_idle.registered = false;
+		m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+		if(t_mailbox) {
+			t_mailbox->parked.store(false, std::memory_order_relaxed);
+			t_mailbox->notified.store(false, std::memory_order_relaxed);
+		}
+	}
+	if(t_idle.spins > 0) {
+		// 空转期间等到了任务，下次多空转几轮
+		t_idle.spinLimit = std::min(s_idle_spin_max, t_idle.spinLimit * 2);
+		t_idle.spins = 0;
+	}
 }
 
 bool Scheduler::stopping() {
+	// 运行期间idle协程反复调用，不必加锁
+	if(!m_stopping) {
+		return false;
+	}
 	std::lock_guard<std::mutex> locker(m_mutex);
-	return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+	// 先读队列中的任务数再读活跃数，与取任务时的顺序相反
+	for(auto &tasks : m_tasks) {
+		if(!tasks.empty()) {
+			return false;
+		}
+	}
+	return m_stopping && m_localTasks == 0 && m_mailboxTasks == 0 && m_activeThreadCount == 0;
 }
 
 void Scheduler::idle() {
 	// LOG_INFO(g_logger) << "idle";
 	while(!stopping()) {
+		if(MYRIEL_UNLIKELY(t_spare) && tryRetire()) {
+			finishSleep();
+			return;
+		}
+		if(t_idle.spins < t_idle.spinLimit) {
+			// 空转：回到调度循环重扫一次队列，任务很快到来时省去休眠与唤醒
+			++t_idle.spins;
+			MYRIEL_CPU_RELAX();
+		} else if(prepareSleep()) {
+			// 这次空转没等到任务，下次少空转几轮
+			t_idle.spinLimit = std::max(s_idle_spin_min, t_idle.spinLimit / 2);
+			// 登记后序号有变化说明有新任务，不会进入休眠
+			uint64_t park_begin = FiberTrace::NowNs();
+			// 弹性线程最多睡到可以退出的时刻
+			uint64_t deadline = t_spare ? t_idle.idleSinceNs + m_retireIdleNs : 0;
+			FutexWait(&m_parkSeq, t_idle.seq, t_mailbox ? ThreadBit(t_mailbox->index) : FUTEX_BITSET_MATCH_ANY, deadline);
+			recordPark(park_begin);
+			finishSleep();
+		}
 		Fiber::GetThis()->yield();
 	}
+	finishSleep();
+	// 调度器可以结束了，叫醒所有休眠的线程检查退出条件
+	unpark(INT_MAX);
 	// LOG_DEBUG(g_logger) << "stopping!";
 }
-}
\ No newline at end of file
+
+int Scheduler::pickLevel() {
+	bool ready[kPriorityLevels];
+	for(int i = 0; i < kPriorityLevels; ++i) {
+		ready[i] = m_listSize[i].load(std::memory_order_relaxed) != 0;
+	}
+	ready[(int)Priority::NORMAL] |= m_localTasks.load(std::memory_order_relaxed) != 0;
+
+	int pick = -1;
+	if(m_strictPriority) {
+		for(int i = 0; i < kPriorityLevels; ++i) {
+			if(!ready[i]) {
+				continue;
+			}
+			if(pick < 0) {
+				pick = i;
+			} else if(++t_dispatch.passed[i] >= m_starvationLimit) {
+				// 饥饿保护：低优先级被跳过太多次，让它执行一次
+				pick = i;
+				break;
+			}
+		}
+		if(pick >= 0) {
+			t_dispatch.passed[pick] = 0;
+		}
+	} else {
+		// 平滑加权轮询：每次给有任务的优先级加上权重，选最大的，再减去总权重
+		int64_t total = 0;
+		for(int i = 0; i < kPriorityLevels; ++i) {
+			if(!ready[i]) {
+				continue;
+			}
+			t_dispatch.current[i] += m_priorityWeights[i];
+			total += m_priorityWeights[i];
+			if(pick < 0 || t_dispatch.current[i] > t_dispatch.current[pick]) {
+				pick = i;
+			}
+		}
+		if(pick >= 0) {
+			t_dispatch.current[pick] -= total;
+		}
+	}
+	return pick >= 0 ? pick : (int)Priority::NORMAL;
+}
+
+void Scheduler::recordQueueWait(SchedulerTask &task) {
+	uint64_t wait = FiberTrace::NowNs() - task.enqueueNs;
+	if(FiberTrace::IsEnabled()) {
+		FiberTrace::SetQueueTime(wait);
+	}
+	if(m_elastic && wait > m_maxWaitNs.load(std::memory_order_relaxed)) {
+		// 只是监视线程的采样，不需要严格的最大值
+		m_maxWaitNs.store(wait, std::memory_order_relaxed);
+	}
+	if(!m_queueWaitStats) {
+		return;
+	}
+	LevelWaitStats &stats = m_waitStats[(int)task.priority];
+	stats.count.fetch_add(1, std::memory_order_relaxed);
+	stats.totalNs.fetch_add(wait, std::memory_order_relaxed);
+	uint64_t max = stats.maxNs.load(std::memory_order_relaxed);
+	while(wait > max && !stats.maxNs.compare_exchange_weak(max, wait, std::memory_order_relaxed));
+	stats.buckets[HistogramBucket(wait)].fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Scheduler::tryRetire() {
+	// 正在停止时和其它线程一样按stopping退出
+	if(!t_spare || m_stopping || t_idle.idleSinceNs == 0) {
+		return false;
+	}
+	uint64_t now = FiberTrace::NowNs();
+	if(now - t_idle.idleSinceNs < m_retireIdleNs) {
+		return false;
+	}
+	// 绑定在本线程共享栈上的协程只能回到本线程运行
+	bool busy = Fiber::GetBoundFibers() != 0;
+	if(!busy && t_mailbox) {
+		std::lock_guard<std::mutex> locker(t_mailbox->mutex);
+		busy = !t_mailbox->tasks.empty();
+		// 关闭之后不再有任务进入信箱
+		t_mailbox->closed = !busy;
+	}
+	if(busy) {
+		t_idle.idleSinceNs = now;
+		return false;
+	}
+	retireThread(std::this_thread::get_id());
+	return true;
+}
+
+void Scheduler::retireThread(std::thread::id thread) {
+	{
+		std::lock_guard<std::mutex> locker(m_retiredMutex);
+		m_retiredThreads[m_retiredNext] = thread;
+		m_retiredNext = (m_retiredNext + 1) % kRetiredRecords;
+	}
+	// 信箱关闭前按线程ID找不到信箱的任务留在全局队列中，改为不指定线程
+	size_t moved = 0;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		for(auto &tasks : m_tasks) {
+			for(auto &task : tasks) {
+				if(task.thread == thread) {
+					task.thread = std::thread::id();
+					++moved;
+				}
+			}
+		}
+	}
+	if(moved) {
+		tickle();
+	}
+}
+
+bool Scheduler::isRetiredThread(std::thread::id thread) {
+	if(thread == std::thread::id()) {
+		return false;
+	}
+	std::lock_guard<std::mutex> locker(m_retiredMutex);
+	return std::find(m_retiredThreads.begin(), m_retiredThreads.end(), thread) != m_retiredThreads.end();
+}
+
+uint64_t Scheduler::getRetireTimeout() const {
+	if(!t_spare || t_idle.idleSinceNs == 0) {
+		return ~0ull;
+	}
+	uint64_t deadline = t_idle.idleSinceNs + m_retireIdleNs;
+	uint64_t now = FiberTrace::NowNs();
+	// 向上取整，避免还差不到一毫秒时反复以0超时空转
+	return deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+}
+
+void Scheduler::monitor() {
+	FiberTrace::SetThreadName(m_name + "_monitor");
+	// 采样间隔取扩容阈值的一半，排队时间连续超过阈值一段时间才扩容
+	uint64_t interval = std::clamp(m_growLatencyNs / 2, s_monitor_interval_min_ns, s_monitor_interval_max_ns);
+	uint64_t executed = 0;
+	uint64_t progress = FiberTrace::NowNs();	// 上次看到有任务执行的时刻
+	uint64_t slow_since = 0;					// 排队时间开始超过阈值的时刻
+	uint64_t last_grow = 0;
+	std::unique_lock<std::mutex> locker(m_monitorMutex);
+	while(!m_monitorStop) {
+		m_monitorCond.wait_for(locker, std::chrono::nanoseconds(interval));
+		if(m_monitorStop) {
+			break;
+		}
+		reapSpares();
+
+		uint64_t now = FiberTrace::NowNs();
+		uint64_t total = 0;
+		for(auto &metrics : m_threadMetrics) {
+			total += metrics->executed.load(std::memory_order_relaxed);
+		}
+		if(total != executed) {
+			executed = total;
+			progress = now;
+		}
+		// 信箱中的任务只能由所属线程执行，增加线程也没有用
+		size_t pending = m_localTasks.load(std::memory_order_relaxed);
+		for(auto &size : m_listSize) {
+			pending += size.load(std::memory_order_relaxed);
+		}
+		// 出队时记录的排队时间；所有线程都被任务占住时没有任务出队，按多久没有任务执行估计
+		uint64_t latency = m_maxWaitNs.exchange(0, std::memory_order_relaxed);
+		if(pending == 0) {
+			progress = now;
+		} else {
+			latency = std::max(latency, now - progress);
+		}
+
+		if(latency < m_growLatencyNs) {
+			slow_since = 0;
+			continue;
+		}
+		if(slow_since == 0) {
+			slow_since = now;
+		}
+		// 新线程启动后也等一个阈值再看效果
+		if(now - slow_since >= m_growLatencyNs && now - last_grow >= m_growLatencyNs && spawnSpare()) {
+			last_grow = now;
+			slow_since = 0;
+		}
+	}
+}
+
+bool Scheduler::spawnSpare() {
+	if(m_stopping) {
+		return false;
+	}
+	for(size_t i = 0; i < m_spareThreads.size(); ++i) {
+		if(!m_spareThreads[i].joinable()) {
+			++m_spareCount;
+			m_spareThreads[i] = std::thread(std::bind(&Scheduler::runThread, this, m_spareBase + i, true));
+			return true;
+		}
+	}
+	return false;
+}
+
+void Scheduler::reapSpares() {
+	for(size_t i = 0; i < m_spareThreads.size(); ++i) {
+		if(m_spareExited[i].load(std::memory_order_acquire)) {
+			m_spareThreads[i].join();
+			m_spareExited[i] = false;
+		}
+	}
+}
+
+void Scheduler::recordRun(SchedulerThreadMetrics *metrics, uint64_t begin_ns, Fiber *fiber) {
+	Bump(metrics->executed);
+	if(MYRIEL_LIKELY(begin_ns == 0)) {
+		return;
+	}
+	uint64_t ns = FiberTrace::NowNs() - begin_ns;
+	if(fiber) {
+		fiber->addRunTime(ns);
+	}
+	Bump(metrics->runNs, ns);
+	if(ns > metrics->runMaxNs.load(std::memory_order_relaxed)) {
+		metrics->runMaxNs.store(ns, std::memory_order_relaxed);
+	}
+	Bump(metrics->runBuckets[HistogramBucket(ns)]);
+}
+
+void Scheduler::recordPark(uint64_t begin_ns) {
+	SchedulerThreadMetrics *metrics = t_metrics;
+	if(!metrics) {
+		return;
+	}
+	Bump(metrics->parks);
+	Bump(metrics->parkNs, FiberTrace::NowNs() - begin_ns);
+}
+
+Scheduler::QueueWaitStats Scheduler::getQueueWaitStats(Priority priority) const {
+	QueueWaitStats result;
+	if(priority == Priority::INHERIT) {
+		return result;
+	}
+	const LevelWaitStats &stats = m_waitStats[(int)priority];
+	result.count = stats.count.load(std::memory_order_relaxed);
+	result.totalNs = stats.totalNs.load(std::memory_order_relaxed);
+	result.maxNs = stats.maxNs.load(std::memory_order_relaxed);
+	for(int i = 0; i < QueueWaitStats::kBuckets; ++i) {
+		result.buckets[i] = stats.buckets[i].load(std::memory_order_relaxed);
+	}
+	return result;
+}
+
+uint64_t Scheduler::QueueWaitStats::percentileNs(double p) const {
+	uint64_t total = 0;
+	for(uint64_t n : buckets) {
+		total += n;
+	}
+	if(total == 0) {
+		return 0;
+	}
+	uint64_t target = (uint64_t)(total * p / 100);
+	uint64_t seen = 0;
+	for(int i = 0; i < kBuckets; ++i) {
+		seen += buckets[i];
+		if(seen > target) {
+			return std::min<uint64_t>((2ull << i) - 1, maxNs);
+		}
+	}
+	return maxNs;
+}
+
+Scheduler::Metrics Scheduler::getMetrics() const {
+	Metrics result;
+	for(int i = 0; i < kPriorityLevels; ++i) {
+		result.queued[i] = m_listSize[i].load(std::memory_order_relaxed);
+		result.queueWait[i] = getQueueWaitStats((Priority)i);
+	}
+	result.localQueued = m_localTasks.load(std::memory_order_relaxed);
+	result.mailboxQueued = m_mailboxTasks.load(std::memory_order_relaxed);
+	result.activeThreads = m_activeThreadCount.load(std::memory_order_relaxed);
+	result.idleThreads = m_idleThreadCount.load(std::memory_order_relaxed);
+	result.sleepingThreads = getSleeperCount();
+	result.spareThreads = getSpareCount();
+	result.liveFibers = Fiber::GetTotalFibers();
+
+	QueueWaitStats &run = result.runTime;
+	result.workers.reserve(m_threadMetrics.size());
+	for(auto &metrics : m_threadMetrics) {
+		WorkerMetrics worker;
+		worker.executed = metrics->executed.load(std::memory_order_relaxed);
+		worker.stolen = metrics->stolen.load(std::memory_order_relaxed);
+		worker.parks = metrics->parks.load(std::memory_order_relaxed);
+		worker.parkNs = metrics->parkNs.load(std::memory_order_relaxed);
+		worker.idleNs = metrics->idleNs.load(std::memory_order_relaxed);
+		worker.runNs = metrics->runNs.load(std::memory_order_relaxed);
+		result.workers.push_back(worker);
+
+		run.totalNs += worker.runNs;
+		run.maxNs = std::max(run.maxNs, metrics->runMaxNs.load(std::memory_order_relaxed));
+		for(int i = 0; i < QueueWaitStats::kBuckets; ++i) {
+			uint64_t n = metrics->runBuckets[i].load(std::memory_order_relaxed);
+			run.buckets[i] += n;
+			run.count += n;
+		}
+	}
+	return result;
+}
+
+uint64_t Scheduler::Metrics::executed() const {
+	uint64_t total = 0;
+	for(const WorkerMetrics &worker : workers) {
+		total += worker.executed;
+	}
+	return total;
+}
+
+uint64_t Scheduler::Metrics::stolen() const {
+	uint64_t total = 0;
+	for(const WorkerMetrics &worker : workers) {
+		total += worker.stolen;
+	}
+	return total;
+}
+
+std::string Scheduler::Metrics::toString() const {
+	static const char *s_levels[kPriorityLevels] = {"high", "normal", "low"};
+	std::stringstream ss;
+	ss << "queued=" << queued[0] << "/" << queued[1] << "/" << queued[2]
+	   << " local=" << localQueued << " mailbox=" << mailboxQueued
+	   << " active=" << activeThreads << " idle=" << idleThreads << " sleeping=" << sleepingThreads
+	   << " spare=" << spareThreads
+	   << " fibers=" << liveFibers << " executed=" << executed() << " stolen=" << stolen();
+	for(size_t i = 0; i < workers.size(); ++i) {
+		const WorkerMetrics &worker = workers[i];
+		ss << "\n  worker[" << i << "] executed=" << worker.executed << " stolen=" << worker.stolen
+		   << " parks=" << worker.parks << " park_ms=" << worker.parkNs / 1000000
+		   << " idle_ms=" << worker.idleNs / 1000000 << " run_ms=" << worker.runNs / 1000000;
+	}
+	auto histogram = [&ss](const char *name, const QueueWaitStats &stats) {
+		if(stats.count == 0) {
+			return;
+		}
+		ss << "\n  " << name << " count=" << stats.count << " avg_ns=" << (uint64_t)stats.avgNs()
+		   << " p50_ns=" << stats.percentileNs(50) << " p99_ns=" << stats.percentileNs(99)
+		   << " max_ns=" << stats.maxNs;
+	};
+	for(int i = 0; i < kPriorityLevels; ++i) {
+		histogram((std::string("queue_wait[") + s_levels[i] + "]").c_str(), queueWait[i]);
+	}
+	histogram("run_time", runTime);
+	return ss.str();
+}
+
+size_t Scheduler::getQueuedCount(Priority priority) const {
+	if(priority == Priority::INHERIT) {
+		return 0;
+	}
+	size_t count = m_listSize[(int)priority].load(std::memory_order_relaxed);
+	if(priority == Priority::NORMAL) {
+		count += m_localTasks.load(std::memory_order_relaxed);
+	}
+	return count;
+}
+}
@@ -1,21 +1,48 @@
 #pragma once
 
+#include <array>
+#include <coroutine>
 #include <memory>
 #include <list>
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <thread>
+#include <condition_variable>
 
 
 #include "fiber.h"
+#include "fiber_future.h"
+#include "fiber_trace.h"
+#include "affinity.h"
 
 namespace myriel {
+class SchedulerWorker;
+class SchedulerMailbox;
+class SchedulerThreadMetrics;
+
 /**
  * @brief 协程调度器
  * @details 封装的是N-M的调度器
  * 			内部存在一个线程池，支持协程在线程池里切换
+ * 			默认所有任务进入一个加锁的全局队列；配置scheduler.work_stealing为true时，
+ * 			每个调度线程另有一个Chase-Lev工作窃取队列，调度线程提交的任务直接进入
+ * 			本线程的队列，空闲时随机窃取其它线程的任务，全局队列只承接外部线程提交
+ * 			的任务与指定了线程的任务，并由调度线程成批搬到自己的队列中。
+ * 			任务分HIGH/NORMAL/LOW三个优先级，每级一个全局队列，工作窃取队列只承接NORMAL
+ * 			任务。有HIGH/LOW任务排队时按scheduler.priority_policy在各级之间分配：
+ * 			weighted为平滑加权轮询，strict为严格优先级，低优先级被连续跳过
+ * 			scheduler.priority_starvation_limit次后执行一次。
+ * 			指定了线程的任务放进该线程自己的信箱(scheduler.mailbox，默认开启)，出队时
+ * 			不再扫描其它线程的任务；信箱中的任务按先后顺序执行，不区分优先级，提交时
+ * 			只唤醒所属的线程。
+ * 			scheduler.elastic.max_threads大于线程数时为弹性模式：监视线程发现排队时间持续
+ * 			超过scheduler.elastic.grow_latency_us时增加一个弹性线程，直到总数达到上限；
+ * 			弹性线程空闲超过scheduler.elastic.retire_idle_ms后退出，构造时给定的线程一直保留。
 */
 class Scheduler {
+friend class SchedulerWorker;
+friend class SchedulerMailbox;
 public:
 	using ptr = std::shared_ptr<Scheduler>;
 
@@ -64,44 +91,187 @@ public:
 	 */
 	void stop();
 
+	static constexpr int kPriorityLevels = 3;			// 优先级个数
+
+	/**
+	 * @brief 某个优先级的排队时间统计，开启scheduler.queue_wait_stats后记录
+	 */
+	struct QueueWaitStats {
+		static constexpr int kBuckets = 40;				// 按2的幂划分的直方图，最后一个桶约18分钟
+
+		uint64_t count = 0;				// 出队的任务数
+		uint64_t totalNs = 0;			// 排队时间总和
+		uint64_t maxNs = 0;				// 最长排队时间
+		uint64_t buckets[kBuckets] = {};	// buckets[i]为排队时间在[2^i, 2^(i+1))纳秒内的任务数
+
+		double avgNs() const { return count ? (double)totalNs / count : 0; }
+
+		/**
+		 * @brief 排队时间的百分位数，返回所在桶的上界
+		 *
+		 * @param p 百分位，如99
+		 */
+		uint64_t percentileNs(double p) const;
+	};
+
+	/**
+	 * @brief 单个调度线程的运行指标
+	 */
+	struct WorkerMetrics {
+		uint64_t executed = 0;			// 切入执行的任务数，协程每次被唤醒都计一次
+		uint64_t stolen = 0;			// 从其它线程窃取的任务数
+		uint64_t parks = 0;				// 休眠次数
+		uint64_t parkNs = 0;			// 休眠时间，醒来时计入
+		uint64_t idleNs = 0;			// 在idle协程中的时间，包括空转与休眠
+		uint64_t runNs = 0;				// 执行任务的时间，开启scheduler.run_time_stats后记录
+	};
+
+	/**
+	 * @brief 调度器运行指标的快照
+	 * @details 各项分别免锁读取，不是同一时刻的一致快照
+	 */
+	struct Metrics {
+		size_t queued[kPriorityLevels] = {};		// 各优先级全局队列中的任务数
+		size_t localQueued = 0;					// 各线程工作窃取队列中的任务数
+		size_t mailboxQueued = 0;				// 各线程信箱中的任务数
+		size_t activeThreads = 0;				// 正在执行任务的线程数
+		size_t idleThreads = 0;					// 在idle协程中的线程数
+		size_t sleepingThreads = 0;				// 已登记休眠的线程数
+		size_t spareThreads = 0;				// 正在运行的弹性线程数
+		uint64_t liveFibers = 0;				// 进程中存活的协程数
+		std::vector<WorkerMetrics> workers;		// 各调度线程，下标为启动顺序，caller线程在其后，最后是各弹性线程的槽位
+		QueueWaitStats queueWait[kPriorityLevels];	// 各优先级的排队时间，开启scheduler.queue_wait_stats后记录
+		QueueWaitStats runTime;					// 每次切入任务到切出的时间，开启scheduler.run_time_stats后记录，
+												// 各协程的累计运行时间见Fiber::getRunTime
+
+		/**
+		 * @brief 所有线程切入执行的任务数
+		 */
+		uint64_t executed() const;
+
+		/**
+		 * @brief 所有线程窃取的任务数
+		 */
+		uint64_t stolen() const;
+
+		std::string toString() const;
+	};
+
 	/**
 	 * @brief 添加调度任务
 	 * 
 	 * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
 	 * @param fc 协程对象或指针
 	 * @param thread 指定运行该任务的线程号，
+	 * @param priority 优先级，指定给协程时之后的唤醒都沿用
 	 */
 	template<class FiberOrCb>
-	void schedule(FiberOrCb fc, std::thread::id thread = std::thread::id()) {
-		bool need_tickle = false; {
-			std::lock_guard<std::mutex> locker(m_mutex);
-			need_tickle = scheduleNoLock(fc, thread);
+	void schedule(FiberOrCb fc, std::thread::id thread = std::thread::id(),
+				  Priority priority = Priority::INHERIT) {
+		SchedulerTask task(fc, thread);
+		task.priority = priority;
+		if(!prepareTask(task)) {
+			return;
+		}
+		if(task.thread != std::thread::id() && pushMailbox(task)) {
+			return;
+		}
+		if(m_workStealing && pushLocal(task)) {
+			return;
 		}
 
-		if(need_tickle) {
-			tickle();
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			scheduleNoLock(task);
 		}
+		tickle();
+	}
+
+	template<class FiberOrCb>
+	void schedule(FiberOrCb fc, Priority priority) {
+		schedule(fc, std::thread::id(), priority);
 	}
 
 	template<class InputIterator>
-	void schedule(InputIterator begin, InputIterator end)
+	void schedule(InputIterator begin, InputIterator end, Priority priority = Priority::INHERIT)
 	{
-		bool need_tickle = false; {
+		size_t count = 0; {
 			std::lock_guard<std::mutex> locker(m_mutex);
 			while(begin != end) {
-				need_tickle = scheduleNoLock(&*begin, std::thread::id()) || need_tickle;
+				SchedulerTask task(&*begin, std::thread::id());
+				task.priority = priority;
+				if(prepareTask(task)) {
+					// 指定了线程的任务进入该线程的信箱，入箱时已唤醒该线程
+					if(task.thread == std::thread::id() || !pushMailbox(task)) {
+						scheduleNoLock(task);
+						++count;
+					}
+				}
 				++begin;
 			}
 		}
-		if(need_tickle) {
+		for(size_t i = 0; i < count && i < m_threadCount + 1; ++i) {
 			tickle();
 		}
 	}
 
+	/**
+	 * @brief 添加调度任务并返回其结果的future
+	 * @details 任务在调度器中以协程运行，返回值或抛出的异常写入future；
+	 * 			在协程中等待future会挂起协程而不阻塞调度线程
+	 *
+	 * @param f 无参可调用对象
+	 * @param thread 指定运行该任务的线程号
+	 */
+	template<class F>
+	auto scheduleFuture(F f, std::thread::id thread = std::thread::id())
+			-> FiberFuture<typename std::invoke_result<F>::type> {
+		using Result = typename std::invoke_result<F>::type;
+		FiberPromise<Result> promise;
+		FiberFuture<Result> future = promise.getFuture();
+		schedule(std::function<void()>([promise, f]() mutable {
+			FulfillPromise(promise, f);
+		}), thread);
+		return future;
+	}
+
+	/**
+	 * @brief 某个优先级的排队时间统计
+	 */
+	QueueWaitStats getQueueWaitStats(Priority priority) const;
+
+	/**
+	 * @brief 某个优先级正在排队的任务数，NORMAL包括各线程工作窃取队列中的任务
+	 * @attention 不包括各线程信箱中指定了线程的任务，见getMailboxCount
+	 */
+	size_t getQueuedCount(Priority priority) const;
+
+	/**
+	 * @brief 各线程信箱中等待执行的任务数
+	 */
+	size_t getMailboxCount() const { return m_mailboxTasks.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief 调度线程数，包括caller线程与正在运行的弹性线程
+	 */
+	size_t getThreadCount() const { return m_threadCount + (m_useCaller ? 1 : 0) + getSpareCount(); }
+
+	/**
+	 * @brief 正在运行的弹性线程数
+	 */
+	size_t getSpareCount() const { return m_spareCount.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief 读取运行指标
+	 * @details 计数器由各线程单独写入，读取不加锁，可以在运行期间随时调用
+	 */
+	Metrics getMetrics() const;
+
 protected:
 
 	/**
-	 * @brief 通知协程调度器有任务了
+	 * @brief 通知协程调度器有任务了，唤醒一个休眠的调度线程
+	 * @details 每次添加任务后都会调用，没有线程休眠时只有一次内存屏障的开销
 	 */
 	virtual void tickle();
 
@@ -114,6 +284,8 @@ protected:
 
 	/**
 	 * @brief 无任务调度时执行idle协程
+	 * @details 先自适应地空转重扫几轮任务队列，仍然没有任务时在futex上休眠，
+	 * 			直到tickle唤醒
 	 */
 	virtual void idle();
 
@@ -123,34 +295,251 @@ protected:
 	void setThis();
 
 	bool hasIdleThread() { return m_idleThreadCount > 0;}
+
+	/**
+	 * @brief 空闲的调度线程准备休眠，在idle协程中调用
+	 * @details 第一次调用登记为休眠线程并返回false，调用方需要让出回到调度循环再扫描
+	 * 			一次任务队列；仍然没有任务时再次调用返回true，此时可以休眠。
+	 * 			登记之后添加的任务一定会通过tickle叫醒本线程或被本线程扫描到。
+	 */
+	bool prepareSleep();
+
+	/**
+	 * @brief 休眠结束，撤销登记
+	 */
+	void finishSleep();
+
+	/**
+	 * @brief 是否有登记休眠的线程，tickle据此决定是否需要唤醒
+	 * @details 调用前需要有一次seq_cst内存屏障，与prepareSleep中的登记配对
+	 */
+	bool hasSleeper() const { return m_sleepers.load(std::memory_order_relaxed) > 0; }
+
+	/**
+	 * @brief 已登记休眠的线程数
+	 */
+	uint32_t getSleeperCount() const { return m_sleepers.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief 唤醒信箱中来了新任务的休眠线程
+	 * @details 默认在futex上只唤醒该线程(线程数超过32时可能连带唤醒共用同一位的线程)
+	 *
+	 * @param index 调度线程的下标
+	 */
+	virtual void wakeThread(size_t index);
+
+	/**
+	 * @brief 不能定向唤醒时，是否需要把唤醒传给信箱中有任务且已登记休眠的其它线程
+	 * @details 每个信箱的唤醒在所属线程醒来前只发出一次；唤醒可能被别的线程消耗，
+	 * 			消耗了唤醒的线程看到已通知过的信箱时仍需继续传递
+	 *
+	 * @param consumed 本线程上一次休眠是否消耗了一次唤醒
+	 * @return 需要再唤醒一个线程
+	 */
+	bool passMailWake(bool consumed);
+
+	/**
+	 * @brief 记录一次休眠，在idle协程中阻塞等待返回后调用
+	 *
+	 * @param begin_ns 开始阻塞的时刻，FiberTrace::NowNs的时间基准
+	 */
+	void recordPark(uint64_t begin_ns);
+
+	/**
+	 * @brief 弹性线程空闲足够久时关闭信箱准备退出，在idle协程中调用
+	 * @details 信箱中还有任务或还有协程绑定在本线程的共享栈上时不退出，重新计算空闲时间。
+	 * 			返回true后idle协程应当撤销休眠登记并结束，调度循环再扫描一次队列后退出线程
+	 */
+	bool tryRetire();
+
+	/**
+	 * @brief 记录退出的弹性线程，全局队列中指定给它的任务改为不指定线程
+	 * @details 在tryRetire确认退出后调用，之后按线程ID找不到信箱的任务由pushMailbox查这份记录。
+	 * 			只保留最近kRetiredRecords条：绑定在退出线程上的协程都已结束，之后仍指定它的
+	 * 			任务只会在退出后不久出现
+	 */
+	void retireThread(std::thread::id thread);
+
+	/**
+	 * @brief 线程是否是本调度器已退出的弹性线程
+	 */
+	bool isRetiredThread(std::thread::id thread);
+
+	/**
+	 * @brief 当前线程距离可以退出还有多少毫秒，不是弹性线程时返回~0ull
+	 */
+	uint64_t getRetireTimeout() const;
 private:
+	struct SchedulerTask;
+
 	/**
-	 * @brief 添加调度任务，无锁
-	 * 
-	 * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
-	 * @param fc 协程对象或指针
-	 * @param thread 指定运行该任务的线程号，
+	 * @brief 调度循环
+	 *
+	 * @param index 调度线程的下标
+	 * @param spare 是否为弹性线程
 	 */
-	template<class FiberOrCb>
-	bool scheduleNoLock(FiberOrCb fc, std::thread::id thread) {
-		bool need_tickle = m_tasks.empty();
-		SchedulerTask task(fc, thread);
-		if(task.fiber || task.cb) {
-			m_tasks.push_back(task);
+	void runThread(size_t index, bool spare);
+
+	/**
+	 * @brief 弹性模式的监视线程，按排队时间增加弹性线程并回收已退出的线程
+	 */
+	void monitor();
+
+	/**
+	 * @brief 在空闲的槽位上启动一个弹性线程
+	 *
+	 * @return 弹性线程已达上限或调度器正在停止时返回false
+	 */
+	bool spawnSpare();
+
+	/**
+	 * @brief 回收已退出的弹性线程，空出它们的槽位
+	 */
+	void reapSpares();
+
+	/**
+	 * @brief 补全任务的运行线程、优先级、取消令牌与入队时间
+	 *
+	 * @return 任务为空时返回false
+	 */
+	bool prepareTask(SchedulerTask &task) {
+		if(!task.fiber && !task.cb && !task.handle) {
+			return false;
+		}
+		// 共享栈协程的栈内容包含绑定线程上的地址，只能回到该线程运行
+		if(task.fiber && task.thread == std::thread::id()) {
+			task.thread = task.fiber->getBoundThread();
+		}
+		if(task.cb) {
+			// 回调任务沿用调度方的取消令牌，调度方被取消时一并取消
+			task.cancel = Fiber::GetCancelToken();
 		}
-		return need_tickle;
+		if(task.priority == Priority::INHERIT) {
+			task.priority = task.fiber ? task.fiber->getPriority() : Fiber::GetPriority();
+		} else if(task.fiber) {
+			task.fiber->setPriority(task.priority);
+		}
+		if(MYRIEL_UNLIKELY(m_queueWaitStats || m_elastic || FiberTrace::IsEnabled())) {
+			task.enqueueNs = FiberTrace::NowNs();
+		}
+		return true;
+	}
+
+	/**
+	 * @brief 添加调度任务到全局队列，调用方持有m_mutex，之后需要调用tickle
+	 */
+	void scheduleNoLock(SchedulerTask &task) {
+		int level = (int)task.priority;
+		m_tasks[level].push_back(std::move(task));
+		m_listSize[level].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief 把指定了线程的任务放入该线程的信箱，所属线程已登记休眠时唤醒它
+	 *
+	 * @return 指定的线程不是本调度器的调度线程(或调度器尚未启动)时返回false，
+	 * 		   任务仍进入全局队列；指定的弹性线程已经退出时改为不指定线程，返回false
+	 * @attention 弹性线程的槽位可能已被新线程复用，按已退出线程的记录识别指定给旧线程的任务
+	 */
+	bool pushMailbox(SchedulerTask &task);
+
+	/**
+	 * @brief 查找线程的信箱
+	 * @details 调度线程不多，顺序比较线程ID，启动之后只读，不需要加锁
+	 */
+	SchedulerMailbox *findMailbox(std::thread::id thread) const;
+
+	/**
+	 * @brief 从当前线程的信箱中取出任务
+	 *
+	 * @param busy 信箱中是否有还没在其它线程上完全切出的协程，此时不能休眠
+	 */
+	bool takeMailbox(SchedulerMailbox *mailbox, SchedulerTask &task, bool &busy);
+
+	/**
+	 * @brief 工作窃取模式下，调度线程把未指定线程的任务放入自己的队列
+	 *
+	 * @return 当前线程不是本调度器的调度线程或任务指定了线程时返回false
+	 */
+	bool pushLocal(SchedulerTask &task);
+
+	/**
+	 * @brief 从某个优先级的全局队列中取出一个可以在当前线程运行的任务
+	 * @details 工作窃取模式下，NORMAL队列顺便把一批任务搬到当前线程的队列
+	 *
+	 * @param tickle_me 是否还有其它线程可以运行的任务
+	 */
+	bool takeFromList(int level, SchedulerTask &task, bool &tickle_me);
+
+	/**
+	 * @brief HIGH或LOW队列中是否有任务
+	 */
+	bool hasPriorityTasks() const {
+		return m_listSize[(int)Priority::HIGH].load(std::memory_order_relaxed) != 0
+			|| m_listSize[(int)Priority::LOW].load(std::memory_order_relaxed) != 0;
 	}
 
+	/**
+	 * @brief 按调度策略选出本次优先执行的优先级
+	 */
+	int pickLevel();
+
+	/**
+	 * @brief 记录出队任务的排队时间
+	 */
+	void recordQueueWait(SchedulerTask &task);
+
+	/**
+	 * @brief 记录一次任务执行
+	 *
+	 * @param begin_ns 切入任务的时刻，未开启运行时间统计时为0
+	 * @param fiber 执行任务的协程，运行时间同时计入该协程；无栈协程为nullptr
+	 */
+	void recordRun(SchedulerThreadMetrics *metrics, uint64_t begin_ns, Fiber *fiber);
+
+	/**
+	 * @brief 从当前线程的队列中取出任务
+	 */
+	bool takeLocal(SchedulerWorker *worker, SchedulerTask &task);
+
+	/**
+	 * @brief 从随机的一个调度线程开始，依次尝试窃取其它线程队列中的任务
+	 */
+	bool stealTask(SchedulerWorker *worker, SchedulerTask &task);
+
+	/**
+	 * @brief 接收从工作窃取队列中取出的任务
+	 *
+	 * @return 协程尚未完全切出时把任务转到全局队列，返回false
+	 */
+	bool acceptTask(SchedulerTask *item, SchedulerTask &task);
+
+	/**
+	 * @brief 推进唤醒序号并唤醒在futex上休眠的调度线程
+	 *
+	 * @param count 最多唤醒的线程数
+	 */
+	void unpark(int count);
+
+	/**
+	 * @brief 调度线程拿到任务，结束空转或撤销休眠登记
+	 */
+	void leaveIdle();
+
 private:
 	/**
-	 * @brief 调度任务，协程/函数二选一
+	 * @brief 调度任务，协程/函数/无栈协程三选一
 	 * 
 	 */
 	struct SchedulerTask
 	{
 		Fiber::ptr fiber;						// 协程
 		std::function<void()> cb;				// 任务
+		std::coroutine_handle<> handle;			// 无栈协程，直接在调度协程上恢复
 		std::thread::id thread;					// 指定线程ID
+		uint64_t enqueueNs = 0;					// 入队时间，仅在开启排队统计或协程追踪时记录
+		CancelToken::ptr cancel;				// 回调任务的取消令牌
+		Priority priority = Priority::NORMAL;	// 优先级，入队前已确定，不会是INHERIT
 
 		/**
 		 * @brief 构造函数
@@ -176,6 +565,9 @@ private:
 		SchedulerTask(std::function<void()> *f, std::thread::id thr)
 			: thread(thr) { cb.swap(*f); }
 
+		SchedulerTask(std::coroutine_handle<> h, std::thread::id thr)
+			: handle(h), thread(thr) {}
+
 		SchedulerTask()
 			: thread(-1) {}
 		
@@ -185,24 +577,79 @@ private:
 		void reset() {
 			fiber = nullptr;
 			cb = nullptr;
+			handle = nullptr;
 			thread = std::thread::id();
+			enqueueNs = 0;
+			cancel = nullptr;
+			priority = Priority::NORMAL;
 		}
 	};
 
 private: 
 	std::mutex m_mutex;									// 锁
 	std::vector<std::thread> m_threads;					// 线程池
-	std::list<SchedulerTask> m_tasks;					// 协程任务队列
+	std::list<SchedulerTask> m_tasks[kPriorityLevels];	// 各优先级的全局任务队列
+	std::atomic<size_t> m_listSize[kPriorityLevels] = {};	// 各全局队列的长度，据此免锁判空
 	std::string m_name;									// 调度器名称
 	Fiber::ptr m_rootFiber;								// 调度器所在线程的调度协程
 	bool m_useCaller;
 
+	bool m_workStealing = false;						// 是否使用工作窃取队列
+	bool m_useMailbox = true;							// 指定了线程的任务是否进入该线程的信箱
+	bool m_hookEnable = false;							// 调度线程是否开启hook
+	std::vector<int> m_cpus;							// 调度线程允许使用的CPU，为空表示不限制
+	NumaPolicy m_numaPolicy = NumaPolicy::NONE;			// 调度线程在NUMA节点间的放置策略
+	bool m_strictPriority = false;						// 严格优先级，否则按权重轮询
+	uint32_t m_priorityWeights[kPriorityLevels] = {16, 4, 1};	// 加权轮询中各优先级的权重
+	uint32_t m_starvationLimit = 64;					// 严格优先级下低优先级最多被连续跳过的次数
+	bool m_queueWaitStats = false;						// 是否统计排队时间
+	bool m_runTimeStats = false;						// 是否统计任务的运行时间
+
+	/**
+	 * @brief 排队时间统计，各线程直接累加
+	 */
+	struct alignas(64) LevelWaitStats {
+		std::atomic<uint64_t> count{0};
+		std::atomic<uint64_t> totalNs{0};
+		std::atomic<uint64_t> maxNs{0};
+		std::atomic<uint64_t> buckets[QueueWaitStats::kBuckets] = {};
+	};
+	LevelWaitStats m_waitStats[kPriorityLevels];
+	std::vector<std::unique_ptr<SchedulerWorker>> m_workers;	// 每个调度线程的队列
+	std::atomic<size_t> m_nextWorker{0};				// 下一个启动的调度线程的下标
+	std::atomic<size_t> m_readyThreads{0};				// 已完成绑定CPU与分配队列的调度线程数
+	std::atomic<size_t> m_localTasks{0};				// 各线程队列中的任务总数
+	std::vector<std::unique_ptr<SchedulerMailbox>> m_mailboxes;	// 每个调度线程的信箱，下标与m_workers相同
+	std::atomic<size_t> m_mailboxTasks{0};				// 各线程信箱中的任务总数
+	std::vector<std::unique_ptr<SchedulerThreadMetrics>> m_threadMetrics;	// 每个调度线程的运行指标，下标与m_workers相同
+
+	bool m_elastic = false;								// 是否按负载增减弹性线程
+	size_t m_maxSpares = 0;								// 弹性线程数上限
+	uint64_t m_growLatencyNs = 0;						// 排队时间持续超过该值时增加弹性线程
+	uint64_t m_retireIdleNs = 0;						// 弹性线程空闲超过该时间后退出
+	size_t m_spareBase = 0;								// 第一个弹性线程的下标，在各调度线程与caller线程之后
+	std::vector<std::thread> m_spareThreads;			// 各槽位上的弹性线程，只由监视线程启动与回收
+	std::unique_ptr<std::atomic<bool>[]> m_spareExited;	// 各槽位上的弹性线程是否已退出，等待回收
+	std::atomic<size_t> m_spareCount{0};				// 正在运行的弹性线程数
+	static constexpr size_t kRetiredRecords = 64;		// 记录最近退出的弹性线程个数
+	std::mutex m_retiredMutex;
+	std::array<std::thread::id, kRetiredRecords> m_retiredThreads;	// 最近退出的弹性线程，环形覆盖最早的记录，线程ID被新的弹性线程复用时清除，m_retiredMutex保护
+	size_t m_retiredNext = 0;							// 下一条记录写入的位置，m_retiredMutex保护
+	std::atomic<uint64_t> m_maxWaitNs{0};				// 上次采样以来出队任务的最长排队时间
+	std::thread m_monitor;								// 监视线程
+	std::mutex m_monitorMutex;
+	std::condition_variable m_monitorCond;
+	bool m_monitorStop = false;							// 监视线程是否退出，m_monitorMutex保护
+
+	std::atomic<uint32_t> m_parkSeq{0};					// 唤醒序号，也是休眠线程等待的futex
+	std::atomic<uint32_t> m_sleepers{0};				// 已登记休眠的线程数
+
 protected:
 	std::vector<std::thread::id> m_threadIds;			// 线程ID数组
 	size_t m_threadCount = 0;							// 工作线程数
 	std::atomic<size_t> m_activeThreadCount = {0};		// 活跃线程数
 	std::atomic<size_t> m_idleThreadCount = {0};		// idle线程数
-	bool m_stopping = false;							// 是否正在停止
+	std::atomic<bool> m_stopping{true};					// 是否正在停止，start之后置为false
 	std::thread::id m_rootThread;						// 主线程id
 };
 }
\ No newline at end of file
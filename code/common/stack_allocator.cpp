@@ -0,0 +1,354 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "stack_allocator.h"
+#include "config.h"
+#include "macro.h"
+
+namespace myriel {
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+static ConfigVar<std::string>::ptr g_stack_allocator =
+	Config::Lookup("fiber.stack_allocator", std::string("pool"), "fiber stack allocator: malloc|mmap|pool");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_high_watermark =
+	Config::Lookup("fiber.stack_pool.high_watermark", (uint32_t)16, "max cached stacks per size class per thread");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_low_watermark =
+	Config::Lookup("fiber.stack_pool.low_watermark", (uint32_t)4, "cached stacks kept per size class per thread after flush");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_depot_max =
+	Config::Lookup("fiber.stack_pool.depot_max", (uint32_t)256, "max idle stacks per size class in global depot");
+
+// 配置项的缓存，避免在申请路径上加锁读取配置
+static std::atomic<uint32_t> s_high_watermark{16};
+static std::atomic<uint32_t> s_low_watermark{4};
+static std::atomic<uint32_t> s_depot_max{256};
+static std::atomic<StackAllocator *> s_default_allocator{nullptr};
+
+static MallocStackAllocator s_malloc_allocator;
+static MmapStackAllocator s_mmap_allocator;
+static PooledStackAllocator s_pooled_allocator;
+
+static StackAllocator *AllocatorFromName(const std::string &name) {
+	if(name == "malloc") {
+		return &s_malloc_allocator;
+	} else if(name == "mmap") {
+		return &s_mmap_allocator;
+	} else if(name == "pool") {
+		return &s_pooled_allocator;
+	}
+	LOG_ERROR(g_logger) << "unknown fiber.stack_allocator: " << name << ", use pool";
+	return &s_pooled_allocator;
+}
+
+struct StackAllocatorIniter {
+	StackAllocatorIniter() {
+		s_default_allocator = AllocatorFromName(g_stack_allocator->getValue());
+		s_high_watermark = g_stack_pool_high_watermark->getValue();
+		s_low_watermark = g_stack_pool_low_watermark->getValue();
+		s_depot_max = g_stack_pool_depot_max->getValue();
+
+		g_stack_allocator->addListener([](const std::string &old_value, const std::string &new_value) {
+			s_default_allocator = AllocatorFromName(new_value);
+		});
+		g_stack_pool_high_watermark->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+			s_high_watermark = new_value;
+		});
+		g_stack_pool_low_watermark->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+			s_low_watermark = new_value;
+		});
+		g_stack_pool_depot_max->addListener([](const uint32_t &old_value, const uint32_t &new_value) {
+			s_depot_max = new_value;
+		});
+	}
+};
+
+static StackAllocatorIniter s_stack_allocator_initer;
+
+StackAllocator *StackAllocator::GetDefault() {
+	StackAllocator *allocator = s_default_allocator.load(std::memory_order_relaxed);
+	// 其它编译单元的静态初始化期间本文件可能尚未初始化
+	return allocator ? allocator : &s_pooled_allocator;
+}
+
+void *MallocStackAllocator::alloc(size_t size) {
+	return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void *vp, size_t size) {
+	free(vp);
+}
+
+/*************************** mmap协程栈 ***************************/
+
+static size_t PageSize() {
+	static size_t s_page_size = sysconf(_SC_PAGESIZE);
+	return s_page_size;
+}
+
+/**
+ * @brief 申请栈空间，低地址额外映射一个保护页
+ *
+ * @return void* 保护页之上的栈底
+ */
+static void *MapStack(size_t size) {
+	size_t guard = PageSize();
+	size = (size + guard - 1) & ~(guard - 1);
+	char *base = (char *)mmap(nullptr, size + guard, PROT_READ | PROT_WRITE,
+							  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	ASSERT2(base != MAP_FAILED, "mmap fiber stack failed, size = " << size);
+	if(mprotect(base, guard, PROT_NONE)) {
+		ASSERT2(false, "mprotect fiber stack guard page failed");
+	}
+	return base + guard;
+}
+
+static void UnmapStack(void *vp, size_t size) {
+	size_t guard = PageSize();
+	size = (size + guard - 1) & ~(guard - 1);
+	munmap((char *)vp - guard, size + guard);
+}
+
+void *MmapStackAllocator::alloc(size_t size) {
+	return MapStack(size);
+}
+
+void MmapStackAllocator::dealloc(void *vp, size_t size) {
+	UnmapStack(vp, size);
+}
+
+size_t MmapStackAllocator::guardSize() const {
+	return PageSize();
+}
+
+/*************************** 协程栈池 ***************************/
+
+// size class从16KB到8MB，按2的幂分级
+static const size_t kMinClassShift = 14;
+static const size_t kClassCount = 10;
+
+static int SizeClass(size_t size) {
+	for(size_t i = 0; i < kClassCount; ++i) {
+		if(size <= ((size_t)1 << (kMinClassShift + i))) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static size_t ClassSize(int cls) {
+	return (size_t)1 << (kMinClassShift + cls);
+}
+
+static std::atomic<uint64_t> s_allocs{0};
+static std::atomic<uint64_t> s_thread_hits{0};
+static std::atomic<uint64_t> s_depot_hits{0};
+static std::atomic<uint64_t> s_misses{0};
+static std::atomic<uint64_t> s_frees{0};
+static std::atomic<uint64_t> s_released{0};
+static std::atomic<uint64_t> s_unmapped{0};
+static std::atomic<uint64_t> s_in_use_bytes{0};
+static std::atomic<uint64_t> s_thread_cached_bytes{0};
+static std::atomic<uint64_t> s_depot_bytes{0};
+static std::atomic<uint64_t> s_mapped_bytes{0};
+
+/**
+ * @brief 全局仓库，保存已归还物理页的空闲栈
+ */
+struct StackDepot {
+	std::mutex mutex;
+	std::vector<void *> stacks[kClassCount];
+};
+
+static StackDepot &GetDepot() {
+	static StackDepot s_depot;
+	return s_depot;
+}
+
+/**
+ * @brief 把栈放入全局仓库，仓库已满时直接释放
+ */
+static void PushToDepot(int cls, void **stacks, size_t n) {
+	size_t size = ClassSize(cls);
+	for(size_t i = 0; i < n; ++i) {
+		madvise(stacks[i], size, MADV_DONTNEED);
+	}
+	s_released.fetch_add(n, std::memory_order_relaxed);
+
+	size_t kept = 0;
+	{
+		StackDepot &depot = GetDepot();
+		std::lock_guard<std::mutex> locker(depot.mutex);
+		auto &list = depot.stacks[cls];
+		while(kept < n && list.size() < s_depot_max.load(std::memory_order_relaxed)) {
+			list.push_back(stacks[kept++]);
+		}
+		// 在锁内计数，避免其它线程先取走再扣减使计数暂时下溢
+		s_depot_bytes.fetch_add(kept * size, std::memory_order_relaxed);
+	}
+
+	for(size_t i = kept; i < n; ++i) {
+		UnmapStack(stacks[i], size);
+	}
+	s_unmapped.fetch_add(n - kept, std::memory_order_relaxed);
+	s_mapped_bytes.fetch_sub((n - kept) * size, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 线程缓存，线程退出时把缓存的栈交还仓库
+ */
+struct StackThreadCache {
+	std::vector<void *> stacks[kClassCount];
+
+	~StackThreadCache();
+};
+
+static thread_local bool t_cache_destroyed = false;
+static thread_local StackThreadCache t_cache;
+
+StackThreadCache::~StackThreadCache() {
+	t_cache_destroyed = true;
+	for(size_t i = 0; i < kClassCount; ++i) {
+		auto &list = stacks[i];
+		if(!list.empty()) {
+			s_thread_cached_bytes.fetch_sub(list.size() * ClassSize(i), std::memory_order_relaxed);
+			PushToDepot(i, list.data(), list.size());
+			list.clear();
+		}
+	}
+}
+
+void *PooledStackAllocator::alloc(size_t size) {
+	s_allocs.fetch_add(1, std::memory_order_relaxed);
+	int cls = SizeClass(size);
+	if(cls < 0) {
+		s_misses.fetch_add(1, std::memory_order_relaxed);
+		s_in_use_bytes.fetch_add(size, std::memory_order_relaxed);
+		s_mapped_bytes.fetch_add(size, std::memory_order_relaxed);
+		return MapStack(size);
+	}
+	size_t cls_size = ClassSize(cls);
+	s_in_use_bytes.fetch_add(cls_size, std::memory_order_relaxed);
+
+	if(MYRIEL_LIKELY(!t_cache_destroyed)) {
+		auto &list = t_cache.stacks[cls];
+		if(!list.empty()) {
+			void *vp = list.back();
+			list.pop_back();
+			s_thread_cached_bytes.fetch_sub(cls_size, std::memory_order_relaxed);
+			s_thread_hits.fetch_add(1, std::memory_order_relaxed);
+			return vp;
+		}
+	}
+
+	void *vp = nullptr;
+	{
+		StackDepot &depot = GetDepot();
+		std::lock_guard<std::mutex> locker(depot.mutex);
+		auto &depot_list = depot.stacks[cls];
+		if(!depot_list.empty()) {
+			vp = depot_list.back();
+			depot_list.pop_back();
+			s_depot_bytes.fetch_sub(cls_size, std::memory_order_relaxed);
+			// 顺便批量取回到低水位，摊薄加锁开销
+			if(!t_cache_destroyed) {
+				auto &list = t_cache.stacks[cls];
+				size_t low = s_low_watermark.load(std::memory_order_relaxed);
+				size_t moved = 0;
+				while(list.size() < low && !depot_list.empty()) {
+					list.push_back(depot_list.back());
+					depot_list.pop_back();
+					++moved;
+				}
+				s_thread_cached_bytes.fetch_add(moved * cls_size, std::memory_order_relaxed);
+				s_depot_bytes.fetch_sub(moved * cls_size, std::memory_order_relaxed);
+			}
+		}
+	}
+	if(vp) {
+		s_depot_hits.fetch_add(1, std::memory_order_relaxed);
+		return vp;
+	}
+
+	s_misses.fetch_add(1, std::memory_order_relaxed);
+	s_mapped_bytes.fetch_add(cls_size, std::memory_order_relaxed);
+	return MapStack(cls_size);
+}
+
+void PooledStackAllocator::dealloc(void *vp, size_t size) {
+	s_frees.fetch_add(1, std::memory_order_relaxed);
+	int cls = SizeClass(size);
+	if(cls < 0) {
+		s_in_use_bytes.fetch_sub(size, std::memory_order_relaxed);
+		s_unmapped.fetch_add(1, std::memory_order_relaxed);
+		s_mapped_bytes.fetch_sub(size, std::memory_order_relaxed);
+		UnmapStack(vp, size);
+		return;
+	}
+	size_t cls_size = ClassSize(cls);
+	s_in_use_bytes.fetch_sub(cls_size, std::memory_order_relaxed);
+
+	if(MYRIEL_UNLIKELY(t_cache_destroyed)) {
+		PushToDepot(cls, &vp, 1);
+		return;
+	}
+
+	auto &list = t_cache.stacks[cls];
+	list.push_back(vp);
+	s_thread_cached_bytes.fetch_add(cls_size, std::memory_order_relaxed);
+
+	size_t high = s_high_watermark.load(std::memory_order_relaxed);
+	if(list.size() > high) {
+		size_t low = std::min<size_t>(s_low_watermark.load(std::memory_order_relaxed), high);
+		size_t n = list.size() - low;
+		s_thread_cached_bytes.fetch_sub(n * cls_size, std::memory_order_relaxed);
+		PushToDepot(cls, list.data() + low, n);
+		list.resize(low);
+	}
+}
+
+size_t PooledStackAllocator::guardSize() const {
+	return PageSize();
+}
+
+StackPoolStats PooledStackAllocator::GetStats() {
+	StackPoolStats stats;
+	stats.allocs = s_allocs.load(std::memory_order_relaxed);
+	stats.threadHits = s_thread_hits.load(std::memory_order_relaxed);
+	stats.depotHits = s_depot_hits.load(std::memory_order_relaxed);
+	stats.misses = s_misses.load(std::memory_order_relaxed);
+	stats.frees = s_frees.load(std::memory_order_relaxed);
+	stats.released = s_released.load(std::memory_order_relaxed);
+	stats.unmapped = s_unmapped.load(std::memory_order_relaxed);
+	stats.inUseBytes = s_in_use_bytes.load(std::memory_order_relaxed);
+	stats.threadCachedBytes = s_thread_cached_bytes.load(std::memory_order_relaxed);
+	stats.depotBytes = s_depot_bytes.load(std::memory_order_relaxed);
+	stats.mappedBytes = s_mapped_bytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+std::string StackPoolStats::toString() const {
+	std::stringstream ss;
+	ss << "allocs=" << allocs
+	   << " thread_hits=" << threadHits
+	   << " depot_hits=" << depotHits
+	   << " misses=" << misses
+	   << " hit_rate=" << hitRate()
+	   << " frees=" << frees
+	   << " released=" << released
+	   << " unmapped=" << unmapped
+	   << " in_use_bytes=" << inUseBytes
+	   << " thread_cached_bytes=" << threadCachedBytes
+	   << " depot_bytes=" << depotBytes
+	   << " mapped_bytes=" << mappedBytes
+	   << " resident_bytes=" << residentBytes();
+	return ss.str();
+}
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace myriel {
+
+/**
+ * @brief 协程栈分配器接口
+ */
+class StackAllocator {
+public:
+	virtual ~StackAllocator() {}
+
+	/**
+	 * @brief 申请协程栈
+	 *
+	 * @param size 栈大小
+	 * @return void* 栈底(低地址)
+	 */
+	virtual void *alloc(size_t size) = 0;
+
+	/**
+	 * @brief 回收协程栈
+	 *
+	 * @param vp 栈底指针
+	 * @param size 申请时的栈大小
+	 */
+	virtual void dealloc(void *vp, size_t size) = 0;
+
+	/**
+	 * @brief 栈底之下保护页的大小，没有保护页时返回0
+	 */
+	virtual size_t guardSize() const { return 0; }
+
+	/**
+	 * @brief 获取配置项fiber.stack_allocator指定的分配器
+	 * @attention 协程需要保存申请时使用的分配器，运行期切换配置不影响已申请的栈
+	 */
+	static StackAllocator *GetDefault();
+};
+
+/**
+ * @brief 直接使用malloc/free的分配器
+ */
+class MallocStackAllocator : public StackAllocator {
+public:
+	void *alloc(size_t size) override;
+	void dealloc(void *vp, size_t size) override;
+};
+
+/**
+ * @brief 使用mmap申请协程栈，栈底之下保留一个PROT_NONE保护页
+ * @details 物理页在首次访问时才提交，预留较大的栈只占用实际访问过的内存；
+ * 			栈溢出会踩到保护页触发SIGSEGV，而不是悄悄破坏相邻的堆内存
+ */
+class MmapStackAllocator : public StackAllocator {
+public:
+	void *alloc(size_t size) override;
+	void dealloc(void *vp, size_t size) override;
+	size_t guardSize() const override;
+};
+
+/**
+ * @brief 协程栈池统计
+ */
+struct StackPoolStats {
+	uint64_t allocs = 0;				// 申请次数
+	uint64_t threadHits = 0;			// 线程缓存命中次数
+	uint64_t depotHits = 0;				// 全局仓库命中次数
+	uint64_t misses = 0;				// 向系统申请的次数
+	uint64_t frees = 0;					// 回收次数
+	uint64_t released = 0;				// madvise归还系统的栈数
+	uint64_t unmapped = 0;				// munmap的栈数
+	uint64_t inUseBytes = 0;			// 协程正在使用的字节数
+	uint64_t threadCachedBytes = 0;		// 线程缓存中的字节数
+	uint64_t depotBytes = 0;			// 全局仓库中的字节数(已归还物理页)
+	uint64_t mappedBytes = 0;			// 已mmap且未munmap的字节数，静止时等于以上三者之和
+
+	/**
+	 * @brief 命中率
+	 */
+	double hitRate() const {
+		return allocs ? (double)(threadHits + depotHits) / allocs : 0;
+	}
+
+	/**
+	 * @brief 常驻内存上界：使用中与线程缓存中的栈，仓库中的栈不占物理页
+	 */
+	uint64_t residentBytes() const { return inUseBytes + threadCachedBytes; }
+
+	std::string toString() const;
+};
+
+/**
+ * @brief 按大小分级的协程栈池
+ * @details 每个线程为每个size class维护一个空闲链表，超过高水位时把多余的栈
+ * 			降到低水位并转移到全局仓库；进入仓库的栈通过madvise(MADV_DONTNEED)
+ * 			归还物理页，仓库满后直接munmap。线程缓存为空时先从仓库批量取回。
+ * 			栈通过mmap申请，同样带有保护页。
+ */
+class PooledStackAllocator : public StackAllocator {
+public:
+	void *alloc(size_t size) override;
+	void dealloc(void *vp, size_t size) override;
+	size_t guardSize() const override;
+
+	/**
+	 * @brief 获取全局统计
+	 */
+	static StackPoolStats GetStats();
+};
+}
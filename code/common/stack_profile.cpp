@@ -0,0 +1,190 @@
+#include <cxxabi.h>
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include "stack_profile.h"
+#include "config.h"
+
+namespace myriel {
+
+static ConfigVar<bool>::ptr g_fiber_stack_profile =
+	Config::Lookup("fiber.stack_profile", false, "paint fiber stacks and record peak usage per entry point");
+
+// 配置项的缓存，避免创建协程时加锁读取配置
+static std::atomic<bool> s_stack_profile{false};
+
+struct StackProfileIniter {
+	StackProfileIniter() {
+		s_stack_profile = g_fiber_stack_profile->getValue();
+		g_fiber_stack_profile->addListener([](const bool &old_value, const bool &new_value) {
+			s_stack_profile = new_value;
+		});
+	}
+};
+
+static StackProfileIniter s_stack_profile_initer;
+
+// 哨兵值，避开0与常见的小整数，降低栈上数据恰好等于哨兵的概率
+static const uint64_t kStackCanary = 0xC5A3C5A3DEADBEEFull;
+
+void StackUsageHistogram::add(size_t used, size_t size) {
+	++count;
+	totalBytes += used;
+	maxBytes = std::max<uint64_t>(maxBytes, used);
+	stackSize = size;
+	size_t i = 0;
+	while(i + 1 < kBuckets && used >= BucketUpper(i)) {
+		++i;
+	}
+	++buckets[i];
+}
+
+uint64_t StackUsageHistogram::BucketUpper(size_t i) {
+	return i + 1 < kBuckets ? (uint64_t)1024 << i : UINT64_MAX;
+}
+
+uint64_t StackUsageHistogram::percentile(double p) const {
+	uint64_t target = (uint64_t)(count * p / 100 + 0.5);
+	uint64_t seen = 0;
+	for(size_t i = 0; i < kBuckets; ++i) {
+		seen += buckets[i];
+		if(seen >= target && seen) {
+			return std::min(BucketUpper(i), stackSize);
+		}
+	}
+	return maxBytes;
+}
+
+std::string StackUsageHistogram::toString() const {
+	std::stringstream ss;
+	ss << "count=" << count
+	   << " avg=" << (uint64_t)avgBytes()
+	   << " p50<" << percentile(50)
+	   << " p99<" << percentile(99)
+	   << " max=" << maxBytes
+	   << " stack_size=" << stackSize;
+	return ss.str();
+}
+
+bool StackProfiler::IsEnabled() {
+	return s_stack_profile.load(std::memory_order_relaxed);
+}
+
+void StackProfiler::Paint(void *begin, size_t size) {
+	uint64_t *p = (uint64_t *)begin;
+	std::fill(p, p + size / sizeof(uint64_t), kStackCanary);
+}
+
+size_t StackProfiler::Measure(const void *stack, size_t size) {
+	const uint64_t *p = (const uint64_t *)stack;
+	const uint64_t *end = p + size / sizeof(uint64_t);
+	while(p < end && *p == kStackCanary) {
+		++p;
+	}
+	return (const char *)stack + size - (const char *)p;
+}
+
+static std::string Demangle(const char *name) {
+	int status = 0;
+	char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+	if(status != 0 || !demangled) {
+		return name;
+	}
+	std::string result(demangled);
+	free(demangled);
+	return result;
+}
+
+/**
+ * @brief 入口名称：函数指针取符号名，其它可调用对象取类型名，
+ * 		  每个lambda都有独立的类型，相当于按定义处区分
+ */
+static std::string EntryName(const std::function<void()> &entry) {
+	if(!entry) {
+		return "<empty>";
+	}
+	if(auto fn = entry.target<void (*)()>()) {
+		Dl_info info;
+		if(dladdr((void *)*fn, &info) && info.dli_sname) {
+			return Demangle(info.dli_sname);
+		}
+		std::stringstream ss;
+		ss << "fn@" << (void *)*fn;
+		return ss.str();
+	}
+	return Demangle(entry.target_type().name());
+}
+
+struct StackProfileData {
+	std::mutex mutex;
+	std::map<std::string, StackUsageHistogram> histograms;
+	// 类型名的缓存，避免每个协程结束时都做一次demangle
+	std::unordered_map<std::type_index, std::string> names;
+};
+
+static StackProfileData &GetProfileData() {
+	static StackProfileData s_data;
+	return s_data;
+}
+
+void StackProfiler::Record(const std::function<void()> &entry, size_t used, size_t size) {
+	StackProfileData &data = GetProfileData();
+	std::lock_guard<std::mutex> locker(data.mutex);
+	if(entry && !entry.target<void (*)()>()) {
+		auto it = data.names.find(entry.target_type());
+		if(it == data.names.end()) {
+			it = data.names.emplace(entry.target_type(), EntryName(entry)).first;
+		}
+		data.histograms[it->second].add(used, size);
+	} else {
+		data.histograms[EntryName(entry)].add(used, size);
+	}
+}
+
+std::map<std::string, StackUsageHistogram> StackProfiler::GetProfile() {
+	StackProfileData &data = GetProfileData();
+	std::lock_guard<std::mutex> locker(data.mutex);
+	return data.histograms;
+}
+
+std::string StackProfiler::Dump() {
+	auto profile = GetProfile();
+	std::vector<std::pair<std::string, StackUsageHistogram>> entries(profile.begin(), profile.end());
+	std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+		return a.second.maxBytes > b.second.maxBytes;
+	});
+
+	std::stringstream ss;
+	ss << "fiber stack usage by entry (" << entries.size() << " entries)\n";
+	for(auto &i : entries) {
+		ss << "  " << i.first << "\n    " << i.second.toString() << "\n    buckets:";
+		for(size_t b = 0; b < StackUsageHistogram::kBuckets; ++b) {
+			if(i.second.buckets[b]) {
+				ss << " <";
+				uint64_t upper = StackUsageHistogram::BucketUpper(b);
+				if(upper == UINT64_MAX) {
+					ss << "inf";
+				} else {
+					ss << upper / 1024 << "K";
+				}
+				ss << ":" << i.second.buckets[b];
+			}
+		}
+		ss << "\n";
+	}
+	return ss.str();
+}
+
+void StackProfiler::Clear() {
+	StackProfileData &data = GetProfileData();
+	std::lock_guard<std::mutex> locker(data.mutex);
+	data.histograms.clear();
+}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace myriel {
+
+/**
+ * @brief 某个入口函数的协程栈峰值用量直方图
+ * @details 第0个桶为[0, 1KB)，第i个桶为[2^(i-1)KB, 2^i KB)，最后一个桶不设上界
+ */
+struct StackUsageHistogram {
+	static const size_t kBuckets = 16;
+
+	uint64_t count = 0;					// 统计的协程数
+	uint64_t totalBytes = 0;			// 峰值用量之和
+	uint64_t maxBytes = 0;				// 最大峰值用量
+	uint64_t stackSize = 0;				// 协程栈大小(取最近一次)
+	uint64_t buckets[kBuckets] = {};	// 各区间的协程数
+
+	void add(size_t used, size_t size);
+
+	double avgBytes() const { return count ? (double)totalBytes / count : 0; }
+
+	/**
+	 * @brief 百分位数，返回所在桶的上界
+	 *
+	 * @param p 百分比，取值(0, 100]
+	 */
+	uint64_t percentile(double p) const;
+
+	/**
+	 * @brief 桶的上界(不含)，最后一个桶返回UINT64_MAX
+	 */
+	static uint64_t BucketUpper(size_t i);
+
+	std::string toString() const;
+};
+
+/**
+ * @brief 协程栈峰值用量分析
+ * @details 开启配置项fiber.stack_profile后，新建协程的栈在申请后整体填充哨兵值，
+ * 			协程进入TERM时从栈底向上扫描第一个被改写的位置得到峰值用量，
+ * 			按入口函数(协程函数的类型，lambda对应定义处)汇总为直方图。
+ * @attention 填充会提交整个栈的物理页，抵消mmap栈按需提交的效果，只用于分析
+ */
+class StackProfiler {
+public:
+	/**
+	 * @brief 是否开启，对开启之后新建的协程生效
+	 */
+	static bool IsEnabled();
+
+	/**
+	 * @brief 用哨兵值填充[begin, begin + size)
+	 */
+	static void Paint(void *begin, size_t size);
+
+	/**
+	 * @brief 测量已使用的栈大小，即栈顶到最低一个被改写位置的距离
+	 *
+	 * @param stack 栈底(低地址)
+	 * @param size 栈大小
+	 */
+	static size_t Measure(const void *stack, size_t size);
+
+	/**
+	 * @brief 记录一次峰值用量
+	 *
+	 * @param entry 协程函数，用于区分入口
+	 */
+	static void Record(const std::function<void()> &entry, size_t used, size_t size);
+
+	/**
+	 * @brief 获取各入口的直方图
+	 */
+	static std::map<std::string, StackUsageHistogram> GetProfile();
+
+	/**
+	 * @brief 按最大峰值降序输出的报表
+	 */
+	static std::string Dump();
+
+	/**
+	 * @brief 清空统计
+	 */
+	static void Clear();
+};
+}
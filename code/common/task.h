@@ -0,0 +1,325 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include "scheduler.h"
+#include "iomanager.h"
+#include "fiber_future.h"
+
+namespace myriel {
+
+template<class T> class Task;
+
+namespace detail {
+
+/**
+ * @brief Task结束时恢复等待它的协程，没有等待者时停在结束点
+ */
+struct TaskFinalAwaiter {
+	bool await_ready() const noexcept { return false; }
+
+	template<class Promise>
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+		std::coroutine_handle<> continuation = h.promise().continuation;
+		return continuation ? continuation : std::noop_coroutine();
+	}
+
+	void await_resume() const noexcept {}
+};
+
+class TaskPromiseBase {
+public:
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	TaskFinalAwaiter final_suspend() const noexcept { return {}; }
+	void unhandled_exception() { m_exception = std::current_exception(); }
+
+	void rethrowIfFailed() const {
+		if(m_exception) {
+			std::rethrow_exception(m_exception);
+		}
+	}
+
+public:
+	std::coroutine_handle<> continuation;		// 等待该Task的协程
+
+private:
+	std::exception_ptr m_exception;
+};
+
+template<class T>
+class TaskPromise : public TaskPromiseBase {
+public:
+	Task<T> get_return_object();
+
+	template<class U>
+	void return_value(U &&value) { m_value.emplace(std::forward<U>(value)); }
+
+	T takeValue() {
+		rethrowIfFailed();
+		return std::move(*m_value);
+	}
+
+private:
+	std::optional<T> m_value;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+	Task<void> get_return_object();
+
+	void return_void() {}
+
+	void takeValue() { rethrowIfFailed(); }
+};
+}
+
+/**
+ * @brief 基于C++20无栈协程的异步任务
+ * @details 惰性启动：被co_await时才开始执行，结束时通过对称转移直接恢复等待方，
+ * 			不经过调度器；只有co_await Yield()、Sleep()、WaitReadable()、FiberFuture等会挂起到调度器，
+ * 			由Scheduler的工作线程在调度协程上直接恢复，不需要独立的协程栈。
+ * 			顶层任务通过CoSpawn交给调度器运行。
+ * @attention 协程帧中不能使用FiberLocal；在Task中使用FiberMutex等会阻塞调度线程
+ *
+ * @tparam T 结果类型，可以是void
+ */
+template<class T = void>
+class Task {
+public:
+	using promise_type = detail::TaskPromise<T>;
+	using handle_type = std::coroutine_handle<promise_type>;
+
+	Task() = default;
+	explicit Task(handle_type handle) : m_handle(handle) {}
+
+	Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+	Task &operator=(Task &&other) noexcept {
+		if(this != &other) {
+			if(m_handle) {
+				m_handle.destroy();
+			}
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	~Task() {
+		if(m_handle) {
+			m_handle.destroy();
+		}
+	}
+
+	bool valid() const { return (bool)m_handle; }
+
+	/**
+	 * @brief 等待该任务：挂起当前协程并开始执行任务，任务结束后恢复当前协程
+	 */
+	auto operator co_await() && noexcept {
+		struct Awaiter {
+			handle_type handle;
+
+			bool await_ready() const noexcept { return !handle || handle.done(); }
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+				handle.promise().continuation = awaiting;
+				return handle;
+			}
+
+			T await_resume() { return handle.promise().takeValue(); }
+		};
+		return Awaiter{m_handle};
+	}
+
+private:
+	handle_type m_handle;
+};
+
+namespace detail {
+
+template<class T>
+Task<T> TaskPromise<T>::get_return_object() {
+	return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+	return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ * @brief 把协程交给调度器恢复，没有调度器时直接在当前上下文恢复
+ */
+inline void ResumeOn(Scheduler *scheduler, std::coroutine_handle<> handle) {
+	if(scheduler) {
+		scheduler->schedule(handle);
+	} else {
+		handle.resume();
+	}
+}
+
+/**
+ * @brief 自行销毁的顶层协程，用于CoSpawn
+ */
+struct DetachedTask {
+	struct promise_type {
+		DetachedTask get_return_object() {
+			return DetachedTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		std::suspend_never final_suspend() const noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+template<class T>
+DetachedTask RunDetached(Task<T> task, FiberPromise<T> promise) {
+	try {
+		if constexpr (std::is_void<T>::value) {
+			co_await std::move(task);
+			promise.setValue();
+		} else {
+			promise.setValue(co_await std::move(task));
+		}
+	} catch (...) {
+		promise.setException(std::current_exception());
+	}
+}
+
+template<class T>
+struct FutureAwaiter {
+	FiberFuture<T> future;
+
+	bool await_ready() const { return future.isReady(); }
+
+	void await_suspend(std::coroutine_handle<> handle) {
+		Scheduler *scheduler = Scheduler::GetThis();
+		// 回调可能立即在其它线程恢复协程，本对象位于协程帧内，之后不能再访问
+		future.onReady([scheduler, handle]() { ResumeOn(scheduler, handle); });
+	}
+
+	T await_resume() {
+		if constexpr (std::is_void<T>::value) {
+			future.get();
+		} else {
+			return future.get();
+		}
+	}
+};
+}
+
+/**
+ * @brief 在调度器上运行顶层任务
+ *
+ * @return 任务结果的future，可以在协程、线程或其它Task中等待
+ */
+template<class T>
+FiberFuture<T> CoSpawn(Scheduler *scheduler, Task<T> task, std::thread::id thread = std::thread::id()) {
+	FiberPromise<T> promise;
+	FiberFuture<T> future = promise.getFuture();
+	detail::DetachedTask detached = detail::RunDetached(std::move(task), promise);
+	scheduler->schedule(std::coroutine_handle<>(detached.handle), thread);
+	return future;
+}
+
+/**
+ * @brief co_await Yield()：重新排到调度器的任务队列末尾，让出调度线程
+ */
+inline auto Yield() {
+	struct Awaiter {
+		bool await_ready() const noexcept { return Scheduler::GetThis() == nullptr; }
+		void await_suspend(std::coroutine_handle<> handle) const {
+			Scheduler::GetThis()->schedule(handle);
+		}
+		void await_resume() const noexcept {}
+	};
+	return Awaiter{};
+}
+
+namespace detail {
+
+struct SleepAwaiter {
+	uint64_t ms;
+
+	bool await_ready() const noexcept { return ms == 0; }
+
+	bool await_suspend(std::coroutine_handle<> handle) const {
+		IOManager *iom = IOManager::GetThis();
+		if(!iom) {
+			// 不在IO调度器中时没有定时器可用，阻塞当前线程后不挂起，
+			// 由协程自身继续执行，避免在await_suspend中恢复导致栈不断加深
+			std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+			return false;
+		}
+		// 定时器回调由调度器执行，直接在其中恢复
+		iom->addTimer(ms, [handle]() { handle.resume(); });
+		return true;
+	}
+
+	void await_resume() const noexcept {}
+};
+
+struct IOEventAwaiter {
+	int fd;
+	IOManager::Event event;
+	bool ok = true;
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> handle) {
+		IOManager *iom = IOManager::GetThis();
+		// 事件可能在addEvent返回前就在其它线程触发并恢复协程，注册成功后不能再访问本对象
+		if(!iom || iom->addEvent(fd, event, [handle]() { handle.resume(); })) {
+			ok = false;
+			return false;
+		}
+		return true;
+	}
+
+	bool await_resume() const noexcept { return ok; }
+};
+}
+
+/**
+ * @brief co_await Sleep(ms)：挂起ms毫秒后由IO调度器的定时器恢复，不占用调度线程
+ * @details 不在IOManager中时阻塞当前线程
+ */
+inline detail::SleepAwaiter Sleep(uint64_t ms) {
+	return detail::SleepAwaiter{ms};
+}
+
+/**
+ * @brief co_await WaitReadable(fd)：挂起直到fd可读
+ * @details 与IOManager::addEvent相同，事件是一次性的，同一fd上同一事件同时只能有一个等待者
+ *
+ * @return 注册事件失败(不在IOManager中，或已有等待者)时不挂起，返回false
+ */
+inline detail::IOEventAwaiter WaitReadable(int fd) {
+	return detail::IOEventAwaiter{fd, IOManager::READ};
+}
+
+/**
+ * @brief co_await WaitWritable(fd)：挂起直到fd可写，同WaitReadable
+ */
+inline detail::IOEventAwaiter WaitWritable(int fd) {
+	return detail::IOEventAwaiter{fd, IOManager::WRITE};
+}
+
+/**
+ * @brief co_await FiberFuture：未就绪时挂起，就绪后由调度器恢复
+ */
+template<class T>
+detail::FutureAwaiter<T> operator co_await(FiberFuture<T> future) {
+	return detail::FutureAwaiter<T>{std::move(future)};
+}
+}
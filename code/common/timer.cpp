@@ -0,0 +1,344 @@
+#include "timer.h"
+#include "utils.h"
+#include "macro.h"
+
+namespace myriel {
+
+/**
+ * @brief 第level层(level >= 1)最低位在时间中的偏移
+ */
+static inline uint32_t LevelShift(int level) {
+	return 8 + 6 * (level - 1);
+}
+
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager)
+	: m_recurring(recurring), m_ms(ms), m_cb(std::move(cb)), m_manager(manager) {
+	m_next = GetElapsedMS() + m_ms;
+}
+
+bool Timer::cancel() {
+	TimerManager *manager = m_manager.load(std::memory_order_acquire);
+	if(!manager) {
+		return false;
+	}
+	Timer::ptr self;
+	std::lock_guard<std::mutex> locker(manager->m_mutex);
+	if(m_level < 0 || !m_cb) {
+		return false;
+	}
+	m_cb = nullptr;
+	manager->unlink(this);
+	--manager->m_count;
+	m_manager.store(nullptr, std::memory_order_release);
+	// 解锁之后再释放，析构可能发生在这里
+	self.swap(m_self);
+	return true;
+}
+
+bool Timer::refresh() {
+	TimerManager *manager = m_manager.load(std::memory_order_acquire);
+	if(!manager) {
+		return false;
+	}
+	std::lock_guard<std::mutex> locker(manager->m_mutex);
+	if(m_level < 0 || !m_cb) {
+		return false;
+	}
+	manager->unlink(this);
+	m_next = GetElapsedMS() + m_ms;
+	manager->insert(this);
+	return true;
+}
+
+bool Timer::reset(uint64_t ms, bool from_now) {
+	if(ms == m_ms && !from_now) {
+		return true;
+	}
+	TimerManager *manager = m_manager.load(std::memory_order_acquire);
+	if(!manager) {
+		return false;
+	}
+	bool at_front = false; {
+		std::lock_guard<std::mutex> locker(manager->m_mutex);
+		if(m_level < 0 || !m_cb) {
+			return false;
+		}
+		manager->unlink(this);
+		uint64_t start = from_now ? GetElapsedMS() : m_next - m_ms;
+		m_ms = ms;
+		m_next = start + m_ms;
+		manager->insert(this);
+		at_front = manager->markFront(m_next);
+	}
+	if(at_front) {
+		manager->onTimerInsertedAtFront();
+	}
+	return true;
+}
+
+TimerManager::TimerManager() {
+	m_current = GetElapsedMS();
+}
+
+TimerManager::~TimerManager() {
+	std::vector<Timer::ptr> timers; {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		auto release = [&timers](Slot &slot) {
+			for(Timer *timer = slot.head; timer; timer = timer->m_nextNode) {
+				timer->m_level = -1;
+				timer->m_cb = nullptr;
+				timer->m_manager.store(nullptr, std::memory_order_release);
+				timers.push_back(std::move(timer->m_self));
+			}
+			slot.head = nullptr;
+		};
+		for(auto &slot : m_level0) {
+			release(slot);
+		}
+		for(auto &level : m_levels) {
+			for(auto &slot : level) {
+				release(slot);
+			}
+		}
+		release(m_overflow);
+		release(m_due);
+	}
+}
+
+Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
+	Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+	bool at_front = false; {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		timer->m_self = timer;
+		insert(timer.get());
+		at_front = markFront(timer->m_next);
+		++m_count;
+	}
+	if(at_front) {
+		onTimerInsertedAtFront();
+	}
+	return timer;
+}
+
+/**
+ * @brief 条件对象仍然存在时才执行回调
+ */
+static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
+	std::shared_ptr<void> tmp = weak_cond.lock();
+	if(tmp) {
+		cb();
+	}
+}
+
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb,
+										   std::weak_ptr<void> cond, bool recurring) {
+	return addTimer(ms, std::bind(&OnTimer, cond, cb), recurring);
+}
+
+uint64_t TimerManager::getNextTimer() {
+	std::lock_guard<std::mutex> locker(m_mutex);
+	uint64_t next = nextTick();
+	m_sleepUntil = next;
+	if(next == ~0ull) {
+		return ~0ull;
+	}
+	uint64_t now = GetElapsedMS();
+	return next > now ? next - now : 0;
+}
+
+void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs) {
+	listExpiredCb(cbs, GetElapsedMS());
+}
+
+void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs, uint64_t now_ms) {
+	std::vector<Timer *> expired;
+	std::vector<Timer::ptr> released; {
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if(m_count == 0) {
+			m_current = std::max(m_current, now_ms);
+			return;
+		}
+		advance(now_ms, expired);
+		uint64_t now = std::max(now_ms, m_current);
+		cbs.reserve(cbs.size() + expired.size());
+		for(Timer *timer : expired) {
+			if(timer->m_recurring) {
+				cbs.push_back(timer->m_cb);
+				timer->m_next = now + timer->m_ms;
+				insert(timer);
+			} else {
+				cbs.push_back(std::move(timer->m_cb));
+				timer->m_cb = nullptr;
+				timer->m_manager.store(nullptr, std::memory_order_release);
+				--m_count;
+				released.push_back(std::move(timer->m_self));
+			}
+		}
+	}
+}
+
+bool TimerManager::hasTimer() {
+	std::lock_guard<std::mutex> locker(m_mutex);
+	return m_count > 0;
+}
+
+size_t TimerManager::getTimerCount() {
+	std::lock_guard<std::mutex> locker(m_mutex);
+	return m_count;
+}
+
+void TimerManager::pushSlot(Slot &slot, Timer *timer) {
+	timer->m_prevNode = nullptr;
+	timer->m_nextNode = slot.head;
+	if(slot.head) {
+		slot.head->m_prevNode = timer;
+	}
+	slot.head = timer;
+}
+
+void TimerManager::insert(Timer *timer) {
+	uint64_t expires = timer->m_next;
+	if(expires <= m_current) {
+		timer->m_level = kDue;
+		timer->m_index = 0;
+		pushSlot(m_due, timer);
+	} else if((expires >> kLevel0Bits) == (m_current >> kLevel0Bits)) {
+		// 与当前时刻在同一个256毫秒的区间内，槽位下标一定大于当前下标
+		uint32_t index = expires & ((1 << kLevel0Bits) - 1);
+		timer->m_level = 0;
+		timer->m_index = index;
+		pushSlot(m_level0[index], timer);
+		m_level0Bits[index / 64] |= 1ull << (index % 64);
+	} else {
+		timer->m_level = kOverflow;
+		for(int level = 1; level < kLevels; ++level) {
+			uint32_t shift = LevelShift(level);
+			if((expires >> (shift + kLevelBits)) == (m_current >> (shift + kLevelBits))) {
+				uint32_t index = (expires >> shift) & ((1 << kLevelBits) - 1);
+				timer->m_level = level;
+				timer->m_index = index;
+				pushSlot(m_levels[level - 1][index], timer);
+				m_levelBits[level - 1] |= 1ull << index;
+				break;
+			}
+		}
+		if(timer->m_level == kOverflow) {
+			timer->m_index = 0;
+			pushSlot(m_overflow, timer);
+		}
+	}
+}
+
+bool TimerManager::markFront(uint64_t expires) {
+	if(expires < m_sleepUntil) {
+		m_sleepUntil = expires;
+		return true;
+	}
+	return false;
+}
+
+void TimerManager::unlink(Timer *timer) {
+	Slot *slot = nullptr;
+	if(timer->m_level == 0) {
+		slot = &m_level0[timer->m_index];
+	} else if(timer->m_level < kLevels) {
+		slot = &m_levels[timer->m_level - 1][timer->m_index];
+	} else if(timer->m_level == kOverflow) {
+		slot = &m_overflow;
+	} else {
+		slot = &m_due;
+	}
+
+	if(timer->m_prevNode) {
+		timer->m_prevNode->m_nextNode = timer->m_nextNode;
+	} else {
+		slot->head = timer->m_nextNode;
+	}
+	if(timer->m_nextNode) {
+		timer->m_nextNode->m_prevNode = timer->m_prevNode;
+	}
+	if(!slot->head) {
+		if(timer->m_level == 0) {
+			m_level0Bits[timer->m_index / 64] &= ~(1ull << (timer->m_index % 64));
+		} else if(timer->m_level < kLevels) {
+			m_levelBits[timer->m_level - 1] &= ~(1ull << timer->m_index);
+		}
+	}
+	timer->m_prevNode = nullptr;
+	timer->m_nextNode = nullptr;
+	timer->m_level = -1;
+}
+
+uint64_t TimerManager::nextTick() const {
+	if(m_due.head) {
+		return m_current;
+	}
+
+	// 第0层中当前下标之后的槽位
+	uint32_t index = m_current & ((1 << kLevel0Bits) - 1);
+	for(uint32_t word = index / 64; word < (1 << kLevel0Bits) / 64; ++word) {
+		uint64_t bits = m_level0Bits[word];
+		if(word == index / 64) {
+			bits &= (~0ull << (index % 64)) << 1;
+		}
+		if(bits) {
+			return (m_current & ~(uint64_t)((1 << kLevel0Bits) - 1)) + word * 64 + __builtin_ctzll(bits);
+		}
+	}
+
+	// 上层槽位的起点，层越高越晚
+	for(int level = 1; level < kLevels; ++level) {
+		uint32_t shift = LevelShift(level);
+		uint32_t cur = (m_current >> shift) & ((1 << kLevelBits) - 1);
+		uint64_t bits = m_levelBits[level - 1] & ((~0ull << cur) << 1);
+		if(bits) {
+			uint64_t base = (m_current >> (shift + kLevelBits)) << (shift + kLevelBits);
+			return base + ((uint64_t)__builtin_ctzll(bits) << shift);
+		}
+	}
+
+	if(m_overflow.head) {
+		uint32_t shift = LevelShift(kLevels);
+		return ((m_current >> shift) + 1) << shift;
+	}
+	return ~0ull;
+}
+
+void TimerManager::advance(uint64_t now, std::vector<Timer *> &expired) {
+	std::vector<Timer *> moving;
+	auto take_all = [this](Slot &slot, std::vector<Timer *> &out) {
+		while(Timer *timer = slot.head) {
+			unlink(timer);
+			out.push_back(timer);
+		}
+	};
+
+	while(true) {
+		take_all(m_due, expired);
+		uint64_t next = nextTick();
+		if(next > now) {
+			break;
+		}
+		m_current = next;
+
+		// 从高到低下放起点恰好是当前时刻的槽位
+		moving.clear();
+		uint32_t top = LevelShift(kLevels);
+		if((next & ((1ull << top) - 1)) == 0) {
+			take_all(m_overflow, moving);
+		}
+		for(int level = kLevels - 1; level >= 1; --level) {
+			uint32_t shift = LevelShift(level);
+			if((next & ((1ull << shift) - 1)) == 0) {
+				take_all(m_levels[level - 1][(next >> shift) & ((1 << kLevelBits) - 1)], moving);
+			}
+		}
+		for(Timer *timer : moving) {
+			insert(timer);
+		}
+
+		take_all(m_level0[next & ((1 << kLevel0Bits) - 1)], expired);
+	}
+	m_current = std::max(m_current, now);
+}
+}
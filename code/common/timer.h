@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace myriel {
+class TimerManager;
+
+/**
+ * @brief 定时器
+ * @details 由TimerManager::addTimer创建，挂在时间轮上期间由时间轮持有一份引用，
+ * 			触发(非循环)或取消后释放。离开时间轮(包括管理器析构)时与管理器解除关联，
+ * 			之后的操作都返回false，定时器可以比管理器活得更久
+ */
+class Timer : public std::enable_shared_from_this<Timer> {
+friend class TimerManager;
+public:
+	using ptr = std::shared_ptr<Timer>;
+
+	/**
+	 * @brief 取消定时器
+	 *
+	 * @return 定时器已触发或已取消时返回false
+	 */
+	bool cancel();
+
+	/**
+	 * @brief 从现在开始重新计时
+	 */
+	bool refresh();
+
+	/**
+	 * @brief 重新设置定时器的时间间隔
+	 *
+	 * @param ms 新的时间间隔(毫秒)
+	 * @param from_now 是否从现在开始计时，否则从上次开始计时的时刻算起
+	 */
+	bool reset(uint64_t ms, bool from_now);
+
+private:
+	Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager);
+
+private:
+	bool m_recurring = false;			// 是否循环
+	uint64_t m_ms = 0;					// 时间间隔(毫秒)
+	uint64_t m_next = 0;				// 到期时刻，GetElapsedMS的时间基准
+	std::function<void()> m_cb;			// 回调
+	std::atomic<TimerManager *> m_manager{nullptr};	// 所属的管理器，离开时间轮后为空
+
+	Timer *m_prevNode = nullptr;		// 所在槽位链表的前驱
+	Timer *m_nextNode = nullptr;		// 所在槽位链表的后继
+	int m_level = -1;					// 所在的层，不在时间轮上时为-1
+	uint32_t m_index = 0;				// 所在层的槽位下标
+	Timer::ptr m_self;					// 挂在时间轮上时持有自身，保证回调前不被释放
+};
+
+/**
+ * @brief 定时器管理器，基于分层时间轮
+ * @details 时间精度1毫秒。第0层256个槽，第1~4层各64个槽，共覆盖2^32毫秒(约49天)，
+ * 			更远的定时器放在溢出链表中，每2^32毫秒重新分配一次。
+ * 			定时器与当前时刻的高位相同的最高层决定它所在的层，时间推进到上一层槽位的起点时
+ * 			把槽中的定时器逐级下放，添加与取消均为O(1)。
+ * 			每层用位图记录非空槽位，可以直接算出下一个需要处理的时刻，
+ * 			推进时跳过空槽，不需要逐毫秒转动。
+ */
+class TimerManager {
+friend class Timer;
+public:
+	TimerManager();
+	virtual ~TimerManager();
+
+	/**
+	 * @brief 添加定时器
+	 *
+	 * @param ms 时间间隔(毫秒)
+	 * @param cb 回调函数
+	 * @param recurring 是否循环
+	 */
+	Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+
+	/**
+	 * @brief 添加条件定时器，触发时条件对象已经释放则不执行回调
+	 *
+	 * @param cond 条件对象
+	 */
+	Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
+								 std::weak_ptr<void> cond, bool recurring = false);
+
+	/**
+	 * @brief 距离下一次需要处理定时器的毫秒数
+	 * @details 可能早于最近的定时器到期时刻(需要下放上层槽位时)，不会晚于它
+	 *
+	 * @return 没有定时器时返回~0ull
+	 */
+	uint64_t getNextTimer();
+
+	/**
+	 * @brief 取出已到期的定时器回调，循环定时器重新计时
+	 */
+	void listExpiredCb(std::vector<std::function<void()>> &cbs);
+
+	/**
+	 * @brief 以指定时刻为当前时间取出到期的回调
+	 *
+	 * @param now_ms GetElapsedMS的时间基准，早于上一次推进的时刻时不会回退
+	 */
+	void listExpiredCb(std::vector<std::function<void()>> &cbs, uint64_t now_ms);
+
+	/**
+	 * @brief 是否有定时器
+	 */
+	bool hasTimer();
+
+	/**
+	 * @brief 定时器个数
+	 */
+	size_t getTimerCount();
+
+protected:
+	/**
+	 * @brief 新添加的定时器早于等待方已知的下一次处理时刻，需要唤醒等待方重新计算
+	 */
+	virtual void onTimerInsertedAtFront() = 0;
+
+private:
+	/**
+	 * @brief 槽位，定时器的侵入式双向链表
+	 */
+	struct Slot {
+		Timer *head = nullptr;
+	};
+
+	/**
+	 * @brief 把定时器放到对应的槽位，调用方持有m_mutex
+	 */
+	void insert(Timer *timer);
+
+	/**
+	 * @brief 到期时刻早于等待方已知的下一次处理时刻时更新该时刻，调用方持有m_mutex
+	 *
+	 * @return 是否需要通知等待方
+	 */
+	bool markFront(uint64_t expires);
+
+	/**
+	 * @brief 把定时器从所在槽位摘下，调用方持有m_mutex
+	 */
+	void unlink(Timer *timer);
+
+	/**
+	 * @brief 下一个需要处理的时刻，调用方持有m_mutex
+	 *
+	 * @return 没有定时器时返回~0ull
+	 */
+	uint64_t nextTick() const;
+
+	/**
+	 * @brief 推进到now，到期的定时器放入expired，调用方持有m_mutex
+	 */
+	void advance(uint64_t now, std::vector<Timer *> &expired);
+
+	void pushSlot(Slot &slot, Timer *timer);
+
+private:
+	static constexpr int kLevels = 5;						// 时间轮层数
+	static constexpr int kOverflow = kLevels;				// 溢出链表的层号
+	static constexpr int kDue = kLevels + 1;				// 已到期链表的层号
+	static constexpr uint32_t kLevel0Bits = 8;				// 第0层256个槽
+	static constexpr uint32_t kLevelBits = 6;				// 其余各层64个槽
+
+	std::mutex m_mutex;
+	uint64_t m_current = 0;									// 时间轮当前时刻
+	uint64_t m_sleepUntil = ~0ull;							// 等待方已知的下一次处理时刻
+	size_t m_count = 0;										// 定时器个数
+	Slot m_level0[1 << kLevel0Bits];						// 第0层
+	Slot m_levels[kLevels - 1][1 << kLevelBits];			// 第1~4层
+	uint64_t m_level0Bits[(1 << kLevel0Bits) / 64] = {};	// 第0层的非空槽位图
+	uint64_t m_levelBits[kLevels - 1] = {};					// 第1~4层的非空槽位图
+	Slot m_overflow;										// 超出时间轮范围的定时器
+	Slot m_due;												// 添加时已经到期的定时器
+};
+}
@@ -1,3 +1,5 @@
+#include <time.h>
+
 #include "log.h"
 
 namespace myriel {
@@ -8,6 +10,12 @@ long GetThreadID() {
 	return syscall(SYS_gettid);
 }
 
+uint64_t GetElapsedMS() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
 // 不要在栈上分配很大的内存空间
 void Backtrace(std::vector<std::string>& bt, int size, int skip) {
 	void **array = (void **)malloc((sizeof(void *) * size));
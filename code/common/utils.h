@@ -20,6 +20,11 @@ namespace myriel {
  */
 long GetThreadID();
 
+/**
+ * @brief 单调时钟的毫秒数，不受系统时间调整影响
+ */
+uint64_t GetElapsedMS();
+
 // 不要在栈上分配很大的内存空间
 void Backtrace(std::vector<std::string> &bt, int size = 64, int skip = 1);
 
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace myriel {
+
+/**
+ * @brief Chase-Lev工作窃取队列，元素为指针
+ * @details 基于可扩容的环形数组(Chase & Lev 2005，内存序参照Lê et al. 2013)。
+ * 			只有所属线程可以push，底部入队无需原子读改写；所属线程与窃取线程都从顶部
+ * 			CAS出队，保持与全局队列一致的FIFO顺序，协程让出后不会插到同线程的其它任务前面。
+ * 			扩容时旧数组可能仍被窃取线程读取，保留到队列析构时再释放。
+ * @attention 析构时不会释放队列中剩余的元素
+ *
+ * @tparam T 元素指向的类型
+ */
+template<class T>
+class WorkStealingQueue {
+public:
+	explicit WorkStealingQueue(size_t capacity = 256) {
+		size_t cap = 1;
+		while(cap < capacity) {
+			cap <<= 1;
+		}
+		m_array.store(new Array(cap), std::memory_order_relaxed);
+	}
+
+	~WorkStealingQueue() {
+		delete m_array.load(std::memory_order_relaxed);
+		for(Array *array : m_retired) {
+			delete array;
+		}
+	}
+
+	WorkStealingQueue(const WorkStealingQueue &) = delete;
+	WorkStealingQueue &operator=(const WorkStealingQueue &) = delete;
+
+	/**
+	 * @brief 入队，只能由所属线程调用
+	 */
+	void push(T *item) {
+		int64_t b = m_bottom.load(std::memory_order_relaxed);
+		int64_t t = m_top.load(std::memory_order_acquire);
+		Array *array = m_array.load(std::memory_order_relaxed);
+		if(b - t > (int64_t)array->mask) {
+			array = grow(array, t, b);
+		}
+		array->put(b, item);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief 从顶部取出一个元素，任意线程均可调用
+	 *
+	 * @param aborted 与其它线程竞争失败时置为true，此时队列可能仍不为空
+	 * @return 队列为空或竞争失败时返回nullptr
+	 */
+	T *steal(bool *aborted = nullptr) {
+		int64_t t = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = m_bottom.load(std::memory_order_acquire);
+		if(t >= b) {
+			return nullptr;
+		}
+		Array *array = m_array.load(std::memory_order_acquire);
+		T *item = array->get(t);
+		if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+										  std::memory_order_relaxed)) {
+			if(aborted) {
+				*aborted = true;
+			}
+			return nullptr;
+		}
+		return item;
+	}
+
+	/**
+	 * @brief 取出一个元素，竞争失败时重试直到成功或队列为空
+	 */
+	T *take() {
+		while(true) {
+			bool aborted = false;
+			T *item = steal(&aborted);
+			if(item || !aborted) {
+				return item;
+			}
+		}
+	}
+
+	/**
+	 * @brief 元素个数的近似值
+	 */
+	size_t size() const {
+		int64_t b = m_bottom.load(std::memory_order_relaxed);
+		int64_t t = m_top.load(std::memory_order_relaxed);
+		return b > t ? b - t : 0;
+	}
+
+	bool empty() const { return size() == 0; }
+
+private:
+	struct Array {
+		explicit Array(size_t capacity)
+			: mask(capacity - 1), slots(new std::atomic<T *>[capacity]) {}
+		~Array() { delete[] slots; }
+
+		T *get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+		void put(int64_t i, T *item) { slots[i & mask].store(item, std::memory_order_relaxed); }
+
+		size_t mask;
+		std::atomic<T *> *slots;
+	};
+
+	/**
+	 * @brief 容量翻倍，只由所属线程调用
+	 */
+	Array *grow(Array *array, int64_t t, int64_t b) {
+		Array *bigger = new Array((array->mask + 1) * 2);
+		for(int64_t i = t; i < b; ++i) {
+			bigger->put(i, array->get(i));
+		}
+		m_retired.push_back(array);
+		m_array.store(bigger, std::memory_order_release);
+		return bigger;
+	}
+
+private:
+	alignas(64) std::atomic<int64_t> m_top{0};		// 出队端，所属线程与窃取线程竞争
+	alignas(64) std::atomic<int64_t> m_bottom{0};	// 入队端，只有所属线程修改
+	std::atomic<Array *> m_array{nullptr};			// 当前数组
+	std::vector<Array *> m_retired;					// 扩容后淘汰的数组
+};
+}
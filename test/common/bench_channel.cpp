@@ -0,0 +1,112 @@
+#include "../../code/common/channel.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/log.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <queue>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 对照组：互斥锁加条件变量保护的有界队列，会阻塞调度线程
+ */
+class LockedQueue {
+public:
+    explicit LockedQueue(size_t capacity) : m_capacity(capacity) {}
+
+    bool send(uint64_t v) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        m_notFull.wait(locker, [this]() { return m_queue.size() < m_capacity; });
+        m_queue.push(v);
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    bool recv(uint64_t &v) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        m_notEmpty.wait(locker, [this]() { return !m_queue.empty() || m_closed; });
+        if (m_queue.empty()) {
+            return false;
+        }
+        v = m_queue.front();
+        m_queue.pop();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::queue<uint64_t> m_queue;
+    size_t m_capacity;
+    bool m_closed = false;
+};
+
+/**
+ * @brief 两个调度线程上各运行一个协程，一个发送一个接收
+ */
+template<class Chan>
+void bench_pingpipe(const std::string &name, Chan &channel, uint64_t n) {
+    myriel::Scheduler sc(2, false);
+    myriel::FiberSemaphore done;
+    uint64_t sum = 0;
+    sc.start();
+
+    uint64_t begin = NowNs();
+    sc.schedule([&]() {
+        for (uint64_t i = 0; i < n; ++i) {
+            channel.send(i);
+        }
+        channel.close();
+    });
+    sc.schedule([&]() {
+        uint64_t v;
+        while (channel.recv(v)) {
+            sum += v;
+        }
+        done.notify();
+    });
+    done.wait();
+    uint64_t end = NowNs();
+    sc.stop();
+
+    ASSERT(sum == n * (n - 1) / 2);
+    LOG_INFO(g_logger) << name << ": " << (double)(end - begin) / n << " ns/item, "
+                       << n * 1000.0 / (end - begin) << " M items/s";
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+    size_t capacity = 1024;
+    {
+        LockedQueue q(capacity);
+        bench_pingpipe("std::mutex+condvar queue", q, n);
+    }
+    {
+        myriel::Channel<uint64_t> ch(capacity);
+        bench_pingpipe("Channel(bounded)", ch, n);
+    }
+    {
+        myriel::Channel<uint64_t> ch;
+        bench_pingpipe("Channel(unbounded)", ch, n);
+    }
+    {
+        myriel::SpscChannel<uint64_t> ch(capacity);
+        bench_pingpipe("SpscChannel", ch, n);
+    }
+    return 0;
+}
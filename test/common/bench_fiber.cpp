@@ -0,0 +1,123 @@
+#include "../../code/common/fiber.h"
+#include "../../code/common/log.h"
+#include "../../code/common/config.h"
+#include "../../code/common/stack_allocator.h"
+#include "../../code/common/fiber_trace.h"
+#include "bench_report.h"
+
+#include <cstdlib>
+#include <ucontext.h>
+
+static const uint64_t kSwitches = 10000000;
+
+/**
+ * @brief 测试Fiber::resume/yield的切换耗时，一次往返计为两次切换
+ */
+void bench_fiber_switch(BenchReport &report, const std::string &name, uint64_t n) {
+    myriel::Fiber::GetThis();
+
+    myriel::Fiber::ptr fiber(new myriel::Fiber([n]() {
+        for(uint64_t i = 0; i < n; ++i) {
+            myriel::Fiber::GetThis()->yield();
+        }
+    }, 0, false));
+
+    uint64_t begin = BenchNowNs();
+    for(uint64_t i = 0; i < n; ++i) {
+        fiber->resume();
+    }
+    uint64_t end = BenchNowNs();
+    fiber->resume();
+
+    report.add(name, "ns_per_switch", (double)(end - begin) / (2 * n));
+}
+
+static ucontext_t s_main_ctx;
+static ucontext_t s_uc_ctx;
+
+static void UcontextFunc() {
+    while(true) {
+        swapcontext(&s_uc_ctx, &s_main_ctx);
+    }
+}
+
+/**
+ * @brief 作为对照，测试裸swapcontext的切换耗时
+ */
+void bench_ucontext_switch(BenchReport &report, uint64_t n) {
+    const size_t stacksize = 128 * 1024;
+    void *stack = malloc(stacksize);
+    getcontext(&s_uc_ctx);
+    s_uc_ctx.uc_link = nullptr;
+    s_uc_ctx.uc_stack.ss_sp = stack;
+    s_uc_ctx.uc_stack.ss_size = stacksize;
+    makecontext(&s_uc_ctx, &UcontextFunc, 0);
+
+    uint64_t begin = BenchNowNs();
+    for(uint64_t i = 0; i < n; ++i) {
+        swapcontext(&s_main_ctx, &s_uc_ctx);
+    }
+    uint64_t end = BenchNowNs();
+    free(stack);
+
+    report.add("ucontext_switch", "ns_per_switch", (double)(end - begin) / (2 * n));
+}
+
+/**
+ * @brief 测试协程创建+运行+销毁的耗时，对比不同的栈分配器
+ */
+void bench_fiber_create(BenchReport &report, const std::string &allocator, uint64_t n) {
+    myriel::Config::Lookup<std::string>("fiber.stack_allocator")->setValue(allocator);
+    myriel::Fiber::GetThis();
+
+    uint64_t begin = BenchNowNs();
+    for(uint64_t i = 0; i < n; ++i) {
+        myriel::Fiber::ptr fiber(new myriel::Fiber([]() {}, 0, false));
+        fiber->resume();
+    }
+    uint64_t end = BenchNowNs();
+
+    report.add("fiber_create_destroy_" + allocator, "ns_per_fiber", (double)(end - begin) / n);
+}
+
+/**
+ * @brief 测试协程reset复用的耗时，不涉及栈的申请与释放
+ */
+void bench_fiber_reset(BenchReport &report, uint64_t n) {
+    myriel::Fiber::GetThis();
+    myriel::Fiber::ptr fiber(new myriel::Fiber([]() {}, 0, false));
+    fiber->resume();
+
+    uint64_t begin = BenchNowNs();
+    for(uint64_t i = 0; i < n; ++i) {
+        fiber->reset([]() {});
+        fiber->resume();
+    }
+    uint64_t end = BenchNowNs();
+
+    report.add("fiber_reset_run", "ns_per_fiber", (double)(end - begin) / n);
+}
+
+int main(int argc, char *argv[]) {
+    BenchReport report("bench_fiber", argc, argv);
+    uint64_t n = report.arg(0, kSwitches);
+#ifdef MYRIEL_FIBER_ASM_CONTEXT
+    report.setInfo("context", "asm");
+#else
+    report.setInfo("context", "ucontext");
+#endif
+    bench_fiber_switch(report, "fiber_switch", n);
+    // 开启追踪后每次往返记录两个事件，缓冲区回绕不影响开销
+    myriel::FiberTrace::SetEnabled(true);
+    bench_fiber_switch(report, "fiber_switch_traced", n);
+    myriel::FiberTrace::SetEnabled(false);
+    bench_ucontext_switch(report, n);
+    bench_fiber_create(report, "malloc", n / 10);
+    bench_fiber_create(report, "mmap", n / 100);
+    bench_fiber_create(report, "pool", n / 10);
+    bench_fiber_reset(report, n / 10);
+
+    myriel::StackPoolStats stats = myriel::PooledStackAllocator::GetStats();
+    report.add("stack_pool", "hit_rate", stats.hitRate());
+    return 0;
+}
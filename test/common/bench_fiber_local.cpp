@@ -0,0 +1,54 @@
+#include "../../code/common/fiber_local.h"
+#include "../../code/common/log.h"
+
+#include <chrono>
+#include <cstdlib>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+static myriel::FiberLocal<uint64_t> s_fiber_value;
+static thread_local uint64_t t_thread_value = 0;
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 编译器屏障，阻止把局部变量的访问提到循环外
+ */
+static inline void Barrier() {
+    asm volatile("" ::: "memory");
+}
+
+void bench(const std::string &where, uint64_t n) {
+    uint64_t begin = NowNs();
+    for (uint64_t i = 0; i < n; ++i) {
+        ++t_thread_value;
+        Barrier();
+    }
+    uint64_t mid = NowNs();
+    for (uint64_t i = 0; i < n; ++i) {
+        ++s_fiber_value.get();
+        Barrier();
+    }
+    uint64_t end = NowNs();
+
+    LOG_INFO(g_logger) << where << " thread_local: " << (double)(mid - begin) / n << " ns/op";
+    LOG_INFO(g_logger) << where << " FiberLocal: " << (double)(end - mid) / n << " ns/op";
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000000;
+
+    // 尚未初始化协程，使用线程局部的槽位
+    bench("no fiber", n / 10);
+
+    // 线程主协程上运行，使用主协程的槽位
+    myriel::Fiber::GetThis();
+    bench("main fiber", n);
+
+    myriel::Fiber::ptr fiber(new myriel::Fiber(std::bind(&bench, "fiber", n), 0, false));
+    fiber->resume();
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "../../code/common/fiber_sync.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/log.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <shared_mutex>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 临界区内做少量计算，模拟真实的持锁时间
+ */
+static inline void CriticalSection(uint64_t &counter) {
+    for (int i = 0; i < 16; ++i) {
+        asm volatile("" ::: "memory");
+    }
+    ++counter;
+}
+
+/**
+ * @brief threads个调度线程上运行fibers个协程，竞争同一把锁
+ */
+template<class Mutex>
+void bench_mutex(const std::string &name, size_t threads, int fibers, int loops) {
+    Mutex mutex;
+    myriel::FiberSemaphore done;
+    uint64_t counter = 0;
+
+    myriel::Scheduler sc(threads, false);
+    sc.start();
+    uint64_t begin = NowNs();
+    for (int i = 0; i < fibers; ++i) {
+        sc.schedule([&]() {
+            for (int j = 0; j < loops; ++j) {
+                std::lock_guard<Mutex> locker(mutex);
+                CriticalSection(counter);
+            }
+            done.notify();
+        });
+    }
+    for (int i = 0; i < fibers; ++i) {
+        done.wait();
+    }
+    uint64_t end = NowNs();
+    sc.stop();
+
+    ASSERT(counter == (uint64_t)fibers * loops);
+    LOG_INFO(g_logger) << name << " threads=" << threads << " fibers=" << fibers << ": "
+                       << (double)(end - begin) / counter << " ns/lock";
+}
+
+/**
+ * @brief 读多写少，每16次操作中1次写
+ */
+template<class Mutex, class ReadLock, class WriteLock>
+void bench_rwmutex(const std::string &name, size_t threads, int fibers, int loops) {
+    Mutex mutex;
+    myriel::FiberSemaphore done;
+    uint64_t counter = 0;
+
+    myriel::Scheduler sc(threads, false);
+    sc.start();
+    uint64_t begin = NowNs();
+    for (int i = 0; i < fibers; ++i) {
+        sc.schedule([&]() {
+            uint64_t local = 0;
+            for (int j = 0; j < loops; ++j) {
+                if (j % 16 == 0) {
+                    WriteLock locker(mutex);
+                    CriticalSection(counter);
+                } else {
+                    ReadLock locker(mutex);
+                    CriticalSection(local);
+                }
+            }
+            done.notify();
+        });
+    }
+    for (int i = 0; i < fibers; ++i) {
+        done.wait();
+    }
+    uint64_t end = NowNs();
+    sc.stop();
+
+    LOG_INFO(g_logger) << name << " threads=" << threads << " fibers=" << fibers << ": "
+                       << (double)(end - begin) / ((uint64_t)fibers * loops) << " ns/op";
+}
+
+int main(int argc, char *argv[]) {
+    int loops = argc > 1 ? atoi(argv[1]) : 20000;
+    for (size_t threads : {1, 4}) {
+        for (int fibers : {4, 64}) {
+            bench_mutex<std::mutex>("std::mutex", threads, fibers, loops);
+            bench_mutex<myriel::FiberMutex>("FiberMutex", threads, fibers, loops);
+        }
+    }
+    for (size_t threads : {1, 4}) {
+        bench_rwmutex<std::shared_mutex, std::shared_lock<std::shared_mutex>,
+                      std::unique_lock<std::shared_mutex>>("std::shared_mutex", threads, 64, loops);
+        bench_rwmutex<myriel::FiberRWMutex, myriel::FiberRWMutex::ReadLock,
+                      myriel::FiberRWMutex::WriteLock>("FiberRWMutex", threads, 64, loops);
+    }
+    return 0;
+}
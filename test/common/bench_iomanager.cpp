@@ -0,0 +1,111 @@
+#include "../../code/common/iomanager.h"
+#include "../../code/common/fiber_sync.h"
+#include "../../code/common/log.h"
+#include "bench_report.h"
+
+#include <algorithm>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 尽量放宽fd上限，返回可以创建的eventfd数
+ */
+static uint64_t RaiseFdLimit(uint64_t want) {
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < want + 64 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, want + 64);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return std::min<uint64_t>(want, limit.rlim_cur > 64 ? limit.rlim_cur - 64 : 0);
+}
+
+/**
+ * @brief n个fd注册读事件，其中少量fd反复就绪，衡量注册、分发与删除的开销
+ * @details 大量注册但不活跃的fd不应拖慢活跃fd的分发，fd上下文的查找与fd总数无关
+ */
+void bench_events(BenchReport &report, size_t threads, uint64_t n, uint64_t rounds, uint64_t batch) {
+    std::vector<int> fds(n);
+    for (auto &fd : fds) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ASSERT(fd >= 0);
+    }
+    BenchReport::Params params = {{"threads", threads}, {"fds", (double)n}};
+
+    myriel::IOManager iom(threads, false, "bench");
+    myriel::FiberSemaphore done;
+    std::atomic<uint64_t> fired{0};
+    std::atomic<uint64_t> target{0};
+    std::function<void(int)> arm = [&](int fd) {
+        iom.addEvent(fd, myriel::IOManager::READ, [&, fd]() {
+            uint64_t value;
+            while (read(fd, &value, sizeof(value)) > 0);
+            arm(fd);
+            if (++fired == target) {
+                done.notify();
+            }
+        });
+    };
+
+    uint64_t begin = BenchNowNs();
+    for (int fd : fds) {
+        arm(fd);
+    }
+    uint64_t end = BenchNowNs();
+    report.add("iomanager_add_event", "ns_per_op", (double)(end - begin) / n, params);
+
+    // 每轮让batch个不同的fd就绪，等待全部回调执行完
+    uint64_t count = std::min(batch, n);
+    std::vector<uint64_t> latency;
+    begin = BenchNowNs();
+    for (uint64_t r = 0; r < rounds; ++r) {
+        target = (r + 1) * count;
+        uint64_t round_begin = BenchNowNs();
+        uint64_t one = 1;
+        for (uint64_t i = 0; i < count; ++i) {
+            int fd = fds[(r * count * 7919 + i) % n];
+            ASSERT(write(fd, &one, sizeof(one)) == sizeof(one));
+        }
+        done.wait();
+        latency.push_back(BenchNowNs() - round_begin);
+    }
+    end = BenchNowNs();
+    std::sort(latency.begin(), latency.end());
+    BenchReport::Params dispatch_params = params;
+    dispatch_params.emplace_back("batch", (double)batch);
+    report.add("iomanager_dispatch", "events_per_sec", rounds * count * 1e9 / (end - begin), dispatch_params);
+    report.add("iomanager_dispatch", "round_p50_us", latency[latency.size() / 2] / 1e3, dispatch_params);
+
+    begin = BenchNowNs();
+    for (int fd : fds) {
+        iom.delEvent(fd, myriel::IOManager::READ);
+    }
+    end = BenchNowNs();
+    report.add("iomanager_del_event", "ns_per_op", (double)(end - begin) / n, params);
+
+    for (int fd : fds) {
+        close(fd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchReport report("bench_iomanager", argc, argv);
+    uint64_t want = report.arg(0, 100000);
+    size_t threads = report.arg(1, 2);
+    uint64_t n = RaiseFdLimit(want);
+    if (n < want) {
+        LOG_WRAN(g_logger) << "RLIMIT_NOFILE too low, registering " << n << " fds instead of " << want;
+    }
+    report.setInfo("fd_limit_capped", n < want ? "true" : "false");
+
+    for (uint64_t fds = 1000; fds < n; fds *= 10) {
+        bench_events(report, threads, fds, 200, 100);
+    }
+    bench_events(report, threads, n, 200, 100);
+    return 0;
+}
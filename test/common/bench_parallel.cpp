@@ -0,0 +1,121 @@
+#include "../../code/common/parallel.h"
+#include "bench_report.h"
+
+#include <cmath>
+#include <random>
+
+/**
+ * @brief 模拟打分：每个元素若干次浮点运算
+ */
+static double Score(uint64_t i) {
+    double x = (double)(i % 1000) + 1;
+    for (int k = 0; k < 32; ++k) {
+        x = std::sqrt(x * 1.0001 + k);
+    }
+    return x;
+}
+
+/**
+ * @brief 在调度器中执行f并返回耗时
+ */
+template<class F>
+static uint64_t RunIn(myriel::Scheduler &sc, F f) {
+    return sc.scheduleFuture([&f]() {
+        uint64_t begin = BenchNowNs();
+        f();
+        return BenchNowNs() - begin;
+    }).get();
+}
+
+/**
+ * @brief 逐元素打分写入数组，对比串行循环
+ */
+void bench_for(BenchReport &report, size_t threads, uint64_t n) {
+    std::vector<double> out(n);
+    myriel::Scheduler sc(threads, false);
+    sc.start();
+    uint64_t serial = RunIn(sc, [&]() {
+        for (uint64_t i = 0; i < n; ++i) {
+            out[i] = Score(i);
+        }
+    });
+    uint64_t parallel = RunIn(sc, [&]() {
+        myriel::ParallelFor((uint64_t)0, n, [&](uint64_t b, uint64_t e) {
+            for (uint64_t i = b; i < e; ++i) {
+                out[i] = Score(i);
+            }
+        });
+    });
+    sc.stop();
+    report.add("parallel_for", "ns_per_item", (double)parallel / n, {{"threads", threads}});
+    report.add("parallel_for", "speedup", (double)serial / parallel, {{"threads", threads}});
+}
+
+/**
+ * @brief 打分求和，对比串行循环
+ */
+void bench_reduce(BenchReport &report, size_t threads, uint64_t n) {
+    myriel::Scheduler sc(threads, false);
+    sc.start();
+    double serial_sum = 0;
+    double parallel_sum = 0;
+    uint64_t serial = RunIn(sc, [&]() {
+        for (uint64_t i = 0; i < n; ++i) {
+            serial_sum += Score(i);
+        }
+    });
+    uint64_t parallel = RunIn(sc, [&]() {
+        parallel_sum = myriel::ParallelReduce((uint64_t)0, n, 0.0, [](uint64_t b, uint64_t e) {
+            double s = 0;
+            for (uint64_t i = b; i < e; ++i) {
+                s += Score(i);
+            }
+            return s;
+        }, [](double a, double b) { return a + b; });
+    });
+    sc.stop();
+    if (std::fabs(serial_sum - parallel_sum) > 1e-6 * std::fabs(serial_sum)) {
+        std::cerr << "parallel_reduce mismatch: " << serial_sum << " vs " << parallel_sum << std::endl;
+    }
+    report.add("parallel_reduce", "ns_per_item", (double)parallel / n, {{"threads", threads}});
+    report.add("parallel_reduce", "speedup", (double)serial / parallel, {{"threads", threads}});
+}
+
+/**
+ * @brief 随机整数排序，对比std::sort
+ */
+void bench_sort(BenchReport &report, size_t threads, uint64_t n) {
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> input(n);
+    for (auto &x : input) {
+        x = rng();
+    }
+    myriel::Scheduler sc(threads, false);
+    sc.start();
+    std::vector<uint64_t> a = input;
+    uint64_t serial = RunIn(sc, [&]() { std::sort(a.begin(), a.end()); });
+    std::vector<uint64_t> b = input;
+    uint64_t parallel = RunIn(sc, [&]() { myriel::ParallelSort(b.begin(), b.end()); });
+    sc.stop();
+    if (a != b) {
+        std::cerr << "parallel_sort mismatch" << std::endl;
+    }
+    report.add("parallel_sort", "ns_per_item", (double)parallel / n, {{"threads", threads}});
+    report.add("parallel_sort", "speedup", (double)serial / parallel, {{"threads", threads}});
+}
+
+int main(int argc, char *argv[]) {
+    BenchReport report("bench_parallel", argc, argv);
+    uint64_t n = report.arg(0, 2000000);
+    size_t max_threads = report.arg(1, std::max(4u, std::thread::hardware_concurrency()));
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        bench_for(report, threads, n);
+    }
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        bench_reduce(report, threads, n);
+    }
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        bench_sort(report, threads, n);
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief 基准测试结果的收集与输出
+ * @details 默认输出对齐的文本表格；命令行带--json时输出单个JSON对象，
+ * 			每条结果包含名称、指标、数值与参数，便于跨版本对比回归。
+ * 			迭代数或耗时为0时算出的inf/nan在JSON中输出为null，文本中输出为n/a
+ */
+class BenchReport {
+public:
+    using Params = std::vector<std::pair<std::string, double>>;
+
+    /**
+     * @brief 构造函数，解析并移除--json，其余参数按位置通过arg获取
+     */
+    BenchReport(const std::string &suite, int argc, char *argv[]) : m_suite(suite) {
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "--json") == 0) {
+                m_json = true;
+            } else {
+                m_args.push_back(argv[i]);
+            }
+        }
+    }
+
+    ~BenchReport() { print(); }
+
+    /**
+     * @brief 第i个位置参数，不存在时返回默认值
+     */
+    uint64_t arg(size_t i, uint64_t def) const {
+        return i < m_args.size() ? strtoull(m_args[i].c_str(), nullptr, 10) : def;
+    }
+
+    /**
+     * @brief 添加一条结果
+     *
+     * @param name 测试项
+     * @param metric 指标名，带单位，如ns_per_switch
+     * @param value 数值
+     * @param params 测试参数，如线程数
+     */
+    void add(const std::string &name, const std::string &metric, double value, const Params &params = {}) {
+        m_results.push_back(Result{name, metric, value, params});
+        if (!m_json) {
+            // 文本模式下边跑边输出，长时间的测试也能看到进度
+            std::cout << std::left << std::setw(32) << name << std::setw(24) << metric << std::right << std::setw(14);
+            if (std::isfinite(value)) {
+                std::cout << std::fixed << std::setprecision(2) << value;
+            } else {
+                std::cout << "n/a";
+            }
+            for (auto &p : params) {
+                std::cout << "  " << p.first << "=" << p.second;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    /**
+     * @brief 附加的环境信息，如上下文切换实现
+     */
+    void setInfo(const std::string &key, const std::string &value) { m_info.emplace_back(key, value); }
+
+private:
+    struct Result {
+        std::string name;
+        std::string metric;
+        double value;
+        Params params;
+    };
+
+    static std::string Quote(const std::string &s) {
+        std::string out = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    /**
+     * @brief JSON数值，inf与nan不是合法的JSON数值，输出为null
+     */
+    static std::string Number(double value) {
+        if (!std::isfinite(value)) {
+            return "null";
+        }
+        std::stringstream ss;
+        ss << std::setprecision(10) << value;
+        return ss.str();
+    }
+
+    void print() {
+        if (!m_json) {
+            return;
+        }
+        std::stringstream ss;
+        ss << "{\"suite\":" << Quote(m_suite)
+           << ",\"timestamp\":" << time(nullptr)
+           << ",\"cpus\":" << std::thread::hardware_concurrency();
+        for (auto &i : m_info) {
+            ss << "," << Quote(i.first) << ":" << Quote(i.second);
+        }
+        ss << ",\"results\":[";
+        for (size_t i = 0; i < m_results.size(); ++i) {
+            const Result &r = m_results[i];
+            ss << (i ? "," : "") << "{\"name\":" << Quote(r.name)
+               << ",\"metric\":" << Quote(r.metric)
+               << ",\"value\":" << Number(r.value)
+               << ",\"params\":{";
+            for (size_t j = 0; j < r.params.size(); ++j) {
+                ss << (j ? "," : "") << Quote(r.params[j].first) << ":" << Number(r.params[j].second);
+            }
+            ss << "}}";
+        }
+        ss << "]}";
+        std::cout << ss.str() << std::endl;
+    }
+
+private:
+    std::string m_suite;
+    bool m_json = false;
+    std::vector<std::string> m_args;
+    std::vector<std::pair<std::string, std::string>> m_info;
+    std::vector<Result> m_results;
+};
+
+/**
+ * @brief 单调时钟，纳秒
+ */
+inline uint64_t BenchNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
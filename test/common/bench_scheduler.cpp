@@ -0,0 +1,467 @@
+#include "../../code/common/scheduler.h"
+#include "../../code/common/fiber_sync.h"
+#include "../../code/common/log.h"
+#include "../../code/common/config.h"
+#include "../../code/common/affinity.h"
+#include "bench_report.h"
+
+#include <algorithm>
+#include <atomic>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+static myriel::ConfigVar<bool>::ptr g_work_stealing =
+    myriel::Config::Lookup<bool>("scheduler.work_stealing");
+
+/**
+ * @brief 测试参数，附带当前的队列模式
+ */
+static BenchReport::Params WithMode(BenchReport::Params params) {
+    params.emplace_back("stealing", g_work_stealing->getValue() ? 1 : 0);
+    return params;
+}
+
+/**
+ * @brief 在threads个调度线程上执行n个空任务，统计吞吐
+ */
+void bench_throughput(BenchReport &report, size_t threads, uint64_t n) {
+    myriel::Scheduler sc(threads, false);
+    myriel::FiberSemaphore done;
+    std::atomic<uint64_t> finished{0};
+    sc.start();
+
+    uint64_t begin = BenchNowNs();
+    for (uint64_t i = 0; i < n; ++i) {
+        sc.schedule([&]() {
+            if (++finished == n) {
+                done.notify();
+            }
+        });
+    }
+    done.wait();
+    uint64_t end = BenchNowNs();
+    sc.stop();
+
+    report.add("scheduler_throughput", "tasks_per_sec", n * 1e9 / (end - begin),
+               WithMode({{"threads", threads}}));
+}
+
+/**
+ * @brief 协程任务的吞吐：每个协程通过调度器让出rounds次
+ */
+void bench_fiber_yield(BenchReport &report, size_t threads, uint64_t fibers, uint64_t rounds) {
+    myriel::Scheduler sc(threads, false);
+    myriel::FiberSemaphore done;
+    sc.start();
+
+    uint64_t begin = BenchNowNs();
+    for (uint64_t i = 0; i < fibers; ++i) {
+        sc.schedule([&]() {
+            for (uint64_t r = 0; r < rounds; ++r) {
+                myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+                myriel::Fiber::GetThis()->yield();
+            }
+            done.notify();
+        });
+    }
+    for (uint64_t i = 0; i < fibers; ++i) {
+        done.wait();
+    }
+    uint64_t end = BenchNowNs();
+    sc.stop();
+
+    report.add("scheduler_fiber_yield", "yields_per_sec", fibers * rounds * 1e9 / (end - begin),
+               WithMode({{"threads", threads}, {"fibers", (double)fibers}}));
+}
+
+/**
+ * @brief 从调用schedule到任务开始执行的延迟分布
+ * @details 每批投递batch个任务后等待这批执行完，避免积压把排队时间算进去
+ */
+void bench_latency(BenchReport &report, size_t threads, uint64_t n, uint64_t batch) {
+    myriel::Scheduler sc(threads, false);
+    std::vector<uint64_t> latency(n);
+    sc.start();
+
+    for (uint64_t i = 0; i < n; i += batch) {
+        myriel::FiberSemaphore done;
+        uint64_t count = std::min(batch, n - i);
+        for (uint64_t j = i; j < i + count; ++j) {
+            uint64_t enqueued = BenchNowNs();
+            sc.schedule([&latency, &done, enqueued, j]() {
+                latency[j] = BenchNowNs() - enqueued;
+                done.notify();
+            });
+        }
+        for (uint64_t j = 0; j < count; ++j) {
+            done.wait();
+        }
+    }
+    sc.stop();
+
+    std::sort(latency.begin(), latency.end());
+    auto pct = [&latency](double p) {
+        return (double)latency[std::min<size_t>(latency.size() - 1, latency.size() * p / 100)];
+    };
+    BenchReport::Params params = WithMode({{"threads", threads}, {"batch", (double)batch}});
+    report.add("schedule_to_run_latency", "p50_ns", pct(50), params);
+    report.add("schedule_to_run_latency", "p90_ns", pct(90), params);
+    report.add("schedule_to_run_latency", "p99_ns", pct(99), params);
+    report.add("schedule_to_run_latency", "p999_ns", pct(99.9), params);
+    report.add("schedule_to_run_latency", "max_ns", (double)latency.back(), params);
+}
+
+/**
+ * @brief 递归派生任务：每个任务在调度线程上派生fanout个子任务，直到depth层
+ * @details 任务全部由调度线程提交，衡量本线程队列与窃取的收益
+ */
+struct SpawnTree {
+    SpawnTree(myriel::Scheduler *sc, uint64_t fanout, uint64_t total)
+        : sc(sc), fanout(fanout), remaining(total) {}
+
+    myriel::Scheduler *sc;
+    uint64_t fanout;
+    std::atomic<uint64_t> remaining;
+    myriel::FiberSemaphore done;
+
+    void spawn(uint64_t depth) {
+        sc->schedule([this, depth]() {
+            if (depth > 0) {
+                for (uint64_t i = 0; i < fanout; ++i) {
+                    spawn(depth - 1);
+                }
+            }
+            if (--remaining == 0) {
+                done.notify();
+            }
+        });
+    }
+};
+
+/**
+ * @brief 递归派生任务树的吞吐，每秒任务数
+ */
+static double SpawnTreeRate(size_t threads, uint64_t fanout, uint64_t depth) {
+    myriel::Scheduler sc(threads, false);
+    uint64_t total = 0;
+    for (uint64_t level = 0, width = 1; level <= depth; ++level, width *= fanout) {
+        total += width;
+    }
+    SpawnTree tree(&sc, fanout, total);
+    sc.start();
+
+    uint64_t begin = BenchNowNs();
+    tree.spawn(depth);
+    tree.done.wait();
+    uint64_t end = BenchNowNs();
+    sc.stop();
+    return total * 1e9 / (end - begin);
+}
+
+void bench_spawn_tree(BenchReport &report, size_t threads, uint64_t fanout, uint64_t depth) {
+    double rate = SpawnTreeRate(threads, fanout, depth);
+    report.add("scheduler_spawn_tree", "tasks_per_sec", rate,
+               WithMode({{"threads", threads}, {"fanout", (double)fanout}, {"depth", (double)depth}}));
+}
+
+/**
+ * @brief 开启运行时间统计对任务吞吐的影响，其余指标始终开启
+ */
+void bench_run_time_stats(BenchReport &report, size_t threads) {
+    auto var = myriel::Config::Lookup<bool>("scheduler.run_time_stats");
+    for (bool enabled : {false, true}) {
+        var->setValue(enabled);
+        double rate = SpawnTreeRate(threads, 4, 8);
+        report.add("scheduler_run_time_stats", "tasks_per_sec", rate,
+                   WithMode({{"threads", threads}, {"enabled", enabled ? 1.0 : 0.0}}));
+    }
+    var->setValue(false);
+}
+
+/**
+ * @brief 任务阻塞调度线程(未hook的sleep)时，固定线程数与弹性线程池的吞吐
+ * @details 每个任务阻塞1毫秒，弹性模式最多扩到threads的4倍
+ */
+void bench_elastic(BenchReport &report, size_t threads, uint64_t n, bool elastic) {
+    auto max_threads = myriel::Config::Lookup<uint32_t>("scheduler.elastic.max_threads");
+    max_threads->setValue(elastic ? threads * 4 : 0);
+    myriel::Config::Lookup<uint32_t>("scheduler.elastic.grow_latency_us")->setValue(1000);
+    myriel::Scheduler sc(threads, false);
+    sc.start();
+    std::atomic<uint64_t> left{n};
+    myriel::FiberSemaphore done;
+
+    uint64_t begin = BenchNowNs();
+    for (uint64_t i = 0; i < n; ++i) {
+        sc.schedule([&]() {
+            usleep(1000);
+            if (--left == 0) {
+                done.notify();
+            }
+        });
+    }
+    done.wait();
+    uint64_t end = BenchNowNs();
+    size_t spares = sc.getSpareCount();
+    sc.stop();
+    max_threads->setValue(0);
+
+    report.add("scheduler_elastic_blocking", "tasks_per_sec", n * 1e9 / (end - begin),
+               WithMode({{"threads", threads}, {"elastic", elastic ? 1.0 : 0.0}}));
+    report.add("scheduler_elastic_blocking", "spare_threads", spares,
+               WithMode({{"threads", threads}, {"elastic", elastic ? 1.0 : 0.0}}));
+}
+
+/**
+ * @brief 进程累计的CPU时间
+ */
+static uint64_t ProcessCpuNs() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull;
+}
+
+/**
+ * @brief 没有任务时调度器占用的CPU，100表示占满一个核
+ */
+void bench_idle_cpu(BenchReport &report, size_t threads, uint64_t ms) {
+    myriel::Scheduler sc(threads, false);
+    sc.start();
+    // 等调度线程空转结束进入休眠
+    usleep(10000);
+
+    uint64_t cpu_begin = ProcessCpuNs();
+    uint64_t begin = BenchNowNs();
+    usleep(ms * 1000);
+    uint64_t cpu_end = ProcessCpuNs();
+    uint64_t end = BenchNowNs();
+    sc.stop();
+
+    report.add("scheduler_idle_cpu", "cpu_percent", (cpu_end - cpu_begin) * 100.0 / (end - begin),
+               WithMode({{"threads", threads}}));
+}
+
+/**
+ * @brief 后台批处理任务积压时请求任务从提交到开始执行的延迟
+ * @details 先提交n个约1微秒的后台任务，其间每隔interval个穿插一个请求任务。
+ * 			use_priority为false时全部是NORMAL，为true时后台为LOW、请求为HIGH
+ */
+void bench_priority(BenchReport &report, size_t threads, uint64_t n, uint64_t interval,
+                    bool use_priority, const std::string &policy) {
+    myriel::Config::Lookup<std::string>("scheduler.priority_policy")->setValue(policy);
+    uint64_t requests = n / interval;
+    std::vector<uint64_t> latency(requests);
+    std::atomic<uint64_t> finished{0};
+    myriel::FiberSemaphore done;
+    myriel::Scheduler sc(threads, false);
+    sc.start();
+
+    auto finish = [&]() {
+        if (++finished == n + requests) {
+            done.notify();
+        }
+    };
+    myriel::Priority background = use_priority ? myriel::Priority::LOW : myriel::Priority::NORMAL;
+    myriel::Priority request = use_priority ? myriel::Priority::HIGH : myriel::Priority::NORMAL;
+    for (uint64_t i = 0; i < n; ++i) {
+        sc.schedule([&]() {
+            uint64_t begin = BenchNowNs();
+            while (BenchNowNs() - begin < 1000);
+            finish();
+        }, background);
+        if (i % interval == 0) {
+            uint64_t enqueued = BenchNowNs();
+            uint64_t j = i / interval;
+            sc.schedule([&latency, &finish, enqueued, j]() {
+                latency[j] = BenchNowNs() - enqueued;
+                finish();
+            }, request);
+        }
+    }
+    done.wait();
+    sc.stop();
+    myriel::Config::Lookup<std::string>("scheduler.priority_policy")->setValue("weighted");
+
+    std::sort(latency.begin(), latency.end());
+    auto pct = [&latency](double p) {
+        return (double)latency[std::min<size_t>(latency.size() - 1, latency.size() * p / 100)];
+    };
+    BenchReport::Params params = WithMode({{"threads", threads}, {"background", (double)n},
+                                           {"priority", use_priority ? 1.0 : 0.0},
+                                           {"strict", policy == "strict" ? 1.0 : 0.0}});
+    report.add("request_latency_under_backlog", "p50_ns", pct(50), params);
+    report.add("request_latency_under_backlog", "p99_ns", pct(99), params);
+    report.add("request_latency_under_backlog", "max_ns", (double)latency.back(), params);
+}
+
+/**
+ * @brief 调度线程在CPU间迁移的统计
+ */
+struct PlacementStats {
+    std::atomic<uint64_t> migrations{0};        // 同一线程两次任务之间换了CPU
+    std::atomic<uint64_t> cross_node{0};        // 其中换了NUMA节点的次数
+};
+
+/**
+ * @brief 每个任务遍历调度线程私有的缓冲区，线程换到其它节点后这些访问都变成跨节点访问
+ */
+static void PlacementTask(PlacementStats *stats, size_t buffer_size) {
+    static thread_local std::vector<uint64_t> t_buffer;
+    static thread_local int t_last_cpu = -1;
+    if (t_buffer.size() != buffer_size) {
+        t_buffer.assign(buffer_size, 0);
+    }
+    for (size_t i = 0; i < t_buffer.size(); i += 8) {
+        ++t_buffer[i];
+    }
+
+    int cpu = sched_getcpu();
+    if (t_last_cpu >= 0 && cpu != t_last_cpu) {
+        ++stats->migrations;
+        const myriel::CpuTopology &topo = myriel::CpuTopology::Get();
+        if (topo.getNodeOfCpu(cpu) != topo.getNodeOfCpu(t_last_cpu)) {
+            ++stats->cross_node;
+        }
+    }
+    t_last_cpu = cpu;
+}
+
+/**
+ * @brief 不同放置策略下的吞吐与线程迁移次数
+ */
+void bench_placement(BenchReport &report, size_t threads, uint64_t n, const std::string &policy) {
+    myriel::Config::Lookup<std::string>("scheduler.numa_policy")->setValue(policy);
+    PlacementStats stats;
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    {
+        myriel::Scheduler sc(threads, false);
+        myriel::FiberSemaphore done;
+        std::atomic<uint64_t> finished{0};
+        sc.start();
+        begin = BenchNowNs();
+        for (uint64_t i = 0; i < n; ++i) {
+            sc.schedule([&]() {
+                // 每个任务扫过256KB，约为一个核的L2
+                PlacementTask(&stats, 32 * 1024);
+                if (++finished == n) {
+                    done.notify();
+                }
+            });
+        }
+        done.wait();
+        end = BenchNowNs();
+        sc.stop();
+    }
+    myriel::Config::Lookup<std::string>("scheduler.numa_policy")->setValue("none");
+
+    BenchReport::Params params = WithMode({{"threads", threads},
+                                           {"numa_nodes", (double)myriel::CpuTopology::Get().getNodeCount()}});
+    std::string name = "scheduler_placement_" + policy;
+    report.add(name, "tasks_per_sec", n * 1e9 / (end - begin), params);
+    report.add(name, "cpu_migrations_per_1k", stats.migrations * 1000.0 / n, params);
+    report.add(name, "cross_node_migrations_per_1k", stats.cross_node * 1000.0 / n, params);
+}
+
+/**
+ * @brief 每个线程各执行一个任务，收集所有调度线程的线程ID
+ */
+static std::vector<std::thread::id> CollectThreadIds(myriel::Scheduler &sc, size_t threads) {
+    std::vector<std::thread::id> ids;
+    std::mutex mutex;
+    std::atomic<size_t> arrived{0};
+    std::atomic<size_t> left{0};
+    for (size_t i = 0; i < threads; ++i) {
+        sc.schedule([&]() {
+            {
+                std::lock_guard<std::mutex> locker(mutex);
+                ids.push_back(std::this_thread::get_id());
+            }
+            ++arrived;
+            while (arrived != threads) {
+                usleep(100);
+            }
+            ++left;
+        });
+    }
+    // 等所有任务都不再访问这里的局部变量
+    while (left != threads) {
+        usleep(1000);
+    }
+    return ids;
+}
+
+/**
+ * @brief n个任务轮流指定到各调度线程上，统计吞吐
+ * @details 关闭信箱时这些任务都在全局队列中，每次出队要跳过其它线程的任务
+ */
+void bench_pinned(BenchReport &report, size_t threads, uint64_t n, bool mailbox) {
+    myriel::Config::Lookup<bool>("scheduler.mailbox")->setValue(mailbox);
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    {
+        myriel::Scheduler sc(threads, false);
+        myriel::FiberSemaphore done;
+        std::atomic<uint64_t> finished{0};
+        sc.start();
+        std::vector<std::thread::id> ids = CollectThreadIds(sc, threads);
+        begin = BenchNowNs();
+        for (uint64_t i = 0; i < n; ++i) {
+            sc.schedule([&]() {
+                if (++finished == n) {
+                    done.notify();
+                }
+            }, ids[i % threads]);
+        }
+        done.wait();
+        end = BenchNowNs();
+        sc.stop();
+    }
+    myriel::Config::Lookup<bool>("scheduler.mailbox")->setValue(true);
+
+    report.add("scheduler_pinned_throughput", "tasks_per_sec", n * 1e9 / (end - begin),
+               WithMode({{"threads", threads}, {"mailbox", mailbox ? 1.0 : 0.0}}));
+}
+
+int main(int argc, char *argv[]) {
+    BenchReport report("bench_scheduler", argc, argv);
+    uint64_t n = report.arg(0, 200000);
+    size_t max_threads = report.arg(1, std::max(4u, std::thread::hardware_concurrency()));
+
+    // 全局队列与工作窃取两种模式各跑一遍，线程数按2的幂递增到max_threads
+    for (bool stealing : {false, true}) {
+        g_work_stealing->setValue(stealing);
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            bench_throughput(report, threads, n);
+        }
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            bench_spawn_tree(report, threads, 4, 8);
+        }
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            bench_fiber_yield(report, threads, 64, n / 64);
+        }
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            bench_latency(report, threads, n / 10, 16);
+        }
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            bench_idle_cpu(report, threads, 200);
+        }
+        bench_priority(report, max_threads, n / 4, 100, false, "weighted");
+        bench_priority(report, max_threads, n / 4, 100, true, "weighted");
+        bench_priority(report, max_threads, n / 4, 100, true, "strict");
+        for (const char *policy : {"none", "pack", "spread"}) {
+            bench_placement(report, max_threads, n / 10, policy);
+        }
+        for (bool mailbox : {false, true}) {
+            bench_pinned(report, max_threads, n / 10, mailbox);
+        }
+        bench_run_time_stats(report, max_threads);
+        for (bool elastic : {false, true}) {
+            bench_elastic(report, max_threads, n / 500, elastic);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "../../code/common/fiber.h"
+#include "../../code/common/log.h"
+
+#include <sys/wait.h>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+struct MemUsage {
+    long vsz_kb = 0;
+    long rss_kb = 0;
+};
+
+static MemUsage GetMemUsage() {
+    std::ifstream ifs("/proc/self/statm");
+    long size = 0, resident = 0;
+    ifs >> size >> resident;
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    return MemUsage{size * page_kb, resident * page_kb};
+}
+
+static uint64_t NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 创建n个协程，每个协程在栈上使用少量内存后挂起，统计挂起状态下的内存占用
+ */
+void bench_parked(uint64_t n, bool shared) {
+    myriel::Fiber::GetThis();
+    std::vector<myriel::Fiber::ptr> fibers;
+    fibers.reserve(n);
+
+    MemUsage before = GetMemUsage();
+    uint64_t begin = NowMs();
+    for(uint64_t i = 0; i < n; ++i) {
+        fibers.emplace_back(new myriel::Fiber([]() {
+            volatile char buf[256];
+            buf[0] = 1;
+            myriel::Fiber::GetThis()->yield();
+            buf[1] = buf[0];
+        }, 0, false, shared));
+        fibers.back()->resume();
+    }
+    uint64_t parked = NowMs();
+    MemUsage after = GetMemUsage();
+
+    for(auto &i : fibers) {
+        i->resume();
+    }
+    uint64_t end = NowMs();
+
+    long rss = after.rss_kb - before.rss_kb;
+    long vsz = after.vsz_kb - before.vsz_kb;
+    LOG_INFO(g_logger) << (shared ? "shared" : "private") << " stack: fibers=" << n
+                       << " rss=" << rss / 1024 << "MB vsz=" << vsz / 1024 << "MB"
+                       << " rss_per_fiber=" << rss * 1024 / (long)n << "B"
+                       << " saved_stack=" << fibers.front()->getSavedStackSize() << "B"
+                       << " park_ms=" << parked - begin << " finish_ms=" << end - parked;
+}
+
+static void RunInChild(uint64_t n, bool shared) {
+    pid_t pid = fork();
+    if(pid == 0) {
+        bench_parked(n, shared);
+        exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t shared_n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    // 每个私有栈占用两个VMA(栈与保护页)，受vm.max_map_count限制，默认只测较少的数量
+    uint64_t private_n = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+
+    RunInChild(shared_n, true);
+    RunInChild(private_n, false);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "../../code/common/task.h"
+#include "../../code/common/log.h"
+
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief 当前进程的常驻内存
+ */
+static uint64_t RssBytes() {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+myriel::Task<void> YieldLoop(uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+        co_await myriel::Yield();
+    }
+}
+
+void FiberYieldLoop(uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+        myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+        myriel::Fiber::GetThis()->yield();
+    }
+}
+
+/**
+ * @brief 同一个工作负载：让出调度器n次，比较一次让出的开销
+ */
+void bench_switch(uint64_t n) {
+    myriel::Scheduler sc(1, false);
+    sc.start();
+
+    uint64_t begin = NowNs();
+    myriel::CoSpawn(&sc, YieldLoop(n)).get();
+    uint64_t mid = NowNs();
+    sc.scheduleFuture(std::bind(&FiberYieldLoop, n)).get();
+    uint64_t end = NowNs();
+    sc.stop();
+
+    LOG_INFO(g_logger) << "yield via scheduler: Task " << (double)(mid - begin) / n
+                       << " ns, Fiber " << (double)(end - mid) / n << " ns";
+}
+
+myriel::Task<uint64_t> Leaf(uint64_t i) {
+    co_return i;
+}
+
+myriel::Task<uint64_t> CallChain(uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        sum += co_await Leaf(i);
+    }
+    co_return sum;
+}
+
+/**
+ * @brief 不经过调度器的直接调用：Task为一次帧分配加两次对称转移，Fiber为一次resume/yield往返
+ */
+void bench_call(uint64_t n) {
+    myriel::Scheduler sc(1, false);
+    sc.start();
+    uint64_t begin = NowNs();
+    uint64_t sum = myriel::CoSpawn(&sc, CallChain(n)).get();
+    uint64_t end = NowNs();
+    sc.stop();
+    ASSERT(sum == n * (n - 1) / 2);
+
+    myriel::Fiber::GetThis();
+    myriel::Fiber::ptr fiber(new myriel::Fiber([n]() {
+        for (uint64_t i = 0; i < n; ++i) {
+            myriel::Fiber::GetThis()->yield();
+        }
+    }, 0, false));
+    uint64_t fbegin = NowNs();
+    for (uint64_t i = 0; i < n; ++i) {
+        fiber->resume();
+    }
+    uint64_t fend = NowNs();
+    fiber->resume();
+
+    LOG_INFO(g_logger) << "await/return: Task " << (double)(end - begin) / n
+                       << " ns, Fiber resume+yield " << (double)(fend - fbegin) / n << " ns";
+}
+
+myriel::Task<void> Parked(myriel::FiberFuture<void> gate, std::atomic<uint64_t> *done) {
+    co_await gate;
+    ++*done;
+}
+
+/**
+ * @brief n个挂起在同一个future上的Task与Fiber，比较常驻内存
+ */
+void bench_memory(uint64_t n) {
+    myriel::Scheduler sc(1, false);
+    sc.start();
+
+    std::atomic<uint64_t> done{0};
+    myriel::FiberPromise<void> task_gate;
+    uint64_t before = RssBytes();
+    for (uint64_t i = 0; i < n; ++i) {
+        myriel::CoSpawn(&sc, Parked(task_gate.getFuture(), &done));
+    }
+    // 只有一个调度线程，任务按顺序执行，这个空任务完成时所有Task都已挂起
+    sc.scheduleFuture([]() {}).get();
+    uint64_t task_rss = RssBytes() - before;
+    task_gate.setValue();
+    while (done < n) {
+        sc.scheduleFuture([]() {}).get();
+    }
+
+    done = 0;
+    myriel::FiberPromise<void> fiber_gate;
+    myriel::FiberFuture<void> gate = fiber_gate.getFuture();
+    before = RssBytes();
+    for (uint64_t i = 0; i < n; ++i) {
+        sc.schedule([gate, &done]() {
+            gate.wait();
+            ++done;
+        });
+    }
+    sc.scheduleFuture([]() {}).get();
+    uint64_t fiber_rss = RssBytes() - before;
+    fiber_gate.setValue();
+    while (done < n) {
+        sc.scheduleFuture([]() {}).get();
+    }
+    sc.stop();
+
+    LOG_INFO(g_logger) << n << " parked: Task " << task_rss / n << " B/task, Fiber "
+                       << fiber_rss / n << " B/fiber";
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    bench_switch(n);
+    bench_call(n * 10);
+    // 每个协程栈是独立的映射，数量受vm.max_map_count限制
+    bench_memory(std::min<uint64_t>(n / 10, 20000));
+    return 0;
+}
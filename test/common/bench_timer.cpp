@@ -0,0 +1,211 @@
+#include "../../code/common/timer.h"
+#include "../../code/common/utils.h"
+#include "../../code/common/log.h"
+#include "bench_report.h"
+
+#include <algorithm>
+#include <mutex>
+#include <random>
+#include <vector>
+
+/**
+ * @brief 时间轮的空实现，基准测试不需要唤醒等待方
+ */
+class BenchTimerManager : public myriel::TimerManager {
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+/**
+ * @brief 对照组：带下标的二叉堆定时器，添加与取消O(log n)
+ */
+class HeapTimerQueue {
+public:
+    struct Timer {
+        uint64_t deadline;
+        std::function<void()> cb;
+        size_t index;
+    };
+
+    ~HeapTimerQueue() {
+        for (Timer *timer : m_heap) {
+            delete timer;
+        }
+    }
+
+    Timer *addTimer(uint64_t ms, std::function<void()> cb) {
+        Timer *timer = new Timer{myriel::GetElapsedMS() + ms, std::move(cb), 0};
+        std::lock_guard<std::mutex> locker(m_mutex);
+        timer->index = m_heap.size();
+        m_heap.push_back(timer);
+        siftUp(timer->index);
+        return timer;
+    }
+
+    void cancel(Timer *timer) {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        removeAt(timer->index);
+        delete timer;
+    }
+
+    void listExpiredCb(std::vector<std::function<void()>> &cbs, uint64_t now) {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        while (!m_heap.empty() && m_heap[0]->deadline <= now) {
+            Timer *timer = m_heap[0];
+            removeAt(0);
+            cbs.push_back(std::move(timer->cb));
+            delete timer;
+        }
+    }
+
+    size_t size() const { return m_heap.size(); }
+
+private:
+    void swapAt(size_t a, size_t b) {
+        std::swap(m_heap[a], m_heap[b]);
+        m_heap[a]->index = a;
+        m_heap[b]->index = b;
+    }
+
+    void siftUp(size_t i) {
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (m_heap[parent]->deadline <= m_heap[i]->deadline) {
+                break;
+            }
+            swapAt(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(size_t i) {
+        size_t n = m_heap.size();
+        while (true) {
+            size_t smallest = i;
+            size_t left = i * 2 + 1;
+            size_t right = left + 1;
+            if (left < n && m_heap[left]->deadline < m_heap[smallest]->deadline) {
+                smallest = left;
+            }
+            if (right < n && m_heap[right]->deadline < m_heap[smallest]->deadline) {
+                smallest = right;
+            }
+            if (smallest == i) {
+                break;
+            }
+            swapAt(i, smallest);
+            i = smallest;
+        }
+    }
+
+    void removeAt(size_t i) {
+        size_t last = m_heap.size() - 1;
+        if (i != last) {
+            swapAt(i, last);
+        }
+        m_heap.pop_back();
+        if (i < m_heap.size()) {
+            siftUp(i);
+            siftDown(i);
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<Timer *> m_heap;
+};
+
+/**
+ * @brief 时间轮与二叉堆的统一接口
+ */
+struct WheelAdapter {
+    using Handle = myriel::Timer::ptr;
+    static constexpr const char *kName = "wheel";
+    BenchTimerManager mgr;
+
+    Handle add(uint64_t ms, std::function<void()> cb) { return mgr.addTimer(ms, std::move(cb)); }
+    void cancel(Handle &handle) { handle->cancel(); handle.reset(); }
+    void expire(std::vector<std::function<void()>> &cbs, uint64_t now) { mgr.listExpiredCb(cbs, now); }
+};
+
+struct HeapAdapter {
+    using Handle = HeapTimerQueue::Timer *;
+    static constexpr const char *kName = "heap";
+    HeapTimerQueue queue;
+
+    Handle add(uint64_t ms, std::function<void()> cb) { return queue.addTimer(ms, std::move(cb)); }
+    void cancel(Handle &handle) { queue.cancel(handle); handle = nullptr; }
+    void expire(std::vector<std::function<void()>> &cbs, uint64_t now) { queue.listExpiredCb(cbs, now); }
+};
+
+/**
+ * @brief n个定时器，超时均匀分布在[1, span_ms)：批量添加、取消一半、
+ * 		  模拟连接空闲超时的取消加重新添加、按毫秒推进直到全部到期
+ */
+template<class Adapter>
+void bench_timers(BenchReport &report, uint64_t n, uint64_t span_ms, uint64_t churn) {
+    Adapter adapter;
+    std::vector<typename Adapter::Handle> handles(n);
+    std::mt19937_64 rng(7);
+    uint64_t fired = 0;
+    BenchReport::Params params = {{"timers", (double)n}, {"span_ms", (double)span_ms}};
+    params.emplace_back(Adapter::kName == std::string("wheel") ? "wheel" : "heap", 1);
+
+    uint64_t begin = BenchNowNs();
+    for (uint64_t i = 0; i < n; ++i) {
+        handles[i] = adapter.add(rng() % (span_ms - 1) + 1, [&fired]() { ++fired; });
+    }
+    uint64_t end = BenchNowNs();
+    report.add(std::string("timer_add_") + Adapter::kName, "ns_per_op", (double)(end - begin) / n, params);
+
+    // 随机顺序取消一半
+    std::vector<uint64_t> order(n);
+    for (uint64_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    begin = BenchNowNs();
+    for (uint64_t i = 0; i < n / 2; ++i) {
+        adapter.cancel(handles[order[i]]);
+    }
+    end = BenchNowNs();
+    report.add(std::string("timer_cancel_") + Adapter::kName, "ns_per_op", (double)(end - begin) / (n / 2), params);
+
+    // 取消剩下的一个再添加一个，保持定时器总数不变
+    begin = BenchNowNs();
+    for (uint64_t i = 0; i < churn; ++i) {
+        uint64_t index = order[n / 2 + i % (n - n / 2)];
+        adapter.cancel(handles[index]);
+        handles[index] = adapter.add(rng() % (span_ms - 1) + 1, [&fired]() { ++fired; });
+    }
+    end = BenchNowNs();
+    report.add(std::string("timer_churn_") + Adapter::kName, "ns_per_op", (double)(end - begin) / churn, params);
+
+    // 逐毫秒推进，直到全部到期
+    std::vector<std::function<void()>> cbs;
+    uint64_t now = myriel::GetElapsedMS();
+    uint64_t expired = 0;
+    begin = BenchNowNs();
+    while (expired < n - n / 2) {
+        adapter.expire(cbs, now++);
+        for (auto &cb : cbs) {
+            cb();
+        }
+        expired += cbs.size();
+        cbs.clear();
+    }
+    end = BenchNowNs();
+    report.add(std::string("timer_expire_") + Adapter::kName, "ns_per_op", (double)(end - begin) / expired, params);
+    handles.clear();
+}
+
+int main(int argc, char *argv[]) {
+    BenchReport report("bench_timer", argc, argv);
+    uint64_t n = report.arg(0, 10000000);
+    uint64_t span_ms = report.arg(1, 60000);
+    uint64_t churn = std::min<uint64_t>(n, 1000000);
+
+    bench_timers<WheelAdapter>(report, n, span_ms, churn);
+    bench_timers<HeapAdapter>(report, n, span_ms, churn);
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "../../code/common/affinity.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+void test_parse() {
+    std::vector<int> cpus;
+    ASSERT(myriel::CpuTopology::ParseCpuList("0-3, 8,10-11,2", cpus));
+    ASSERT((cpus == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    ASSERT(myriel::CpuTopology::ParseCpuList("", cpus) && cpus.empty());
+    ASSERT(!myriel::CpuTopology::ParseCpuList("3-1", cpus));
+    ASSERT(!myriel::CpuTopology::ParseCpuList("1x", cpus));
+    ASSERT(!myriel::CpuTopology::ParseCpuList("-1", cpus));
+
+    myriel::NumaPolicy policy;
+    ASSERT(myriel::NumaPolicyFromString("Spread", policy) && policy == myriel::NumaPolicy::SPREAD);
+    ASSERT(myriel::NumaPolicyFromString("pack", policy) && policy == myriel::NumaPolicy::PACK);
+    ASSERT(!myriel::NumaPolicyFromString("random", policy));
+}
+
+void test_place() {
+    const myriel::CpuTopology &topo = myriel::CpuTopology::Get();
+    LOG_INFO(g_logger) << "numa nodes=" << topo.getNodeCount() << " cpus=" << topo.getCpus().size();
+    ASSERT(topo.getNodeCount() >= 1);
+    for (int cpu : topo.getCpus()) {
+        ASSERT(topo.getNodeOfCpu(cpu) >= 0);
+    }
+
+    // NONE返回整个集合，PACK/SPREAD每个线程一个CPU，数量超过CPU数时循环使用
+    ASSERT(topo.placeThread({}, myriel::NumaPolicy::NONE, 0) == topo.getCpus());
+    size_t n = topo.getCpus().size();
+    for (auto policy : {myriel::NumaPolicy::PACK, myriel::NumaPolicy::SPREAD}) {
+        std::vector<int> seen;
+        for (size_t i = 0; i < n * 2; ++i) {
+            std::vector<int> cpus = topo.placeThread({}, policy, i);
+            ASSERT(cpus.size() == 1);
+            if (i < n) {
+                seen.push_back(cpus[0]);
+            } else {
+                ASSERT(cpus[0] == seen[i - n]);
+            }
+        }
+        std::sort(seen.begin(), seen.end());
+        ASSERT(seen == topo.getCpus());
+    }
+    // SPREAD时相邻线程落在不同节点上
+    if (topo.getNodeCount() > 1) {
+        int node0 = topo.getNodeOfCpu(topo.placeThread({}, myriel::NumaPolicy::SPREAD, 0)[0]);
+        int node1 = topo.getNodeOfCpu(topo.placeThread({}, myriel::NumaPolicy::SPREAD, 1)[0]);
+        ASSERT(node0 != node1);
+    }
+}
+
+/**
+ * @brief 调度线程绑定到配置的CPU上
+ */
+void test_scheduler() {
+    int cpu = myriel::CpuTopology::Get().getCpus().back();
+    myriel::Config::Lookup<std::string>("scheduler.cpu_affinity")->setValue(std::to_string(cpu));
+    myriel::Config::Lookup<std::string>("scheduler.numa_policy")->setValue("pack");
+    for (bool stealing : {false, true}) {
+        myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(stealing);
+        std::atomic<int> done{0};
+        myriel::Scheduler sc(3, false, "pinned");
+        sc.start();
+        for (int i = 0; i < 100; ++i) {
+            sc.schedule([&]() {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                ASSERT(sched_getaffinity(0, sizeof(set), &set) == 0);
+                ASSERT(CPU_COUNT(&set) == 1 && CPU_ISSET(cpu, &set));
+                ASSERT(sched_getcpu() == cpu);
+                ++done;
+            });
+        }
+        while (done != 100) {
+            usleep(1000);
+        }
+        sc.stop();
+    }
+    myriel::Config::Lookup<std::string>("scheduler.cpu_affinity")->setValue("");
+    myriel::Config::Lookup<std::string>("scheduler.numa_policy")->setValue("none");
+}
+
+int main() {
+    test_parse();
+    test_place();
+    test_scheduler();
+    LOG_INFO(g_logger) << "test_affinity ok";
+    return 0;
+}
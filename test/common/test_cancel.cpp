@@ -0,0 +1,226 @@
+#include "../../code/common/cancel.h"
+#include "../../code/common/channel.h"
+#include "../../code/common/fiber_future.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/utils.h"
+#include "../../code/common/log.h"
+
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 截止时间到达时挂起的接收立即返回
+ */
+void test_deadline() {
+    myriel::Scheduler sc(2, false);
+    sc.start();
+    myriel::Channel<int> ch;
+    myriel::SpscChannel<int> spsc(4);
+    std::atomic<int> done{0};
+
+    sc.schedule([&]() {
+        uint64_t begin = myriel::GetElapsedMS();
+        myriel::CancelScope scope(50);
+        int value = 0;
+        ASSERT(!ch.recv(value));
+        ASSERT(scope.status() == myriel::WaitStatus::TIMEOUT);
+        ASSERT(myriel::Fiber::IsCancelled());
+        uint64_t cost = myriel::GetElapsedMS() - begin;
+        ASSERT(cost >= 45 && cost < 1000);
+        ++done;
+    });
+    sc.schedule([&]() {
+        myriel::CancelScope scope(30);
+        int value = 0;
+        ASSERT(!spsc.recv(value));
+        ASSERT(scope.status() == myriel::WaitStatus::TIMEOUT);
+        ++done;
+    });
+    // 挂起的协程不在任务队列中，stop不会等待它们
+    while(done != 2) {
+        usleep(1000);
+    }
+    sc.stop();
+
+    // 超时之后通道仍然可用，被撤下的等待者不会吞掉数据
+    ch.send(1);
+    int value = 0;
+    ASSERT(ch.tryRecv(value) && value == 1);
+    spsc.send(2);
+    ASSERT(spsc.tryRecv(value) && value == 2);
+}
+
+/**
+ * @brief 取消父令牌时，子协程与回调任务中的各种等待一并返回
+ */
+void test_propagation() {
+    myriel::Scheduler sc(2, false);
+    sc.start();
+
+    myriel::CancelToken::ptr root = myriel::CancelToken::Create();
+    myriel::FiberSemaphore sem;
+    myriel::FiberMutex mutex;
+    myriel::FiberCondVar cond;
+    myriel::FiberPromise<int> promise;
+    myriel::Channel<int> a, b;
+    std::atomic<int> cancelled{0};
+    std::atomic<int> started{0};
+
+    mutex.lock();
+    myriel::Fiber::ptr parent(new myriel::Fiber([&]() {
+        // 子协程获得子令牌
+        sc.schedule(myriel::Fiber::ptr(new myriel::Fiber([&]() {
+            ++started;
+            if(sem.wait() == myriel::WaitStatus::CANCELLED) {
+                ++cancelled;
+            }
+        })));
+        // 回调任务沿用父协程的令牌
+        sc.schedule([&]() {
+            ++started;
+            if(mutex.lockCancellable() == myriel::WaitStatus::CANCELLED) {
+                ++cancelled;
+            }
+        });
+        sc.schedule([&]() {
+            ++started;
+            try {
+                promise.getFuture().get();
+            } catch(const myriel::CancelledError &e) {
+                ASSERT(e.status() == myriel::WaitStatus::CANCELLED);
+                ++cancelled;
+            }
+        });
+        sc.schedule([&]() {
+            ++started;
+            myriel::Select sel;
+            int x, y;
+            sel.recv(a, x);
+            sel.recv(b, y);
+            if(sel.wait() == myriel::Select::kCancelled) {
+                ++cancelled;
+            }
+        });
+        ++started;
+        myriel::FiberMutex local;
+        local.lock();
+        if(cond.wait(local, []() { return false; }) == myriel::WaitStatus::CANCELLED) {
+            ++cancelled;
+        }
+        local.unlock();
+    }));
+    parent->setCancelToken(root);
+    sc.schedule(parent);
+
+    while(started != 5) {
+        usleep(1000);
+    }
+    usleep(20 * 1000);
+    ASSERT(cancelled == 0);
+    ASSERT(root->cancel());
+    ASSERT(!root->cancel());
+    while(cancelled != 5) {
+        usleep(1000);
+    }
+    mutex.unlock();
+    sc.stop();
+
+    // 被取消的等待者已经离开队列，计数与锁都没有丢失
+    sem.notify();
+    ASSERT(sem.tryWait());
+    ASSERT(mutex.try_lock());
+    mutex.unlock();
+}
+
+/**
+ * @brief 唤醒与取消竞争时，被取消的等待者不会吞掉唤醒
+ */
+void test_wakeup_race() {
+    myriel::Scheduler sc(2, false);
+    sc.start();
+    myriel::FiberSemaphore sem;
+    std::atomic<int> acquired{0}, cancelled{0};
+    std::vector<myriel::CancelToken::ptr> tokens;
+    for(int i = 0; i < 200; ++i) {
+        myriel::CancelToken::ptr token = myriel::CancelToken::Create();
+        tokens.push_back(token);
+        myriel::Fiber::ptr fiber(new myriel::Fiber([&]() {
+            if(sem.wait() == myriel::WaitStatus::OK) {
+                ++acquired;
+            } else {
+                ++cancelled;
+            }
+        }));
+        fiber->setCancelToken(token);
+        sc.schedule(fiber);
+    }
+    for(int i = 0; i < 200; ++i) {
+        if(i % 2) {
+            tokens[i]->cancel();
+        } else {
+            sem.notify();
+        }
+    }
+    // 尚未挂起的协程可能直接拿走计数，其余等待者全部取消
+    for(auto &token : tokens) {
+        token->cancel();
+    }
+    while(acquired + cancelled != 200) {
+        usleep(1000);
+    }
+    sc.stop();
+    // 发出100个计数，被取消的等待者没有拿走计数，也没有丢失计数
+    int left = 0;
+    while(sem.tryWait()) {
+        ++left;
+    }
+    ASSERT(acquired + left == 100);
+    ASSERT(cancelled >= 100);
+    LOG_INFO(g_logger) << "acquired=" << acquired << " cancelled=" << cancelled << " left=" << left;
+}
+
+/**
+ * @brief 线程上下文中同样可以设置截止时间
+ */
+void test_thread_mode() {
+    myriel::FiberPromise<void> promise;
+    myriel::CancelScope scope(20);
+    ASSERT(promise.getFuture().wait() == myriel::WaitStatus::TIMEOUT);
+    ASSERT(scope.token()->deadline() != 0);
+    myriel::CancelToken::ptr child = scope.token()->child(1000);
+    ASSERT(child->isCancelled() && child->status() == myriel::WaitStatus::TIMEOUT);
+}
+
+/**
+ * @brief 令牌在截止时间前后被释放，与截止时间线程的到期处理竞争
+ */
+void test_drop_at_deadline() {
+    std::vector<std::thread> thrs;
+    for (int t = 0; t < 4; ++t) {
+        thrs.emplace_back([t]() {
+            for (int i = 0; i < 500; ++i) {
+                myriel::CancelToken::ptr token = myriel::CancelToken::Create(1);
+                myriel::CancelToken::ptr child = token->child(1);
+                // 在1毫秒前后释放，覆盖到期前、到期时与到期后
+                usleep((i * 7 + t * 13) % 1500);
+                child.reset();
+                token.reset();
+            }
+        });
+    }
+    for (auto &i : thrs) {
+        i.join();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    test_deadline();
+    test_drop_at_deadline();
+    test_propagation();
+    test_wakeup_race();
+    test_thread_mode();
+    return 0;
+}
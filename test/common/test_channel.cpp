@@ -0,0 +1,191 @@
+#include "../../code/common/channel.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/log.h"
+
+#include <atomic>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 多生产者多消费者，容量很小，发送与接收都会频繁挂起
+ */
+void test_mpmc() {
+    myriel::Scheduler sc(4, false);
+    sc.start();
+
+    const int producers = 4;
+    const int consumers = 4;
+    const int items = 2000;
+    myriel::Channel<int> channel(8);
+    myriel::FiberSemaphore produced;
+    myriel::FiberSemaphore done;
+    std::atomic<int64_t> sum{0};
+    std::atomic<int> count{0};
+
+    for (int p = 0; p < producers; ++p) {
+        sc.schedule([&]() {
+            for (int i = 1; i <= items; ++i) {
+                ASSERT(channel.send(i));
+            }
+            produced.notify();
+        });
+    }
+    for (int c = 0; c < consumers; ++c) {
+        sc.schedule([&]() {
+            int v;
+            while (channel.recv(v)) {
+                sum += v;
+                ++count;
+            }
+            done.notify();
+        });
+    }
+    for (int p = 0; p < producers; ++p) {
+        produced.wait();
+    }
+    channel.close();
+    for (int c = 0; c < consumers; ++c) {
+        done.wait();
+    }
+    sc.stop();
+
+    LOG_INFO(g_logger) << "mpmc count = " << count << " sum = " << sum;
+    ASSERT(count == producers * items);
+    ASSERT(sum == (int64_t)producers * items * (items + 1) / 2);
+}
+
+/**
+ * @brief 无界通道发送不会挂起；关闭后发送失败，剩余数据仍可取出
+ */
+void test_unbounded_close() {
+    myriel::Channel<std::string> channel;
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT(channel.send(std::to_string(i)));
+    }
+    ASSERT(channel.size() == 10000);
+    channel.close();
+    ASSERT(!channel.send("x"));
+    ASSERT(!channel.trySend("x"));
+
+    std::string v;
+    int n = 0;
+    while (channel.recv(v)) {
+        ASSERT(v == std::to_string(n));
+        ++n;
+    }
+    ASSERT(n == 10000);
+    ASSERT(!channel.tryRecv(v));
+    LOG_INFO(g_logger) << "unbounded drained " << n;
+}
+
+/**
+ * @brief select同时等待两个通道，通道关闭后不再加入select
+ */
+void test_select() {
+    myriel::Scheduler sc(2, false);
+    sc.start();
+
+    myriel::Channel<int> ints(1);
+    myriel::Channel<std::string> strs(1);
+    myriel::FiberSemaphore done;
+    int int_count = 0;
+    int str_count = 0;
+
+    sc.schedule([&]() {
+        bool ints_open = true;
+        bool strs_open = true;
+        while (ints_open || strs_open) {
+            int i = 0;
+            std::string s;
+            bool ok = false;
+            myriel::Select sel;
+            size_t int_case = ints_open ? sel.recv(ints, i, &ok) : -1;
+            size_t str_case = strs_open ? sel.recv(strs, s, &ok) : -1;
+            size_t idx = sel.wait();
+            if (idx == int_case) {
+                if (ok) {
+                    ++int_count;
+                } else {
+                    ints_open = false;
+                }
+            } else if (idx == str_case) {
+                if (ok) {
+                    ++str_count;
+                } else {
+                    strs_open = false;
+                }
+            }
+        }
+        done.notify();
+    });
+    sc.schedule([&]() {
+        for (int i = 0; i < 1000; ++i) {
+            ints.send(i);
+            // 发送分支：通道满时挂起
+            myriel::Select sel;
+            bool ok = false;
+            sel.send(strs, std::to_string(i), &ok);
+            ASSERT(sel.wait() == 0 && ok);
+        }
+        ints.close();
+        strs.close();
+    });
+    done.wait();
+    sc.stop();
+
+    LOG_INFO(g_logger) << "select ints = " << int_count << " strs = " << str_count;
+    ASSERT(int_count == 1000 && str_count == 1000);
+
+    // 通道已关闭时select立即返回，ok为false
+    myriel::Channel<int> closed(1);
+    closed.close();
+    myriel::Select sel;
+    int v;
+    bool ok = true;
+    sel.recv(closed, v, &ok);
+    ASSERT(sel.tryWait() == 0 && !ok);
+}
+
+/**
+ * @brief 单生产者单消费者保持顺序，容量很小，两端都会挂起
+ */
+void test_spsc() {
+    myriel::Scheduler sc(2, false);
+    sc.start();
+
+    const uint64_t items = 100000;
+    myriel::SpscChannel<uint64_t> channel(4);
+    myriel::FiberSemaphore done;
+    uint64_t received = 0;
+
+    sc.schedule([&]() {
+        for (uint64_t i = 0; i < items; ++i) {
+            ASSERT(channel.send(i));
+        }
+        channel.close();
+    });
+    sc.schedule([&]() {
+        uint64_t v;
+        while (channel.recv(v)) {
+            ASSERT(v == received);
+            ++received;
+        }
+        done.notify();
+    });
+    done.wait();
+    sc.stop();
+
+    LOG_INFO(g_logger) << "spsc received = " << received;
+    ASSERT(received == items);
+    ASSERT(channel.capacity() == 4);
+}
+
+int main(int argc, char *argv[]) {
+    LOG_INFO(g_logger) << "main begin";
+    test_mpmc();
+    test_unbounded_close();
+    test_select();
+    test_spsc();
+    LOG_INFO(g_logger) << "main end";
+    return 0;
+}
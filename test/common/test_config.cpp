@@ -16,7 +16,7 @@ public:
         ss<<"[ name="<<m_name<<", age="<<m_age<<" ]";
         return ss.str();
     }
-    bool operator==(const Person& oth){
+    bool operator==(const Person& oth) const {
         return m_age == oth.m_age && m_name == oth.m_name;
     }
 };
@@ -0,0 +1,239 @@
+#include "../../code/common/scheduler.h"
+#include "../../code/common/iomanager.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+#include "../../code/common/utils.h"
+
+#include <unistd.h>
+#include <vector>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 开启弹性模式，排队超过1毫秒扩容，空闲200毫秒退出
+ */
+static void EnableElastic(uint32_t max_threads) {
+    myriel::Config::Lookup<uint32_t>("scheduler.elastic.max_threads")->setValue(max_threads);
+    myriel::Config::Lookup<uint32_t>("scheduler.elastic.grow_latency_us")->setValue(1000);
+    myriel::Config::Lookup<uint32_t>("scheduler.elastic.retire_idle_ms")->setValue(200);
+}
+
+/**
+ * @brief 等待条件成立，超时返回false
+ */
+template<class Pred>
+static bool WaitFor(Pred pred, uint64_t timeout_ms) {
+    uint64_t begin = myriel::GetElapsedMS();
+    while (!pred()) {
+        if (myriel::GetElapsedMS() - begin > timeout_ms) {
+            return false;
+        }
+        usleep(1000);
+    }
+    return true;
+}
+
+/**
+ * @brief 唯一的调度线程被阻塞时增加弹性线程执行排队的任务，空闲后弹性线程退出
+ * @details 工作窃取模式下任务在被阻塞线程自己的队列里，只能由弹性线程窃取
+ */
+template<class S>
+void test_grow_and_retire(const char *name, bool stealing) {
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(stealing);
+    EnableElastic(3);
+    const size_t n = 20;
+    std::atomic<bool> gate{false};
+    std::atomic<size_t> done{0};
+    S sc(1, false, name);
+    sc.start();
+    ASSERT(sc.getSpareCount() == 0);
+    sc.schedule([&]() {
+        for (size_t i = 0; i < n; ++i) {
+            myriel::Scheduler::GetThis()->schedule([&]() { ++done; });
+        }
+        while (!gate) {
+            usleep(1000);
+        }
+    });
+    ASSERT(WaitFor([&]() { return done == n; }, 3000));
+    ASSERT(sc.getSpareCount() >= 1);
+    LOG_INFO(g_logger) << name << ": " << sc.getMetrics().toString();
+
+    gate = true;
+    ASSERT(WaitFor([&]() { return sc.getSpareCount() == 0; }, 3000));
+    myriel::Scheduler::Metrics metrics = sc.getMetrics();
+    ASSERT(metrics.spareThreads == 0);
+    ASSERT(metrics.executed() == n + 1);
+    sc.stop();
+    EnableElastic(0);
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(false);
+}
+
+/**
+ * @brief 指定给弹性线程的任务在它存活期间都在它上面运行；绑定在它共享栈上的协程
+ * 		  析构前它不会退出，退出后指定给它的任务改在其它线程运行
+ */
+void test_pinned_spare() {
+    EnableElastic(2);
+    std::atomic<bool> gate{false};
+    myriel::Scheduler sc(1, false, "elastic");
+    sc.start();
+    std::thread::id core;
+    sc.schedule([&]() {
+        core = std::this_thread::get_id();
+        while (!gate) {
+            usleep(1000);
+        }
+    });
+    std::atomic<bool> got{false};
+    std::thread::id spare;
+    sc.schedule([&]() {
+        spare = std::this_thread::get_id();
+        got = true;
+    });
+    ASSERT(WaitFor([&]() { return got.load(); }, 3000));
+    ASSERT(spare != core && sc.getSpareCount() == 1);
+
+    const size_t n = 200;
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> wrong{0};
+    for (size_t i = 0; i < n; ++i) {
+        sc.schedule([&]() {
+            if (std::this_thread::get_id() != spare) {
+                ++wrong;
+            }
+            ++done;
+        }, spare);
+    }
+    ASSERT(WaitFor([&]() { return done == n; }, 3000));
+    ASSERT(wrong == 0);
+
+    // 共享栈协程在弹性线程上开始运行后绑定到它，挂起期间弹性线程空闲也不退出
+    std::atomic<int> step{0};
+    std::thread::id resumed;
+    myriel::Fiber::ptr fiber(new myriel::Fiber([&]() {
+        step = 1;
+        myriel::Fiber::GetThis()->yield();
+        resumed = std::this_thread::get_id();
+        step = 2;
+    }, 0, true, true));
+    sc.schedule(fiber, spare);
+    ASSERT(WaitFor([&]() { return step == 1; }, 3000));
+    gate = true;
+    usleep(500 * 1000);
+    ASSERT(sc.getSpareCount() == 1);
+    ASSERT(fiber->getBoundThread() == spare);
+    sc.schedule(fiber);
+    ASSERT(WaitFor([&]() { return step == 2; }, 3000));
+    ASSERT(resumed == spare);
+
+    // 协程析构后弹性线程空闲够久退出，指定给它的任务由其它线程执行
+    ASSERT(WaitFor([&]() { return fiber->getState() == myriel::Fiber::TERM && fiber.use_count() == 1; }, 3000));
+    fiber.reset();
+    ASSERT(WaitFor([&]() { return sc.getSpareCount() == 0; }, 3000));
+    std::atomic<bool> ran{false};
+    sc.schedule([&]() {
+        ASSERT(std::this_thread::get_id() == core);
+        ran = true;
+    }, spare);
+    ASSERT(WaitFor([&]() { return ran.load(); }, 3000));
+    sc.stop();
+    EnableElastic(0);
+}
+
+/**
+ * @brief 阻塞唯一的调度线程直到弹性线程启动，返回弹性线程的ID
+ */
+static std::thread::id SpawnSpare(myriel::Scheduler &sc, std::atomic<bool> &gate) {
+    sc.schedule([&gate]() {
+        while (!gate) {
+            usleep(1000);
+        }
+    });
+    std::atomic<bool> got{false};
+    std::thread::id spare;
+    sc.schedule([&]() {
+        spare = std::this_thread::get_id();
+        got = true;
+    });
+    ASSERT(WaitFor([&]() { return got.load(); }, 3000));
+    return spare;
+}
+
+/**
+ * @brief 弹性线程退出后它的槽位被新线程复用，新线程的ID不同，指定给旧线程的任务仍会执行
+ * @details 先占住退出线程的ID，新的弹性线程就拿不到同一个ID
+ */
+void test_slot_reuse() {
+    EnableElastic(2);
+    myriel::Config::Lookup<uint32_t>("scheduler.elastic.retire_idle_ms")->setValue(100);
+    myriel::Scheduler sc(1, false, "elastic");
+    sc.start();
+
+    std::atomic<bool> gate{false};
+    std::thread::id old_spare = SpawnSpare(sc, gate);
+    gate = true;
+    ASSERT(WaitFor([&]() { return sc.getSpareCount() == 0; }, 3000));
+    // 退出的线程被监视线程回收后，新建的线程会复用它的ID
+    std::atomic<bool> release{false};
+    std::vector<std::thread> squatters;
+    // 没拿到该ID的线程立即退出，但在最后才回收，下次创建不会再拿到它的ID
+    for (int i = 0; i < 100 && (squatters.empty() || squatters.back().get_id() != old_spare); ++i) {
+        squatters.emplace_back([&]() {
+            while (std::this_thread::get_id() == old_spare && !release) {
+                usleep(1000);
+            }
+        });
+    }
+    std::thread &squatter = squatters.back();
+    ASSERT(squatter.get_id() == old_spare);
+
+    gate = false;
+    std::thread::id new_spare = SpawnSpare(sc, gate);
+    ASSERT(new_spare != old_spare);
+
+    std::atomic<bool> ran{false};
+    sc.schedule([&]() { ran = true; }, old_spare);
+    ASSERT(WaitFor([&]() { return ran.load(); }, 3000));
+
+    gate = true;
+    release = true;
+    for (auto &i : squatters) {
+        i.join();
+    }
+    sc.stop();
+    EnableElastic(0);
+}
+
+/**
+ * @brief 排队时间没有超过阈值时不增加线程
+ */
+void test_no_grow() {
+    EnableElastic(4);
+    myriel::Config::Lookup<uint32_t>("scheduler.elastic.grow_latency_us")->setValue(100 * 1000);
+    std::atomic<size_t> done{0};
+    myriel::Scheduler sc(2, false, "elastic");
+    sc.start();
+    for (int round = 0; round < 50; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            sc.schedule([&]() { ++done; });
+        }
+        usleep(1000);
+    }
+    ASSERT(WaitFor([&]() { return done == 5000; }, 3000));
+    ASSERT(sc.getSpareCount() == 0);
+    sc.stop();
+    EnableElastic(0);
+}
+
+int main(int argc, char *argv[]) {
+    test_grow_and_retire<myriel::Scheduler>("elastic", false);
+    test_grow_and_retire<myriel::Scheduler>("elastic", true);
+    test_grow_and_retire<myriel::IOManager>("elastic_io", false);
+    test_pinned_spare();
+    test_slot_reuse();
+    test_no_grow();
+    LOG_INFO(g_logger) << "test_elastic done";
+    return 0;
+}
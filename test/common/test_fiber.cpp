@@ -57,6 +57,64 @@ void test_fiber() {
     LOG_INFO(g_logger) << "test_fiber end";
 }
 
+/**
+ * @brief 共享栈协程交替运行，切换后栈上的局部变量保持不变
+ */
+void test_shared_stack() {
+    LOG_INFO(g_logger) << "test_shared_stack begin";
+    myriel::Fiber::GetThis();
+
+    std::vector<myriel::Fiber::ptr> fibers;
+    for (int i = 0; i < 8; i++) {
+        fibers.emplace_back(new myriel::Fiber([i]() {
+            int local[16];
+            for (int j = 0; j < 16; j++) {
+                local[j] = i * 100 + j;
+            }
+            myriel::Fiber::GetThis()->yield();
+            for (int j = 0; j < 16; j++) {
+                ASSERT(local[j] == i * 100 + j);
+            }
+        }, 0, false, true));
+    }
+    for (auto &i : fibers) {
+        i->resume();
+    }
+    for (auto &i : fibers) {
+        LOG_INFO(g_logger) << "fiber " << i->getId() << " saved stack: " << i->getSavedStackSize();
+        i->resume();
+    }
+    LOG_INFO(g_logger) << "test_shared_stack end";
+}
+
+/**
+ * @brief 共享栈协程比创建它的线程活得更久，线程退出后在别的线程析构
+ */
+void test_shared_stack_outlive_thread() {
+    LOG_INFO(g_logger) << "test_shared_stack_outlive_thread begin";
+    std::vector<myriel::Fiber::ptr> fibers;
+    std::thread([&fibers]() {
+        myriel::Fiber::GetThis();
+        for (int i = 0; i < 4; i++) {
+            fibers.emplace_back(new myriel::Fiber([]() {
+                myriel::Fiber::GetThis()->yield();
+            }, 0, false, true));
+        }
+        // 两个停在yield，两个运行结束，都保持与该线程共享栈的绑定
+        for (auto &i : fibers) {
+            i->resume();
+        }
+        fibers[2]->resume();
+        fibers[3]->resume();
+    }).join();
+    for (auto &i : fibers) {
+        ASSERT(i->isSharedStack());
+    }
+    // 停在yield的协程不能在别的线程恢复，直接析构，解除绑定时访问的共享栈仍然有效
+    fibers.clear();
+    LOG_INFO(g_logger) << "test_shared_stack_outlive_thread end";
+}
+
 int main(int argc, char *argv[]) {
     // myriel::EnvMgr::GetInstance()->init(argc, argv);
     // myriel::Config::LoadFromConfDir(myriel::EnvMgr::GetInstance()->getConfigPath());
@@ -73,6 +131,9 @@ int main(int argc, char *argv[]) {
         i.join();
     }
 
+    std::thread(std::bind(&test_shared_stack)).join();
+    test_shared_stack_outlive_thread();
+
     LOG_INFO(g_logger) << "main end";
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "../../code/common/fiber_future.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/log.h"
+
+#include <stdexcept>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 模拟一次后端调用：让出若干次后返回结果
+ */
+static int Backend(int i) {
+    for (int j = 0; j < i % 4; ++j) {
+        myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+        myriel::Fiber::GetThis()->yield();
+    }
+    return i * i;
+}
+
+/**
+ * @brief 在协程中扇出子请求并等待全部完成
+ */
+void test_scatter_gather() {
+    myriel::Scheduler sc(4, false);
+    sc.start();
+
+    auto total = sc.scheduleFuture([&sc]() {
+        std::vector<myriel::FiberFuture<int>> parts;
+        for (int i = 0; i < 32; ++i) {
+            parts.push_back(sc.scheduleFuture(std::bind(&Backend, i)));
+        }
+        myriel::WhenAll(parts).get();
+        int sum = 0;
+        for (auto &part : parts) {
+            ASSERT(part.isReady());
+            sum += part.get();
+        }
+        return sum;
+    });
+
+    // 主线程不在调度器中，get阻塞线程
+    int sum = total.get();
+    sc.stop();
+
+    int expect = 0;
+    for (int i = 0; i < 32; ++i) {
+        expect += i * i;
+    }
+    LOG_INFO(g_logger) << "scatter-gather sum = " << sum;
+    ASSERT(sum == expect);
+}
+
+/**
+ * @brief WhenAny返回最先就绪的下标
+ */
+void test_when_any() {
+    myriel::Scheduler sc(2, false);
+    sc.start();
+
+    myriel::FiberPromise<std::string> slow;
+    std::vector<myriel::FiberFuture<std::string>> futures;
+    futures.push_back(slow.getFuture());
+    futures.push_back(sc.scheduleFuture([]() { return std::string("fast"); }));
+
+    size_t first = myriel::WhenAny(futures).get();
+    LOG_INFO(g_logger) << "when_any first = " << first << " value = " << futures[first].get();
+    ASSERT(first == 1);
+    ASSERT(!futures[0].isReady());
+
+    slow.setValue("slow");
+    ASSERT(futures[0].get() == "slow");
+    ASSERT(myriel::WhenAny(futures).get() == 0);
+    sc.stop();
+}
+
+/**
+ * @brief 异常通过future传递给等待方
+ */
+void test_exception() {
+    myriel::Scheduler sc(1, false);
+    sc.start();
+
+    myriel::FiberFuture<void> failed = sc.scheduleFuture([]() {
+        throw std::runtime_error("backend down");
+    });
+    myriel::FiberFuture<void> ok = sc.scheduleFuture([]() {});
+
+    bool caught = false;
+    try {
+        failed.get();
+    } catch (std::runtime_error &ex) {
+        caught = std::string(ex.what()) == "backend down";
+    }
+    ok.get();
+    myriel::WhenAll(std::vector<myriel::FiberFuture<void>>{failed, ok}).get();
+    sc.stop();
+
+    LOG_INFO(g_logger) << "exception caught = " << caught;
+    ASSERT(caught);
+}
+
+int main(int argc, char *argv[]) {
+    LOG_INFO(g_logger) << "main begin";
+    test_scatter_gather();
+    test_when_any();
+    test_exception();
+    LOG_INFO(g_logger) << "main end";
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "../../code/common/fiber_local.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/log.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<int> s_destroyed{0};
+
+struct RequestContext {
+    uint64_t trace_id = 0;
+    ~RequestContext() { ++s_destroyed; }
+};
+
+static myriel::FiberLocal<RequestContext> s_context;
+static myriel::FiberLocal<int> s_counter([]() { return 100; });
+
+/**
+ * @brief 设置追踪id后多次让出并重新调度，可能换到其它线程运行，值保持不变
+ */
+void handle_request(uint64_t trace_id) {
+    s_context->trace_id = trace_id;
+    for (int i = 0; i < 3; ++i) {
+        myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+        myriel::Fiber::GetThis()->yield();
+        ASSERT(s_context->trace_id == trace_id);
+        ++*s_counter;
+    }
+    ASSERT(*s_counter == 103);
+    LOG_INFO(g_logger) << "request " << trace_id << " done, trace_id = " << s_context->trace_id;
+}
+
+/**
+ * @brief 执行完的回调协程会被下一个回调复用，复用时协程局部变量与取消令牌都是新的
+ */
+void test_reused_callback_fiber() {
+    std::vector<uint64_t> ids;
+    bool clean = true;
+    myriel::Scheduler sc(1, false);
+    sc.start();
+    for (int i = 0; i < 5; ++i) {
+        sc.schedule([&]() {
+            ids.push_back(myriel::Fiber::GetFiberId());
+            clean &= *s_counter == 100 && !myriel::Fiber::GetCancelToken();
+            *s_counter = 1;
+        });
+        if (i == 2) {
+            // 让出的回调协程交给了调度器，不能被后面的回调复用
+            sc.schedule([&]() {
+                ids.push_back(myriel::Fiber::GetFiberId());
+                myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+                myriel::Fiber::GetThis()->yield();
+            });
+        }
+    }
+    sc.stop();
+    ASSERT(clean);
+    ASSERT(ids.size() == 6);
+    ASSERT(ids[0] == ids[1] && ids[1] == ids[2] && ids[2] == ids[3]);
+    ASSERT(ids[4] != ids[3] && ids[5] == ids[4]);
+}
+
+/**
+ * @brief 变量析构后下标归还复用，协程上残留的旧值不会被复用下标的新变量读到
+ */
+void test_slot_reuse() {
+    // 反复创建销毁的变量个数超过上限
+    for (size_t i = 0; i < myriel::FiberLocalBase::kMaxLocals * 2; ++i) {
+        myriel::FiberLocal<int> local;
+        *local = (int)i;
+        ASSERT(local.has());
+    }
+
+    myriel::Fiber::GetThis();
+    auto old_local = std::make_unique<myriel::FiberLocal<RequestContext>>();
+    std::unique_ptr<myriel::FiberLocal<std::string>> new_local;
+    int destroyed = s_destroyed;
+    myriel::Fiber::ptr fiber(new myriel::Fiber([&]() {
+        (*old_local)->trace_id = 7;
+        myriel::Fiber::GetThis()->yield();
+        // 旧值仍在本协程的槽位中，新变量访问时按原类型析构后重新构造
+        ASSERT(!new_local->has());
+        ASSERT(s_destroyed == destroyed + 1);
+        ASSERT((*new_local)->empty());
+        **new_local = "reused";
+    }, 0, false));
+    fiber->resume();
+
+    // 在主协程上销毁旧变量，协程上的值保留到下次被访问
+    old_local.reset();
+    ASSERT(s_destroyed == destroyed);
+    new_local = std::make_unique<myriel::FiberLocal<std::string>>();
+    fiber->resume();
+    ASSERT(fiber->getState() == myriel::Fiber::TERM);
+    ASSERT(!new_local->has());
+}
+
+int main(int argc, char *argv[]) {
+    LOG_INFO(g_logger) << "main begin";
+
+    // 线程主协程上访问时使用线程局部的槽位
+    s_context->trace_id = 1;
+    ASSERT(s_context.has());
+
+    {
+        myriel::Scheduler sc(3, false);
+        sc.start();
+        for (uint64_t i = 0; i < 10; ++i) {
+            sc.schedule(std::bind(&handle_request, 1000 + i));
+        }
+        sc.stop();
+    }
+
+    LOG_INFO(g_logger) << "destroyed: " << s_destroyed;
+    ASSERT(s_destroyed == 10);
+    ASSERT(s_context->trace_id == 1);
+
+    test_reused_callback_fiber();
+    test_slot_reuse();
+
+    LOG_INFO(g_logger) << "main end";
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "../../code/common/fiber_sync.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/log.h"
+
+#include <atomic>
+#include <deque>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+static const int kFibers = 64;
+static const int kLoops = 1000;
+
+/**
+ * @brief 持锁期间让出协程，std::mutex在这里会让同一线程上的其它协程死锁
+ */
+void test_mutex() {
+    myriel::Scheduler sc(4, false);
+    sc.start();
+
+    myriel::FiberMutex mutex;
+    myriel::FiberSemaphore done;
+    int counter = 0;
+    for (int i = 0; i < kFibers; ++i) {
+        sc.schedule([&]() {
+            for (int j = 0; j < kLoops; ++j) {
+                std::lock_guard<myriel::FiberMutex> locker(mutex);
+                int v = counter;
+                if (j % 100 == 0) {
+                    myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+                    myriel::Fiber::GetThis()->yield();
+                }
+                counter = v + 1;
+            }
+            done.notify();
+        });
+    }
+    // 主线程不在调度器中，以线程方式等待
+    for (int i = 0; i < kFibers; ++i) {
+        done.wait();
+    }
+    sc.stop();
+
+    LOG_INFO(g_logger) << "mutex counter = " << counter;
+    ASSERT(counter == kFibers * kLoops);
+}
+
+/**
+ * @brief 有界队列上的生产者/消费者
+ */
+void test_condvar() {
+    myriel::Scheduler sc(4, false);
+    sc.start();
+
+    myriel::FiberMutex mutex;
+    myriel::FiberCondVar not_empty;
+    myriel::FiberCondVar not_full;
+    myriel::FiberSemaphore done;
+    std::deque<int> queue;
+    const size_t capacity = 4;
+    const int producers = 8;
+    const int items = 500;
+    std::atomic<int64_t> sum{0};
+
+    for (int p = 0; p < producers; ++p) {
+        sc.schedule([&]() {
+            for (int i = 1; i <= items; ++i) {
+                std::unique_lock<myriel::FiberMutex> locker(mutex);
+                not_full.wait(mutex, [&]() { return queue.size() < capacity; });
+                queue.push_back(i);
+                not_empty.notifyOne();
+            }
+            done.notify();
+        });
+        sc.schedule([&]() {
+            for (int i = 0; i < items; ++i) {
+                std::unique_lock<myriel::FiberMutex> locker(mutex);
+                not_empty.wait(mutex, [&]() { return !queue.empty(); });
+                sum += queue.front();
+                queue.pop_front();
+                not_full.notifyOne();
+            }
+            done.notify();
+        });
+    }
+    for (int i = 0; i < producers * 2; ++i) {
+        done.wait();
+    }
+    sc.stop();
+
+    LOG_INFO(g_logger) << "condvar sum = " << sum;
+    ASSERT(sum == (int64_t)producers * items * (items + 1) / 2);
+    ASSERT(queue.empty());
+}
+
+/**
+ * @brief 信号量限制并发数
+ */
+void test_semaphore() {
+    myriel::Scheduler sc(4, false);
+    sc.start();
+
+    myriel::FiberSemaphore slots(3);
+    myriel::FiberSemaphore done;
+    std::atomic<int> running{0};
+    std::atomic<int> peak{0};
+    for (int i = 0; i < kFibers; ++i) {
+        sc.schedule([&]() {
+            slots.wait();
+            int now = ++running;
+            int old = peak.load();
+            while (now > old && !peak.compare_exchange_weak(old, now)) {}
+            myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+            myriel::Fiber::GetThis()->yield();
+            --running;
+            slots.notify();
+            done.notify();
+        });
+    }
+    for (int i = 0; i < kFibers; ++i) {
+        done.wait();
+    }
+    sc.stop();
+
+    LOG_INFO(g_logger) << "semaphore peak = " << peak;
+    ASSERT(peak <= 3);
+    ASSERT(slots.tryWait() && slots.tryWait() && slots.tryWait());
+    ASSERT(!slots.tryWait());
+}
+
+/**
+ * @brief 读者之间可以并发，写者独占
+ */
+void test_rwmutex() {
+    myriel::Scheduler sc(4, false);
+    sc.start();
+
+    myriel::FiberRWMutex rwmutex;
+    myriel::FiberSemaphore done;
+    std::atomic<int> readers{0};
+    std::atomic<bool> writing{false};
+    int value = 0;
+    for (int i = 0; i < kFibers; ++i) {
+        bool writer = i % 8 == 0;
+        sc.schedule([&, writer]() {
+            for (int j = 0; j < 100; ++j) {
+                if (writer) {
+                    myriel::FiberRWMutex::WriteLock locker(rwmutex);
+                    ASSERT(readers == 0 && !writing);
+                    writing = true;
+                    ++value;
+                    writing = false;
+                } else {
+                    myriel::FiberRWMutex::ReadLock locker(rwmutex);
+                    ++readers;
+                    ASSERT(!writing);
+                    if (j % 10 == 0) {
+                        myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+                        myriel::Fiber::GetThis()->yield();
+                    }
+                    --readers;
+                }
+            }
+            done.notify();
+        });
+    }
+    for (int i = 0; i < kFibers; ++i) {
+        done.wait();
+    }
+    sc.stop();
+
+    LOG_INFO(g_logger) << "rwmutex value = " << value;
+    ASSERT(value == kFibers / 8 * 100);
+}
+
+int main(int argc, char *argv[]) {
+    LOG_INFO(g_logger) << "main begin";
+    test_mutex();
+    test_condvar();
+    test_semaphore();
+    test_rwmutex();
+    LOG_INFO(g_logger) << "main end";
+    return 0;
+}
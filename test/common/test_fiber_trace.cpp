@@ -0,0 +1,77 @@
+#include "../../code/common/fiber_trace.h"
+#include "../../code/common/fiber_sync.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+
+#include <unistd.h>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+static size_t Count(const std::string &s, const std::string &pattern) {
+    size_t n = 0;
+    for (size_t pos = s.find(pattern); pos != std::string::npos; pos = s.find(pattern, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    // 关闭时不记录任何事件
+    {
+        myriel::Scheduler sc(1, false, "untraced");
+        sc.start();
+        sc.schedule([]() { myriel::Fiber::GetThis()->yield(); });
+        sc.stop();
+    }
+    ASSERT(myriel::FiberTrace::DumpChromeJson().find("\"ph\":\"B\"") == std::string::npos);
+
+    myriel::Config::Lookup<bool>("fiber.trace")->setValue(true);
+    ASSERT(myriel::FiberTrace::IsEnabled());
+    {
+        myriel::Scheduler sc(2, false, "traced");
+        sc.start();
+        myriel::FiberSemaphore sem;
+        sc.schedule([&sem]() { sem.wait(); });
+        sc.schedule([&sem]() {
+            for (int i = 0; i < 3; ++i) {
+                myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+                myriel::Fiber::GetThis()->yield();
+            }
+            sem.notify();
+        });
+        sc.stop();
+    }
+    myriel::Config::Lookup<bool>("fiber.trace")->setValue(false);
+
+    std::string json = myriel::FiberTrace::DumpChromeJson();
+    LOG_INFO(g_logger) << "\n" << json;
+
+    size_t begins = Count(json, "\"ph\":\"B\"");
+    size_t ends = Count(json, "\"ph\":\"E\"");
+    // 等待者1次切出 + 唤醒后结束，让出者3次切出 + 结束
+    ASSERT(begins == ends);
+    ASSERT(begins >= 6);
+    ASSERT(Count(json, "\"reason\":\"semaphore\"") == 1);
+    ASSERT(Count(json, "\"reason\":\"term\"") >= 2);
+    ASSERT(Count(json, "\"reason\":\"yield\"") >= 3);
+    ASSERT(json.find("queue_us") != std::string::npos);
+    ASSERT(json.find("traced") != std::string::npos);
+
+    const char *path = "/tmp/test_fiber_trace.json";
+    ASSERT(myriel::FiberTrace::DumpToFile(path));
+    unlink(path);
+    myriel::FiberTrace::Clear();
+    ASSERT(Count(myriel::FiberTrace::DumpChromeJson(), "\"ph\":\"B\"") == 0);
+
+    // 清空后继续写入的事件照常导出，线程名中的引号与反斜杠被转义
+    std::thread([]() {
+        myriel::FiberTrace::SetThreadName("quote\"back\\slash");
+        myriel::FiberTrace::SwitchIn(1);
+        myriel::FiberTrace::SwitchOut(1);
+    }).join();
+    json = myriel::FiberTrace::DumpChromeJson();
+    ASSERT(Count(json, "\"ph\":\"B\"") == 1);
+    ASSERT(json.find("quote\\\"back\\\\slash") != std::string::npos);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include "../../code/common/hook.h"
+#include "../../code/common/iomanager.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+#include "../../code/common/utils.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 单个调度线程上的三个协程同时睡眠，总耗时约等于最长的一次
+ */
+void test_sleep() {
+    std::atomic<int> done{0};
+    uint64_t begin = myriel::GetElapsedMS();
+    {
+        myriel::IOManager iom(1, false, "hook");
+        iom.schedule([&]() {
+            ASSERT(myriel::is_hook_enable());
+            usleep(200 * 1000);
+            ++done;
+        });
+        iom.schedule([&]() {
+            struct timespec req = {0, 200 * 1000 * 1000};
+            ASSERT(nanosleep(&req, nullptr) == 0);
+            ++done;
+        });
+        iom.schedule([&]() {
+            ASSERT(sleep(0) == 0);
+            usleep(100 * 1000);
+            ++done;
+        });
+        while(done != 3) {
+            usleep(1000);
+        }
+    }
+    uint64_t cost = myriel::GetElapsedMS() - begin;
+    LOG_INFO(g_logger) << "3 sleeping fibers on 1 thread took " << cost << "ms";
+    ASSERT(cost < 400);
+    // 没有开启hook的线程照常阻塞
+    ASSERT(!myriel::is_hook_enable());
+}
+
+/**
+ * @brief 创建监听在回环地址随机端口上的socket
+ */
+static int Listen(sockaddr_in &addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT(bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+    socklen_t len = sizeof(addr);
+    ASSERT(getsockname(fd, (sockaddr *)&addr, &len) == 0);
+    ASSERT(listen(fd, 16) == 0);
+    return fd;
+}
+
+/**
+ * @brief 单线程上的服务端与客户端用阻塞写法互相收发
+ */
+void test_socket() {
+    std::atomic<int> done{0};
+    {
+        myriel::IOManager iom(1, false, "hook");
+        iom.schedule([&]() {
+            sockaddr_in addr;
+            int listen_fd = Listen(addr);
+
+            myriel::IOManager::GetThis()->schedule([addr, &done]() {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                ASSERT(connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0);
+                // 用户看到的仍是阻塞socket
+                ASSERT(!(fcntl(fd, F_GETFL) & O_NONBLOCK));
+                usleep(50 * 1000);
+                ASSERT(send(fd, "ping", 4, 0) == 4);
+                char buf[16];
+                ASSERT(read(fd, buf, sizeof(buf)) == 4);
+                ASSERT(memcmp(buf, "pong", 4) == 0);
+                close(fd);
+                ++done;
+            });
+
+            int fd = accept(listen_fd, nullptr, nullptr);
+            ASSERT(fd >= 0);
+            char buf[16];
+            ASSERT(recv(fd, buf, sizeof(buf), 0) == 4);
+            ASSERT(memcmp(buf, "ping", 4) == 0);
+            struct iovec iov = {(void *)"pong", 4};
+            ASSERT(writev(fd, &iov, 1) == 4);
+            // 对端关闭后读到0
+            ASSERT(recv(fd, buf, sizeof(buf), 0) == 0);
+            close(fd);
+            close(listen_fd);
+            ++done;
+        });
+        while(done != 2) {
+            usleep(1000);
+        }
+    }
+}
+
+/**
+ * @brief 读超时、取消令牌的截止时间与显式取消、其它协程关闭fd都会结束等待
+ */
+void test_timeout_cancel() {
+    std::atomic<int> done{0};
+    {
+        myriel::IOManager iom(1, false, "hook");
+        iom.schedule([&]() {
+            sockaddr_in addr;
+            int listen_fd = Listen(addr);
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            ASSERT(connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0);
+            char buf[16];
+
+            struct timeval tv = {0, 50 * 1000};
+            ASSERT(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+            uint64_t begin = myriel::GetElapsedMS();
+            ASSERT(recv(fd, buf, sizeof(buf), 0) == -1 && errno == ETIMEDOUT);
+            ASSERT(myriel::GetElapsedMS() - begin >= 50);
+            tv.tv_usec = 0;
+            ASSERT(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+
+            {
+                myriel::CancelScope scope(30);
+                ASSERT(read(fd, buf, sizeof(buf)) == -1 && errno == ETIMEDOUT);
+            }
+            {
+                myriel::CancelScope scope;
+                myriel::CancelToken::ptr token = scope.token();
+                myriel::IOManager::GetThis()->schedule([token]() {
+                    usleep(20 * 1000);
+                    token->cancel();
+                });
+                ASSERT(recv(fd, buf, sizeof(buf), 0) == -1 && errno == ECANCELED);
+                ASSERT(usleep(1000 * 1000) == -1 && errno == EINTR);
+            }
+
+            myriel::IOManager::GetThis()->schedule([fd]() {
+                usleep(20 * 1000);
+                close(fd);
+            });
+            ASSERT(recv(fd, buf, sizeof(buf), 0) == -1 && errno == EBADF);
+            close(listen_fd);
+            ++done;
+        });
+        while(done != 1) {
+            usleep(1000);
+        }
+    }
+}
+
+int main() {
+    myriel::Config::Lookup<bool>("scheduler.hook")->setValue(true);
+    test_sleep();
+    test_socket();
+    test_timeout_cancel();
+    LOG_INFO(g_logger) << "test_hook ok";
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "../../code/common/iomanager.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 协程注册读事件后让出，管道可读时被唤醒
+ */
+void test_fiber_event() {
+    int fds[2];
+    ASSERT(pipe2(fds, O_NONBLOCK) == 0);
+    std::atomic<int> done{0};
+    {
+        myriel::IOManager iom(2, false, "io");
+        iom.schedule([&]() {
+            ASSERT(myriel::IOManager::GetThis() == &iom);
+            ASSERT(iom.addEvent(fds[0], myriel::IOManager::READ) == 0);
+            // 同一事件不能重复注册
+            ASSERT(iom.addEvent(fds[0], myriel::IOManager::READ, []() {}) == -1);
+            myriel::Fiber::GetThis()->yield();
+            char buf[16];
+            ASSERT(read(fds[0], buf, sizeof(buf)) == 5);
+            ++done;
+        });
+        while(iom.getPendingEventCount() == 0) {
+            usleep(1000);
+        }
+        ASSERT(write(fds[1], "hello", 5) == 5);
+    }
+    ASSERT(done == 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * @brief 回调事件：写事件立即触发，delEvent不触发回调，cancelEvent/cancelAll触发回调
+ */
+void test_cancel() {
+    int fds[2];
+    ASSERT(pipe2(fds, O_NONBLOCK) == 0);
+    std::atomic<int> reads{0};
+    std::atomic<int> writes{0};
+    {
+        myriel::IOManager iom(1, false, "io");
+        ASSERT(iom.addEvent(fds[1], myriel::IOManager::WRITE, [&]() { ++writes; }) == 0);
+        while(writes != 1) {
+            usleep(1000);
+        }
+
+        ASSERT(iom.addEvent(fds[0], myriel::IOManager::READ, [&]() { ++reads; }) == 0);
+        ASSERT(iom.delEvent(fds[0], myriel::IOManager::READ));
+        ASSERT(!iom.delEvent(fds[0], myriel::IOManager::READ));
+        ASSERT(iom.addEvent(fds[0], myriel::IOManager::READ, [&]() { ++reads; }) == 0);
+        ASSERT(iom.cancelEvent(fds[0], myriel::IOManager::READ));
+        ASSERT(!iom.cancelEvent(fds[0], myriel::IOManager::READ));
+
+        ASSERT(iom.addEvent(fds[0], myriel::IOManager::READ, [&]() { ++reads; }) == 0);
+        ASSERT(iom.cancelAll(fds[0]));
+        ASSERT(!iom.cancelAll(fds[0]));
+        ASSERT(iom.getPendingEventCount() == 0);
+    }
+    ASSERT(reads == 2);
+    ASSERT(writes == 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * @brief 超过一个分块的fd
+ */
+void test_large_fd() {
+    int fds[2];
+    ASSERT(pipe2(fds, O_NONBLOCK) == 0);
+    int big = 5000;
+    ASSERT(dup2(fds[0], big) == big);
+    std::atomic<int> reads{0};
+    {
+        myriel::IOManager iom(2, false, "io");
+        ASSERT(iom.addEvent(big, myriel::IOManager::READ, [&]() { ++reads; }) == 0);
+        ASSERT(iom.addEvent(-1, myriel::IOManager::READ, [&]() { ++reads; }) == -1);
+        ASSERT(write(fds[1], "x", 1) == 1);
+        while(reads != 1) {
+            usleep(1000);
+        }
+        char c;
+        ASSERT(read(big, &c, 1) == 1);
+
+        ASSERT(iom.addEvent(big, myriel::IOManager::READ, [&]() { ++reads; }) == 0);
+        ASSERT(iom.cancelAll(big));
+    }
+    ASSERT(reads == 2);
+    close(big);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char *argv[]) {
+    test_fiber_event();
+    test_cancel();
+    test_large_fd();
+    return 0;
+}
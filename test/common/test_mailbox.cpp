@@ -0,0 +1,187 @@
+#include "../../code/common/scheduler.h"
+#include "../../code/common/iomanager.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+#include "../../code/common/utils.h"
+
+#include <unistd.h>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 收集调度器所有线程的线程ID
+ */
+static std::vector<std::thread::id> ThreadIds(myriel::Scheduler &sc, size_t threads) {
+    std::vector<std::thread::id> ids;
+    std::mutex mutex;
+    std::atomic<size_t> arrived{0};
+    std::atomic<size_t> left{0};
+    // 每个任务等到所有线程都有任务在跑才返回，保证各线程各拿到一个
+    for (size_t i = 0; i < threads; ++i) {
+        sc.schedule([&]() {
+            {
+                std::lock_guard<std::mutex> locker(mutex);
+                ids.push_back(std::this_thread::get_id());
+            }
+            ++arrived;
+            while (arrived != threads) {
+                usleep(100);
+            }
+            ++left;
+        });
+    }
+    // 等所有任务都不再访问这里的局部变量
+    while (left != threads) {
+        usleep(1000);
+    }
+    return ids;
+}
+
+/**
+ * @brief 指定了线程的任务都在该线程上运行，不进入全局队列
+ */
+void test_pinned(bool stealing) {
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(stealing);
+    const size_t threads = 4;
+    const size_t n = 2000;
+    myriel::Scheduler sc(threads, false, "mailbox");
+    sc.start();
+    std::vector<std::thread::id> ids = ThreadIds(sc, threads);
+    ASSERT(ids.size() == threads);
+
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> wrong{0};
+    for (size_t i = 0; i < n; ++i) {
+        std::thread::id id = ids[i % threads];
+        sc.schedule([&, id]() {
+            if (std::this_thread::get_id() != id) {
+                ++wrong;
+            }
+            ++done;
+        }, id);
+        ASSERT(sc.getQueuedCount(myriel::Priority::NORMAL) == 0);
+    }
+    while (done != n) {
+        usleep(1000);
+    }
+    ASSERT(wrong == 0);
+    ASSERT(sc.getMailboxCount() == 0);
+    sc.stop();
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(false);
+}
+
+/**
+ * @brief 协程在其它线程上把自己指定到另一个线程后让出，之后在目标线程上恢复
+ */
+void test_fiber_hop() {
+    const size_t threads = 3;
+    myriel::Scheduler sc(threads, false, "mailbox");
+    sc.start();
+    std::vector<std::thread::id> ids = ThreadIds(sc, threads);
+
+    std::atomic<bool> ok{true};
+    std::atomic<bool> done{false};
+    sc.schedule([&]() {
+        for (int i = 0; i < 300; ++i) {
+            std::thread::id target = ids[i % threads];
+            myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis(), target);
+            myriel::Fiber::GetThis()->yield();
+            if (std::this_thread::get_id() != target) {
+                ok = false;
+            }
+        }
+        done = true;
+    });
+    while (!done) {
+        usleep(1000);
+    }
+    ASSERT(ok);
+    sc.stop();
+}
+
+/**
+ * @brief 所有线程都已休眠时，指定线程的任务只唤醒所属线程并很快执行
+ */
+template<class S>
+void test_wake_owner(const char *name) {
+    const size_t threads = 4;
+    S sc(threads, false, name);
+    sc.start();
+    std::vector<std::thread::id> ids = ThreadIds(sc, threads);
+    for (size_t round = 0; round < 20; ++round) {
+        // 等所有线程空转结束进入休眠
+        usleep(20 * 1000);
+        std::thread::id id = ids[round % threads];
+        std::atomic<bool> done{false};
+        uint64_t begin = myriel::GetElapsedMS();
+        sc.schedule([&]() {
+            ASSERT(std::this_thread::get_id() == id);
+            done = true;
+        }, id);
+        while (!done) {
+            usleep(100);
+        }
+        // IOManager的epoll_wait兜底超时为5秒，没有叫醒所属线程时会等到超时
+        ASSERT(myriel::GetElapsedMS() - begin < 1000);
+    }
+    sc.stop();
+}
+
+/**
+ * @brief 关闭信箱后指定了线程的任务仍进入全局队列
+ */
+void test_disabled() {
+    myriel::Config::Lookup<bool>("scheduler.mailbox")->setValue(false);
+    const size_t threads = 2;
+    myriel::Scheduler sc(threads, false, "mailbox");
+    sc.start();
+    std::vector<std::thread::id> ids = ThreadIds(sc, threads);
+    std::atomic<size_t> done{0};
+    for (size_t i = 0; i < 100; ++i) {
+        std::thread::id id = ids[i % threads];
+        sc.schedule([&, id]() {
+            ASSERT(std::this_thread::get_id() == id);
+            ++done;
+        }, id);
+    }
+    while (done != 100) {
+        usleep(1000);
+    }
+    ASSERT(sc.getMailboxCount() == 0);
+    sc.stop();
+    myriel::Config::Lookup<bool>("scheduler.mailbox")->setValue(true);
+}
+
+/**
+ * @brief 启动前指定caller线程的任务进入全局队列，stop时由caller线程执行
+ */
+void test_caller() {
+    std::atomic<int> done{0};
+    std::thread::id caller = std::this_thread::get_id();
+    myriel::Scheduler sc(2, true, "mailbox");
+    sc.schedule([&]() {
+        ASSERT(std::this_thread::get_id() == caller);
+        ++done;
+    }, caller);
+    sc.start();
+    sc.schedule([&]() {
+        ASSERT(std::this_thread::get_id() == caller);
+        ++done;
+    }, caller);
+    ASSERT(sc.getMailboxCount() == 1);
+    sc.stop();
+    ASSERT(done == 2);
+}
+
+int main(int argc, char *argv[]) {
+    test_pinned(false);
+    test_pinned(true);
+    test_fiber_hop();
+    test_wake_owner<myriel::Scheduler>("mailbox");
+    test_wake_owner<myriel::IOManager>("mailbox_io");
+    test_disabled();
+    test_caller();
+    LOG_INFO(g_logger) << "test_mailbox done";
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "../../code/common/scheduler.h"
+#include "../../code/common/iomanager.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+#include "../../code/common/fiber_trace.h"
+
+#include <unistd.h>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+using myriel::Priority;
+
+/**
+ * @brief 线程被阻塞期间排队的任务计入队列深度，放开后计入执行数与运行时间
+ */
+void test_queue_and_run() {
+    myriel::Config::Lookup<bool>("scheduler.run_time_stats")->setValue(true);
+    std::atomic<bool> gate{false};
+    std::atomic<bool> blocked{false};
+    std::atomic<size_t> done{0};
+    std::thread::id worker;
+    myriel::Scheduler sc(1, false, "metrics");
+    sc.start();
+    sc.schedule([&]() {
+        worker = std::this_thread::get_id();
+        blocked = true;
+        while (!gate) {
+            usleep(100);
+        }
+    });
+    while (!blocked) {
+        usleep(100);
+    }
+
+    for (int i = 0; i < 10; ++i) {
+        sc.schedule([&]() { ++done; });
+    }
+    sc.schedule([&]() { ++done; }, Priority::HIGH);
+    sc.schedule([&]() { ++done; }, worker);
+    myriel::Scheduler::Metrics metrics = sc.getMetrics();
+    ASSERT(metrics.queued[(int)Priority::NORMAL] == 10);
+    ASSERT(metrics.queued[(int)Priority::HIGH] == 1);
+    ASSERT(metrics.mailboxQueued == 1);
+    ASSERT(metrics.activeThreads == 1);
+    ASSERT(metrics.workers.size() == 1);
+    ASSERT(metrics.liveFibers > 0);
+
+    usleep(2000);
+    gate = true;
+    while (done != 12) {
+        usleep(1000);
+    }
+    sc.stop();
+    metrics = sc.getMetrics();
+    LOG_INFO(g_logger) << metrics.toString();
+    ASSERT(metrics.executed() == 13);
+    ASSERT(metrics.runTime.count == 13);
+    // 阻塞任务至少跑了两毫秒
+    ASSERT(metrics.runTime.maxNs >= 1000 * 1000);
+    ASSERT(metrics.workers[0].runNs >= metrics.runTime.maxNs);
+    ASSERT(metrics.queued[(int)Priority::NORMAL] == 0 && metrics.mailboxQueued == 0);
+    myriel::Config::Lookup<bool>("scheduler.run_time_stats")->setValue(false);
+}
+
+/**
+ * @brief 空闲的线程计入idle与休眠时间；未开启运行时间统计时只计执行数
+ */
+template<class S>
+void test_park(const char *name) {
+    S sc(2, false, name);
+    sc.start();
+    sc.schedule([]() {});
+    usleep(50 * 1000);
+    myriel::Scheduler::Metrics metrics = sc.getMetrics();
+    sc.stop();
+    LOG_INFO(g_logger) << name << ": " << metrics.toString();
+    ASSERT(metrics.executed() == 1);
+    ASSERT(metrics.runTime.count == 0);
+    uint64_t parks = 0;
+    for (const auto &worker : metrics.workers) {
+        parks += worker.parks;
+        ASSERT(worker.idleNs >= worker.parkNs);
+        ASSERT(worker.idleNs > 0);
+    }
+    ASSERT(parks > 0);
+}
+
+/**
+ * @brief 调度线程阻塞在自己队列中的任务之前，其它线程只能通过窃取执行这些任务
+ */
+void test_steal() {
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(true);
+    const size_t n = 100;
+    std::atomic<size_t> done{0};
+    myriel::Scheduler sc(3, false, "metrics");
+    sc.start();
+    sc.schedule([&]() {
+        for (size_t i = 0; i < n; ++i) {
+            myriel::Scheduler::GetThis()->schedule([&]() { ++done; });
+        }
+        while (done != n) {
+            usleep(100);
+        }
+    });
+    while (done != n) {
+        usleep(1000);
+    }
+    sc.stop();
+    myriel::Scheduler::Metrics metrics = sc.getMetrics();
+    LOG_INFO(g_logger) << metrics.toString();
+    ASSERT(metrics.stolen() == n);
+    ASSERT(metrics.executed() == n + 1);
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(false);
+}
+
+/**
+ * @brief 协程分两次切入运行，两段运行时间都计入该协程，让出后等待的时间不计入
+ */
+void test_fiber_run_time() {
+    myriel::Config::Lookup<bool>("scheduler.run_time_stats")->setValue(true);
+    auto spin = [](uint64_t ns) {
+        uint64_t begin = myriel::FiberTrace::NowNs();
+        while (myriel::FiberTrace::NowNs() - begin < ns);
+    };
+    myriel::Scheduler sc(1, false, "metrics");
+    sc.start();
+    myriel::Fiber::ptr fiber(new myriel::Fiber([&]() {
+        spin(2 * 1000 * 1000);
+        myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+        myriel::Fiber::GetThis()->yield();
+        spin(2 * 1000 * 1000);
+    }));
+    myriel::Fiber::ptr idle(new myriel::Fiber([]() {}));
+    sc.schedule(fiber);
+    sc.schedule(idle);
+    sc.stop();
+    LOG_INFO(g_logger) << "fiber run time: " << fiber->getRunTime() << " ns";
+    ASSERT(fiber->getRunTime() >= 4 * 1000 * 1000);
+    ASSERT(idle->getRunTime() < fiber->getRunTime());
+    myriel::Config::Lookup<bool>("scheduler.run_time_stats")->setValue(false);
+}
+
+int main(int argc, char *argv[]) {
+    test_queue_and_run();
+    test_fiber_run_time();
+    test_park<myriel::Scheduler>("metrics");
+    test_park<myriel::IOManager>("metrics_io");
+    test_steal();
+    LOG_INFO(g_logger) << "test_metrics done";
+    return 0;
+}
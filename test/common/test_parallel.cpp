@@ -0,0 +1,230 @@
+#include "../../code/common/parallel.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+
+#include <unistd.h>
+#include <random>
+#include <set>
+#include <stdexcept>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 每个下标恰好执行一次，块分布在多个线程上，调用方协程也参与执行
+ */
+void test_for(myriel::Scheduler &sc) {
+    const size_t n = 100000;
+    std::vector<std::atomic<int>> hits(n);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::atomic<size_t> chunks{0};
+    std::atomic<bool> caller_ran{false};
+    sc.scheduleFuture([&]() {
+        uint64_t caller = myriel::Fiber::GetFiberId();
+        myriel::ParallelFor((size_t)0, n, [&](size_t b, size_t e) {
+            ASSERT(b < e && e <= n);
+            for (size_t i = b; i < e; ++i) {
+                ++hits[i];
+            }
+            if (myriel::Fiber::GetFiberId() == caller) {
+                caller_ran = true;
+            }
+            ++chunks;
+            std::lock_guard<std::mutex> locker(mutex);
+            threads.insert(std::this_thread::get_id());
+            // 让其它线程有机会拿到块
+            usleep(100);
+        }, 64);
+    }).get();
+    for (size_t i = 0; i < n; ++i) {
+        ASSERT(hits[i] == 1);
+    }
+    ASSERT(caller_ran);
+    ASSERT(chunks > 1);
+    LOG_INFO(g_logger) << "ParallelFor: " << chunks << " chunks on " << threads.size() << " threads";
+
+    // 不以0开始的区间与空区间
+    std::atomic<int64_t> sum{0};
+    sc.scheduleFuture([&]() {
+        myriel::ParallelFor(-500, 500, [&](int b, int e) {
+            for (int i = b; i < e; ++i) {
+                sum += i;
+            }
+        });
+        myriel::ParallelFor(10, 10, [&](int, int) { ASSERT(false); });
+    }).get();
+    ASSERT(sum == -500);
+}
+
+void test_reduce(myriel::Scheduler &sc) {
+    const uint64_t n = 1000000;
+    uint64_t sum = sc.scheduleFuture([&]() {
+        return myriel::ParallelReduce((uint64_t)0, n, (uint64_t)0, [](uint64_t b, uint64_t e) {
+            uint64_t s = 0;
+            for (uint64_t i = b; i < e; ++i) {
+                s += i;
+            }
+            return s;
+        }, [](uint64_t a, uint64_t b) { return a + b; });
+    }).get();
+    ASSERT(sum == n * (n - 1) / 2);
+
+    // 非平凡的结果类型
+    std::vector<int> merged = sc.scheduleFuture([&]() {
+        return myriel::ParallelReduce(0, 1000, std::vector<int>(), [](int b, int e) {
+            std::vector<int> v;
+            for (int i = b; i < e; ++i) {
+                v.push_back(i);
+            }
+            return v;
+        }, [](std::vector<int> a, std::vector<int> b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        }, 10);
+    }).get();
+    std::sort(merged.begin(), merged.end());
+    ASSERT(merged.size() == 1000 && merged.front() == 0 && merged.back() == 999);
+}
+
+void test_sort(myriel::Scheduler &sc) {
+    std::mt19937 rng(42);
+    for (size_t n : {0, 1, 100, 5000, 100000, 300001}) {
+        std::vector<int> v(n);
+        for (auto &x : v) {
+            x = rng() % 1000;
+        }
+        std::vector<int> expect = v;
+        std::sort(expect.begin(), expect.end());
+        sc.scheduleFuture([&]() { myriel::ParallelSort(v.begin(), v.end()); }).get();
+        ASSERT(v == expect);
+    }
+
+    std::vector<std::string> words;
+    for (int i = 0; i < 20000; ++i) {
+        words.push_back(std::to_string(rng()));
+    }
+    std::vector<std::string> expect = words;
+    std::sort(expect.begin(), expect.end(), std::greater<std::string>());
+    sc.scheduleFuture([&]() {
+        myriel::ParallelSort(words.begin(), words.end(), std::greater<std::string>(), 1000);
+    }).get();
+    ASSERT(words == expect);
+}
+
+/**
+ * @brief 块抛出异常时在调用方重新抛出，之后没有块再访问调用方的对象
+ */
+void test_exception(myriel::Scheduler &sc) {
+    std::atomic<size_t> done{0};
+    bool caught = sc.scheduleFuture([&]() {
+        try {
+            myriel::ParallelFor(0, 100000, [&](int b, int e) {
+                if (b <= 50000 && 50000 < e) {
+                    throw std::runtime_error("bad chunk");
+                }
+                done += e - b;
+            }, 16);
+        } catch (const std::runtime_error &e) {
+            return true;
+        }
+        return false;
+    }).get();
+    ASSERT(caught);
+    size_t seen = done;
+    usleep(10 * 1000);
+    ASSERT(done == seen && seen < 100000);
+}
+
+/**
+ * @brief 块中再嵌套并行，内层等待时挂起协程，调度线程可以去执行其它块
+ */
+void test_nested(myriel::Scheduler &sc) {
+    std::atomic<uint64_t> total{0};
+    sc.scheduleFuture([&]() {
+        myriel::ParallelFor(0, 16, [&](int b, int e) {
+            for (int i = b; i < e; ++i) {
+                total += myriel::ParallelReduce(0, 10000, (uint64_t)0, [](int lo, int hi) {
+                    return (uint64_t)(hi - lo);
+                }, [](uint64_t a, uint64_t c) { return a + c; }, 100);
+            }
+        }, 1);
+    }).get();
+    ASSERT(total == 16 * 10000);
+}
+
+/**
+ * @brief 多个共享栈协程同时并行归约与排序，挂起期间调用方的栈被其它协程覆盖也不影响结果
+ */
+void test_shared_stack(myriel::Scheduler &sc) {
+    const int fibers = 32;
+    std::vector<uint64_t> sums(fibers, 0);
+    std::vector<char> sorted(fibers, 0);
+    std::atomic<int> done{0};
+    // 每个线程只有一个共享栈，协程让出后栈马上被下一个协程使用
+    auto stack_count = myriel::Config::Lookup<uint32_t>("fiber.shared_stack.count");
+    uint32_t old_count = stack_count->getValue();
+    stack_count->setValue(1);
+    for (int f = 0; f < fibers; ++f) {
+        sc.schedule(myriel::Fiber::ptr(new myriel::Fiber([&, f]() {
+            sums[f] = myriel::ParallelReduce(0, 100000, (uint64_t)f, [](int b, int e) {
+                // 块中让出，调用方执行块时也会切出，其它参与者在此期间继续执行
+                myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+                myriel::Fiber::GetThis()->yield();
+                return (uint64_t)(e - b);
+            }, [](uint64_t a, uint64_t c) { return a + c; }, 100);
+            std::vector<int> v(50000);
+            std::mt19937 rng(f);
+            for (auto &i : v) {
+                i = rng();
+            }
+            myriel::ParallelSort(v.begin(), v.end(), std::less<int>(), 1000);
+            sorted[f] = std::is_sorted(v.begin(), v.end());
+            ++done;
+        }, 0, true, true)));
+    }
+    while (done < fibers) {
+        usleep(1000);
+    }
+    stack_count->setValue(old_count);
+    for (int f = 0; f < fibers; ++f) {
+        ASSERT(sums[f] == 100000 + (uint64_t)f);
+        ASSERT(sorted[f]);
+    }
+}
+
+/**
+ * @brief 不在调度器中时串行执行
+ */
+void test_serial() {
+    std::thread::id self = std::this_thread::get_id();
+    int chunks = 0;
+    myriel::ParallelFor(0, 1000, [&](int b, int e) {
+        ASSERT(std::this_thread::get_id() == self);
+        ASSERT(b == 0 && e == 1000);
+        ++chunks;
+    });
+    ASSERT(chunks == 1);
+    std::vector<int> v{3, 1, 2};
+    myriel::ParallelSort(v.begin(), v.end());
+    ASSERT((v == std::vector<int>{1, 2, 3}));
+}
+
+int main(int argc, char *argv[]) {
+    test_serial();
+    for (bool stealing : {false, true}) {
+        myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(stealing);
+        myriel::Scheduler sc(4, false, "parallel");
+        sc.start();
+        test_for(sc);
+        test_reduce(sc);
+        test_sort(sc);
+        test_exception(sc);
+        test_nested(sc);
+        test_shared_stack(sc);
+        sc.stop();
+    }
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(false);
+    LOG_INFO(g_logger) << "test_parallel done";
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "../../code/common/scheduler.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+
+#include <unistd.h>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+using myriel::Priority;
+
+/**
+ * @brief 单个调度线程被阻塞期间按low、high的顺序提交任务，放开后记录执行顺序
+ */
+static std::vector<Priority> RunOrder(size_t lows, size_t highs) {
+    std::vector<Priority> order;
+    std::mutex mutex;
+    std::atomic<bool> gate{false};
+    std::atomic<bool> blocked{false};
+    std::atomic<size_t> done{0};
+    myriel::Scheduler sc(1, false, "priority");
+    sc.start();
+    sc.schedule([&]() {
+        blocked = true;
+        while (!gate) {
+            usleep(100);
+        }
+    });
+    // 调度线程拿到阻塞任务之后再提交，否则它可能先执行后提交的HIGH任务
+    while (!blocked) {
+        usleep(100);
+    }
+    auto record = [&](Priority priority) {
+        return [&, priority]() {
+            std::lock_guard<std::mutex> locker(mutex);
+            order.push_back(priority);
+            ++done;
+        };
+    };
+    for (size_t i = 0; i < lows; ++i) {
+        sc.schedule(record(Priority::LOW), Priority::LOW);
+    }
+    for (size_t i = 0; i < highs; ++i) {
+        sc.schedule(record(Priority::HIGH), Priority::HIGH);
+    }
+    ASSERT(sc.getQueuedCount(Priority::LOW) == lows);
+    ASSERT(sc.getQueuedCount(Priority::HIGH) == highs);
+    gate = true;
+    while (done != lows + highs) {
+        usleep(1000);
+    }
+    sc.stop();
+    return order;
+}
+
+/**
+ * @brief 最后一个HIGH任务的位置
+ */
+static size_t LastHigh(const std::vector<Priority> &order) {
+    size_t last = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (order[i] == Priority::HIGH) {
+            last = i;
+        }
+    }
+    return last;
+}
+
+void test_weighted() {
+    myriel::Config::Lookup<std::string>("scheduler.priority_policy")->setValue("weighted");
+    // 权重16:1，32个HIGH任务中间最多穿插2个LOW
+    std::vector<Priority> order = RunOrder(100, 32);
+    ASSERT(LastHigh(order) <= 33);
+    ASSERT(order[0] == Priority::HIGH);
+}
+
+void test_strict() {
+    myriel::Config::Lookup<std::string>("scheduler.priority_policy")->setValue("strict");
+    myriel::Config::Lookup<uint32_t>("scheduler.priority_starvation_limit")->setValue(64);
+    std::vector<Priority> order = RunOrder(10, 32);
+    ASSERT(LastHigh(order) == 31);
+
+    // HIGH任务源源不断时，LOW每被跳过64次执行一次
+    order = RunOrder(4, 1000);
+    size_t first_low = std::find(order.begin(), order.end(), Priority::LOW) - order.begin();
+    LOG_INFO(g_logger) << "strict: first low task ran at " << first_low;
+    ASSERT(first_low >= 60 && first_low <= 70);
+    ASSERT(LastHigh(order) > 900);
+    myriel::Config::Lookup<std::string>("scheduler.priority_policy")->setValue("weighted");
+}
+
+/**
+ * @brief 协程的优先级在让出后保持，协程中调度的回调继承其优先级
+ */
+void test_inherit() {
+    std::atomic<int> done{0};
+    myriel::Scheduler sc(2, false, "priority");
+    sc.start();
+    sc.schedule([&]() {
+        ASSERT(myriel::Fiber::GetPriority() == Priority::HIGH);
+        myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+        myriel::Fiber::GetThis()->yield();
+        ASSERT(myriel::Fiber::GetPriority() == Priority::HIGH);
+        myriel::Scheduler::GetThis()->schedule([&]() {
+            ASSERT(myriel::Fiber::GetPriority() == Priority::HIGH);
+            myriel::Scheduler::GetThis()->schedule([&]() {
+                ASSERT(myriel::Fiber::GetPriority() == Priority::LOW);
+                ++done;
+            }, Priority::LOW);
+        });
+    }, Priority::HIGH);
+    sc.schedule([&]() {
+        ASSERT(myriel::Fiber::GetPriority() == Priority::NORMAL);
+        ++done;
+    });
+    while (done != 2) {
+        usleep(1000);
+    }
+    sc.stop();
+}
+
+/**
+ * @brief 每个优先级单独统计排队时间
+ */
+void test_wait_stats() {
+    myriel::Config::Lookup<bool>("scheduler.queue_wait_stats")->setValue(true);
+    std::atomic<int> done{0};
+    myriel::Scheduler sc(1, false, "priority");
+    sc.start();
+    sc.schedule([]() { usleep(20 * 1000); });
+    for (int i = 0; i < 10; ++i) {
+        sc.schedule([&]() { ++done; }, Priority::LOW);
+        sc.schedule([&]() { ++done; }, Priority::HIGH);
+    }
+    while (done != 20) {
+        usleep(1000);
+    }
+    sc.stop();
+    myriel::Config::Lookup<bool>("scheduler.queue_wait_stats")->setValue(false);
+
+    auto high = sc.getQueueWaitStats(Priority::HIGH);
+    auto low = sc.getQueueWaitStats(Priority::LOW);
+    auto normal = sc.getQueueWaitStats(Priority::NORMAL);
+    LOG_INFO(g_logger) << "high avg=" << high.avgNs() << "ns p99=" << high.percentileNs(99)
+                       << "ns, low avg=" << low.avgNs() << "ns p99=" << low.percentileNs(99) << "ns";
+    ASSERT(high.count == 10 && low.count == 10 && normal.count == 1);
+    // 都在20ms的阻塞任务后面排队
+    ASSERT(high.percentileNs(50) >= 10 * 1000 * 1000);
+    ASSERT(low.maxNs >= high.maxNs);
+    ASSERT(high.percentileNs(99) <= high.maxNs);
+}
+
+int main() {
+    for (bool stealing : {false, true}) {
+        myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(stealing);
+        test_weighted();
+        test_strict();
+        test_inherit();
+        test_wait_stats();
+    }
+    LOG_INFO(g_logger) << "test_priority ok";
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "../../code/common/fiber.h"
+#include "../../code/common/log.h"
+#include "../../code/common/config.h"
+#include "../../code/common/stack_allocator.h"
+
+#include <vector>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 每个栈都在使用中、线程缓存或仓库之一，三者之和等于尚未munmap的字节数
+ */
+void check_balance(const myriel::StackPoolStats &stats) {
+    ASSERT2(stats.inUseBytes + stats.threadCachedBytes + stats.depotBytes == stats.mappedBytes,
+            stats.toString());
+}
+
+/**
+ * @brief 每轮创建一批协程再全部销毁，模拟连接的频繁建立与断开
+ */
+void churn() {
+    myriel::Fiber::GetThis();
+    for(int round = 0; round < 100; ++round) {
+        std::vector<myriel::Fiber::ptr> fibers;
+        for(int i = 0; i < 64; ++i) {
+            fibers.emplace_back(new myriel::Fiber([]() {
+                char buf[1024];
+                memset(buf, 0, sizeof(buf));
+            }, 0, false));
+        }
+        for(auto &i : fibers) {
+            i->resume();
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    LOG_INFO(g_logger) << "main begin";
+
+    myriel::Config::Lookup<uint32_t>("fiber.stack_pool.high_watermark")->setValue(32);
+    myriel::Config::Lookup<uint32_t>("fiber.stack_pool.low_watermark")->setValue(8);
+
+    std::vector<std::thread> thrs;
+    for(int i = 0; i < 4; ++i) {
+        thrs.push_back(std::thread(&churn));
+    }
+    for(auto &i : thrs) {
+        i.join();
+    }
+
+    myriel::StackPoolStats stats = myriel::PooledStackAllocator::GetStats();
+    LOG_INFO(g_logger) << stats.toString();
+    ASSERT(stats.allocs == stats.frees);
+    ASSERT(stats.inUseBytes == 0);
+    // 线程都已退出，缓存全部交还仓库或释放
+    ASSERT(stats.threadCachedBytes == 0);
+    check_balance(stats);
+
+    // 主线程上持有一批栈时同样平衡，超过高水位的部分在回收时转入仓库
+    {
+        myriel::Fiber::GetThis();
+        std::vector<myriel::Fiber::ptr> fibers;
+        for(int i = 0; i < 64; ++i) {
+            fibers.emplace_back(new myriel::Fiber([]() {}, 0, false));
+        }
+        stats = myriel::PooledStackAllocator::GetStats();
+        ASSERT(stats.inUseBytes > 0);
+        check_balance(stats);
+        for(auto &i : fibers) {
+            i->resume();
+        }
+    }
+    stats = myriel::PooledStackAllocator::GetStats();
+    LOG_INFO(g_logger) << stats.toString();
+    ASSERT(stats.inUseBytes == 0);
+    check_balance(stats);
+
+    LOG_INFO(g_logger) << "main end";
+    return 0;
+}
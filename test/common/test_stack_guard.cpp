@@ -0,0 +1,111 @@
+#include "../../code/common/fiber.h"
+#include "../../code/common/log.h"
+#include "../../code/common/config.h"
+
+#include <sys/wait.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+static long ResidentKB() {
+    std::ifstream ifs("/proc/self/statm");
+    long size = 0, resident = 0;
+    ifs >> size >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int Recurse(int depth) {
+    volatile char buf[1024];
+    buf[0] = (char)depth;
+    if(depth < 0) {
+        return 0;
+    }
+    return Recurse(depth + 1) + buf[0];
+}
+
+/**
+ * @brief 子进程中让协程无限递归，应被保护页拦截并输出溢出的协程id
+ * @details 协程在fork前创建，子进程的地址空间与父进程相同，父进程据此检查报告的故障地址，
+ * 			最后在父进程中不递归地运行结束
+ */
+void test_overflow() {
+    static bool s_overflow = false;
+    myriel::Fiber::GetThis();
+    myriel::Fiber::ptr fiber(new myriel::Fiber([]() {
+        if(s_overflow) {
+            Recurse(0);
+        }
+    }, 64 * 1024, false));
+
+    int fds[2];
+    ASSERT(pipe(fds) == 0);
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        s_overflow = true;
+        fiber->resume();
+        _exit(0);
+    }
+    close(fds[1]);
+
+    std::string err;
+    char buf[256];
+    ssize_t n = 0;
+    while((n = read(fds[0], buf, sizeof(buf))) > 0) {
+        err.append(buf, n);
+    }
+    close(fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    LOG_INFO(g_logger) << "child exit by signal: " << (WIFSIGNALED(status) ? WTERMSIG(status) : 0)
+                       << ", stderr: " << err;
+    ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+
+    std::string expect = "fiber stack overflow: fiber_id=" + std::to_string(fiber->getId()) + " fault_addr=0x";
+    size_t pos = err.find(expect);
+    ASSERT2(pos != std::string::npos, err);
+    uintptr_t addr = std::stoull(err.substr(pos + expect.size()), nullptr, 16);
+    ASSERT(fiber->isInStackGuard((void *)addr));
+    fiber->resume();
+}
+
+/**
+ * @brief 预留1MB的栈，只访问少量内存，常驻内存只计算实际访问过的页
+ */
+void test_lazy_commit() {
+    myriel::Config::Lookup<std::string>("fiber.stack_allocator")->setValue("mmap");
+    myriel::Fiber::GetThis();
+
+    const int count = 1000;
+    long before = ResidentKB();
+    std::vector<myriel::Fiber::ptr> fibers;
+    for(int i = 0; i < count; ++i) {
+        fibers.emplace_back(new myriel::Fiber([]() {
+            char buf[2048];
+            memset(buf, 0, sizeof(buf));
+            myriel::Fiber::GetThis()->yield();
+        }, 1024 * 1024, false));
+        fibers.back()->resume();
+    }
+    long after = ResidentKB();
+    LOG_INFO(g_logger) << count << " fibers with 1MB stack reserved, resident: "
+                       << (after - before) << " KB";
+    // 全部提交需要约1GB，每个协程只应占用栈顶的几页
+    ASSERT2(after - before < count * 64, (after - before) << " KB");
+
+    for(auto &i : fibers) {
+        i->resume();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    LOG_INFO(g_logger) << "main begin";
+    test_overflow();
+    test_lazy_commit();
+    LOG_INFO(g_logger) << "main end";
+    return 0;
+}
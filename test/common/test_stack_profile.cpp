@@ -0,0 +1,66 @@
+#include "../../code/common/fiber.h"
+#include "../../code/common/stack_profile.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+
+#include <alloca.h>
+#include <cstring>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 在栈上使用约size字节
+ */
+static void __attribute__((noinline)) UseStack(size_t size) {
+    char *buf = (char *)alloca(size);
+    memset(buf, 1, size);
+    asm volatile("" :: "r"(buf) : "memory");
+}
+
+void DeepEntry() {
+    UseStack(40 * 1024);
+}
+
+int main(int argc, char *argv[]) {
+    myriel::Config::Lookup<bool>("fiber.stack_profile")->setValue(true);
+    myriel::Fiber::GetThis();
+
+    for (int i = 0; i < 10; ++i) {
+        myriel::Fiber::ptr shallow(new myriel::Fiber([]() {}, 0, false));
+        shallow->resume();
+
+        myriel::Fiber::ptr deep(new myriel::Fiber(&DeepEntry, 0, false));
+        deep->resume();
+    }
+
+    // 复用同一个协程：重新填充后再次测量，不受上一次用量的影响
+    myriel::Fiber::ptr reused(new myriel::Fiber(std::bind(&UseStack, 20 * 1024), 0, false));
+    reused->resume();
+    reused->reset([]() {});
+    reused->resume();
+
+    LOG_INFO(g_logger) << "\n" << myriel::StackProfiler::Dump();
+
+    auto profile = myriel::StackProfiler::GetProfile();
+    ASSERT(profile.size() == 4);
+
+    auto &deep = profile["DeepEntry()"];
+    ASSERT(deep.count == 10);
+    ASSERT(deep.maxBytes >= 40 * 1024 && deep.maxBytes < 48 * 1024);
+    ASSERT(deep.percentile(99) == 64 * 1024);
+
+    uint64_t lambdas = 0;
+    for (auto &i : profile) {
+        if (i.first.find("lambda") != std::string::npos) {
+            ASSERT(i.second.maxBytes < 4096);
+            lambdas += i.second.count;
+        } else if (i.first.find("_Bind") != std::string::npos) {
+            ASSERT(i.second.count == 1 && i.second.maxBytes >= 20 * 1024);
+        }
+    }
+    ASSERT(lambdas == 11);
+
+    myriel::StackProfiler::Clear();
+    ASSERT(myriel::StackProfiler::GetProfile().empty());
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include "../../code/common/task.h"
+#include "../../code/common/log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdexcept>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+myriel::Task<int> Square(int i) {
+    co_await myriel::Yield();
+    co_return i * i;
+}
+
+myriel::Task<int> SumOfSquares(int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += co_await Square(i);
+    }
+    co_return sum;
+}
+
+myriel::Task<void> Fail() {
+    co_await myriel::Yield();
+    throw std::runtime_error("task failed");
+}
+
+/**
+ * @brief 在Task中等待协程计算的future，以及捕获子Task的异常
+ */
+myriel::Task<std::string> Mixed(myriel::Scheduler *sc) {
+    int from_fiber = co_await sc->scheduleFuture([]() {
+        myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+        myriel::Fiber::GetThis()->yield();
+        return 42;
+    });
+
+    bool caught = false;
+    try {
+        co_await Fail();
+    } catch (std::runtime_error &ex) {
+        caught = true;
+    }
+    co_return std::to_string(from_fiber) + (caught ? " caught" : " missed");
+}
+
+/**
+ * @brief 挂起在定时器上，返回实际等待的毫秒数
+ */
+myriel::Task<uint64_t> Nap(uint64_t ms) {
+    uint64_t start = myriel::GetElapsedMS();
+    co_await myriel::Sleep(ms);
+    co_return myriel::GetElapsedMS() - start;
+}
+
+/**
+ * @brief 不在IO调度器中时连续Sleep，每次都阻塞后直接继续，协程栈不应随次数增长
+ */
+myriel::Task<int> SleepLoop(int n) {
+    int count = 0;
+    for (int i = 0; i < n; ++i) {
+        co_await myriel::Sleep(1);
+        ++count;
+    }
+    co_return count;
+}
+
+/**
+ * @brief 挂起直到管道可读，读出写端写入的内容
+ */
+myriel::Task<std::string> ReadPipe(int fd) {
+    bool ok = co_await myriel::WaitReadable(fd);
+    ASSERT(ok);
+    char buf[64];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    ASSERT(n > 0);
+    co_return std::string(buf, n);
+}
+
+myriel::Task<bool> WritePipe(int fd, std::string data) {
+    bool ok = co_await myriel::WaitWritable(fd);
+    co_return ok && write(fd, data.data(), data.size()) == (ssize_t)data.size();
+}
+
+/**
+ * @brief 在单线程的IO调度器上等待定时器与管道，等待期间调度线程可以运行其它任务
+ */
+void test_io_awaiters() {
+    myriel::IOManager iom(1, false);
+
+    // 长的先开始，短的先结束，说明Sleep没有阻塞调度线程
+    myriel::FiberFuture<uint64_t> slow = myriel::CoSpawn(&iom, Nap(100));
+    myriel::FiberFuture<uint64_t> fast = myriel::CoSpawn(&iom, Nap(10));
+    uint64_t fast_ms = fast.get();
+    ASSERT(!slow.isReady());
+    uint64_t slow_ms = slow.get();
+    LOG_INFO(g_logger) << "nap fast = " << fast_ms << " ms, slow = " << slow_ms << " ms";
+    ASSERT(fast_ms < slow_ms && slow_ms >= 90);
+
+    int fds[2];
+    ASSERT(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    myriel::FiberFuture<std::string> reader = myriel::CoSpawn(&iom, ReadPipe(fds[0]));
+    // 读者挂起在管道上，20ms后才有数据
+    iom.addTimer(20, [fds, &iom]() {
+        myriel::CoSpawn(&iom, WritePipe(fds[1], "hello"));
+    });
+    usleep(5 * 1000);
+    ASSERT(!reader.isReady());
+    ASSERT(reader.get() == "hello");
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char *argv[]) {
+    LOG_INFO(g_logger) << "main begin";
+    myriel::Scheduler sc(2, false);
+    sc.start();
+
+    std::vector<myriel::FiberFuture<int>> sums;
+    for (int i = 0; i < 100; ++i) {
+        sums.push_back(myriel::CoSpawn(&sc, SumOfSquares(10)));
+    }
+    myriel::WhenAll(sums).get();
+    for (auto &sum : sums) {
+        ASSERT(sum.get() == 285);
+    }
+
+    std::string mixed = myriel::CoSpawn(&sc, Mixed(&sc)).get();
+    LOG_INFO(g_logger) << "mixed = " << mixed;
+    ASSERT(mixed == "42 caught");
+
+    // 从协程中等待Task的结果
+    int from_task = sc.scheduleFuture([&sc]() {
+        return myriel::CoSpawn(&sc, Square(9)).get();
+    }).get();
+    ASSERT(from_task == 81);
+
+    // 普通调度器上没有IO事件可等，不挂起直接返回false
+    bool waited = myriel::CoSpawn(&sc, WritePipe(-1, "")).get();
+    ASSERT(!waited);
+
+    // 普通调度器上没有定时器，Sleep阻塞调度线程后继续
+    int slept = myriel::CoSpawn(&sc, SleepLoop(3000)).get();
+    ASSERT(slept == 3000);
+
+    sc.stop();
+
+    test_io_awaiters();
+    LOG_INFO(g_logger) << "main end";
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "../../code/common/timer.h"
+#include "../../code/common/iomanager.h"
+#include "../../code/common/utils.h"
+#include "../../code/common/log.h"
+#include "../../code/common/macro.h"
+
+#include <random>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+class TestTimerManager : public myriel::TimerManager {
+public:
+    int fronts = 0;
+protected:
+    void onTimerInsertedAtFront() override { ++fronts; }
+};
+
+/**
+ * @brief 随机的到期时间(包括超出时间轮范围的)与随机的推进步长，
+ * 		  每个定时器恰好在第一次推进到它的到期时刻时触发
+ */
+void test_wheel() {
+    TestTimerManager mgr;
+    std::mt19937_64 rng(42);
+    const size_t n = 100000;
+    std::vector<uint64_t> ms(n);
+    std::vector<uint64_t> fired_at(n, 0);
+    uint64_t now = 0;
+
+    uint64_t base_begin = myriel::GetElapsedMS();
+    for (size_t i = 0; i < n; ++i) {
+        switch (i % 4) {
+            case 0: ms[i] = rng() % 256; break;
+            case 1: ms[i] = rng() % 100000; break;
+            case 2: ms[i] = rng() % (1ull << 32); break;
+            default: ms[i] = rng() % (1ull << 34); break;
+        }
+        mgr.addTimer(ms[i], [&fired_at, &now, i]() { fired_at[i] = now; });
+    }
+    uint64_t base_end = myriel::GetElapsedMS();
+    ASSERT(mgr.getTimerCount() == n);
+
+    std::vector<std::function<void()>> cbs;
+    now = base_end;
+    uint64_t prev = base_begin;
+    size_t fired = 0;
+    while (fired < n) {
+        uint64_t r = rng() % 10;
+        uint64_t step = r < 5 ? rng() % 300 + 1 : (r < 8 ? rng() % 100000 + 1 : rng() % (1ull << 31) + 1);
+        now += step;
+        // 下一次需要处理的时刻不会晚于最早的到期时刻
+        uint64_t next = mgr.getNextTimer();
+        ASSERT(next != ~0ull);
+        mgr.listExpiredCb(cbs, now);
+        for (auto &cb : cbs) {
+            cb();
+        }
+        fired += cbs.size();
+        cbs.clear();
+        for (size_t i = 0; i < n; ++i) {
+            if (fired_at[i] == now) {
+                ASSERT(base_begin + ms[i] <= now);
+                ASSERT2(base_end + ms[i] > prev, "ms=" << ms[i] << " prev=" << prev << " now=" << now);
+            }
+        }
+        prev = now;
+    }
+    ASSERT(mgr.getTimerCount() == 0);
+    ASSERT(mgr.getNextTimer() == ~0ull);
+}
+
+/**
+ * @brief 取消、重新计时、循环定时器与条件定时器
+ */
+void test_api() {
+    TestTimerManager mgr;
+    std::vector<std::function<void()>> cbs;
+    uint64_t now = myriel::GetElapsedMS();
+    int count = 0;
+
+    myriel::Timer::ptr t1 = mgr.addTimer(1000, [&]() { ++count; });
+    ASSERT(mgr.fronts == 1);
+    // 更晚的定时器不需要通知
+    myriel::Timer::ptr t2 = mgr.addTimer(5000, [&]() { count += 10; });
+    ASSERT(mgr.fronts == 1);
+    ASSERT(t2->cancel());
+    ASSERT(!t2->cancel());
+
+    // 从现在起重新设为100毫秒，早于已知的下一次处理时刻
+    ASSERT(t1->reset(100, true));
+    ASSERT(mgr.fronts == 2);
+    mgr.listExpiredCb(cbs, now + 99);
+    ASSERT(cbs.empty());
+    mgr.listExpiredCb(cbs, now + 1000);
+    ASSERT(cbs.size() == 1);
+    cbs[0]();
+    cbs.clear();
+    ASSERT(count == 1);
+    ASSERT(!t1->cancel());
+    ASSERT(!t1->refresh());
+
+    // 循环定时器以触发时刻重新计时
+    myriel::Timer::ptr t3 = mgr.addTimer(10, [&]() { ++count; }, true);
+    mgr.listExpiredCb(cbs, now + 2000);
+    mgr.listExpiredCb(cbs, now + 2005);
+    mgr.listExpiredCb(cbs, now + 2010);
+    mgr.listExpiredCb(cbs, now + 2020);
+    ASSERT(cbs.size() == 3);
+    ASSERT(t3->cancel());
+    ASSERT(mgr.getTimerCount() == 0);
+
+    // 条件对象释放后不执行回调
+    cbs.clear();
+    count = 0;
+    auto cond = std::make_shared<int>(0);
+    mgr.addConditionTimer(10, [&]() { ++count; }, cond);
+    mgr.addConditionTimer(10, [&]() { ++count; }, cond);
+    mgr.listExpiredCb(cbs, now + 3000);
+    cbs[0]();
+    cond.reset();
+    cbs[1]();
+    ASSERT(count == 1);
+}
+
+/**
+ * @brief IOManager空闲等待以最近的定时器为超时，插到最前面的定时器唤醒等待方
+ */
+void test_iomanager() {
+    std::atomic<uint64_t> fired_ms{0};
+    std::atomic<int> ticks{0};
+    uint64_t begin = 0;
+    {
+        myriel::IOManager iom(2, false, "timer");
+        myriel::Timer::ptr far = iom.addTimer(5000, []() {});
+        // 让调度线程带着5秒的超时进入epoll_wait
+        usleep(20000);
+        begin = myriel::GetElapsedMS();
+        iom.addTimer(30, [&]() { fired_ms = myriel::GetElapsedMS(); });
+        myriel::Timer::ptr recurring;
+        recurring = iom.addTimer(10, [&]() {
+            if (++ticks == 3) {
+                recurring->cancel();
+            }
+        }, true);
+        while (fired_ms == 0 || ticks < 3) {
+            usleep(1000);
+        }
+        ASSERT(far->cancel());
+    }
+    uint64_t cost = fired_ms - begin;
+    LOG_INFO(g_logger) << "30ms timer fired after " << cost << "ms";
+    ASSERT(cost >= 29 && cost < 1000);
+    ASSERT(ticks == 3);
+}
+
+/**
+ * @brief 定时器比管理器活得更久，管理器析构后的操作不访问已释放的管理器
+ */
+void test_outlive_manager() {
+    myriel::Timer::ptr live;
+    myriel::Timer::ptr fired;
+    {
+        TestTimerManager mgr;
+        std::vector<std::function<void()>> cbs;
+        live = mgr.addTimer(1000, []() {});
+        fired = mgr.addTimer(10, []() {});
+        mgr.listExpiredCb(cbs, myriel::GetElapsedMS() + 100);
+        ASSERT(cbs.size() == 1);
+        ASSERT(!fired->cancel());
+    }
+    ASSERT(!live->cancel());
+    ASSERT(!live->refresh());
+    ASSERT(!live->reset(10, true));
+    ASSERT(!fired->reset(10, true));
+}
+
+int main(int argc, char *argv[]) {
+    test_wheel();
+    test_api();
+    test_iomanager();
+    test_outlive_manager();
+    return 0;
+}
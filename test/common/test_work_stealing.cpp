@@ -0,0 +1,92 @@
+#include "../../code/common/work_stealing_queue.h"
+#include "../../code/common/scheduler.h"
+#include "../../code/common/config.h"
+#include "../../code/common/log.h"
+
+#include <thread>
+#include <vector>
+
+myriel::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 所属线程入队(包括扩容)的同时其它线程窃取，每个元素恰好被取出一次
+ */
+void test_queue() {
+    const int n = 200000;
+    std::vector<int> items(n);
+    std::vector<std::atomic<int>> taken(n);
+    myriel::WorkStealingQueue<int> queue(4);
+    std::atomic<bool> producing{true};
+    std::atomic<int> count{0};
+
+    std::vector<std::thread> thieves;
+    for(int i = 0; i < 3; ++i) {
+        thieves.emplace_back([&]() {
+            while(producing || !queue.empty()) {
+                if(int *item = queue.steal()) {
+                    ++taken[item - items.data()];
+                    ++count;
+                }
+            }
+        });
+    }
+    for(int i = 0; i < n; ++i) {
+        queue.push(&items[i]);
+        if(i % 3 == 0) {
+            if(int *item = queue.take()) {
+                ++taken[item - items.data()];
+                ++count;
+            }
+        }
+    }
+    producing = false;
+    for(auto &t : thieves) {
+        t.join();
+    }
+    ASSERT(count == n);
+    for(int i = 0; i < n; ++i) {
+        ASSERT(taken[i] == 1);
+    }
+    ASSERT(queue.take() == nullptr);
+}
+
+/**
+ * @brief 工作窃取模式下，调度线程派生的任务、外部提交的任务与指定线程的任务都能完成
+ */
+void test_scheduler() {
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(true);
+    std::atomic<int> done{0};
+    std::atomic<int> pinned{0};
+    {
+        myriel::Scheduler sc(4, true, "steal");
+        sc.start();
+        std::thread::id root = std::this_thread::get_id();
+        for(int i = 0; i < 100; ++i) {
+            sc.schedule([&]() {
+                for(int j = 0; j < 100; ++j) {
+                    myriel::Scheduler::GetThis()->schedule([&]() {
+                        // 让出后可能被其它线程窃取
+                        myriel::Scheduler::GetThis()->schedule(myriel::Fiber::GetThis());
+                        myriel::Fiber::GetThis()->yield();
+                        ++done;
+                    });
+                }
+            });
+            sc.schedule([&]() {
+                ASSERT(std::this_thread::get_id() == root);
+                ++pinned;
+            }, root);
+        }
+        sc.stop();
+    }
+    myriel::Config::Lookup<bool>("scheduler.work_stealing")->setValue(false);
+    LOG_INFO(g_logger) << "done=" << done << " pinned=" << pinned;
+    ASSERT(done == 100 * 100);
+    ASSERT(pinned == 100);
+}
+
+int main(int argc, char *argv[]) {
+    test_queue();
+    test_scheduler();
+    return 0;
+}